@@ -182,6 +182,7 @@ async fn main(spawner: Spawner) {
         vial_config,
         ble_battery_config,
         storage_config,
+        ..Default::default()
     };
 
     // Initialze keyboard stuffs
@@ -172,6 +172,10 @@ pub struct RmkConstantsConfig {
     #[serde_inline_default(8)]
     #[serde(deserialize_with = "check_max_patterns_per_key")]
     pub max_patterns_per_key: usize,
+    /// Maximum number of keys held in the buffer while waiting for tap/hold/combo decisions
+    #[serde_inline_default(16)]
+    #[serde(deserialize_with = "check_held_buffer_size")]
+    pub held_buffer_size: usize,
     /// Macro space size in bytes for storing sequences
     #[serde_inline_default(256)]
     pub macro_space_size: usize,
@@ -181,9 +185,30 @@ pub struct RmkConstantsConfig {
     /// Report channel size
     #[serde_inline_default(16)]
     pub report_channel_size: usize,
+    /// Coalesce the queued reports before sending them to the host
+    #[serde_inline_default(false)]
+    pub report_coalescing: bool,
+    /// USB HID endpoint polling interval in microseconds
+    #[serde_inline_default(1000)]
+    #[serde(deserialize_with = "check_usb_poll_interval_us")]
+    pub usb_poll_interval_us: u32,
+    /// Maximum number of BLE HID notifications in flight, at most one per HID characteristic
+    #[serde_inline_default(1)]
+    #[serde(deserialize_with = "check_ble_notify_in_flight")]
+    pub ble_notify_in_flight: usize,
     /// Vial channel size
     #[serde_inline_default(4)]
     pub vial_channel_size: usize,
+    /// Number of flash pages tracked by the storage cache, must be at least `num_sectors` of the storage
+    #[serde_inline_default(32)]
+    pub storage_cache_pages: usize,
+    /// Number of recently used storage keys whose flash addresses are cached
+    #[serde_inline_default(32)]
+    pub storage_cache_keys: usize,
+    /// Maximum number of keymap writes buffered before they're committed to flash, 0 disables the write-back buffer
+    #[serde_inline_default(32)]
+    #[serde(deserialize_with = "check_storage_write_back_size")]
+    pub storage_write_back_size: usize,
     /// Flash channel size
     #[serde_inline_default(4)]
     pub flash_channel_size: usize,
@@ -198,6 +223,20 @@ pub struct RmkConstantsConfig {
     pub split_central_sleep_timeout_seconds: u32,
 }
 
+/// Events of the event ring are stored once and published by any task, so the number of publishers can't be set
+fn check_ring_event<'de, D>(deserializer: D) -> Result<EventChannelConfig, D::Error>
+where
+    D: de::Deserializer<'de>,
+{
+    let value: EventChannelConfig = SerdeDeserialize::deserialize(deserializer)?;
+    if value.pubs.is_some() {
+        panic!(
+            "❌ Parse `keyboard.toml` error: `pubs` is not supported by `key` and `modifier` events, they use the event ring which has no publisher limit"
+        );
+    }
+    Ok(value)
+}
+
 fn check_combo_max_num<'de, D>(deserializer: D) -> Result<usize, D::Error>
 where
     D: de::Deserializer<'de>,
@@ -209,6 +248,61 @@ where
     Ok(value)
 }
 
+fn check_usb_poll_interval_us<'de, D>(deserializer: D) -> Result<u32, D::Error>
+where
+    D: de::Deserializer<'de>,
+{
+    let value = SerdeDeserialize::deserialize(deserializer)?;
+    if !(125..=255_000).contains(&value) {
+        panic!("❌ Parse `keyboard.toml` error: usb_poll_interval_us must be between 125 and 255000, got {value}");
+    }
+    Ok(value)
+}
+
+fn check_ble_notify_in_flight<'de, D>(deserializer: D) -> Result<usize, D::Error>
+where
+    D: de::Deserializer<'de>,
+{
+    let value = SerdeDeserialize::deserialize(deserializer)?;
+    if !(1..=4).contains(&value) {
+        panic!("❌ Parse `keyboard.toml` error: ble_notify_in_flight must be between 1 and 4, got {value}");
+    }
+    Ok(value)
+}
+
+fn check_storage_write_back_size<'de, D>(deserializer: D) -> Result<usize, D::Error>
+where
+    D: de::Deserializer<'de>,
+{
+    let value = SerdeDeserialize::deserialize(deserializer)?;
+    if value > 256 {
+        panic!("❌ Parse `keyboard.toml` error: storage_write_back_size must be between 0 and 256, got {value}");
+    }
+    Ok(value)
+}
+
+fn check_conn_param_steps<'de, D>(deserializer: D) -> Result<Option<Vec<ConnParamStepConfig>>, D::Error>
+where
+    D: de::Deserializer<'de>,
+{
+    let steps: Vec<ConnParamStepConfig> = SerdeDeserialize::deserialize(deserializer)?;
+    if steps.is_empty() {
+        panic!("❌ Parse `keyboard.toml` error: connection parameter policy must have at least one step");
+    }
+    if steps.windows(2).any(|w| w[0].idle_after.0 > w[1].idle_after.0) {
+        panic!("❌ Parse `keyboard.toml` error: steps of connection parameter policy must be sorted by `idle_after`");
+    }
+    for step in &steps {
+        if !(7500..=4_000_000).contains(&step.interval_us) || step.interval_us % 1250 != 0 {
+            panic!(
+                "❌ Parse `keyboard.toml` error: connection interval must be a multiple of 1250us between 7500us and 4000000us, got {}",
+                step.interval_us
+            );
+        }
+    }
+    Ok(Some(steps))
+}
+
 fn check_morse_max_num<'de, D>(deserializer: D) -> Result<usize, D::Error>
 where
     D: de::Deserializer<'de>,
@@ -220,6 +314,17 @@ where
     Ok(value)
 }
 
+fn check_held_buffer_size<'de, D>(deserializer: D) -> Result<usize, D::Error>
+where
+    D: de::Deserializer<'de>,
+{
+    let value = SerdeDeserialize::deserialize(deserializer)?;
+    if !(1..=128).contains(&value) {
+        panic!("❌ Parse `keyboard.toml` error: held_buffer_size must be between 1 and 128, got {value}");
+    }
+    Ok(value)
+}
+
 fn check_max_patterns_per_key<'de, D>(deserializer: D) -> Result<usize, D::Error>
 where
     D: de::Deserializer<'de>,
@@ -252,11 +357,18 @@ impl Default for RmkConstantsConfig {
             combo_max_length: 4,
             fork_max_num: 8,
             morse_max_num: 8,
+            held_buffer_size: 16,
             max_patterns_per_key: 8,
             macro_space_size: 256,
             debounce_time: 20,
             report_channel_size: 16,
+            report_coalescing: false,
+            usb_poll_interval_us: 1000,
+            ble_notify_in_flight: 1,
             vial_channel_size: 4,
+            storage_cache_pages: 32,
+            storage_cache_keys: 32,
+            storage_write_back_size: 32,
             flash_channel_size: 4,
             split_peripherals_num: 0,
             ble_profiles_num: 3,
@@ -308,15 +420,17 @@ pub struct EventConfig {
     pub ble_state_change: EventChannelConfig,
     #[serde(default = "default_event")]
     pub ble_profile_change: EventChannelConfig,
+    #[serde(default = "default_conn_param_update_event")]
+    pub conn_param_update: EventChannelConfig,
 
     // Connection events
     #[serde(default = "default_event")]
     pub connection_change: EventChannelConfig,
 
     // Input events
-    #[serde(default = "default_input_event")]
+    #[serde(default = "default_input_event", deserialize_with = "check_ring_event")]
     pub key: EventChannelConfig,
-    #[serde(default = "default_input_event")]
+    #[serde(default = "default_input_event", deserialize_with = "check_ring_event")]
     pub modifier: EventChannelConfig,
 
     // Keyboard state events
@@ -349,6 +463,7 @@ impl EventConfig {
     pub fn with_defaults(mut self) -> Self {
         self.ble_state_change = self.ble_state_change.with_defaults(default_ble_state_event());
         self.ble_profile_change = self.ble_profile_change.with_defaults(default_event());
+        self.conn_param_update = self.conn_param_update.with_defaults(default_conn_param_update_event());
         self.connection_change = self.connection_change.with_defaults(default_event());
         self.key = self.key.with_defaults(default_input_event());
         self.modifier = self.modifier.with_defaults(default_input_event());
@@ -399,7 +514,7 @@ fn default_led_indicator_event() -> EventChannelConfig {
 }
 
 /// Default for high-frequency input events: (8, 1, 2)
-/// Used by: key, modifier
+/// Used by: key, modifier. They use the event ring, so `pubs` is only a placeholder and can't be set by the user
 fn default_input_event() -> EventChannelConfig {
     EventChannelConfig {
         channel_size: Some(8),
@@ -418,6 +533,16 @@ fn default_ble_state_event() -> EventChannelConfig {
     }
 }
 
+/// Default for connection parameter update event: (2, 1, 1)
+/// The host link and the split links can be updated at the same time
+fn default_conn_param_update_event() -> EventChannelConfig {
+    EventChannelConfig {
+        channel_size: Some(2),
+        pubs: Some(1),
+        subs: Some(1),
+    }
+}
+
 /// Default for peripheral battery monitoring: (2, 1, 2)
 /// Buffering for split keyboard battery updates
 fn default_peripheral_battery_event() -> EventChannelConfig {
@@ -433,6 +558,7 @@ impl Default for EventConfig {
         Self {
             ble_state_change: default_ble_state_event(),
             ble_profile_change: default_event(),
+            conn_param_update: default_conn_param_update_event(),
             connection_change: default_event(),
             key: default_input_event(),
             modifier: default_input_event(),
@@ -529,6 +655,8 @@ pub struct StorageConfig {
     pub clear_storage: Option<bool>,
     // Clear on the layout at reboot, set this to true if you want to reset the layout
     pub clear_layout: Option<bool>,
+    // Read the keymap from the storage while the USB/BLE transports are starting
+    pub staged_load: Option<bool>,
 }
 
 #[derive(Clone, Default, Debug, Deserialize)]
@@ -542,6 +670,34 @@ pub struct BleConfig {
     pub adc_divider_total: Option<u32>,
     pub default_tx_power: Option<i8>,
     pub use_2m_phy: Option<bool>,
+    /// Connection parameter policies of the BLE links, the default policies are used if not set
+    pub conn_param: Option<BleConnParamConfig>,
+}
+
+/// Connection parameter policies of the BLE links
+#[derive(Clone, Default, Debug, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct BleConnParamConfig {
+    /// Steps of the host link policy
+    #[serde(default, deserialize_with = "check_conn_param_steps")]
+    pub host: Option<Vec<ConnParamStepConfig>>,
+    /// Steps of the split link policy, only used by the split central
+    #[serde(default, deserialize_with = "check_conn_param_steps")]
+    pub split: Option<Vec<ConnParamStepConfig>>,
+}
+
+/// One step of a connection parameter policy
+#[derive(Clone, Debug, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct ConnParamStepConfig {
+    /// Time without activity before entering this step, ignored for the first step
+    pub idle_after: DurationMillis,
+    /// Connection interval in microseconds, a multiple of 1250 between 7500 and 4000000
+    pub interval_us: u32,
+    /// Peripheral latency, in number of connection events
+    #[serde(default)]
+    pub latency: u16,
+    pub supervision_timeout: DurationMillis,
 }
 
 /// Config for chip-specific settings
@@ -887,6 +1043,8 @@ pub struct InputDeviceConfig {
     pub encoder: Option<Vec<EncoderConfig>>,
     pub pointing: Option<Vec<PointingDeviceConfig>>,
     pub joystick: Option<Vec<JoystickConfig>>,
+    /// Timer-triggered DMA scan of the joysticks, the joysticks are polled when it's not set
+    pub adc_scan: Option<AdcScanConfig>,
     pub pmw3610: Option<Vec<Pmw3610Config>>,
     pub pmw33xx: Option<Vec<Pmw33xxConfig>>,
 }
@@ -906,6 +1064,56 @@ pub struct JoystickConfig {
     pub transform: Vec<Vec<i16>>,
     pub bias: Vec<i16>,
     pub resolution: u16,
+    /// Acceleration, smoothing and scroll mode of the motion
+    pub motion: Option<MotionConfig>,
+}
+
+/// Timer-triggered DMA scan of the SAADC (nRF52 only)
+#[derive(Clone, Debug, Default, Deserialize)]
+#[allow(unused)]
+#[serde(deny_unknown_fields)]
+pub struct AdcScanConfig {
+    /// Timer which triggers the scans, default is `TIMER1`. It must not be used by anything else
+    pub timer: Option<String>,
+    /// Two PPI channels which connect the timer and the SAADC, default is `["PPI_CH0", "PPI_CH1"]`
+    pub ppi_channels: Option<[String; 2]>,
+    /// Interval between two scans of all channels, default is 1ms
+    pub scan_interval: Option<DurationMillis>,
+    /// Deadzone of the joysticks around their rest position in raw ADC units, default is 40
+    pub deadzone: Option<u16>,
+}
+
+/// Motion processing of a pointing device or joystick
+#[derive(Clone, Debug, Default, Deserialize)]
+#[allow(unused)]
+#[serde(deny_unknown_fields)]
+pub struct MotionConfig {
+    /// Acceleration curve, a list of `[speed, gain_percent]` points sorted by speed.
+    /// The speed is in counts per report.
+    #[serde(default)]
+    pub accel: Vec<[u16; 2]>,
+    /// Strength of the exponential smoothing, 0 disables smoothing
+    #[serde(default)]
+    pub smoothing: u8,
+    #[serde(default)]
+    pub axis_snap: AxisSnapConfig,
+    /// The motion is converted to scrolling while this layer is active
+    pub scroll_layer: Option<u8>,
+    /// Motion counts per scroll step
+    pub scroll_divisor: Option<u8>,
+    /// Scroll down when moving up
+    #[serde(default)]
+    pub invert_scroll: bool,
+}
+
+/// When the minor axis of the motion is snapped to zero
+#[derive(Clone, Copy, Debug, Default, Deserialize, PartialEq, Eq)]
+#[serde(rename_all = "lowercase")]
+pub enum AxisSnapConfig {
+    #[default]
+    Off,
+    Scroll,
+    Always,
 }
 
 /// PMW3610 optical mouse sensor configuration
@@ -949,6 +1157,8 @@ pub struct Pmw3610Config {
     /// Swap X and Y axes
     #[serde(default)]
     pub proc_swap_xy: bool,
+    /// Acceleration, smoothing and scroll mode of the motion
+    pub motion: Option<MotionConfig>,
 }
 
 #[derive(Clone, Debug, Default, Deserialize)]
@@ -992,6 +1202,8 @@ pub struct Pmw33xxConfig {
     /// Report rate (Hz). Motion will be accumulated and emitted at this rate.
     #[serde(default = "default_pointing_report_hz")]
     pub report_hz: u16,
+    /// Acceleration, smoothing and scroll mode of the motion
+    pub motion: Option<MotionConfig>,
 }
 
 #[derive(Clone, Debug, Default, Deserialize)]
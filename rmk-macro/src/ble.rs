@@ -1,6 +1,6 @@
 use proc_macro2::TokenStream as TokenStream2;
 use quote::{format_ident, quote};
-use rmk_config::{ChipSeries, CommunicationConfig, KeyboardTomlConfig};
+use rmk_config::{ChipSeries, CommunicationConfig, ConnParamStepConfig, KeyboardTomlConfig};
 
 // Default implementations of ble configuration.
 // Because ble configuration in `config` is enabled by a feature gate, so this function returns two TokenStreams.
@@ -8,6 +8,62 @@ use rmk_config::{ChipSeries, CommunicationConfig, KeyboardTomlConfig};
 pub(crate) fn expand_ble_config(
     keyboard_config: &KeyboardTomlConfig,
 ) -> (TokenStream2, TokenStream2) {
+    let (mut ble_config, mut set_ble_config) = expand_ble_battery_config(keyboard_config);
+    if set_ble_config.is_empty() {
+        return (ble_config, set_ble_config);
+    }
+    let conn_param = keyboard_config
+        .get_communication_config()
+        .unwrap()
+        .get_ble_config()
+        .and_then(|ble| ble.conn_param)
+        .unwrap_or_default();
+    let host = conn_param.host.map(|steps| {
+        let policy = expand_conn_param_policy(&steps);
+        quote! { host: #policy, }
+    });
+    let split = conn_param.split.map(|steps| {
+        let policy = expand_conn_param_policy(&steps);
+        quote! { split: #policy, }
+    });
+    ble_config.extend(quote! {
+        let ble_conn_param_config = ::rmk::config::BleConnParamConfig {
+            #host
+            #split
+            ..Default::default()
+        };
+    });
+    set_ble_config.extend(quote! {
+        ble_conn_param_config,
+    });
+    (ble_config, set_ble_config)
+}
+
+/// Expand the steps to a `ConnParamPolicy`, which is checked at compile time
+fn expand_conn_param_policy(steps: &[ConnParamStepConfig]) -> TokenStream2 {
+    let steps = steps.iter().map(|step| {
+        let idle_after = step.idle_after.0;
+        let interval_us = step.interval_us as u64;
+        let latency = step.latency;
+        let supervision_timeout = step.supervision_timeout.0;
+        quote! {
+            ::rmk::ble::ConnParamStep {
+                idle_after: ::embassy_time::Duration::from_millis(#idle_after),
+                interval: ::embassy_time::Duration::from_micros(#interval_us),
+                latency: #latency,
+                supervision_timeout: ::embassy_time::Duration::from_millis(#supervision_timeout),
+            }
+        }
+    });
+    quote! {
+        {
+            const POLICY: ::rmk::ble::ConnParamPolicy = ::rmk::ble::ConnParamPolicy::new(&[#(#steps),*]);
+            POLICY
+        }
+    }
+}
+
+fn expand_ble_battery_config(keyboard_config: &KeyboardTomlConfig) -> (TokenStream2, TokenStream2) {
     let communication = keyboard_config.get_communication_config().unwrap();
     if !communication.ble_enabled() {
         return (quote! {}, quote! {});
@@ -1,6 +1,6 @@
 //! Controller event channel generation.
 //!
-//! Generates static PubSub channels and trait implementations for controller events.
+//! Generates static PubSub channels or event rings and trait implementations for controller events.
 
 use proc_macro2::TokenStream;
 use quote::quote;
@@ -8,7 +8,7 @@ use quote::quote;
 use super::config::ControllerEventChannelConfig;
 use crate::utils::to_upper_snake_case;
 
-/// Generate controller event channel (PubSubChannel) and trait implementations.
+/// Generate controller event channel (PubSubChannel or EventRing) and trait implementations.
 ///
 /// Returns (channel_static, trait_impls) TokenStreams.
 pub fn generate_controller_event_channel(
@@ -18,6 +18,32 @@ pub fn generate_controller_event_channel(
     where_clause: Option<&syn::WhereClause>,
     config: &ControllerEventChannelConfig,
 ) -> (TokenStream, TokenStream) {
+    if let Some(transport) = &config.transport {
+        if !transport.is_ident("ring") {
+            let error = syn::Error::new_spanned(
+                transport,
+                "Unknown controller event transport, the supported transport is `ring`",
+            )
+            .to_compile_error();
+            return (error, TokenStream::new());
+        }
+        if let Some(pubs) = &config.pubs {
+            let error = syn::Error::new_spanned(
+                pubs,
+                "`pubs` is not used by the `ring` transport, the events can be published by any number of publishers",
+            )
+            .to_compile_error();
+            return (error, TokenStream::new());
+        }
+        return generate_controller_event_ring(
+            type_name,
+            ty_generics,
+            impl_generics,
+            where_clause,
+            config,
+        );
+    }
+
     let channel_name = syn::Ident::new(
         &format!(
             "{}_CONTROLLER_CHANNEL",
@@ -102,3 +128,89 @@ pub fn generate_controller_event_channel(
 
     (channel_static, trait_impls)
 }
+
+/// Generate controller event ring (EventRing) and trait implementations.
+///
+/// The events are stored once, so `pubs` is rejected. Returns (channel_static, trait_impls) TokenStreams.
+fn generate_controller_event_ring(
+    type_name: &syn::Ident,
+    ty_generics: &syn::TypeGenerics,
+    impl_generics: &syn::ImplGenerics,
+    where_clause: Option<&syn::WhereClause>,
+    config: &ControllerEventChannelConfig,
+) -> (TokenStream, TokenStream) {
+    let ring_name = syn::Ident::new(
+        &format!(
+            "{}_CONTROLLER_RING",
+            to_upper_snake_case(&type_name.to_string())
+        ),
+        type_name.span(),
+    );
+
+    let cap = config.channel_size.clone().unwrap_or_else(|| quote! { 1 });
+    let subs_val = config.subs.clone().unwrap_or_else(|| quote! { 4 });
+    let ring_type = quote! {
+        ::rmk::event::EventRing<#type_name #ty_generics, { #cap }, { #subs_val }>
+    };
+    let subscriber_type = quote! {
+        ::rmk::event::RingSubscriber<'static, #type_name #ty_generics, { #cap }, { #subs_val }>
+    };
+    let publisher_type = quote! {
+        ::rmk::event::RingPublisher<'static, #type_name #ty_generics, { #cap }, { #subs_val }>
+    };
+    let subs_error = subscriber_limit_error(type_name);
+
+    let channel_static = quote! {
+        #[doc(hidden)]
+        static #ring_name: #ring_type = ::rmk::event::EventRing::new();
+    };
+
+    let trait_impls = quote! {
+        impl #impl_generics ::rmk::event::PublishableControllerEvent for #type_name #ty_generics #where_clause {
+            type Publisher = #publisher_type;
+
+            fn controller_publisher() -> Self::Publisher {
+                #ring_name.publisher()
+            }
+        }
+
+        impl #impl_generics ::rmk::event::SubscribableControllerEvent for #type_name #ty_generics #where_clause {
+            type Subscriber = #subscriber_type;
+
+            fn controller_subscriber() -> Self::Subscriber {
+                #ring_name.subscriber(::rmk::event::SubscriberPriority::BestEffort).expect(#subs_error)
+            }
+        }
+
+        impl #impl_generics ::rmk::event::AsyncPublishableControllerEvent for #type_name #ty_generics #where_clause {
+            type AsyncPublisher = #publisher_type;
+
+            fn controller_publisher_async() -> Self::AsyncPublisher {
+                #ring_name.publisher()
+            }
+        }
+
+        impl #impl_generics ::rmk::event::RingControllerEvent for #type_name #ty_generics #where_clause {
+            fn controller_lossless_subscriber() -> Self::Subscriber {
+                #ring_name.subscriber(::rmk::event::SubscriberPriority::Lossless).expect(#subs_error)
+            }
+
+            fn controller_ring_stats() -> ::rmk::event::RingStats {
+                #ring_name.stats()
+            }
+        }
+    };
+
+    (channel_static, trait_impls)
+}
+
+/// Panic message of exceeding the `subs` limit
+fn subscriber_limit_error(type_name: &syn::Ident) -> TokenStream {
+    quote! {
+        concat!(
+            "Failed to create controller subscriber for ",
+            stringify!(#type_name),
+            ". The 'subs' limit has been exceeded. Increase the 'subs' parameter in #[controller_event(subs = N)]."
+        )
+    }
+}
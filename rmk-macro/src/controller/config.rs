@@ -9,9 +9,11 @@ pub struct ControllerConfig {
     pub poll_interval_ms: Option<u64>,
 }
 
-/// Controller event channel config (channel_size, subs, pubs).
+/// Controller event channel config (channel_size, subs, pubs, transport).
 pub struct ControllerEventChannelConfig {
     pub channel_size: Option<TokenStream>,
     pub subs: Option<TokenStream>,
     pub pubs: Option<TokenStream>,
+    /// `None` for the default `PubSubChannel`, `ring` for the `EventRing`
+    pub transport: Option<Path>,
 }
@@ -18,7 +18,7 @@ pub fn parse_controller_config(tokens: impl Into<TokenStream>) -> ControllerConf
 }
 
 /// Parse controller_event parameters from a TokenStream.
-/// Extracts `channel_size`, `subs`, `pubs`.
+/// Extracts `channel_size`, `subs`, `pubs`, `transport`.
 pub fn parse_controller_event_channel_config(
     tokens: impl Into<TokenStream>,
 ) -> ControllerEventChannelConfig {
@@ -28,6 +28,7 @@ pub fn parse_controller_event_channel_config(
         channel_size: parser.get_expr_tokens("channel_size"),
         subs: parser.get_expr_tokens("subs"),
         pubs: parser.get_expr_tokens("pubs"),
+        transport: parser.get_path("transport"),
     }
 }
 
@@ -42,6 +43,7 @@ pub fn parse_controller_event_channel_config_from_attr(
             channel_size: None,
             subs: None,
             pubs: None,
+            transport: None,
         }
     }
 }
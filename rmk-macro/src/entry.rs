@@ -4,6 +4,7 @@ use quote::{format_ident, quote};
 use rmk_config::{BoardConfig, CommunicationConfig, KeyboardTomlConfig};
 use syn::{ItemFn, ItemMod};
 
+use crate::feature::is_feature_enabled;
 use crate::keyboard::Overwritten;
 
 pub(crate) fn expand_rmk_entry(
@@ -12,7 +13,9 @@ pub(crate) fn expand_rmk_entry(
     devices: Vec<TokenStream2>,
     processors: Vec<TokenStream2>,
     controllers: Vec<TokenStream2>,
+    rmk_features: &Option<Vec<String>>,
 ) -> TokenStream2 {
+    let task_stats = is_feature_enabled(rmk_features, "task_stats");
     // If there is a function with `#[Overwritten(entry)]`, override the entry
     if let Some((_, items)) = &item_mod.content {
         items
@@ -31,9 +34,16 @@ pub(crate) fn expand_rmk_entry(
                 devices,
                 processors,
                 controllers,
+                task_stats,
             ))
     } else {
-        rmk_entry_select(keyboard_config, devices, processors, controllers)
+        rmk_entry_select(
+            keyboard_config,
+            devices,
+            processors,
+            controllers,
+            task_stats,
+        )
     }
 }
 
@@ -49,25 +59,38 @@ pub(crate) fn rmk_entry_select(
     devices: Vec<TokenStream2>,
     processors: Vec<TokenStream2>,
     controllers: Vec<TokenStream2>,
+    task_stats: bool,
 ) -> TokenStream2 {
     let devices_task = {
         let mut devs = devices.clone();
         devs.push(quote! {matrix});
-        quote! {
-            ::rmk::run_all! (
-                #(#devs),*
-            )
-        }
+        instrument_task(
+            task_stats,
+            "Devices",
+            quote! {
+                ::rmk::run_all! (
+                    #(#devs),*
+                )
+            },
+        )
     };
     let processors_task = if processors.is_empty() {
         quote! {}
     } else {
-        quote! {
-            ::rmk::run_all! (
-                #(#processors),*
-            )
-        }
+        instrument_task(
+            task_stats,
+            "Processors",
+            quote! {
+                ::rmk::run_all! (
+                    #(#processors),*
+                )
+            },
+        )
     };
+    let controllers: Vec<TokenStream2> = controllers
+        .into_iter()
+        .map(|c| instrument_task(task_stats, "Controllers", c))
+        .collect();
     let event_trait_import = if !controllers.is_empty() {
         quote! { use ::rmk::controller::EventController; }
     } else {
@@ -95,15 +118,17 @@ pub(crate) fn rmk_entry_select(
 
     let entry = match &board {
         BoardConfig::Split(split_config) => {
-            let keyboard_task = quote! {
-                keyboard.run(),
-            };
+            let keyboard_task = instrument_task(task_stats, "Keyboard", quote! { keyboard.run() });
             let mut tasks = vec![devices_task, keyboard_task];
             tasks.extend(controllers);
             if split_config.connection == "ble" {
-                let rmk_task = quote! {
-                    ::rmk::run_rmk(#keymap #usb_driver_arg &stack, #storage rmk_config)
-                };
+                let rmk_task = instrument_task(
+                    task_stats,
+                    "Rmk",
+                    quote! {
+                        ::rmk::run_rmk(#keymap #usb_driver_arg &stack, #storage rmk_config)
+                    },
+                );
                 tasks.push(rmk_task);
                 if !processors.is_empty() {
                     tasks.push(processors_task);
@@ -113,23 +138,35 @@ pub(crate) fn rmk_entry_select(
                     let col = p.cols;
                     let row_offset = p.row_offset;
                     let col_offset = p.col_offset;
-                    tasks.push(quote! {
-                        ::rmk::split::central::run_peripheral_manager::<#row, #col, #row_offset, #col_offset, _>(
-                            #idx,
-                            &peripheral_addrs,
-                            &stack,
-                        )
-                    });
+                    tasks.push(instrument_task(
+                        task_stats,
+                        "Split",
+                        quote! {
+                            ::rmk::split::central::run_peripheral_manager::<#row, #col, #row_offset, #col_offset, _>(
+                                #idx,
+                                &peripheral_addrs,
+                                &stack,
+                            )
+                        },
+                    ));
                 });
-                let scan_task = quote! {
-                    ::rmk::split::ble::central::scan_peripherals(&stack, &peripheral_addrs)
-                };
+                let scan_task = instrument_task(
+                    task_stats,
+                    "SplitScan",
+                    quote! {
+                        ::rmk::split::ble::central::scan_peripherals(&stack, &peripheral_addrs)
+                    },
+                );
                 tasks.push(scan_task);
                 join_all_tasks(tasks)
             } else if split_config.connection == "serial" {
-                let rmk_task = quote! {
-                    ::rmk::run_rmk(#keymap #usb_driver_arg #storage rmk_config),
-                };
+                let rmk_task = instrument_task(
+                    task_stats,
+                    "Rmk",
+                    quote! {
+                        ::rmk::run_rmk(#keymap #usb_driver_arg #storage rmk_config)
+                    },
+                );
                 tasks.push(rmk_task);
                 if !processors.is_empty() {
                     tasks.push(processors_task);
@@ -152,12 +189,16 @@ pub(crate) fn rmk_entry_select(
                             .instance
                             .to_lowercase()
                     );
-                    tasks.push(quote! {
-                        ::rmk::split::central::run_peripheral_manager::<#row, #col, #row_offset, #col_offset, _>(
-                            #idx,
-                            #uart_instance,
-                        )
-                    });
+                    tasks.push(instrument_task(
+                        task_stats,
+                        "Split",
+                        quote! {
+                            ::rmk::split::central::run_peripheral_manager::<#row, #col, #row_offset, #col_offset, _>(
+                                #idx,
+                                #uart_instance,
+                            )
+                        },
+                    ));
                 });
                 join_all_tasks(tasks)
             } else {
@@ -167,9 +208,13 @@ pub(crate) fn rmk_entry_select(
                 );
             }
         }
-        BoardConfig::UniBody(_) => {
-            rmk_entry_unibody(keyboard_config, devices_task, processors_task, controllers)
-        }
+        BoardConfig::UniBody(_) => rmk_entry_unibody(
+            keyboard_config,
+            devices_task,
+            processors_task,
+            controllers,
+            task_stats,
+        ),
     };
 
     quote! {
@@ -184,10 +229,9 @@ pub(crate) fn rmk_entry_unibody(
     devices_task: TokenStream2,
     processors_task: TokenStream2,
     controllers: Vec<TokenStream2>,
+    task_stats: bool,
 ) -> TokenStream2 {
-    let keyboard_task = quote! {
-        keyboard.run()
-    };
+    let keyboard_task = instrument_task(task_stats, "Keyboard", quote! { keyboard.run() });
 
     let mut tasks = vec![devices_task, keyboard_task];
     if !processors_task.is_empty() {
@@ -209,23 +253,35 @@ pub(crate) fn rmk_entry_unibody(
     let communication = keyboard_config.get_communication_config().unwrap();
     match communication {
         CommunicationConfig::Usb(_) => {
-            let rmk_task = quote! {
-                ::rmk::run_rmk(#keymap driver, #storage rmk_config)
-            };
+            let rmk_task = instrument_task(
+                task_stats,
+                "Rmk",
+                quote! {
+                    ::rmk::run_rmk(#keymap driver, #storage rmk_config)
+                },
+            );
             tasks.push(rmk_task);
             join_all_tasks(tasks)
         }
         CommunicationConfig::Ble(_) => {
-            let rmk_task = quote! {
-                ::rmk::run_rmk(#keymap &stack, #storage rmk_config)
-            };
+            let rmk_task = instrument_task(
+                task_stats,
+                "Rmk",
+                quote! {
+                    ::rmk::run_rmk(#keymap &stack, #storage rmk_config)
+                },
+            );
             tasks.push(rmk_task);
             join_all_tasks(tasks)
         }
         CommunicationConfig::Both(_, _) => {
-            let rmk_task = quote! {
-                ::rmk::run_rmk(#keymap driver, &stack, #storage rmk_config)
-            };
+            let rmk_task = instrument_task(
+                task_stats,
+                "Rmk",
+                quote! {
+                    ::rmk::run_rmk(#keymap driver, &stack, #storage rmk_config)
+                },
+            );
             tasks.push(rmk_task);
             join_all_tasks(tasks)
         }
@@ -233,6 +289,17 @@ pub(crate) fn rmk_entry_unibody(
     }
 }
 
+/// Wrap a task with the accounting of the `task_stats` feature, `task` is the name of a `TaskId` variant
+pub(crate) fn instrument_task(task_stats: bool, task: &str, fut: TokenStream2) -> TokenStream2 {
+    if !task_stats {
+        return fut;
+    }
+    let task = format_ident!("{}", task);
+    quote! {
+        ::rmk::task_stats::instrument(::rmk::task_stats::TaskId::#task, #fut)
+    }
+}
+
 pub fn expand_tasks(tasks: Vec<TokenStream2>) -> TokenStream2 {
     let mut current_joined = quote! {};
     tasks.iter().enumerate().for_each(|(id, task)| {
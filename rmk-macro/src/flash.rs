@@ -45,12 +45,14 @@ fn expand_storage_config(storage_config: &StorageConfig) -> TokenStream2 {
     let start_addr = storage_config.start_addr.unwrap_or(0);
     let clear_storage = storage_config.clear_storage.unwrap_or(false);
     let clear_layout = storage_config.clear_layout.unwrap_or(false);
+    let staged_load = storage_config.staged_load.unwrap_or(false);
     quote! {
         let storage_config = ::rmk::config::StorageConfig {
             num_sectors: #num_sectors,
             start_addr: #start_addr,
             clear_storage: #clear_storage,
-            clear_layout: #clear_layout
+            clear_layout: #clear_layout,
+            staged_load: #staged_load
         };
     }
 }
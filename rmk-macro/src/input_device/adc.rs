@@ -1,18 +1,21 @@
 use quote::{format_ident, quote};
-use rmk_config::{BleConfig, ChipSeries, JoystickConfig};
+use rmk_config::{BleConfig, ChipSeries, InputDeviceConfig, JoystickConfig};
 
 use crate::input_device::Initializer;
 
 /// Expand the ADC device configuration.
 /// Returns (device initializers, processor initializers)
 pub(crate) fn expand_adc_device(
-    joystick_config: Vec<JoystickConfig>,
+    input_device: InputDeviceConfig,
     ble_config: Option<BleConfig>,
     chip_model: ChipSeries,
 ) -> (Vec<Initializer>, Vec<Initializer>) {
+    let joystick_config = input_device.joystick.unwrap_or_default();
     match chip_model {
         ChipSeries::Nrf52 => {
             let mut channel_cfg = vec![];
+            // Rest position of each channel in raw ADC units, used by the DMA scan
+            let mut channel_rest = vec![];
             let mut adc_type = vec![];
             let mut default_polling_interval = 30000u16; // default 30s
             let mut light_sleep: Option<u16> = None;
@@ -36,6 +39,7 @@ pub(crate) fn expand_adc_device(
                     }
                 };
                 channel_cfg.push(adc_pin_def);
+                channel_rest.push(quote! { 0 });
                 adc_type.push(quote! {
                     ::rmk::input_device::adc::AnalogEventType::Battery
                 });
@@ -63,10 +67,17 @@ pub(crate) fn expand_adc_device(
                 default_polling_interval = 20;
                 light_sleep = Some(350);
             }
+            // The joysticks are scanned continuously by the timer-triggered DMA scanner if it's enabled
+            let dma_scan = input_device.adc_scan;
+            if dma_scan.is_some() && joystick_config.is_empty() {
+                panic!(
+                    "\n❌ keyboard.toml: `[input_device.adc_scan]` is only used by joysticks, but no joystick is configured. Please check the documentation: https://rmk.rs/docs/features/configuration/input_device/joystick.html#dma-scan"
+                );
+            }
 
             for joystick in joystick_config {
                 let mut cnt = 0u8;
-                for pin in [joystick.pin_x, joystick.pin_y, joystick.pin_z].iter() {
+                for pin in [&joystick.pin_x, &joystick.pin_y, &joystick.pin_z] {
                     if pin == "_" {
                         break;
                     }
@@ -74,6 +85,15 @@ pub(crate) fn expand_adc_device(
                     channel_cfg.push(quote! {
                         saadc::ChannelConfig::single_ended(p.#adc_pin_def.degrade_saadc())
                     });
+                    // The bias is added to the scaled reading, so the axis is at rest at `-bias`
+                    let rest = joystick
+                        .bias
+                        .get(cnt as usize)
+                        .copied()
+                        .unwrap_or(0)
+                        .saturating_neg();
+                    channel_rest
+                        .push(quote! { ::rmk::input_device::adc::raw_joystick_value(#rest) });
                     cnt += 1;
                 }
 
@@ -85,11 +105,14 @@ pub(crate) fn expand_adc_device(
                     transform,
                     bias,
                     resolution,
+                    motion,
                     ..
                 } = joystick;
+                let motion = expand_motion_config(&motion);
                 let joystick_processor = Initializer {
                     initializer: quote! {
-                        let mut #joy_ident = rmk::input_device::joystick::JoystickProcessor::new([#([#(#transform),*]),*], [#(#bias),*], #resolution, &keymap);
+                        let mut #joy_ident = rmk::input_device::joystick::JoystickProcessor::new([#([#(#transform),*]),*], [#(#bias),*], #resolution, &keymap)
+                            .with_motion(#motion);
                     },
                     var_name: joy_ident,
                 };
@@ -102,6 +125,41 @@ pub(crate) fn expand_adc_device(
                 } else {
                     quote! {None}
                 };
+                let adc_new = if let Some(adc_scan) = dma_scan {
+                    // The default TIMER1 and PPI_CH0/PPI_CH1 are not used by the BLE stack
+                    let timer = format_ident!("{}", adc_scan.timer.as_deref().unwrap_or("TIMER1"));
+                    let [ppi_ch1, ppi_ch2] = adc_scan
+                        .ppi_channels
+                        .unwrap_or_else(|| ["PPI_CH0".to_string(), "PPI_CH1".to_string()])
+                        .map(|ch| format_ident!("{}", ch));
+                    let scan_interval = adc_scan.scan_interval.map_or(1, |d| d.0);
+                    let deadzone = match adc_scan.deadzone {
+                        Some(deadzone) => quote! { #deadzone },
+                        None => quote! { ::rmk::input_device::adc::DEFAULT_JOYSTICK_DEADZONE },
+                    };
+                    quote! {
+                        rmk::input_device::adc::NrfDmaAdc::new(
+                                adc,
+                                p.#timer,
+                                p.#ppi_ch1,
+                                p.#ppi_ch2,
+                                [#(#adc_type),*],
+                                Duration::from_millis(#scan_interval),
+                                #light_sleep_option,
+                            )
+                            .with_deadzone(#deadzone)
+                            .with_rest([#(#channel_rest),*])
+                    }
+                } else {
+                    quote! {
+                        rmk::input_device::adc::NrfAdc::new(
+                                adc,
+                                [#(#adc_type),*],
+                                Duration::from_millis(#default_polling_interval as u64),
+                                #light_sleep_option,
+                            )
+                    }
+                };
                 let adc_device = Initializer {
                     initializer: quote! {
                         let mut adc_device = {
@@ -116,12 +174,7 @@ pub(crate) fn expand_adc_device(
                         let adc = saadc::Saadc::new(p.SAADC, SaadcIrqs, saadc_config, [#(#channel_cfg),*]);
                         adc.calibrate().await;
 
-                        rmk::input_device::adc::NrfAdc::new(
-                                adc,
-                                [#(#adc_type),*],
-                                Duration::from_millis(#default_polling_interval as u64),
-                                #light_sleep_option,
-                            )
+                        #adc_new
                         };
                     },
                     var_name: format_ident!("adc_device"),
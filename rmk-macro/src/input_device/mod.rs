@@ -5,8 +5,8 @@ use pmw3610::expand_pmw3610_device;
 use proc_macro2::{Ident, TokenStream};
 use quote::quote;
 use rmk_config::{
-    BleConfig, BoardConfig, CommunicationConfig, InputDeviceConfig, KeyboardTomlConfig,
-    UniBodyConfig,
+    AxisSnapConfig, BleConfig, BoardConfig, CommunicationConfig, InputDeviceConfig,
+    KeyboardTomlConfig, MotionConfig, UniBodyConfig,
 };
 
 pub(crate) mod adc;
@@ -40,11 +40,9 @@ pub(crate) fn expand_input_device_config(
     let board = keyboard_config.get_board_config().unwrap();
     let chip = keyboard_config.get_chip_model().unwrap();
     let (adc_initializers, adc_processors) = match &board {
-        BoardConfig::UniBody(UniBodyConfig { input_device, .. }) => expand_adc_device(
-            input_device.clone().joystick.unwrap_or(Vec::new()),
-            ble_config,
-            chip.series.clone(),
-        ),
+        BoardConfig::UniBody(UniBodyConfig { input_device, .. }) => {
+            expand_adc_device(input_device.clone(), ble_config, chip.series.clone())
+        }
         BoardConfig::Split(split_config) => {
             // For split central, read battery config from split.central instead of [ble]
             // This provides better consistency with peripheral configuration
@@ -87,9 +85,7 @@ pub(crate) fn expand_input_device_config(
                     .central
                     .input_device
                     .clone()
-                    .unwrap_or(InputDeviceConfig::default())
-                    .joystick
-                    .unwrap_or(Vec::new()),
+                    .unwrap_or(InputDeviceConfig::default()),
                 central_ble_config,
                 chip.series.clone(),
             )
@@ -243,3 +239,37 @@ pub(crate) fn expand_input_device_config(
 
     (initialization, devices, processors)
 }
+
+/// Expand the motion processing configuration of a pointing device or joystick.
+pub(crate) fn expand_motion_config(motion: &Option<MotionConfig>) -> TokenStream {
+    let Some(motion) = motion else {
+        return quote! { ::rmk::input_device::motion::MotionConfig::default() };
+    };
+    let accel_points = motion.accel.iter().map(|[speed, gain_percent]| {
+        // Gain is in 1/256 in the motion stage
+        let gain = (*gain_percent as u32 * 256 / 100).min(u16::MAX as u32) as u16;
+        quote! { ::rmk::input_device::motion::AccelPoint { speed: #speed, gain: #gain } }
+    });
+    let smoothing = motion.smoothing;
+    let axis_snap = match motion.axis_snap {
+        AxisSnapConfig::Off => quote! { ::rmk::input_device::motion::AxisSnap::Off },
+        AxisSnapConfig::Scroll => quote! { ::rmk::input_device::motion::AxisSnap::Scroll },
+        AxisSnapConfig::Always => quote! { ::rmk::input_device::motion::AxisSnap::Always },
+    };
+    let scroll_layer = match motion.scroll_layer {
+        Some(layer) => quote! { Some(#layer) },
+        None => quote! { None },
+    };
+    let scroll_divisor = motion.scroll_divisor.unwrap_or(8);
+    let invert_scroll = motion.invert_scroll;
+    quote! {
+        ::rmk::input_device::motion::MotionConfig {
+            accel: ::rmk::input_device::motion::AccelCurve { points: &[#(#accel_points),*] },
+            smoothing: #smoothing,
+            axis_snap: #axis_snap,
+            scroll_layer: #scroll_layer,
+            scroll_divisor: #scroll_divisor,
+            invert_scroll: #invert_scroll,
+        }
+    }
+}
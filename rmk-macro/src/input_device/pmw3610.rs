@@ -1,7 +1,7 @@
 use quote::{format_ident, quote};
 use rmk_config::{ChipModel, ChipSeries, Pmw3610Config};
 
-use super::Initializer;
+use super::{Initializer, expand_motion_config};
 
 /// Expand PMW3610 device configuration.
 /// Returns (device initializers, processor initializers)
@@ -159,6 +159,8 @@ pub(crate) fn expand_pmw3610_device(
             var_name: device_ident,
         });
 
+        let motion = expand_motion_config(&sensor.motion);
+
         // Generate processor initialization
         let processor_init = quote! {
 
@@ -166,7 +168,7 @@ pub(crate) fn expand_pmw3610_device(
                 invert_x: #proc_invert_x,
                 invert_y: #proc_invert_y,
                 swap_xy: #proc_swap_xy,
-                ..Default::default()
+                motion: #motion,
             };
 
             let mut #processor_ident = ::rmk::input_device::pointing::PointingProcessor::new(&keymap, #processor_ident_config);
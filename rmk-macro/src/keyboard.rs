@@ -147,7 +147,14 @@ fn expand_main(
     let (input_device_config, devices, processors) = expand_input_device_config(keyboard_config);
     let matrix_and_keyboard = expand_matrix_and_keyboard_init(keyboard_config);
     let (controller_initializers, controllers) = expand_controller_init(keyboard_config, &item_mod);
-    let run_rmk = expand_rmk_entry(keyboard_config, &item_mod, devices, processors, controllers);
+    let run_rmk = expand_rmk_entry(
+        keyboard_config,
+        &item_mod,
+        devices,
+        processors,
+        controllers,
+        rmk_features,
+    );
 
     let vial_config = if keyboard_config.get_host_config().vial_enabled {
         quote! { vial_config: VIAL_CONFIG,}
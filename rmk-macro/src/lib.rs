@@ -83,6 +83,12 @@ pub fn rmk_peripheral(attr: TokenStream, item: TokenStream) -> TokenStream {
 ///     pub keyboard_event: KeyboardEvent,
 ///     pub key_action: KeyAction,
 /// }
+///
+/// // Use `EventRing` instead of `PubSubChannel`: the events are stored once,
+/// // and lagging subscribers never block the publisher
+/// #[controller_event(transport = ring, channel_size = 8, subs = 4)]
+/// #[derive(Clone, Copy, Debug)]
+/// pub struct EncoderTurnEvent(pub i8);
 /// ```
 #[proc_macro_attribute]
 pub fn controller_event(attr: TokenStream, item: TokenStream) -> TokenStream {
@@ -8,7 +8,7 @@ use syn::ItemMod;
 
 use crate::chip_init::expand_chip_init;
 use crate::controller::expand_controller_init;
-use crate::entry::join_all_tasks;
+use crate::entry::{instrument_task, join_all_tasks};
 use crate::feature::{get_rmk_features, is_feature_enabled};
 use crate::flash::expand_flash_init;
 use crate::gpio_config::expand_output_initialization;
@@ -334,6 +334,7 @@ fn expand_split_peripheral(
         devices,
         processors,
         controllers,
+        is_feature_enabled(rmk_features, "task_stats"),
     );
 
     quote! {
@@ -357,35 +358,52 @@ fn expand_split_peripheral_entry(
     devices: Vec<TokenStream2>,
     processors: Vec<TokenStream2>,
     controllers: Vec<TokenStream2>,
+    task_stats: bool,
 ) -> TokenStream2 {
     // Add matrix to devices, and run all devices
     let mut devs = devices.clone();
     devs.push(quote! {matrix});
-    let device_task = quote! {
-        ::rmk::run_all! (
-            #(#devs),*
-        )
-    };
-
-    // Create processor task if there are processors
-    let processor_task = if !processors.is_empty() {
+    let device_task = instrument_task(
+        task_stats,
+        "Devices",
         quote! {
             ::rmk::run_all! (
-                #(#processors),*
+                #(#devs),*
             )
-        }
+        },
+    );
+
+    // Create processor task if there are processors
+    let processor_task = if !processors.is_empty() {
+        instrument_task(
+            task_stats,
+            "Processors",
+            quote! {
+                ::rmk::run_all! (
+                    #(#processors),*
+                )
+            },
+        )
     } else {
         quote! {}
     };
+    let controllers: Vec<TokenStream2> = controllers
+        .into_iter()
+        .map(|c| instrument_task(task_stats, "Controllers", c))
+        .collect();
 
     if split_config.connection == "ble" {
-        let peripheral_run = quote! {
-            ::rmk::split::peripheral::run_rmk_split_peripheral(
-                #id,
-                &stack,
-                &mut storage,
-            )
-        };
+        let peripheral_run = instrument_task(
+            task_stats,
+            "Split",
+            quote! {
+                ::rmk::split::peripheral::run_rmk_split_peripheral(
+                    #id,
+                    &stack,
+                    &mut storage,
+                )
+            },
+        );
         // Build task list: device, processor (if any), peripheral, controllers
         let mut tasks = vec![device_task];
         if !processors.is_empty() {
@@ -418,9 +436,13 @@ fn expand_split_peripheral_entry(
                 .instance
                 .to_lowercase()
         );
-        let peripheral_run = quote! {
-            ::rmk::split::peripheral::run_rmk_split_peripheral(#uart_instance)
-        };
+        let peripheral_run = instrument_task(
+            task_stats,
+            "Split",
+            quote! {
+                ::rmk::split::peripheral::run_rmk_split_peripheral(#uart_instance)
+            },
+        );
         let mut tasks = vec![device_task, peripheral_run];
         tasks.extend(controllers);
         let run_rmk_peripheral = join_all_tasks(tasks);
@@ -479,9 +501,7 @@ pub(crate) fn expand_peripheral_input_device_config(
             split_config.peripheral[id]
                 .input_device
                 .clone()
-                .unwrap_or(InputDeviceConfig::default())
-                .joystick
-                .unwrap_or(Vec::new()),
+                .unwrap_or(InputDeviceConfig::default()),
             peripheral_ble_config,
             chip.series.clone(),
         ),
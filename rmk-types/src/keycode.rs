@@ -843,8 +843,8 @@ pub fn to_ascii(keycode: HidKeyCode, shifted: bool) -> u8 {
         (HidKeyCode::Quote, true) => b'"',
         (HidKeyCode::Grave, false) => b'`',
         (HidKeyCode::Grave, true) => b'~',
-        (HidKeyCode::Backslash, true) => b'\\',
-        (HidKeyCode::Backslash, false) => b'|',
+        (HidKeyCode::Backslash, false) => b'\\',
+        (HidKeyCode::Backslash, true) => b'|',
         (HidKeyCode::Comma, false) => b',',
         (HidKeyCode::Comma, true) => b'<',
         (HidKeyCode::Dot, false) => b'.',
@@ -53,6 +53,10 @@ pub enum ViaKeyboardInfo {
     SwitchMatrixState = 0x03,
     FirmwareVersion = 0x04,
     DeviceIndication = 0x05,
+    /// RMK specific: latency statistics of a stage, available with the `latency_trace` feature
+    LatencyStats = 0x80,
+    /// RMK specific: polls, wakeups and busy time of a task, available with the `task_stats` feature
+    TaskStats = 0x81,
 }
 
 impl TryFrom<u8> for ViaKeyboardInfo {
@@ -84,6 +88,8 @@ pub enum VialCommand {
     QmkSettingsReset = 0x0C,
     // Operate on tapdance, combos, etc
     DynamicEntryOp = 0x0D,
+    /// RMK specific: bulk keymap transfer, see `VialBulkKeymap`
+    BulkKeymap = 0x40,
     Unhandled = 0xFF,
 }
 
@@ -134,3 +140,28 @@ impl From<u8> for VialDynamic {
         Self::from_repr(value).unwrap_or(Self::Unhandled)
     }
 }
+
+/// RMK specific bulk keymap transfer subcommands.
+///
+/// The changed keys are applied to the keymap in RAM, and saved to storage as a whole when the transaction is
+/// committed.
+#[derive(Debug, Copy, Clone, PartialEq, Eq, PartialOrd, Ord, FromRepr)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+#[repr(u8)]
+pub enum VialBulkKeymap {
+    /// Start a transaction, returns the number of keys per packet and the total number of keys
+    Begin = 0x00,
+    /// Write consecutive keys, starting from a key index
+    Append = 0x01,
+    /// Read consecutive keys, starting from a key index
+    Read = 0x02,
+    /// Save the keymap to storage and end the transaction
+    Commit = 0x03,
+    Unhandled = 0xFF,
+}
+
+impl From<u8> for VialBulkKeymap {
+    fn from(value: u8) -> Self {
+        Self::from_repr(value).unwrap_or(Self::Unhandled)
+    }
+}
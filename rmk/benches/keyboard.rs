@@ -0,0 +1,209 @@
+//! Host benchmarks of the keyboard processing pipeline.
+//!
+//! Every case feeds a scripted sequence of `KeyboardEvent`s to `Keyboard::process_inner` back-to-back and drains the
+//! reports from `KEYBOARD_REPORT_CHANNEL`, the reported throughput is in key events.
+//!
+//! The embassy time is mocked and advanced by the harness, see `rmk_benches`. Run them in the `benches` package.
+//! The combo case uses all `COMBO_MAX_NUM` combos, run with `keyboard.toml` to get 64 combos:
+//!
+//! ```shell
+//! KEYBOARD_TOML_PATH=$(pwd)/keyboard.toml cargo bench --bench keyboard -- --save-baseline main
+//! KEYBOARD_TOML_PATH=$(pwd)/keyboard.toml cargo bench --bench keyboard -- --baseline main
+//! ```
+use criterion::{Criterion, Throughput, criterion_group, criterion_main};
+use heapless::Vec;
+use rmk::channel::KEYBOARD_REPORT_CHANNEL;
+use rmk::combo::{Combo, ComboConfig};
+use rmk::config::{BehaviorConfig, CombosConfig, Hand, MorsesConfig, PositionalConfig};
+use rmk::keyboard_macros::{MacroOperation, define_macro_sequences, to_macro_sequence};
+use rmk::types::action::{Action, KeyAction, MorseMode, MorseProfile};
+use rmk::types::keycode::{HidKeyCode, KeyCode};
+use rmk::types::modifier::ModifierCombination;
+use rmk::{a, k, mt};
+use rmk_benches::{Clock, create_keyboard, hid, key, process_event, run_macro_sequence, run_sequence, tap};
+
+fn bench_taps(c: &mut Criterion, clock: Clock) {
+    let keymap = [[core::array::from_fn(|col| hid(0x04 + col as u8))]];
+    let mut keyboard = create_keyboard::<1, 16, 1>(keymap, BehaviorConfig::default(), PositionalConfig::default());
+
+    let mut sequence = std::vec::Vec::new();
+    // Single taps, and rolls with overlapping key presses
+    for col in 0..8 {
+        sequence.extend(tap(0, col));
+    }
+    for col in 8..15 {
+        sequence.extend([
+            key(0, col, true),
+            key(0, col + 1, true),
+            key(0, col, false),
+            key(0, col + 1, false),
+        ]);
+    }
+
+    let mut group = c.benchmark_group("taps");
+    group.throughput(Throughput::Elements(sequence.len() as u64));
+    group.bench_function("16_keys", |b| run_sequence(b, clock, &mut keyboard, &sequence));
+    group.finish();
+}
+
+fn bench_combos(c: &mut Criterion, clock: Clock) {
+    // 4x16 distinct keys, the combo `i` is the position `i` and `i + 1`
+    let keymap = [core::array::from_fn(|row| {
+        core::array::from_fn(|col| hid(0x04 + (row * 16 + col) as u8))
+    })];
+    let mut combo = CombosConfig::default();
+    let num_combos = combo.combos.len();
+    for (i, slot) in combo.combos.iter_mut().enumerate() {
+        let output = KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::F13)));
+        *slot = Some(Combo::new(ComboConfig::new(
+            [hid(0x04 + i as u8), hid(0x05 + i as u8)],
+            output,
+            Some(0),
+        )));
+    }
+    let behavior_config = BehaviorConfig {
+        combo,
+        ..Default::default()
+    };
+    let mut keyboard = create_keyboard::<4, 16, 1>(keymap, behavior_config, PositionalConfig::default());
+
+    let pos = |i: usize| ((i / 16) as u8, (i % 16) as u8);
+    let mut sequence = std::vec::Vec::new();
+    for i in (0..num_combos.min(63)).step_by(2) {
+        let ((r0, c0), (r1, c1), (r2, c2)) = (pos(i), pos(i + 1), pos((i + 2) % 64));
+        // Triggered combo
+        sequence.extend([
+            key(r0, c0, true),
+            key(r1, c1, true),
+            key(r0, c0, false),
+            key(r1, c1, false),
+        ]);
+        // Combo interrupted by a key which isn't in the combo
+        sequence.extend([
+            key(r0, c0, true),
+            key(r2, c2, true),
+            key(r0, c0, false),
+            key(r2, c2, false),
+        ]);
+    }
+
+    let mut group = c.benchmark_group("combos");
+    group.throughput(Throughput::Elements(sequence.len() as u64));
+    group.bench_function(format!("{num_combos}_combos"), |b| {
+        run_sequence(b, clock, &mut keyboard, &sequence)
+    });
+    group.finish();
+}
+
+fn bench_transparent_layers(c: &mut Criterion, clock: Clock) {
+    // The key at column `l` of layer `l` activates the layer `l + 1`, the last key is only defined in layer 0
+    let mut keymap = [[[a!(Transparent); 16]; 1]; 16];
+    for (layer, layer_keys) in keymap.iter_mut().enumerate().take(15) {
+        layer_keys[0][layer] = KeyAction::Single(Action::LayerOn(layer as u8 + 1));
+    }
+    keymap[0][0][15] = k!(A);
+    let mut keyboard = create_keyboard::<1, 16, 16>(keymap, BehaviorConfig::default(), PositionalConfig::default());
+
+    // Hold all layer keys, so that all 16 layers are active
+    for col in 0..15 {
+        process_event(&mut keyboard, key(0, col, true));
+    }
+    KEYBOARD_REPORT_CHANNEL.clear();
+
+    let sequence = tap(0, 15);
+    let mut group = c.benchmark_group("layers");
+    group.throughput(Throughput::Elements(sequence.len() as u64));
+    group.bench_function("16_transparent", |b| run_sequence(b, clock, &mut keyboard, &sequence));
+    group.finish();
+}
+
+fn bench_home_row_mods(c: &mut Criterion, clock: Clock) {
+    let keymap = [[[
+        k!(A),
+        mt!(B, ModifierCombination::LSHIFT),
+        mt!(C, ModifierCombination::LGUI),
+        mt!(D, ModifierCombination::LCTRL),
+        mt!(E, ModifierCombination::LALT),
+    ]]];
+    let behavior_config = BehaviorConfig {
+        // Flow tap isn't enabled, back-to-back events are always in the prior idle time
+        morse: MorsesConfig {
+            default_profile: MorseProfile::new(Some(true), Some(MorseMode::PermissiveHold), Some(250u16), Some(250u16)),
+            ..Default::default()
+        },
+        ..Default::default()
+    };
+    let hand = [[Hand::Left, Hand::Left, Hand::Left, Hand::Right, Hand::Right]];
+    let mut keyboard = create_keyboard::<1, 5, 1>(keymap, behavior_config, PositionalConfig::new(hand));
+
+    let sequence = [
+        // Tap of a mod-tap key
+        key(0, 1, true),
+        key(0, 1, false),
+        // Permissive hold, Shift + A
+        key(0, 1, true),
+        key(0, 0, true),
+        key(0, 0, false),
+        key(0, 1, false),
+        // Unilateral tap of two same hand mod-tap keys
+        key(0, 1, true),
+        key(0, 2, true),
+        key(0, 2, false),
+        key(0, 1, false),
+        // Opposite hand roll, Ctrl + Alt + A
+        key(0, 3, true),
+        key(0, 4, true),
+        key(0, 0, true),
+        key(0, 0, false),
+        key(0, 4, false),
+        key(0, 3, false),
+        // Rolling release, both are tapped
+        key(0, 2, true),
+        key(0, 4, true),
+        key(0, 2, false),
+        key(0, 4, false),
+    ];
+
+    let mut group = c.benchmark_group("morse");
+    group.throughput(Throughput::Elements(sequence.len() as u64));
+    group.bench_function("home_row_mods", |b| run_sequence(b, clock, &mut keyboard, &sequence));
+    group.finish();
+}
+
+fn bench_macros(c: &mut Criterion, clock: Clock) {
+    let keymap = [[[
+        KeyAction::Single(Action::TriggerMacro(0)),
+        KeyAction::Single(Action::TriggerMacro(1)),
+    ]]];
+    let press_release = Vec::from_slice(&[
+        MacroOperation::Press(HidKeyCode::LShift),
+        MacroOperation::Press(HidKeyCode::A),
+        MacroOperation::Release(HidKeyCode::A),
+        MacroOperation::Release(HidKeyCode::LShift),
+    ])
+    .expect("too many elements");
+    let mut behavior_config = BehaviorConfig::default();
+    behavior_config.keyboard_macros.macro_sequences =
+        define_macro_sequences(&[press_release, to_macro_sequence("Hello")]);
+    let mut keyboard = create_keyboard::<1, 2, 1>(keymap, behavior_config, PositionalConfig::default());
+
+    let mut group = c.benchmark_group("macros");
+    for (name, col) in [("press_release", 0), ("text", 1)] {
+        let sequence = tap(0, col);
+        group.throughput(Throughput::Elements(sequence.len() as u64));
+        group.bench_function(name, |b| run_macro_sequence(b, clock, &mut keyboard, &sequence));
+    }
+    group.finish();
+}
+
+fn keyboard_benches(c: &mut Criterion) {
+    let clock = Clock::from_env();
+    bench_taps(c, clock);
+    bench_combos(c, clock);
+    bench_transparent_layers(c, clock);
+    bench_home_row_mods(c, clock);
+    bench_macros(c, clock);
+}
+
+criterion_group!(benches, keyboard_benches);
+criterion_main!(benches);
@@ -0,0 +1,160 @@
+//! Harness of the host benchmarks of the keyboard processing pipeline.
+//!
+//! The benchmarks run on the mock time driver of `embassy-time`, the time only moves when it's advanced by the
+//! harness: 1ms per key event, as if the events were scanned 1ms apart. So the keyboard never waits on a timer, the
+//! measured time is the processing time only, and the timeouts behave the same in every run.
+//!
+//! The time is measured by the wall clock. Set `RMK_BENCH_CLOCK=cpu` to measure the CPU time of the benchmark thread
+//! instead, on unix.
+use core::cell::RefCell;
+use std::time::{Duration, Instant};
+
+use embassy_futures::select::select;
+use embassy_futures::{block_on, yield_now};
+use embassy_time::MockDriver;
+use rmk::channel::KEYBOARD_REPORT_CHANNEL;
+use rmk::config::{BehaviorConfig, PositionalConfig};
+use rmk::event::KeyboardEvent;
+use rmk::keyboard::Keyboard;
+use rmk::keyboard_macros::keyboard_report_written;
+use rmk::keymap::KeyMap;
+use rmk::types::action::{Action, KeyAction};
+use rmk::types::keycode::{HidKeyCode, KeyCode};
+
+/// Mock time between two key events
+const EVENT_INTERVAL: embassy_time::Duration = embassy_time::Duration::from_millis(1);
+
+/// Measurement clock of the benchmarks
+#[derive(Clone, Copy)]
+pub enum Clock {
+    Wall,
+    /// CPU time of the benchmark thread
+    #[cfg(unix)]
+    ThreadCpu,
+}
+
+impl Clock {
+    pub fn from_env() -> Self {
+        match std::env::var("RMK_BENCH_CLOCK").as_deref() {
+            #[cfg(unix)]
+            Ok("cpu") => Self::ThreadCpu,
+            _ => Self::Wall,
+        }
+    }
+
+    /// Measure the time of running `f`
+    pub fn measure(self, f: impl FnOnce()) -> Duration {
+        match self {
+            Self::Wall => {
+                let start = Instant::now();
+                f();
+                start.elapsed()
+            }
+            #[cfg(unix)]
+            Self::ThreadCpu => {
+                let start = thread_cpu_time();
+                f();
+                thread_cpu_time() - start
+            }
+        }
+    }
+}
+
+#[cfg(unix)]
+fn thread_cpu_time() -> Duration {
+    let mut time = libc::timespec { tv_sec: 0, tv_nsec: 0 };
+    // SAFETY: `time` is a valid timespec, `CLOCK_THREAD_CPUTIME_ID` is always supported
+    unsafe { libc::clock_gettime(libc::CLOCK_THREAD_CPUTIME_ID, &mut time) };
+    Duration::new(time.tv_sec as u64, time.tv_nsec as u32)
+}
+
+pub fn key(row: u8, col: u8, pressed: bool) -> KeyboardEvent {
+    KeyboardEvent::key(row, col, pressed)
+}
+
+/// Press and release the key
+pub fn tap(row: u8, col: u8) -> [KeyboardEvent; 2] {
+    [key(row, col, true), key(row, col, false)]
+}
+
+pub fn hid(code: u8) -> KeyAction {
+    KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::from(code))))
+}
+
+pub fn create_keyboard<const ROW: usize, const COL: usize, const NUM_LAYER: usize>(
+    keymap: [[[KeyAction; COL]; ROW]; NUM_LAYER],
+    behavior_config: BehaviorConfig,
+    positional_config: PositionalConfig<ROW, COL>,
+) -> Keyboard<'static, ROW, COL, NUM_LAYER> {
+    // Box::leak is acceptable in benchmarks, the keyboards live until the end of the process
+    let keymap = block_on(KeyMap::new(
+        Box::leak(Box::new(keymap)),
+        None,
+        Box::leak(Box::new(behavior_config)),
+        Box::leak(Box::new(positional_config)),
+    ));
+    Keyboard::new(Box::leak(Box::new(RefCell::new(keymap))))
+}
+
+/// Process the event at the next scan time
+pub fn process_event<const ROW: usize, const COL: usize, const NUM_LAYER: usize>(
+    keyboard: &mut Keyboard<'static, ROW, COL, NUM_LAYER>,
+    event: KeyboardEvent,
+) {
+    MockDriver::get().advance(EVENT_INTERVAL);
+    block_on(keyboard.process_inner(event));
+}
+
+/// Benchmark the key sequence, the reports are dropped
+pub fn run_sequence<const ROW: usize, const COL: usize, const NUM_LAYER: usize>(
+    b: &mut criterion::Bencher,
+    clock: Clock,
+    keyboard: &mut Keyboard<'static, ROW, COL, NUM_LAYER>,
+    sequence: &[KeyboardEvent],
+) {
+    KEYBOARD_REPORT_CHANNEL.clear();
+    b.iter_custom(|iters| {
+        clock.measure(|| {
+            for _ in 0..iters {
+                for event in sequence {
+                    process_event(keyboard, *event);
+                    // Drain the reports, so that the keyboard never waits for the channel
+                    while KEYBOARD_REPORT_CHANNEL.try_receive().is_ok() {}
+                }
+            }
+        })
+    });
+}
+
+/// Benchmark the key sequence which triggers macros, the macros are played until they're finished
+pub fn run_macro_sequence<const ROW: usize, const COL: usize, const NUM_LAYER: usize>(
+    b: &mut criterion::Bencher,
+    clock: Clock,
+    keyboard: &mut Keyboard<'static, ROW, COL, NUM_LAYER>,
+    sequence: &[KeyboardEvent],
+) {
+    KEYBOARD_REPORT_CHANNEL.clear();
+    b.iter_custom(|iters| {
+        clock.measure(|| {
+            for _ in 0..iters {
+                for event in sequence {
+                    process_event(keyboard, *event);
+                    block_on(select(keyboard.play_macros(), run_host()));
+                    while KEYBOARD_REPORT_CHANNEL.try_receive().is_ok() {}
+                }
+            }
+        })
+    });
+}
+
+/// Play the HID writer while a macro is running: the queued reports are taken and acknowledged, so the macro plays
+/// the next step right away. The mock time is advanced too, for the delays of the macro.
+async fn run_host() {
+    loop {
+        while KEYBOARD_REPORT_CHANNEL.try_receive().is_ok() {
+            keyboard_report_written();
+        }
+        MockDriver::get().advance(EVENT_INTERVAL);
+        yield_now().await;
+    }
+}
@@ -50,6 +50,15 @@ fn main() {
 fn get_constants_str(constants: RmkConstantsConfig, events: rmk_config::EventConfig) -> String {
     // Compute build hash according to the latest git commit
     let build_hash = compute_build_hash();
+    // The HID class sets the endpoint interval in milliseconds, round sub-millisecond intervals up to 1ms
+    let usb_poll_interval_ms = constants.usb_poll_interval_us.div_ceil(1000).clamp(1, 255) as u8;
+    if constants.usb_poll_interval_us % 1000 != 0 {
+        println!(
+            "cargo:warning=usb_poll_interval_us = {} is rounded up to {}ms, the USB HID endpoint interval is set in milliseconds",
+            constants.usb_poll_interval_us, usb_poll_interval_ms
+        );
+    }
+    let usb_poll_interval_us = usb_poll_interval_ms as u32 * 1000;
     // Add other constants
     let mut constant_strs = vec![
         const_declaration!(pub(crate) MOUSE_KEY_INTERVAL = constants.mouse_key_interval),
@@ -60,13 +69,21 @@ fn get_constants_str(constants: RmkConstantsConfig, events: rmk_config::EventCon
         const_declaration!(pub(crate) FORK_MAX_NUM = constants.fork_max_num),
         const_declaration!(pub(crate) DEBOUNCE_THRESHOLD = constants.debounce_time),
         const_declaration!(pub(crate) REPORT_CHANNEL_SIZE = constants.report_channel_size),
+        const_declaration!(pub(crate) REPORT_COALESCING = constants.report_coalescing),
+        const_declaration!(pub(crate) USB_POLL_INTERVAL_MS = usb_poll_interval_ms),
+        const_declaration!(pub(crate) USB_POLL_INTERVAL_US = usb_poll_interval_us),
+        const_declaration!(pub(crate) BLE_NOTIFY_IN_FLIGHT = constants.ble_notify_in_flight),
         const_declaration!(pub(crate) VIAL_CHANNEL_SIZE = constants.vial_channel_size),
+        const_declaration!(pub(crate) STORAGE_CACHE_PAGES = constants.storage_cache_pages),
+        const_declaration!(pub(crate) STORAGE_CACHE_KEYS = constants.storage_cache_keys),
+        const_declaration!(pub(crate) STORAGE_WRITE_BACK_SIZE = constants.storage_write_back_size),
         const_declaration!(pub(crate) FLASH_CHANNEL_SIZE = constants.flash_channel_size),
         const_declaration!(pub(crate) SPLIT_PERIPHERALS_NUM = constants.split_peripherals_num),
         const_declaration!(pub(crate) NUM_BLE_PROFILE = constants.ble_profiles_num),
         const_declaration!(pub(crate) SPLIT_CENTRAL_SLEEP_TIMEOUT_SECONDS = constants.split_central_sleep_timeout_seconds),
         const_declaration!(pub(crate) MORSE_MAX_NUM = constants.morse_max_num),
         const_declaration!(pub(crate) MAX_PATTERNS_PER_KEY = constants.max_patterns_per_key),
+        const_declaration!(pub(crate) HELD_BUFFER_SIZE = constants.held_buffer_size),
         format!("pub(crate) const BUILD_HASH: u32 = {build_hash:#010x};\n"),
     ];
 
@@ -75,10 +92,13 @@ fn get_constants_str(constants: RmkConstantsConfig, events: rmk_config::EventCon
     let (ble_state_change_size, ble_state_change_pubs, ble_state_change_subs) = events.ble_state_change.into_values();
     let (ble_profile_change_size, ble_profile_change_pubs, ble_profile_change_subs) =
         events.ble_profile_change.into_values();
+    let (conn_param_update_size, conn_param_update_pubs, conn_param_update_subs) =
+        events.conn_param_update.into_values();
     let (connection_change_size, connection_change_pubs, connection_change_subs) =
         events.connection_change.into_values();
-    let (key_size, key_pubs, key_subs) = events.key.into_values();
-    let (modifier_size, modifier_pubs, modifier_subs) = events.modifier.into_values();
+    // The key and modifier events use the event ring, which has no publisher limit
+    let (key_size, _, key_subs) = events.key.into_values();
+    let (modifier_size, _, modifier_subs) = events.modifier.into_values();
     let (layer_change_size, layer_change_pubs, layer_change_subs) = events.layer_change.into_values();
     let (wpm_update_size, wpm_update_pubs, wpm_update_subs) = events.wpm_update.into_values();
     let (led_indicator_size, led_indicator_pubs, led_indicator_subs) = events.led_indicator.into_values();
@@ -100,16 +120,17 @@ fn get_constants_str(constants: RmkConstantsConfig, events: rmk_config::EventCon
         const_declaration!(pub(crate) BLE_PROFILE_CHANGE_EVENT_CHANNEL_SIZE = ble_profile_change_size),
         const_declaration!(pub(crate) BLE_PROFILE_CHANGE_EVENT_PUB_SIZE = ble_profile_change_pubs),
         const_declaration!(pub(crate) BLE_PROFILE_CHANGE_EVENT_SUB_SIZE = ble_profile_change_subs),
+        const_declaration!(pub(crate) CONN_PARAM_UPDATE_EVENT_CHANNEL_SIZE = conn_param_update_size),
+        const_declaration!(pub(crate) CONN_PARAM_UPDATE_EVENT_PUB_SIZE = conn_param_update_pubs),
+        const_declaration!(pub(crate) CONN_PARAM_UPDATE_EVENT_SUB_SIZE = conn_param_update_subs),
         // Connection events
         const_declaration!(pub(crate) CONNECTION_CHANGE_EVENT_CHANNEL_SIZE = connection_change_size),
         const_declaration!(pub(crate) CONNECTION_CHANGE_EVENT_PUB_SIZE = connection_change_pubs),
         const_declaration!(pub(crate) CONNECTION_CHANGE_EVENT_SUB_SIZE = connection_change_subs),
         // Input events
         const_declaration!(pub(crate) KEY_EVENT_CHANNEL_SIZE = key_size),
-        const_declaration!(pub(crate) KEY_EVENT_PUB_SIZE = key_pubs),
         const_declaration!(pub(crate) KEY_EVENT_SUB_SIZE = key_subs),
         const_declaration!(pub(crate) MODIFIER_EVENT_CHANNEL_SIZE = modifier_size),
-        const_declaration!(pub(crate) MODIFIER_EVENT_PUB_SIZE = modifier_pubs),
         const_declaration!(pub(crate) MODIFIER_EVENT_SUB_SIZE = modifier_subs),
         // Keyboard state events
         const_declaration!(pub(crate) LAYER_CHANGE_EVENT_CHANNEL_SIZE = layer_change_size),
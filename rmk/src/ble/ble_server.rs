@@ -1,3 +1,7 @@
+use core::sync::atomic::Ordering;
+
+use embassy_futures::join::join_array;
+use embassy_time::Instant;
 use ssmarshal::serialize;
 use trouble_host::prelude::*;
 use usbd_hid::descriptor::SerializedDescriptor;
@@ -6,9 +10,13 @@ use super::battery_service::BatteryService;
 use super::device_info::DeviceConfigurationService;
 #[cfg(feature = "host")]
 use super::host_service::HostService;
+use super::notify_pipeline::{KEYBOARD_SLOT, NotifyBatch, record_batch, record_latency};
 use crate::channel::KEYBOARD_REPORT_CHANNEL;
 use crate::descriptor::{CompositeReport, CompositeReportType, KeyboardReport};
+use crate::hid::coalescer::ReportCoalescer;
 use crate::hid::{HidError, HidWriterTrait, Report, RunnableHidWriter};
+use crate::state::ConnectionState;
+use crate::{BLE_NOTIFY_IN_FLIGHT, CONNECTION_STATE, REPORT_COALESCING};
 
 // Used for saving the CCCD table
 pub(crate) const CCCD_TABLE_SIZE: usize = _CCCD_TABLE_SIZE;
@@ -83,6 +91,9 @@ pub(crate) struct BleHidServer<'stack, 'server, 'conn, P: PacketPool> {
     pub(crate) media_report: Characteristic<[u8; 2]>,
     pub(crate) system_report: Characteristic<[u8; 1]>,
     pub(crate) conn: &'conn GattConnection<'stack, 'server, P>,
+    coalescer: ReportCoalescer,
+    /// The report which is received but can't be sent in the current batch
+    deferred: Option<Report>,
 }
 
 impl<'stack, 'server, 'conn, P: PacketPool> BleHidServer<'stack, 'server, 'conn, P> {
@@ -93,23 +104,59 @@ impl<'stack, 'server, 'conn, P: PacketPool> BleHidServer<'stack, 'server, 'conn,
             media_report: server.composite_service.media_report,
             system_report: server.composite_service.system_report,
             conn,
+            coalescer: ReportCoalescer::new(),
+            deferred: None,
         }
     }
-}
 
-impl<P: PacketPool> HidWriterTrait for BleHidServer<'_, '_, '_, P> {
-    type ReportType = Report;
+    /// Get the next report if there is one queued, without waiting
+    fn try_get_report(&mut self) -> Option<Report> {
+        if REPORT_COALESCING {
+            self.coalescer.try_next_report()
+        } else {
+            KEYBOARD_REPORT_CHANNEL.try_receive().ok()
+        }
+    }
 
-    async fn write_report(&mut self, report: Self::ReportType) -> Result<usize, HidError> {
+    /// Wait for a report, then collect the queued reports which can be notified together with it
+    async fn next_batch(&mut self) -> NotifyBatch {
+        let mut batch = NotifyBatch::new(BLE_NOTIFY_IN_FLIGHT);
+        let first = match self.deferred.take() {
+            Some(report) => report,
+            None => self.get_report().await,
+        };
+        let _ = batch.push(first);
+        while !batch.is_full()
+            && let Some(report) = self.try_get_report()
+        {
+            if let Err(report) = batch.push(report) {
+                self.deferred = Some(report);
+                break;
+            }
+        }
+        record_batch(KEYBOARD_REPORT_CHANNEL.len() + self.deferred.is_some() as usize);
+        batch
+    }
+
+    /// Notify a report of a batch, and record its latency since it's dequeued
+    async fn notify_in_batch(&self, report: Option<Report>, dequeued: Instant) -> Result<usize, HidError> {
+        let Some(report) = report else {
+            return Ok(0);
+        };
+        let result = self.notify_report(report).await;
+        if let Err(e) = &result {
+            error!("Failed to send report: {:?}", e);
+        }
+        record_latency(dequeued.elapsed());
+        result
+    }
+
+    async fn notify_report(&self, report: Report) -> Result<usize, HidError> {
         match report {
-            Report::KeyboardReport(keyboard_report) => {
-                let mut buf = [0u8; 8];
-                let n = serialize(&mut buf, &keyboard_report).map_err(|_| HidError::ReportSerializeError)?;
-                self.input_keyboard.notify(self.conn, &buf).await.map_err(|e| {
-                    error!("Failed to notify keyboard report: {:?}", e);
-                    HidError::BleError
-                })?;
-                Ok(n)
+            Report::KeyboardReport(keyboard_report) => self.write_keyboard_report(keyboard_report).await,
+            Report::NkroReport(nkro_report) => {
+                // The BLE HID service only has the boot keyboard report, so NKRO reports are always downgraded
+                self.write_keyboard_report(nkro_report.to_boot_report()).await
             }
             Report::MouseReport(mouse_report) => {
                 let mut buf = [0u8; 5];
@@ -118,6 +165,7 @@ impl<P: PacketPool> HidWriterTrait for BleHidServer<'_, '_, '_, P> {
                     error!("Failed to notify mouse report: {:?}", e);
                     HidError::BleError
                 })?;
+                crate::input_device::pointing::mouse_report_written();
                 Ok(n)
             }
             Report::MediaKeyboardReport(media_keyboard_report) => {
@@ -140,10 +188,64 @@ impl<P: PacketPool> HidWriterTrait for BleHidServer<'_, '_, '_, P> {
             }
         }
     }
+
+    async fn write_keyboard_report(&self, keyboard_report: KeyboardReport) -> Result<usize, HidError> {
+        let mut buf = [0u8; 8];
+        let n = serialize(&mut buf, &keyboard_report).map_err(|_| HidError::ReportSerializeError)?;
+        self.input_keyboard.notify(self.conn, &buf).await.map_err(|e| {
+            error!("Failed to notify keyboard report: {:?}", e);
+            HidError::BleError
+        })?;
+        #[cfg(feature = "latency_trace")]
+        crate::latency_trace::report_written(&keyboard_report);
+        crate::keyboard_macros::keyboard_report_written();
+        Ok(n)
+    }
+}
+
+impl<P: PacketPool> HidWriterTrait for BleHidServer<'_, '_, '_, P> {
+    type ReportType = Report;
+
+    async fn write_report(&mut self, report: Self::ReportType) -> Result<usize, HidError> {
+        if !REPORT_COALESCING {
+            return self.notify_report(report).await;
+        }
+        let result = self.notify_report(report.clone()).await;
+        self.coalescer.report_written(&report, &result);
+        result
+    }
 }
 
 impl<P: PacketPool> RunnableHidWriter for BleHidServer<'_, '_, '_, P> {
     async fn get_report(&mut self) -> Self::ReportType {
-        KEYBOARD_REPORT_CHANNEL.receive().await
+        if REPORT_COALESCING {
+            self.coalescer.next_report().await
+        } else {
+            KEYBOARD_REPORT_CHANNEL.receive().await
+        }
+    }
+
+    /// Notify the reports in batches, the reports of a batch are in flight together
+    async fn run_writer(&mut self) {
+        loop {
+            let batch = self.next_batch().await;
+            // Only send the reports after the connection is established.
+            if CONNECTION_STATE.load(Ordering::Acquire) != Into::<bool>::into(ConnectionState::Connected) {
+                continue;
+            }
+            let dequeued = Instant::now();
+            let reports = batch.into_reports();
+            // The keyboard report is recorded by the coalescer only after it's written
+            let keyboard_report = if REPORT_COALESCING {
+                reports[KEYBOARD_SLOT].clone()
+            } else {
+                None
+            };
+            let this = &*self;
+            let results = join_array(reports.map(|report| this.notify_in_batch(report, dequeued))).await;
+            if let Some(report) = keyboard_report {
+                self.coalescer.report_written(&report, &results[KEYBOARD_SLOT]);
+            }
+        }
     }
 }
@@ -0,0 +1,277 @@
+//! Activity-aware BLE connection parameter scheduler.
+//!
+//! Each link, the host link and the link to every split peripheral, runs its own scheduler with a
+//! `ConnParamPolicy`. A policy is a list of steps, step 0 is used while typing and the following steps are
+//! entered one by one when there is no activity for the step's `idle_after` time.
+//!
+//! Activity drops the link back to step 0 immediately, while the ramp up only happens after a whole quiet
+//! period, so a short pause in typing doesn't renegotiate the connection parameters.
+//!
+//! The policies are set by [`BleConnParamConfig`] of the `RmkConfig`, or `[ble.conn_param]` in `keyboard.toml`.
+//!
+//! [`BleConnParamConfig`]: crate::config::BleConnParamConfig
+#[cfg(feature = "split")]
+use core::cell::Cell;
+use core::sync::atomic::Ordering;
+
+use bt_hci::cmd::le::LeReadLocalSupportedFeatures;
+use bt_hci::controller::ControllerCmdSync;
+#[cfg(feature = "split")]
+use embassy_sync::blocking_mutex::Mutex;
+use embassy_sync::watch::Watch;
+use embassy_time::{Duration, with_timeout};
+use trouble_host::prelude::*;
+
+use crate::ble::{CONNECTIONS_MAX, SLEEPING_STATE, update_conn_params};
+#[cfg(feature = "controller")]
+use crate::event::{ConnParamUpdateEvent, publish_controller_event};
+
+/// Activity notification, every scheduler holds a receiver
+static ACTIVITY: Watch<crate::RawMutex, (), CONNECTIONS_MAX> = Watch::new();
+
+/// Policy of the split links, it's set by `run_ble` before any peripheral is connected
+#[cfg(feature = "split")]
+static SPLIT_POLICY: Mutex<crate::RawMutex, Cell<ConnParamPolicy>> = Mutex::new(Cell::new(ConnParamPolicy::SPLIT));
+
+/// Notify the schedulers about user activity, aka key or pointing events
+pub(crate) fn notify_activity() {
+    ACTIVITY.sender().send(());
+}
+
+/// Set the policy of the links between split central and peripherals
+#[cfg(feature = "split")]
+pub(crate) fn set_split_policy(policy: ConnParamPolicy) {
+    SPLIT_POLICY.lock(|p| p.set(policy));
+}
+
+/// Policy of the links between split central and peripherals
+#[cfg(feature = "split")]
+pub(crate) fn split_policy() -> ConnParamPolicy {
+    SPLIT_POLICY.lock(|p| p.get())
+}
+
+/// BLE link which connection parameters are scheduled
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub enum ConnLink {
+    /// The link between the keyboard and the host
+    Host,
+    /// The link between the split central and the peripheral with the given id
+    SplitPeripheral(usize),
+}
+
+/// One step of a connection parameter policy
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ConnParamStep {
+    /// Time without activity before entering this step, ignored for the first step
+    pub idle_after: Duration,
+    /// Connection interval
+    pub interval: Duration,
+    /// Peripheral latency, in number of connection events
+    pub latency: u16,
+    pub supervision_timeout: Duration,
+}
+
+impl ConnParamStep {
+    pub(crate) fn connect_params(&self) -> ConnectParams {
+        ConnectParams {
+            min_connection_interval: self.interval,
+            max_connection_interval: self.interval,
+            max_latency: self.latency,
+            min_event_length: Duration::from_secs(0),
+            max_event_length: Duration::from_secs(0),
+            supervision_timeout: self.supervision_timeout,
+        }
+    }
+}
+
+/// Connection parameter policy of a link, the steps should be sorted by `idle_after`
+#[derive(Clone, Copy, Debug)]
+pub struct ConnParamPolicy {
+    pub steps: &'static [ConnParamStep],
+}
+
+impl ConnParamPolicy {
+    /// Create a policy, panics if there's no step or the steps aren't sorted by `idle_after`.
+    ///
+    /// Use it in a const item, then an invalid policy fails to compile.
+    pub const fn new(steps: &'static [ConnParamStep]) -> Self {
+        assert!(
+            !steps.is_empty(),
+            "Connection parameter policy must have at least one step"
+        );
+        let mut i = 1;
+        while i < steps.len() {
+            assert!(
+                steps[i - 1].idle_after.as_ticks() <= steps[i].idle_after.as_ticks(),
+                "Steps of connection parameter policy must be sorted by `idle_after`"
+            );
+            i += 1;
+        }
+        Self { steps }
+    }
+
+    /// Policy of the host link
+    pub const HOST: Self = Self::new(&[
+        ConnParamStep {
+            idle_after: Duration::from_secs(0),
+            interval: Duration::from_micros(7500),
+            latency: 0,
+            supervision_timeout: Duration::from_secs(5),
+        },
+        ConnParamStep {
+            idle_after: Duration::from_secs(5),
+            interval: Duration::from_micros(7500),
+            latency: 30,
+            supervision_timeout: Duration::from_secs(5),
+        },
+        ConnParamStep {
+            idle_after: Duration::from_secs(60),
+            interval: Duration::from_millis(15),
+            latency: 30,
+            supervision_timeout: Duration::from_secs(6),
+        },
+    ]);
+
+    /// Policy of the link between split central and peripheral, the longer intervals are set by the sleep manager
+    pub const SPLIT: Self = Self::new(&[
+        ConnParamStep {
+            idle_after: Duration::from_secs(0),
+            interval: Duration::from_micros(7500),
+            latency: 0,
+            supervision_timeout: Duration::from_secs(5),
+        },
+        ConnParamStep {
+            idle_after: Duration::from_secs(5),
+            interval: Duration::from_micros(7500),
+            latency: 30, // 225ms
+            supervision_timeout: Duration::from_secs(5),
+        },
+    ]);
+
+    /// The parameters used while typing
+    pub(crate) fn active(&self) -> ConnectParams {
+        self.steps[0].connect_params()
+    }
+
+    /// Time to wait in `step` before entering the next step
+    fn dwell_time(&self, step: usize) -> Option<Duration> {
+        let next = self.steps.get(step + 1)?;
+        Some(
+            next.idle_after
+                .checked_sub(self.steps[step].idle_after)
+                .unwrap_or_default(),
+        )
+    }
+}
+
+pub(crate) struct ConnParamScheduler {
+    link: ConnLink,
+    policy: ConnParamPolicy,
+    /// Current step of the policy
+    step: usize,
+}
+
+impl ConnParamScheduler {
+    /// Create a scheduler, the link should already use the first step of the policy
+    pub(crate) fn new(link: ConnLink, policy: ConnParamPolicy) -> Self {
+        Self { link, policy, step: 0 }
+    }
+
+    /// Run the scheduler on the connection, this future never finishes.
+    pub(crate) async fn run<C: Controller + ControllerCmdSync<LeReadLocalSupportedFeatures>, P: PacketPool>(
+        &mut self,
+        stack: &Stack<'_, C, P>,
+        conn: &Connection<'_, P>,
+    ) {
+        let Some(mut activity) = ACTIVITY.receiver() else {
+            error!(
+                "No activity receiver left for {:?}, connection parameters are not scheduled",
+                self.link
+            );
+            return core::future::pending().await;
+        };
+
+        loop {
+            let has_activity = match self.policy.dwell_time(self.step) {
+                Some(dwell_time) => with_timeout(dwell_time, activity.changed()).await.is_ok(),
+                None => {
+                    activity.changed().await;
+                    true
+                }
+            };
+            let step = self.next_step(has_activity);
+            if step == self.step {
+                continue;
+            }
+            self.step = step;
+
+            // While sleeping, the connection parameters are managed by the sleep manager
+            if step != 0 && SLEEPING_STATE.load(Ordering::Acquire) {
+                continue;
+            }
+            let params = &self.policy.steps[step];
+            debug!("Connection parameters of {:?} changed to step {}", self.link, step);
+            update_conn_params(stack, conn, &params.connect_params()).await;
+            #[cfg(feature = "controller")]
+            publish_controller_event(ConnParamUpdateEvent {
+                link: self.link,
+                step: step as u8,
+                interval_us: params.interval.as_micros() as u32,
+                latency: params.latency,
+            });
+        }
+    }
+
+    /// Activity switches to the first step, the quiet period moves forward to the next step
+    fn next_step(&self, has_activity: bool) -> usize {
+        if has_activity {
+            0
+        } else {
+            (self.step + 1).min(self.policy.steps.len() - 1)
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_policy_steps() {
+        for policy in [ConnParamPolicy::HOST, ConnParamPolicy::SPLIT] {
+            assert!(policy.steps.windows(2).all(|w| w[0].idle_after <= w[1].idle_after));
+            assert!(policy.steps.iter().all(|s| {
+                // The supervision timeout should cover the skipped connection events
+                s.supervision_timeout.as_micros() > (1 + s.latency as u64) * s.interval.as_micros() * 2
+            }));
+            assert_eq!(policy.dwell_time(policy.steps.len() - 1), None);
+        }
+        assert_eq!(ConnParamPolicy::HOST.dwell_time(1), Some(Duration::from_secs(55)));
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_unsorted_policy() {
+        let step = ConnParamPolicy::HOST.steps[1];
+        let steps: &'static [ConnParamStep] = Box::leak(Box::new([
+            step,
+            ConnParamStep {
+                idle_after: Duration::from_secs(1),
+                ..step
+            },
+        ]));
+        ConnParamPolicy::new(steps);
+    }
+
+    #[test]
+    fn test_next_step() {
+        let mut scheduler = ConnParamScheduler::new(ConnLink::Host, ConnParamPolicy::HOST);
+        assert_eq!(scheduler.next_step(true), 0);
+        for expected in [1, 2, 2] {
+            scheduler.step = scheduler.next_step(false);
+            assert_eq!(scheduler.step, expected);
+        }
+        assert_eq!(scheduler.next_step(true), 0);
+    }
+}
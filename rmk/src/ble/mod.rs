@@ -34,6 +34,7 @@ use {
 
 use crate::ble::battery_service::BleBatteryServer;
 use crate::ble::ble_server::{BleHidServer, Server};
+use crate::ble::conn_param::ConnParamScheduler;
 use crate::ble::device_info::{PnPID, VidSource};
 use crate::ble::led::BleLedReader;
 use crate::ble::profile::{ProfileInfo, ProfileManager, UPDATED_CCCD_TABLE, UPDATED_PROFILE};
@@ -50,12 +51,17 @@ use crate::usb::add_usb_logger;
 use crate::{CONNECTION_STATE, run_keyboard};
 pub(crate) mod battery_service;
 pub(crate) mod ble_server;
+pub(crate) mod conn_param;
 pub(crate) mod device_info;
 #[cfg(feature = "host")]
 pub(crate) mod host_service;
 pub(crate) mod led;
+pub(crate) mod notify_pipeline;
 pub(crate) mod profile;
 
+pub use conn_param::{ConnLink, ConnParamPolicy, ConnParamStep};
+pub use notify_pipeline::{BleNotifyStats, ble_notify_stats};
+
 #[derive(Clone, Copy, Debug)]
 #[cfg_attr(feature = "defmt", derive(defmt::Format))]
 pub enum BleState {
@@ -122,6 +128,10 @@ pub(crate) async fn run_ble<
     {
         rmk_config.device_config.serial_number = crate::hid::get_serial_number();
     }
+    let conn_param_config = rmk_config.ble_conn_param_config;
+    // Set before the split central connects to any peripheral
+    #[cfg(feature = "split")]
+    conn_param::set_split_policy(conn_param_config.split);
 
     // Initialize usb device and usb hid reader/writer
     #[cfg(not(feature = "_no_usb"))]
@@ -136,6 +146,9 @@ pub(crate) async fn run_ble<
     #[cfg(all(not(feature = "_no_usb"), feature = "host"))]
     let mut host_reader_writer = add_usb_reader_writer!(&mut _usb_builder, ViaReport, 32, 32);
 
+    #[cfg(all(not(feature = "_no_usb"), feature = "nkro"))]
+    let mut nkro_writer = crate::usb::add_usb_nkro_writer(&mut _usb_builder);
+
     // Optional usb logger initialization
     #[cfg(all(feature = "usb_log", not(feature = "_no_usb")))]
     let usb_logger = add_usb_logger!(&mut _usb_builder);
@@ -228,21 +241,29 @@ pub(crate) async fn run_ble<
         }
     };
 
+    let ble_stack_task = ble_task(runner);
+    #[cfg(feature = "task_stats")]
+    let ble_stack_task = crate::task_stats::instrument(crate::task_stats::TaskId::BleStack, ble_stack_task);
+    #[cfg(all(feature = "task_stats", not(feature = "_no_usb")))]
+    let usb_task = crate::task_stats::instrument(crate::task_stats::TaskId::Usb, usb_task);
+
     #[cfg(all(not(feature = "usb_log"), not(feature = "_no_usb")))]
-    let background_task = join(ble_task(runner), usb_task);
+    let background_task = join(ble_stack_task, usb_task);
     #[cfg(all(feature = "usb_log", not(feature = "_no_usb")))]
     let background_task = join(
-        ble_task(runner),
+        ble_stack_task,
         select(
             usb_task,
             embassy_usb_logger::with_class!(1024, log::LevelFilter::Debug, usb_logger),
         ),
     );
     #[cfg(feature = "_no_usb")]
-    let background_task = ble_task(runner);
+    let background_task = ble_stack_task;
 
     // Main loop
     join(background_task, async {
+        // The keymap of the staged startup is loaded by the storage task, while advertising
+        crate::startup::record_boot_phase(crate::startup::BootPhase::TransportStarted);
         loop {
             // Advertising state
             #[cfg(feature = "controller")]
@@ -261,7 +282,11 @@ pub(crate) async fn run_ble<
                             USB_ENABLED.wait(),
                             adv_fut,
                             #[cfg(feature = "storage")]
-                            run_dummy_keyboard(storage),
+                            run_dummy_keyboard(
+                                #[cfg(feature = "host")]
+                                keymap,
+                                storage,
+                            ),
                             #[cfg(not(feature = "storage"))]
                             run_dummy_keyboard(),
                             profile_manager.update_profile(),
@@ -285,7 +310,12 @@ pub(crate) async fn run_ble<
                                     rmk_config.vial_config,
                                     USB_SUSPENDED.wait(),
                                     UsbLedReader::new(&mut keyboard_reader),
-                                    UsbKeyboardWriter::new(&mut keyboard_writer, &mut other_writer),
+                                    UsbKeyboardWriter::new(
+                                        &mut keyboard_writer,
+                                        &mut other_writer,
+                                        #[cfg(feature = "nkro")]
+                                        &mut nkro_writer,
+                                    ),
                                 );
                                 select(usb_fut, profile_manager.update_profile()).await;
                             }
@@ -298,6 +328,7 @@ pub(crate) async fn run_ble<
                                     &server,
                                     &conn,
                                     stack,
+                                    conn_param_config.host,
                                     #[cfg(feature = "host")]
                                     keymap,
                                     #[cfg(feature = "host")]
@@ -343,7 +374,12 @@ pub(crate) async fn run_ble<
                             rmk_config.vial_config,
                             core::future::pending::<()>(), // Run forever until BLE connected
                             UsbLedReader::new(&mut keyboard_reader),
-                            UsbKeyboardWriter::new(&mut keyboard_writer, &mut other_writer),
+                            UsbKeyboardWriter::new(
+                                &mut keyboard_writer,
+                                &mut other_writer,
+                                #[cfg(feature = "nkro")]
+                                &mut nkro_writer,
+                            ),
                         );
                         match select3(adv_fut, usb_fut, profile_manager.update_profile()).await {
                             Either3::First(Ok(conn)) => {
@@ -353,6 +389,7 @@ pub(crate) async fn run_ble<
                                         &server,
                                         &conn,
                                         stack,
+                                        conn_param_config.host,
                                         #[cfg(feature = "host")]
                                         keymap,
                                         #[cfg(feature = "host")]
@@ -391,6 +428,13 @@ pub(crate) async fn run_ble<
                 }
             }
 
+            // No storage task runs while advertising, so the pending keymap is loaded along with the advertising
+            #[cfg(all(feature = "_no_usb", feature = "storage", feature = "host"))]
+            let adv_fut = async {
+                join(adv_fut, crate::startup::load_pending_keymap(keymap, storage))
+                    .await
+                    .0
+            };
             #[cfg(feature = "_no_usb")]
             match adv_fut.await {
                 Ok(conn) => {
@@ -400,6 +444,7 @@ pub(crate) async fn run_ble<
                             &server,
                             &conn,
                             &stack,
+                            conn_param_config.host,
                             #[cfg(feature = "host")]
                             keymap,
                             #[cfg(feature = "host")]
@@ -760,16 +805,26 @@ async fn advertise<'a, 'b, C: Controller>(
 // Dummy keyboard service is used to monitoring keys when there's no actual connection.
 // It's useful for functions like switching active profiles when there's no connection.
 pub(crate) async fn run_dummy_keyboard<
+    'a,
     #[cfg(feature = "storage")] F: AsyncNorFlash,
     #[cfg(feature = "storage")] const ROW: usize,
     #[cfg(feature = "storage")] const COL: usize,
     #[cfg(feature = "storage")] const NUM_LAYER: usize,
     #[cfg(feature = "storage")] const NUM_ENCODER: usize,
 >(
+    #[cfg(all(feature = "storage", feature = "host"))] keymap: &'a RefCell<
+        KeyMap<'a, ROW, COL, NUM_LAYER, NUM_ENCODER>,
+    >,
     #[cfg(feature = "storage")] storage: &mut Storage<F, ROW, COL, NUM_LAYER, NUM_ENCODER>,
 ) {
     CONNECTION_STATE.store(ConnectionState::Disconnected.into(), Ordering::Release);
-    #[cfg(feature = "storage")]
+    #[cfg(all(feature = "storage", feature = "host"))]
+    let storage_fut = async {
+        // Load the keymap of the staged startup while advertising
+        crate::startup::load_pending_keymap(keymap, storage).await;
+        storage.run().await
+    };
+    #[cfg(all(feature = "storage", not(feature = "host")))]
     let storage_fut = storage.run();
     let mut dummy_writer = DummyWriter {};
     #[cfg(feature = "storage")]
@@ -786,6 +841,7 @@ pub(crate) async fn set_conn_params<
 >(
     stack: &Stack<'_, C, P>,
     conn: &GattConnection<'a, 'b, P>,
+    policy: ConnParamPolicy,
 ) {
     // Wait for 5 seconds before setting connection parameters to avoid connection drop
     embassy_time::Timer::after_secs(5).await;
@@ -809,23 +865,13 @@ pub(crate) async fn set_conn_params<
     embassy_time::Timer::after_secs(5).await;
 
     // Setting the conn param the second time ensures that we have best performance on all platforms
-    update_conn_params(
-        stack,
-        conn.raw(),
-        &ConnectParams {
-            min_connection_interval: Duration::from_micros(7500),
-            max_connection_interval: Duration::from_micros(7500),
-            max_latency: 30,
-            min_event_length: Duration::from_secs(0),
-            max_event_length: Duration::from_secs(0),
-            supervision_timeout: Duration::from_secs(5),
-        },
-    )
-    .await;
+    update_conn_params(stack, conn.raw(), &policy.active()).await;
 
-    // Wait forever. This is because we want the conn params setting can be interrupted when the connection is lost.
-    // So this task shouldn't quit after setting the conn params.
-    core::future::pending::<()>().await;
+    // Then adjust the conn params by the typing activity. The scheduler never quits, because we want the conn params
+    // setting can be interrupted when the connection is lost.
+    ConnParamScheduler::new(ConnLink::Host, policy)
+        .run(stack, conn.raw())
+        .await;
 }
 
 /// Run BLE keyboard with connected device
@@ -844,6 +890,7 @@ async fn run_ble_keyboard<
     server: &'b Server<'_>,
     conn: &GattConnection<'a, 'b, DefaultPacketPool>,
     stack: &Stack<'_, C, DefaultPacketPool>,
+    conn_param_policy: ConnParamPolicy,
     #[cfg(feature = "host")] keymap: &'c RefCell<KeyMap<'c, ROW, COL, NUM_LAYER, NUM_ENCODER>>,
     #[cfg(feature = "host")] rmk_config: &'d mut RmkConfig<'static>,
     #[cfg(feature = "storage")] storage: &mut Storage<F, ROW, COL, NUM_LAYER, NUM_ENCODER>,
@@ -871,7 +918,7 @@ async fn run_ble_keyboard<
     let communication_task = async {
         if let Either3::First(e) = select3(
             gatt_events_task(server, conn),
-            set_conn_params(stack, conn),
+            set_conn_params(stack, conn, conn_param_policy),
             ble_battery_server.run(),
         )
         .await
@@ -879,6 +926,8 @@ async fn run_ble_keyboard<
             error!("[gatt_events_task] end: {:?}", e)
         }
     };
+    #[cfg(feature = "task_stats")]
+    let communication_task = crate::task_stats::instrument(crate::task_stats::TaskId::Gatt, communication_task);
 
     run_keyboard(
         #[cfg(feature = "storage")]
@@ -0,0 +1,206 @@
+//! Pipelined BLE HID notifications.
+//!
+//! `trouble-host` resolves a notification once its PDU is queued to the controller, so notifying the reports one by
+//! one keeps at most one report in the controller's queue, and a burst of reports is spread over several connection
+//! events. The BLE writer collects the reports which are already queued in the report channel into a [`NotifyBatch`]
+//! instead, at most one report per HID characteristic, and notifies the whole batch concurrently. A keyboard, a mouse
+//! and a media report which are queued together are sent in the same connection event.
+//!
+//! Two reports of the same characteristic are never in flight together, so the press/release order is kept.
+//!
+//! The queue depth before each batch and the notify latency of each report, from leaving the report channel until the
+//! controller accepts it, are recorded and can be read by [`ble_notify_stats`].
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use embassy_time::Duration;
+
+use crate::hid::Report;
+
+/// Number of HID characteristics which are notified: keyboard, mouse, media and system control
+pub(crate) const NOTIFY_SLOTS: usize = 4;
+/// Slot of the keyboard reports in a batch
+pub(crate) const KEYBOARD_SLOT: usize = 0;
+
+/// Number of notified reports
+static REPORTS: AtomicU32 = AtomicU32::new(0);
+/// Number of notified batches
+static BATCHES: AtomicU32 = AtomicU32::new(0);
+/// Reports queued in the report channel when the latest batch was collected
+static QUEUE_DEPTH: AtomicU32 = AtomicU32::new(0);
+static MAX_QUEUE_DEPTH: AtomicU32 = AtomicU32::new(0);
+/// Moving average of the notify latency, in microseconds
+static AVG_LATENCY_US: AtomicU32 = AtomicU32::new(0);
+static MAX_LATENCY_US: AtomicU32 = AtomicU32::new(0);
+
+/// Statistics of the BLE HID notifications
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct BleNotifyStats {
+    /// Number of notified reports
+    pub reports: u32,
+    /// Number of batches, each batch is sent without waiting for the previous notification of another characteristic
+    pub batches: u32,
+    /// Reports left in the report channel when the latest batch was collected
+    pub queue_depth: u32,
+    /// Maximum of `queue_depth`
+    pub max_queue_depth: u32,
+    /// Moving average of the time from leaving the report channel until the notification is queued to the controller,
+    /// in microseconds
+    pub avg_latency_us: u32,
+    /// Maximum of the notify latency, in microseconds
+    pub max_latency_us: u32,
+}
+
+/// Get the statistics of the BLE HID notifications
+pub fn ble_notify_stats() -> BleNotifyStats {
+    BleNotifyStats {
+        reports: REPORTS.load(Ordering::Relaxed),
+        batches: BATCHES.load(Ordering::Relaxed),
+        queue_depth: QUEUE_DEPTH.load(Ordering::Relaxed),
+        max_queue_depth: MAX_QUEUE_DEPTH.load(Ordering::Relaxed),
+        avg_latency_us: AVG_LATENCY_US.load(Ordering::Relaxed),
+        max_latency_us: MAX_LATENCY_US.load(Ordering::Relaxed),
+    }
+}
+
+// Only the BLE writer of the connection updates the statistics
+fn store_max(counter: &AtomicU32, value: u32) {
+    if value > counter.load(Ordering::Relaxed) {
+        counter.store(value, Ordering::Relaxed);
+    }
+}
+
+/// Record a collected batch and the number of reports which are still queued
+pub(crate) fn record_batch(queue_depth: usize) {
+    BATCHES.store(BATCHES.load(Ordering::Relaxed).wrapping_add(1), Ordering::Relaxed);
+    QUEUE_DEPTH.store(queue_depth as u32, Ordering::Relaxed);
+    store_max(&MAX_QUEUE_DEPTH, queue_depth as u32);
+}
+
+/// Record the notify latency of a report
+pub(crate) fn record_latency(latency: Duration) {
+    let latency_us = latency.as_micros().min(u32::MAX as u64) as u32;
+    let reports = REPORTS.load(Ordering::Relaxed);
+    let avg = if reports == 0 {
+        latency_us
+    } else {
+        // Exponential moving average with a weight of 1/8
+        let avg = AVG_LATENCY_US.load(Ordering::Relaxed);
+        avg - avg / 8 + latency_us / 8
+    };
+    AVG_LATENCY_US.store(avg, Ordering::Relaxed);
+    store_max(&MAX_LATENCY_US, latency_us);
+    REPORTS.store(reports.wrapping_add(1), Ordering::Relaxed);
+}
+
+/// Characteristic which the report is notified through
+fn slot(report: &Report) -> usize {
+    match report {
+        Report::KeyboardReport(_) | Report::NkroReport(_) => KEYBOARD_SLOT,
+        Report::MouseReport(_) => 1,
+        Report::MediaKeyboardReport(_) => 2,
+        Report::SystemControlReport(_) => 3,
+    }
+}
+
+/// Reports which are notified together, at most one per characteristic
+pub(crate) struct NotifyBatch {
+    reports: [Option<Report>; NOTIFY_SLOTS],
+    len: usize,
+    limit: usize,
+}
+
+impl NotifyBatch {
+    /// Create an empty batch of at most `limit` reports
+    pub(crate) fn new(limit: usize) -> Self {
+        Self {
+            reports: [None, None, None, None],
+            len: 0,
+            limit: limit.clamp(1, NOTIFY_SLOTS),
+        }
+    }
+
+    pub(crate) fn is_full(&self) -> bool {
+        self.len >= self.limit
+    }
+
+    /// Add the report to the batch.
+    ///
+    /// The report is returned if the batch is full, or a report of the same characteristic is already in the batch.
+    /// It should be sent in the next batch then.
+    pub(crate) fn push(&mut self, report: Report) -> Result<(), Report> {
+        let slot = &mut self.reports[slot(&report)];
+        if self.len >= self.limit || slot.is_some() {
+            return Err(report);
+        }
+        *slot = Some(report);
+        self.len += 1;
+        Ok(())
+    }
+
+    /// Take the reports out of the batch, the empty characteristics are `None`
+    pub(crate) fn into_reports(self) -> [Option<Report>; NOTIFY_SLOTS] {
+        self.reports
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use usbd_hid::descriptor::{MediaKeyboardReport, MouseReport};
+
+    use super::*;
+    use crate::descriptor::KeyboardReport;
+
+    fn keyboard(keycode: u8) -> Report {
+        Report::KeyboardReport(KeyboardReport {
+            keycodes: [keycode, 0, 0, 0, 0, 0],
+            ..Default::default()
+        })
+    }
+
+    fn mouse(x: i8) -> Report {
+        Report::MouseReport(MouseReport {
+            buttons: 0,
+            x,
+            y: 0,
+            wheel: 0,
+            pan: 0,
+        })
+    }
+
+    #[test]
+    fn test_one_report_per_characteristic() {
+        let mut batch = NotifyBatch::new(NOTIFY_SLOTS);
+        assert!(batch.push(keyboard(4)).is_ok());
+        assert!(batch.push(mouse(10)).is_ok());
+        // The second keyboard report waits for the next batch, so it can't overtake the first one
+        assert!(matches!(batch.push(keyboard(0)), Err(Report::KeyboardReport(_))));
+        assert!(
+            batch
+                .push(Report::MediaKeyboardReport(MediaKeyboardReport { usage_id: 0xE9 }))
+                .is_ok()
+        );
+        assert!(!batch.is_full());
+
+        let reports = batch.into_reports();
+        assert!(matches!(&reports[0], Some(Report::KeyboardReport(r)) if r.keycodes[0] == 4));
+        assert!(matches!(&reports[1], Some(Report::MouseReport(r)) if r.x == 10));
+        assert!(reports[2].is_some());
+        assert!(reports[3].is_none());
+    }
+
+    #[test]
+    fn test_batch_limit() {
+        // A limit of 1 notifies the reports one by one
+        let mut batch = NotifyBatch::new(1);
+        assert!(batch.push(mouse(1)).is_ok());
+        assert!(batch.is_full());
+        assert!(batch.push(keyboard(4)).is_err());
+
+        let mut batch = NotifyBatch::new(2);
+        assert!(batch.push(Report::NkroReport(Default::default())).is_ok());
+        assert!(batch.push(keyboard(4)).is_err());
+        assert!(batch.push(mouse(1)).is_ok());
+        assert!(batch.is_full());
+    }
+}
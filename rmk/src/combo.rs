@@ -1,10 +1,15 @@
+use core::ops::{BitOr, BitOrAssign};
+
 use heapless::Vec;
 use postcard::experimental::max_size::MaxSize;
-use rmk_types::action::KeyAction;
+use rmk_types::action::{KeyAction, MorseProfile};
 use serde::{Deserialize, Serialize};
 
-use crate::COMBO_MAX_LENGTH;
 use crate::event::KeyboardEvent;
+use crate::{COMBO_MAX_LENGTH, COMBO_MAX_NUM};
+
+/// Number of words of `ComboMask`
+const COMBO_MASK_WORDS: usize = COMBO_MAX_NUM.div_ceil(32);
 
 /// Configuration data for a combo
 #[derive(Clone, Copy, Debug, Serialize, Deserialize, MaxSize)]
@@ -162,3 +167,196 @@ impl Combo {
         self.is_triggered = false;
     }
 }
+
+/// A bitset of combo indices
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub(crate) struct ComboMask([u32; COMBO_MASK_WORDS]);
+
+impl ComboMask {
+    pub(crate) fn set(&mut self, idx: usize) {
+        self.0[idx / 32] |= 1 << (idx % 32);
+    }
+
+    pub(crate) fn contains(&self, idx: usize) -> bool {
+        self.0.get(idx / 32).is_some_and(|word| word & (1 << (idx % 32)) != 0)
+    }
+
+    pub(crate) fn is_empty(&self) -> bool {
+        self.0.iter().all(|word| *word == 0)
+    }
+
+    /// A mask of all combos
+    pub(crate) fn all() -> Self {
+        Self([u32::MAX; COMBO_MASK_WORDS])
+    }
+
+    /// Remove the lowest index from the mask and return it
+    pub(crate) fn pop_first(&mut self) -> Option<usize> {
+        let (i, word) = self.0.iter_mut().enumerate().find(|(_, word)| **word != 0)?;
+        let bit = word.trailing_zeros() as usize;
+        *word &= *word - 1;
+        Some(i * 32 + bit)
+    }
+}
+
+impl BitOr for ComboMask {
+    type Output = Self;
+
+    fn bitor(mut self, rhs: Self) -> Self {
+        self |= rhs;
+        self
+    }
+}
+
+impl BitOrAssign for ComboMask {
+    fn bitor_assign(&mut self, rhs: Self) {
+        for (word, rhs) in self.0.iter_mut().zip(rhs.0) {
+            *word |= rhs;
+        }
+    }
+}
+
+/// Iterator over the combos of a `ComboMask`, only the set bits of the mask are visited
+pub(crate) struct ComboIterMut<'a> {
+    /// The combos after the last visited one
+    combos: &'a mut [Option<Combo>],
+    /// Index of the first combo of `combos`
+    offset: usize,
+    mask: ComboMask,
+}
+
+impl<'a> ComboIterMut<'a> {
+    pub(crate) fn new(combos: &'a mut [Option<Combo>], mask: ComboMask) -> Self {
+        Self {
+            combos,
+            offset: 0,
+            mask,
+        }
+    }
+}
+
+impl<'a> Iterator for ComboIterMut<'a> {
+    type Item = &'a mut Combo;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        while let Some(i) = self.mask.pop_first() {
+            let combos = core::mem::take(&mut self.combos);
+            let (combo, rest) = combos.get_mut(i - self.offset..)?.split_first_mut()?;
+            self.combos = rest;
+            self.offset = i + 1;
+            if let Some(combo) = combo.as_mut() {
+                return Some(combo);
+            }
+        }
+        None
+    }
+}
+
+/// Hash of a key action, equal key actions have the same hash.
+///
+/// Like the `PartialEq` of `KeyAction`, the profile of `TapHold` is ignored.
+pub(crate) fn key_action_hash(key_action: &KeyAction) -> u32 {
+    let key_action = match *key_action {
+        KeyAction::TapHold(tap, hold, _) => KeyAction::TapHold(tap, hold, MorseProfile::const_default()),
+        other => other,
+    };
+    let mut buf = [0u8; KeyAction::POSTCARD_MAX_SIZE];
+    let bytes: &[u8] = postcard::to_slice(&key_action, &mut buf).map_or(&[][..], |b| &*b);
+    // FNV-1a
+    bytes
+        .iter()
+        .fold(0x811C_9DC5, |hash, &b| (hash ^ b as u32).wrapping_mul(0x0100_0193))
+}
+
+/// Index from key action to the combos which contain it.
+///
+/// Without the index, every key event has to compare the key action against the actions of all combos.
+/// The index must be rebuilt whenever the combos are changed.
+#[derive(Clone, Debug, Default)]
+pub(crate) struct ComboIndex {
+    /// Distinct key actions of all combos with their hashes, sorted by hash, and the combos which contain each of them
+    entries: Vec<(u32, KeyAction, ComboMask), { COMBO_MAX_NUM * COMBO_MAX_LENGTH }>,
+}
+
+impl ComboIndex {
+    /// Build the index from combos
+    pub(crate) fn new(combos: &[Option<Combo>]) -> Self {
+        let mut index = Self::default();
+        for (i, combo) in combos.iter().enumerate() {
+            let Some(combo) = combo else {
+                continue;
+            };
+            for action in combo.config.actions.iter().filter(|a| !a.is_empty()) {
+                match index.entries.iter_mut().find(|(_, a, _)| a == action) {
+                    Some((_, _, mask)) => mask.set(i),
+                    None => {
+                        let mut mask = ComboMask::default();
+                        mask.set(i);
+                        // The capacity covers all actions of all combos
+                        let _ = index.entries.push((key_action_hash(action), *action, mask));
+                    }
+                }
+            }
+        }
+        index.entries.sort_unstable_by_key(|(hash, _, _)| *hash);
+        index
+    }
+
+    /// Get the combos which contain the key action
+    pub(crate) fn candidates(&self, key_action: &KeyAction) -> ComboMask {
+        if self.entries.is_empty() {
+            return ComboMask::default();
+        }
+        let hash = key_action_hash(key_action);
+        let start = self.entries.partition_point(|(h, _, _)| *h < hash);
+        self.entries[start..]
+            .iter()
+            .take_while(|(h, _, _)| *h == hash)
+            .find(|(_, a, _)| a == key_action)
+            .map(|(_, _, mask)| *mask)
+            .unwrap_or_default()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::k;
+
+    #[test]
+    fn test_combo_index() {
+        let mut combos = [None; COMBO_MAX_NUM];
+        combos[0] = Some(Combo::new(ComboConfig::new([k!(A), k!(B)], k!(X), None)));
+        combos[2] = Some(Combo::new(ComboConfig::new([k!(B), k!(C)], k!(Y), None)));
+        let index = ComboIndex::new(&combos);
+
+        let a = index.candidates(&k!(A));
+        assert!(a.contains(0) && !a.contains(1) && !a.contains(2));
+        let b = index.candidates(&k!(B));
+        assert!(b.contains(0) && b.contains(2));
+        assert_eq!(index.candidates(&k!(D)), ComboMask::default());
+        assert_eq!(index.candidates(&KeyAction::No), ComboMask::default());
+    }
+
+    #[test]
+    fn test_combo_iter_mut() {
+        let mut combos = [None; COMBO_MAX_NUM];
+        combos[1] = Some(Combo::new(ComboConfig::new([k!(A), k!(B)], k!(X), None)));
+        combos[2] = Some(Combo::new(ComboConfig::new([k!(B), k!(C)], k!(Y), None)));
+        combos[COMBO_MAX_NUM - 1] = Some(Combo::new(ComboConfig::new([k!(C), k!(D)], k!(Z), None)));
+
+        let mut mask = ComboMask::default();
+        // Empty slots in the mask are skipped
+        for i in [0, 2, COMBO_MAX_NUM - 1] {
+            mask.set(i);
+        }
+        let outputs: std::vec::Vec<KeyAction> = ComboIterMut::new(&mut combos, mask).map(|c| c.config.output).collect();
+        assert_eq!(outputs, [k!(Y), k!(Z)]);
+        assert_eq!(ComboIterMut::new(&mut combos, ComboMask::default()).count(), 0);
+
+        let mut all = ComboMask::all();
+        assert_eq!(all.pop_first(), Some(0));
+        assert_eq!(all.pop_first(), Some(1));
+    }
+}
@@ -1,6 +1,8 @@
 #[cfg(feature = "_nrf_ble")]
 use embassy_nrf::gpio::{Input, Output};
 
+use crate::ble::ConnParamPolicy;
+
 pub struct BleBatteryConfig<'a> {
     #[cfg(feature = "_nrf_ble")]
     pub charge_state_pin: Option<Input<'a>>,
@@ -51,3 +53,21 @@ impl<'a> BleBatteryConfig<'a> {
         }
     }
 }
+
+/// Connection parameter policies of the BLE links
+#[derive(Clone, Copy, Debug)]
+pub struct BleConnParamConfig {
+    /// Policy of the link between the keyboard and the host
+    pub host: ConnParamPolicy,
+    /// Policy of the links between split central and peripherals, only used by the split central
+    pub split: ConnParamPolicy,
+}
+
+impl Default for BleConnParamConfig {
+    fn default() -> Self {
+        Self {
+            host: ConnParamPolicy::HOST,
+            split: ConnParamPolicy::SPLIT,
+        }
+    }
+}
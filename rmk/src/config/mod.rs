@@ -3,7 +3,7 @@ mod ble_config;
 pub mod macro_config;
 
 #[cfg(feature = "_ble")]
-pub use ble_config::BleBatteryConfig;
+pub use ble_config::{BleBatteryConfig, BleConnParamConfig};
 use embassy_time::Duration;
 use heapless::Vec;
 use macro_config::KeyboardMacrosConfig;
@@ -24,6 +24,8 @@ pub struct RmkConfig<'a> {
     pub storage_config: StorageConfig,
     #[cfg(feature = "_ble")]
     pub ble_battery_config: BleBatteryConfig<'a>,
+    #[cfg(feature = "_ble")]
+    pub ble_conn_param_config: BleConnParamConfig,
 }
 
 #[derive(Clone, Copy, Debug, PartialEq, Eq)]
@@ -168,6 +170,9 @@ pub struct StorageConfig {
     pub num_sectors: u8,
     pub clear_storage: bool,
     pub clear_layout: bool,
+    /// Start the keyboard on the default keymap and read the keymap from the storage while the transports are starting,
+    /// see [`crate::startup`]
+    pub staged_load: bool,
 }
 
 impl Default for StorageConfig {
@@ -177,6 +182,7 @@ impl Default for StorageConfig {
             num_sectors: 2,
             clear_storage: false,
             clear_layout: false,
+            staged_load: false,
         }
     }
 }
@@ -0,0 +1,171 @@
+use embassy_time::Instant;
+
+use super::BatchDebouncerTrait;
+use crate::DEBOUNCE_THRESHOLD;
+
+/// Number of bit planes of the vertical counters, enough to count to `DEBOUNCE_THRESHOLD`
+const COUNTER_BITS: usize = (u16::BITS - DEBOUNCE_THRESHOLD.leading_zeros()) as usize;
+
+/// Bit-packed debouncer, which debounces a whole row of up to 32 keys with a few word operations.
+///
+/// Each key has a vertical counter: bit `i` of the counter of the key at (row, col) is
+/// bit `col` of `counters[row][i]`, so the counters of a row are incremented together by a ripple-carry
+/// over the bit planes. A counter counts the milliseconds elapsed since the key's raw state differs from
+/// its debounced state, the key is debounced when the counter reaches `DEBOUNCE_THRESHOLD`.
+/// Keys whose raw state goes back to the debounced state restart from zero.
+///
+/// It uses only one timestamp per frame, and costs nothing per key when the matrix is idle.
+pub struct BitDebouncer<const ROW: usize, const COL: usize> {
+    /// Vertical counters of elapsed milliseconds
+    counters: [[u32; COUNTER_BITS]; ROW],
+    /// Keys which were debouncing in the last frame
+    debouncing: [u32; ROW],
+    /// Timestamp of the last frame, in ms
+    last_ms: u16,
+}
+
+impl<const ROW: usize, const COL: usize> Default for BitDebouncer<ROW, COL> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<const ROW: usize, const COL: usize> BitDebouncer<ROW, COL> {
+    const SIZE_CHECK: () = if COL > 32 {
+        panic!("BitDebouncer supports at most 32 columns")
+    };
+
+    pub fn new() -> Self {
+        #[allow(clippy::let_unit_value)]
+        let _ = Self::SIZE_CHECK;
+        Self {
+            counters: [[0; COUNTER_BITS]; ROW],
+            debouncing: [0; ROW],
+            last_ms: Instant::now().as_millis() as u16,
+        }
+    }
+}
+
+impl<const ROW: usize, const COL: usize> BatchDebouncerTrait<ROW, COL> for BitDebouncer<ROW, COL> {
+    fn debounce_frame(&mut self, now: Instant, raw: &[u32; ROW], state: &[u32; ROW], changed: &mut [u32; ROW]) -> bool {
+        let now_ms = now.as_millis() as u16;
+        // Counters never exceed the threshold, so there's no need to count more ticks than that
+        let ticks = now_ms.wrapping_sub(self.last_ms).min(DEBOUNCE_THRESHOLD);
+        self.last_ms = now_ms;
+
+        let mut any_changed = false;
+        for row_idx in 0..ROW {
+            let diff = raw[row_idx] ^ state[row_idx];
+            let counter = &mut self.counters[row_idx];
+
+            // Stable keys restart debouncing
+            for plane in counter.iter_mut() {
+                *plane &= diff;
+            }
+
+            let mut done = if DEBOUNCE_THRESHOLD == 0 { diff } else { 0 };
+            // Keys which are just found changed in this frame start counting from the next frame
+            let mut counting = diff & self.debouncing[row_idx] & !done;
+            for _ in 0..ticks {
+                if counting == 0 {
+                    break;
+                }
+                // Increment the counters of counting keys
+                let mut carry = counting;
+                for plane in counter.iter_mut() {
+                    let p = *plane;
+                    *plane = p ^ carry;
+                    carry &= p;
+                }
+                // Find the counters which reach the threshold
+                let mut reached = counting;
+                for (i, plane) in counter.iter().enumerate() {
+                    reached &= if DEBOUNCE_THRESHOLD & (1 << i) != 0 {
+                        *plane
+                    } else {
+                        !*plane
+                    };
+                }
+                done |= reached;
+                counting &= !reached;
+            }
+
+            // Debounced keys become stable
+            for plane in counter.iter_mut() {
+                *plane &= !done;
+            }
+            self.debouncing[row_idx] = diff & !done;
+            changed[row_idx] = done;
+            any_changed |= done != 0;
+        }
+        any_changed
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn frame(debouncer: &mut BitDebouncer<2, 4>, ms: u64, raw: [u32; 2], state: &mut [u32; 2]) -> [u32; 2] {
+        let mut changed = [0; 2];
+        debouncer.debounce_frame(Instant::from_millis(ms), &raw, state, &mut changed);
+        for (s, c) in state.iter_mut().zip(changed.iter()) {
+            *s ^= *c;
+        }
+        changed
+    }
+
+    #[test]
+    fn test_bit_debouncer_press_and_release() {
+        let threshold = DEBOUNCE_THRESHOLD as u64;
+        let mut debouncer = BitDebouncer::<2, 4>::new();
+        debouncer.last_ms = 0;
+        let mut state = [0; 2];
+
+        // Two keys in different rows are pressed in the same frame
+        assert_eq!(frame(&mut debouncer, 0, [0b0010, 0b1000], &mut state), [0, 0]);
+        assert_eq!(
+            frame(&mut debouncer, threshold / 2, [0b0010, 0b1000], &mut state),
+            [0, 0]
+        );
+        assert_eq!(
+            frame(&mut debouncer, threshold, [0b0010, 0b1000], &mut state),
+            [0b0010, 0b1000]
+        );
+        assert_eq!(state, [0b0010, 0b1000]);
+
+        // Stable frames don't report anything
+        assert_eq!(
+            frame(&mut debouncer, threshold * 3, [0b0010, 0b1000], &mut state),
+            [0, 0]
+        );
+
+        // Release one key
+        let t = threshold * 4;
+        assert_eq!(frame(&mut debouncer, t, [0b0010, 0], &mut state), [0, 0]);
+        assert_eq!(
+            frame(&mut debouncer, t + threshold, [0b0010, 0], &mut state),
+            [0, 0b1000]
+        );
+        assert_eq!(state, [0b0010, 0]);
+    }
+
+    #[test]
+    fn test_bit_debouncer_bounce() {
+        let threshold = DEBOUNCE_THRESHOLD as u64;
+        let mut debouncer = BitDebouncer::<2, 4>::new();
+        debouncer.last_ms = 0;
+        let mut state = [0; 2];
+
+        // The key bounces back before the threshold, the counter restarts
+        assert_eq!(frame(&mut debouncer, 0, [0b0001, 0], &mut state), [0, 0]);
+        assert_eq!(frame(&mut debouncer, threshold - 1, [0b0001, 0], &mut state), [0, 0]);
+        assert_eq!(frame(&mut debouncer, threshold, [0, 0], &mut state), [0, 0]);
+        assert_eq!(frame(&mut debouncer, threshold + 1, [0b0001, 0], &mut state), [0, 0]);
+        assert_eq!(frame(&mut debouncer, threshold * 2, [0b0001, 0], &mut state), [0, 0]);
+        assert_eq!(
+            frame(&mut debouncer, threshold * 2 + 1, [0b0001, 0], &mut state),
+            [0b0001, 0]
+        );
+    }
+}
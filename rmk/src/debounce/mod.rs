@@ -1,5 +1,8 @@
+use embassy_time::Instant;
+
 use crate::matrix::KeyState;
 
+pub mod bit_debouncer;
 pub mod default_debouncer;
 pub mod fast_debouncer;
 
@@ -13,6 +16,47 @@ pub trait DebouncerTrait<const ROW: usize, const COL: usize> {
     ) -> DebounceState;
 }
 
+/// Debouncer which processes a whole matrix frame at once.
+///
+/// The frame is row-major, bit `col` of `raw[row]` is the hardware key active signal of the key at (row, col).
+/// Every [`DebouncerTrait`] implements this trait by debouncing the keys one by one,
+/// bit-packed debouncers like [`bit_debouncer::BitDebouncer`] implement it directly.
+pub trait BatchDebouncerTrait<const ROW: usize, const COL: usize> {
+    /// Debounce a frame captured at `now`.
+    ///
+    /// `state` is the current debounced key state. The keys whose debounced state changed
+    /// are written to `changed` as bitmasks. Returns true if any key is changed.
+    fn debounce_frame(&mut self, now: Instant, raw: &[u32; ROW], state: &[u32; ROW], changed: &mut [u32; ROW]) -> bool;
+}
+
+impl<T: DebouncerTrait<ROW, COL>, const ROW: usize, const COL: usize> BatchDebouncerTrait<ROW, COL> for T {
+    fn debounce_frame(
+        &mut self,
+        _now: Instant,
+        raw: &[u32; ROW],
+        state: &[u32; ROW],
+        changed: &mut [u32; ROW],
+    ) -> bool {
+        let mut any_changed = false;
+        for row_idx in 0..ROW {
+            changed[row_idx] = 0;
+            for col_idx in 0..COL {
+                let bit = 1 << col_idx;
+                let key_state = KeyState {
+                    pressed: state[row_idx] & bit != 0,
+                };
+                if let DebounceState::Debounced =
+                    self.detect_change_with_debounce(row_idx, col_idx, raw[row_idx] & bit != 0, &key_state)
+                {
+                    changed[row_idx] |= bit;
+                    any_changed = true;
+                }
+            }
+        }
+        any_changed
+    }
+}
+
 /// Debounce state
 pub enum DebounceState {
     Debounced,
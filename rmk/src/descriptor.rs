@@ -30,6 +30,111 @@ pub struct KeyboardReport {
     pub keycodes: [u8; 6],
 }
 
+/// Number of bytes of the NKRO keycode bitmap, covering keycodes `0x00..=0xDF`.
+pub const NKRO_KEYCODE_BYTES: usize = 28;
+
+/// Total length of a serialized `NkroKeyboardReport`: modifier byte + keycode bitmap.
+pub const NKRO_REPORT_SIZE: usize = 1 + NKRO_KEYCODE_BYTES;
+
+/// Report descriptor of `NkroKeyboardReport`.
+///
+/// Keys are reported as a bitmap of variable items instead of the 6-slot array used by the boot
+/// keyboard, so any number of keys can be pressed at the same time. The LED output report is
+/// intentionally left out, the host keeps writing LEDs to the boot keyboard interface.
+const NKRO_KEYBOARD_REPORT_DESCRIPTOR: &[u8] = &[
+    0x05, 0x01, // Usage Page (Generic Desktop)
+    0x09, 0x06, // Usage (Keyboard)
+    0xA1, 0x01, // Collection (Application)
+    0x05, 0x07, //   Usage Page (Keyboard/Keypad)
+    0x19, 0xE0, //   Usage Minimum (Left Control)
+    0x29, 0xE7, //   Usage Maximum (Right GUI)
+    0x15, 0x00, //   Logical Minimum (0)
+    0x25, 0x01, //   Logical Maximum (1)
+    0x75, 0x01, //   Report Size (1)
+    0x95, 0x08, //   Report Count (8)
+    0x81, 0x02, //   Input (Data, Variable, Absolute)
+    0x19, 0x00, //   Usage Minimum (0x00)
+    0x29, 0xDF, //   Usage Maximum (0xDF)
+    0x95, 0xE0, //   Report Count (224)
+    0x81, 0x02, //   Input (Data, Variable, Absolute)
+    0xC0, // End Collection
+];
+
+/// NkroKeyboardReport reports the modifiers and a bitmap of all pressed keys.
+///
+/// Setting or clearing a key is a single bit operation, there are no slots to manage. When the
+/// host side doesn't support NKRO, the report is downgraded by `to_boot_report`.
+#[derive(Default, Debug, Clone, Copy, PartialEq, Eq, Serialize)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct NkroKeyboardReport {
+    pub modifier: u8, // ModifierCombination
+    pub keycodes: [u8; NKRO_KEYCODE_BYTES],
+}
+
+impl SerializedDescriptor for NkroKeyboardReport {
+    fn desc() -> &'static [u8] {
+        NKRO_KEYBOARD_REPORT_DESCRIPTOR
+    }
+}
+
+impl AsInputReport for NkroKeyboardReport {}
+
+impl NkroKeyboardReport {
+    /// Mark the key as pressed, keycodes out of the bitmap range are ignored.
+    pub fn set_key(&mut self, keycode: u8) {
+        if let Some(byte) = self.keycodes.get_mut((keycode >> 3) as usize) {
+            *byte |= 1 << (keycode & 0x07);
+        }
+    }
+
+    /// Mark the key as released.
+    pub fn clear_key(&mut self, keycode: u8) {
+        if let Some(byte) = self.keycodes.get_mut((keycode >> 3) as usize) {
+            *byte &= !(1 << (keycode & 0x07));
+        }
+    }
+
+    /// Whether the key is pressed.
+    pub fn is_pressed(&self, keycode: u8) -> bool {
+        self.keycodes
+            .get((keycode >> 3) as usize)
+            .is_some_and(|byte| byte & (1 << (keycode & 0x07)) != 0)
+    }
+
+    /// Convert to the 6KRO boot keyboard report.
+    ///
+    /// Follows the boot protocol rollover rule: if more than 6 keys are pressed, all slots are
+    /// filled with `ErrorRollOver`.
+    pub fn to_boot_report(&self) -> KeyboardReport {
+        let mut keycodes = [0u8; 6];
+        let mut count = 0;
+        for (i, &byte) in self.keycodes.iter().enumerate() {
+            let mut bits = byte;
+            while bits != 0 {
+                if count == keycodes.len() {
+                    // ErrorRollOver
+                    keycodes = [0x01; 6];
+                    return KeyboardReport {
+                        modifier: self.modifier,
+                        reserved: 0,
+                        leds: 0,
+                        keycodes,
+                    };
+                }
+                keycodes[count] = (i as u8) << 3 | bits.trailing_zeros() as u8;
+                count += 1;
+                bits &= bits - 1;
+            }
+        }
+        KeyboardReport {
+            modifier: self.modifier,
+            reserved: 0,
+            leds: 0,
+            keycodes,
+        }
+    }
+}
+
 #[gen_hid_descriptor(
     (collection = APPLICATION, usage_page = 0xFF60, usage = 0x61) = {
         (usage = 0x62, logical_min = 0x0) = {
@@ -124,3 +229,42 @@ pub struct CompositeReport {
     pub(crate) media_usage_id: u16,
     pub(crate) system_usage_id: u8,
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_nkro_set_and_clear_key() {
+        let mut report = NkroKeyboardReport::default();
+        report.set_key(0x04);
+        report.set_key(0x2C);
+        report.set_key(0xDF);
+        assert!(report.is_pressed(0x04) && report.is_pressed(0x2C) && report.is_pressed(0xDF));
+        assert_eq!(report.keycodes[0], 0x10);
+        report.clear_key(0x2C);
+        assert!(!report.is_pressed(0x2C));
+        // Out-of-range keycodes are ignored
+        report.set_key(0xE0);
+        assert!(!report.is_pressed(0xE0));
+    }
+
+    #[test]
+    fn test_nkro_to_boot_report() {
+        let mut report = NkroKeyboardReport {
+            modifier: 0x02,
+            ..Default::default()
+        };
+        for key in [0x1D, 0x04, 0x05] {
+            report.set_key(key);
+        }
+        let boot = report.to_boot_report();
+        assert_eq!(boot.modifier, 0x02);
+        assert_eq!(boot.keycodes, [0x04, 0x05, 0x1D, 0, 0, 0]);
+
+        for key in 0x06..0x0A {
+            report.set_key(key);
+        }
+        assert_eq!(report.to_boot_report().keycodes, [0x01; 6]);
+    }
+}
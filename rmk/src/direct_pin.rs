@@ -1,4 +1,4 @@
-use embassy_time::{Instant, Timer};
+use embassy_time::{Duration, Timer};
 use embedded_hal;
 use embedded_hal::digital::InputPin;
 use rmk_macro::input_device;
@@ -8,8 +8,12 @@ use {embassy_futures::select::select_slice, embedded_hal_async::digital::Wait, h
 use crate::MatrixTrait;
 use crate::debounce::{DebounceState, DebouncerTrait};
 use crate::event::KeyboardEvent;
+use crate::input_device::scan_governor::ScanGovernor;
 use crate::matrix::KeyState;
 
+/// Interval between two scan passes while a key is pressed
+const SCAN_INTERVAL: Duration = Duration::from_micros(100);
+
 /// DirectPinMartex only has input pins.
 #[input_device(publish = KeyboardEvent)]
 pub struct DirectPinMatrix<
@@ -28,8 +32,10 @@ pub struct DirectPinMatrix<
     debouncer: D,
     /// Key state matrix
     key_states: [[KeyState; COL]; ROW],
-    /// Start scanning
-    scan_start: Option<Instant>,
+    /// Re-scan needed flag, set when a key is pressed or being debounced
+    rescan_needed: bool,
+    /// Scan rate governor
+    governor: ScanGovernor,
     /// Pin active level
     low_active: bool,
     /// Current scan pos: (out_idx, in_idx)
@@ -53,7 +59,8 @@ impl<
             direct_pins,
             debouncer,
             key_states: [[KeyState::new(); COL]; ROW],
-            scan_start: None,
+            rescan_needed: false,
+            governor: ScanGovernor::register(),
             low_active,
             scan_pos: (0, 0),
         }
@@ -77,9 +84,6 @@ impl<
         loop {
             let (row_idx_start, col_idx_start) = self.scan_pos;
 
-            #[cfg(feature = "async_matrix")]
-            self.wait_for_key().await;
-
             // Scan matrix and send report
             for row_idx in row_idx_start..self.direct_pins.len() {
                 let pins_row = self.direct_pins.get_mut(row_idx).unwrap();
@@ -105,6 +109,7 @@ impl<
                             let key_state = self.key_states[row_idx][col_idx];
 
                             self.scan_pos = (row_idx, col_idx);
+                            self.rescan_needed = true;
                             return KeyboardEvent::key(
                                 (row_idx + ROW_OFFSET) as u8,
                                 (col_idx + COL_OFFSET) as u8,
@@ -112,10 +117,11 @@ impl<
                             );
                         }
 
-                        // If there's key still pressed, always refresh the self.scan_start
-                        #[cfg(feature = "async_matrix")]
-                        if self.key_states[row_idx][col_idx].pressed {
-                            self.scan_start = Some(Instant::now());
+                        // Keep scanning at full rate while a key is pressed or being debounced
+                        if self.key_states[row_idx][col_idx].pressed
+                            || matches!(debounce_state, DebounceState::InProgress)
+                        {
+                            self.rescan_needed = true;
                         }
                     }
                 }
@@ -123,7 +129,18 @@ impl<
 
             self.scan_pos = (0, 0);
 
-            Timer::after_micros(100).await;
+            if self.rescan_needed {
+                self.governor.activity();
+                Timer::after(SCAN_INTERVAL).await;
+            } else {
+                let rate = self.governor.idle(SCAN_INTERVAL, cfg!(feature = "async_matrix"));
+                #[cfg(feature = "async_matrix")]
+                rate.sleep(self.wait_for_key()).await;
+                #[cfg(not(feature = "async_matrix"))]
+                rate.sleep(core::future::pending::<()>()).await;
+                self.governor.wake();
+            }
+            self.rescan_needed = false;
         }
     }
 }
@@ -143,15 +160,6 @@ impl<
     async fn wait_for_key(&mut self) {
         use core::pin::pin;
 
-        if let Some(start_time) = self.scan_start {
-            // If no key press over 1ms, stop scanning and wait for interupt
-            if start_time.elapsed().as_millis() <= 1 {
-                return;
-            } else {
-                self.scan_start = None;
-            }
-        }
-        Timer::after_micros(1).await;
         info!("Waiting for active level");
 
         if self.low_active {
@@ -171,6 +179,5 @@ impl<
             }
             let _ = select_slice(pin!(futs.as_mut_slice())).await;
         }
-        self.scan_start = Some(Instant::now());
     }
 }
@@ -2,7 +2,7 @@
 
 use rmk_macro::controller_event;
 
-use crate::ble::BleState;
+use crate::ble::{BleState, ConnLink};
 
 /// BLE state changed event
 #[controller_event(channel_size = crate::BLE_STATE_CHANGE_EVENT_CHANNEL_SIZE, pubs = crate::BLE_STATE_CHANGE_EVENT_PUB_SIZE, subs = crate::BLE_STATE_CHANGE_EVENT_SUB_SIZE)]
@@ -26,3 +26,15 @@ impl BleStateChangeEvent {
 pub struct BleProfileChangeEvent {
     pub profile: u8,
 }
+
+/// BLE connection parameters changed by the connection parameter scheduler
+#[controller_event(channel_size = crate::CONN_PARAM_UPDATE_EVENT_CHANNEL_SIZE, pubs = crate::CONN_PARAM_UPDATE_EVENT_PUB_SIZE, subs = crate::CONN_PARAM_UPDATE_EVENT_SUB_SIZE)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct ConnParamUpdateEvent {
+    pub link: ConnLink,
+    /// Step of the link's `ConnParamPolicy`, 0 is the step used while typing
+    pub step: u8,
+    pub interval_us: u32,
+    pub latency: u16,
+}
@@ -8,7 +8,9 @@ use crate::event::KeyboardEvent;
 
 /// TODO: Split the KeyEvent to KeyboardEvent and processed KeyAction, or maybe HidReportEvent?
 /// Key press/release event
-#[controller_event(channel_size = crate::KEY_EVENT_CHANNEL_SIZE, pubs = crate::KEY_EVENT_PUB_SIZE, subs = crate::KEY_EVENT_SUB_SIZE)]
+///
+/// It's published for every key, so it uses the event ring: lagging controllers never block the keyboard
+#[controller_event(transport = ring, channel_size = crate::KEY_EVENT_CHANNEL_SIZE, subs = crate::KEY_EVENT_SUB_SIZE)]
 #[derive(Clone, Copy, Debug)]
 #[cfg_attr(feature = "defmt", derive(defmt::Format))]
 pub struct KeyEvent {
@@ -17,7 +19,7 @@ pub struct KeyEvent {
 }
 
 /// Modifier keys combination changed event
-#[controller_event(channel_size = crate::MODIFIER_EVENT_CHANNEL_SIZE, pubs = crate::MODIFIER_EVENT_PUB_SIZE, subs = crate::MODIFIER_EVENT_SUB_SIZE)]
+#[controller_event(transport = ring, channel_size = crate::MODIFIER_EVENT_CHANNEL_SIZE, subs = crate::MODIFIER_EVENT_SUB_SIZE)]
 #[derive(Clone, Copy, Debug)]
 #[cfg_attr(feature = "defmt", derive(defmt::Format))]
 pub struct ModifierEvent {
@@ -12,7 +12,7 @@ mod power;
 mod split;
 
 #[cfg(feature = "_ble")]
-pub use ble::{BleProfileChangeEvent, BleStateChangeEvent};
+pub use ble::{BleProfileChangeEvent, BleStateChangeEvent, ConnParamUpdateEvent};
 pub use connection::{ConnectionChangeEvent, ConnectionType};
 pub use input::{KeyEvent, ModifierEvent};
 pub use keyboard_state::{LayerChangeEvent, LedIndicatorEvent, SleepStateEvent, WpmUpdateEvent};
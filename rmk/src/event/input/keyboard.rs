@@ -1,8 +1,12 @@
+use embassy_time::Instant;
+use heapless::Vec;
 use postcard::experimental::max_size::MaxSize;
 use rmk_macro::input_event;
 use serde::{Deserialize, Serialize};
 
 use crate::input_device::rotary_encoder::Direction;
+#[cfg(feature = "latency_trace")]
+use crate::latency_trace::TraceStamp;
 
 /// `KeyboardEvent` is the event whose `KeyAction` is stored in the keymap.
 ///
@@ -15,6 +19,10 @@ use crate::input_device::rotary_encoder::Direction;
 pub struct KeyboardEvent {
     pub pressed: bool,
     pub pos: KeyboardEventPos,
+    /// Scan timestamp of the event, it's not serialized and it's ignored when comparing events
+    #[cfg(feature = "latency_trace")]
+    #[serde(skip)]
+    pub timestamp: TraceStamp,
 }
 
 impl KeyboardEvent {
@@ -22,6 +30,8 @@ impl KeyboardEvent {
         Self {
             pressed,
             pos: KeyboardEventPos::Key(KeyPos { row, col }),
+            #[cfg(feature = "latency_trace")]
+            timestamp: TraceStamp::now(),
         }
     }
 
@@ -29,10 +39,29 @@ impl KeyboardEvent {
         Self {
             pressed,
             pos: KeyboardEventPos::RotaryEncoder(RotaryEncoderPos { id, direction }),
+            #[cfg(feature = "latency_trace")]
+            timestamp: TraceStamp::now(),
         }
     }
 }
 
+/// Maximum number of key changes in one [`KeyboardBatchEvent`]
+pub const KEYBOARD_BATCH_EVENT_SIZE: usize = 8;
+
+/// All debounced key changes of one matrix scan pass.
+///
+/// It's published by matrices in frame mode, so a chord costs one channel operation instead of one per key.
+/// The keyboard processes the events in the batch in order.
+#[input_event(channel_size = 4)]
+#[derive(Clone, Debug)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct KeyboardBatchEvent {
+    /// Timestamp of the scan pass
+    pub timestamp: Instant,
+    /// Key changes, in scan order
+    pub events: Vec<KeyboardEvent, KEYBOARD_BATCH_EVENT_SIZE>,
+}
+
 /// The position of the keyboard event.
 ///
 /// The position can be either a key (row, col), or a rotary encoder (id, direction)
@@ -9,7 +9,9 @@ mod pointing;
 mod touchpad;
 
 pub use battery::{BatteryAdcEvent, ChargingStateEvent};
-pub use keyboard::{KeyPos, KeyboardEvent, KeyboardEventPos, RotaryEncoderPos};
+pub use keyboard::{
+    KEYBOARD_BATCH_EVENT_SIZE, KeyPos, KeyboardBatchEvent, KeyboardEvent, KeyboardEventPos, RotaryEncoderPos,
+};
 pub use pointing::{Axis, AxisEvent, AxisValType, PointingEvent};
 pub use touchpad::TouchpadEvent;
 
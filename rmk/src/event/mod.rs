@@ -4,6 +4,7 @@
 //! - Event infrastructure (traits, publish/subscribe patterns, implementations)
 //! - Built-in controller events (battery, connection, input, etc.)
 //! - Built-in input device events (keyboard, touchpad, joystick, etc.)
+//! - `EventRing`, the broadcast ring transport of controller events
 
 use embassy_sync::blocking_mutex::raw::RawMutex;
 use embassy_sync::pubsub::{ImmediatePublisher, Publisher, Subscriber};
@@ -11,9 +12,11 @@ use embassy_sync::{channel, watch};
 
 mod controller;
 mod input;
+mod ring;
 
 pub use controller::*;
 pub use input::*;
+pub use ring::{EventRing, RingPublisher, RingStats, RingSubscriber, SubscriberPriority};
 
 /// Trait for event publishers
 pub trait EventPublisher {
@@ -105,6 +108,19 @@ pub trait AsyncControllerEvent: ControllerEvent + AsyncPublishableControllerEven
 
 impl<T: ControllerEvent + AsyncPublishableControllerEvent> AsyncControllerEvent for T {}
 
+/// Trait for controller events which are transported by an `EventRing`.
+///
+/// This trait will be automatically implemented by `#[controller_event(transport = ring)]`.
+pub trait RingControllerEvent: SubscribableControllerEvent {
+    /// Create a lossless subscriber, which never misses an event published by `publish_controller_event_async`.
+    ///
+    /// The subscribers created by `controller_subscriber` are best-effort.
+    fn controller_lossless_subscriber() -> Self::Subscriber;
+
+    /// Statistics of the event ring
+    fn controller_ring_stats() -> RingStats;
+}
+
 // Implementations for embassy-sync PubSubChannel
 impl<'a, M: RawMutex, T: Clone, const CAP: usize, const SUBS: usize, const PUBS: usize> EventPublisher
     for ImmediatePublisher<'a, M, T, CAP, SUBS, PUBS>
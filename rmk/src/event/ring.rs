@@ -0,0 +1,343 @@
+//! Broadcast ring transport for controller events, used by `#[controller_event(transport = ring)]`.
+//!
+//! Every event is stored once in the ring, and each subscriber only keeps the number of its unread events.
+//! Subscribers can read the events by reference, so the events are not copied for each subscriber.
+//!
+//! There are two kinds of subscribers:
+//! - lossless subscribers never miss an event, publishing with backpressure waits until all of them have room
+//! - best-effort subscribers, aka most controllers, skip the oldest events when they lag behind, so they never block
+//!   the publisher
+//!
+//! The number of published events, the high-water mark of the queued events and the number of overrun events are
+//! recorded in `RingStats`.
+use core::cell::RefCell;
+use core::future::poll_fn;
+use core::task::Poll;
+
+use embassy_sync::blocking_mutex::Mutex;
+use embassy_sync::waitqueue::WakerRegistration;
+
+use crate::RawMutex;
+use crate::event::{AsyncEventPublisher, EventPublisher, EventSubscriber};
+
+/// Priority of a ring subscriber
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub enum SubscriberPriority {
+    /// Never misses an event when the events are published with backpressure, it's woken before the best-effort ones
+    Lossless,
+    /// Skips the oldest events when it lags behind more than the ring capacity
+    BestEffort,
+}
+
+/// Statistics of an event ring
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct RingStats {
+    /// Number of published events
+    pub published: u32,
+    /// Maximum number of unread events of a subscriber
+    pub high_water: u16,
+    /// Number of events which are overwritten before they are read by a subscriber
+    pub overruns: u32,
+}
+
+struct SubscriberSlot {
+    /// `None` if the slot is free
+    priority: Option<SubscriberPriority>,
+    /// Number of unread events
+    unread: usize,
+    waker: WakerRegistration,
+}
+
+impl SubscriberSlot {
+    const fn new() -> Self {
+        Self {
+            priority: None,
+            unread: 0,
+            waker: WakerRegistration::new(),
+        }
+    }
+}
+
+struct RingState<T, const CAP: usize, const SUBS: usize> {
+    events: [Option<T>; CAP],
+    /// Index of the slot of the next published event
+    head: usize,
+    subscribers: [SubscriberSlot; SUBS],
+    /// Waker of the publisher which waits for a lossless subscriber
+    publisher_waker: WakerRegistration,
+    stats: RingStats,
+}
+
+impl<T, const CAP: usize, const SUBS: usize> RingState<T, CAP, SUBS> {
+    /// Whether a lossless subscriber would miss an event if a new event is published
+    fn is_full(&self) -> bool {
+        self.subscribers
+            .iter()
+            .any(|s| s.priority == Some(SubscriberPriority::Lossless) && s.unread >= CAP)
+    }
+
+    fn push(&mut self, event: T) {
+        self.events[self.head] = Some(event);
+        self.head = (self.head + 1) % CAP;
+        self.stats.published = self.stats.published.wrapping_add(1);
+        for slot in self.subscribers.iter_mut().filter(|s| s.priority.is_some()) {
+            if slot.unread == CAP {
+                // The oldest unread event is overwritten
+                self.stats.overruns = self.stats.overruns.wrapping_add(1);
+            } else {
+                slot.unread += 1;
+            }
+            self.stats.high_water = self.stats.high_water.max(slot.unread as u16);
+        }
+        for priority in [SubscriberPriority::Lossless, SubscriberPriority::BestEffort] {
+            for slot in self.subscribers.iter_mut().filter(|s| s.priority == Some(priority)) {
+                slot.waker.wake();
+            }
+        }
+    }
+
+    /// The oldest unread event of the subscriber
+    fn peek(&self, id: usize) -> Option<&T> {
+        let unread = self.subscribers[id].unread;
+        if unread == 0 {
+            return None;
+        }
+        self.events[(self.head + CAP - unread) % CAP].as_ref()
+    }
+
+    fn consume(&mut self, id: usize) {
+        let slot = &mut self.subscribers[id];
+        slot.unread -= 1;
+        if slot.priority == Some(SubscriberPriority::Lossless) {
+            self.publisher_waker.wake();
+        }
+    }
+}
+
+/// Single ring broadcast channel, the events are stored once and read by all subscribers
+pub struct EventRing<T, const CAP: usize, const SUBS: usize> {
+    state: Mutex<RawMutex, RefCell<RingState<T, CAP, SUBS>>>,
+}
+
+impl<T: Clone, const CAP: usize, const SUBS: usize> Default for EventRing<T, CAP, SUBS> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T: Clone, const CAP: usize, const SUBS: usize> EventRing<T, CAP, SUBS> {
+    pub const fn new() -> Self {
+        Self {
+            state: Mutex::new(RefCell::new(RingState {
+                events: [const { None }; CAP],
+                head: 0,
+                subscribers: [const { SubscriberSlot::new() }; SUBS],
+                publisher_waker: WakerRegistration::new(),
+                stats: RingStats {
+                    published: 0,
+                    high_water: 0,
+                    overruns: 0,
+                },
+            })),
+        }
+    }
+
+    /// Publish an event without waiting, the oldest event is overwritten for subscribers which lag behind
+    pub fn publish_immediate(&self, event: T) {
+        self.state.lock(|state| state.borrow_mut().push(event));
+    }
+
+    /// Publish an event, wait until all lossless subscribers have room for it
+    pub async fn publish(&self, event: T) {
+        let mut event = Some(event);
+        poll_fn(|cx| {
+            self.state.lock(|state| {
+                let mut state = state.borrow_mut();
+                if state.is_full() {
+                    state.publisher_waker.register(cx.waker());
+                    Poll::Pending
+                } else {
+                    if let Some(event) = event.take() {
+                        state.push(event);
+                    }
+                    Poll::Ready(())
+                }
+            })
+        })
+        .await
+    }
+
+    pub fn publisher(&self) -> RingPublisher<'_, T, CAP, SUBS> {
+        RingPublisher { ring: self }
+    }
+
+    /// Create a subscriber, which receives the events published after it's created.
+    ///
+    /// Returns `None` if there are already `SUBS` subscribers.
+    pub fn subscriber(&self, priority: SubscriberPriority) -> Option<RingSubscriber<'_, T, CAP, SUBS>> {
+        self.state.lock(|state| {
+            let mut state = state.borrow_mut();
+            let id = state.subscribers.iter().position(|s| s.priority.is_none())?;
+            state.subscribers[id].priority = Some(priority);
+            state.subscribers[id].unread = 0;
+            Some(RingSubscriber { ring: self, id })
+        })
+    }
+
+    pub fn stats(&self) -> RingStats {
+        self.state.lock(|state| state.borrow().stats)
+    }
+}
+
+pub struct RingPublisher<'a, T, const CAP: usize, const SUBS: usize> {
+    ring: &'a EventRing<T, CAP, SUBS>,
+}
+
+impl<T: Clone, const CAP: usize, const SUBS: usize> EventPublisher for RingPublisher<'_, T, CAP, SUBS> {
+    type Event = T;
+    fn publish(&self, message: T) {
+        self.ring.publish_immediate(message);
+    }
+}
+
+impl<T: Clone, const CAP: usize, const SUBS: usize> AsyncEventPublisher for RingPublisher<'_, T, CAP, SUBS> {
+    type Event = T;
+    async fn publish_async(&self, message: T) {
+        self.ring.publish(message).await
+    }
+}
+
+pub struct RingSubscriber<'a, T, const CAP: usize, const SUBS: usize> {
+    ring: &'a EventRing<T, CAP, SUBS>,
+    /// Index of the subscriber slot
+    id: usize,
+}
+
+impl<T: Clone, const CAP: usize, const SUBS: usize> RingSubscriber<'_, T, CAP, SUBS> {
+    /// Wait for the next event and read it by reference.
+    ///
+    /// `f` is called with the ring locked, it should be short.
+    pub async fn next_event_with<R>(&mut self, f: impl FnOnce(&T) -> R) -> R {
+        let mut f = Some(f);
+        poll_fn(|cx| {
+            self.ring.state.lock(|state| {
+                let mut state = state.borrow_mut();
+                let Some(event) = state.peek(self.id) else {
+                    state.subscribers[self.id].waker.register(cx.waker());
+                    return Poll::Pending;
+                };
+                // The future isn't polled again after it's ready, so `f` is always there
+                let Some(f) = f.take() else {
+                    return Poll::Pending;
+                };
+                let result = f(event);
+                state.consume(self.id);
+                Poll::Ready(result)
+            })
+        })
+        .await
+    }
+
+    /// Read the next event if there's one, without waiting
+    pub fn try_next_event(&mut self) -> Option<T> {
+        self.ring.state.lock(|state| {
+            let mut state = state.borrow_mut();
+            let event = state.peek(self.id)?.clone();
+            state.consume(self.id);
+            Some(event)
+        })
+    }
+}
+
+impl<T: Clone, const CAP: usize, const SUBS: usize> EventSubscriber for RingSubscriber<'_, T, CAP, SUBS> {
+    type Event = T;
+    async fn next_event(&mut self) -> Self::Event {
+        self.next_event_with(T::clone).await
+    }
+}
+
+impl<T, const CAP: usize, const SUBS: usize> Drop for RingSubscriber<'_, T, CAP, SUBS> {
+    fn drop(&mut self) {
+        self.ring.state.lock(|state| {
+            let mut state = state.borrow_mut();
+            state.subscribers[self.id].priority = None;
+            state.subscribers[self.id].unread = 0;
+            // The publisher might wait for this subscriber
+            state.publisher_waker.wake();
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use embassy_futures::block_on;
+    use embassy_futures::select::{Either, select};
+
+    use super::*;
+
+    #[test]
+    fn test_broadcast_by_reference() {
+        let ring: EventRing<u32, 4, 2> = EventRing::new();
+        let mut a = ring.subscriber(SubscriberPriority::Lossless).unwrap();
+        let mut b = ring.subscriber(SubscriberPriority::BestEffort).unwrap();
+        assert!(ring.subscriber(SubscriberPriority::BestEffort).is_none());
+
+        ring.publish_immediate(1);
+        ring.publish_immediate(2);
+        assert_eq!(block_on(a.next_event_with(|e| *e * 10)), 10);
+        assert_eq!(block_on(a.next_event()), 2);
+        assert_eq!(b.try_next_event(), Some(1));
+        assert_eq!(b.try_next_event(), Some(2));
+        assert_eq!(b.try_next_event(), None);
+        assert_eq!(
+            ring.stats(),
+            RingStats {
+                published: 2,
+                high_water: 2,
+                overruns: 0
+            }
+        );
+
+        // The slot is released when the subscriber is dropped
+        drop(b);
+        assert!(ring.subscriber(SubscriberPriority::BestEffort).is_some());
+    }
+
+    #[test]
+    fn test_best_effort_overrun() {
+        let ring: EventRing<u32, 4, 1> = EventRing::new();
+        let mut sub = ring.subscriber(SubscriberPriority::BestEffort).unwrap();
+        for event in 0..6 {
+            block_on(ring.publish(event));
+        }
+        // The oldest events are skipped, the publisher isn't blocked by a best-effort subscriber
+        for event in 2..6 {
+            assert_eq!(sub.try_next_event(), Some(event));
+        }
+        assert_eq!(ring.stats().overruns, 2);
+        assert_eq!(ring.stats().high_water, 4);
+    }
+
+    #[test]
+    fn test_lossless_backpressure() {
+        let ring: EventRing<u32, 2, 2> = EventRing::new();
+        let mut lossless = ring.subscriber(SubscriberPriority::Lossless).unwrap();
+        let _best_effort = ring.subscriber(SubscriberPriority::BestEffort).unwrap();
+        block_on(ring.publish(0));
+        block_on(ring.publish(1));
+
+        // The ring is full for the lossless subscriber, publishing waits until it reads an event
+        block_on(async {
+            match select(ring.publish(2), lossless.next_event()).await {
+                Either::First(_) => panic!("Publisher should wait for the lossless subscriber"),
+                Either::Second(event) => assert_eq!(event, 0),
+            }
+        });
+        block_on(ring.publish(2));
+        assert_eq!(lossless.try_next_event(), Some(1));
+        assert_eq!(lossless.try_next_event(), Some(2));
+        assert_eq!(ring.stats().overruns, 1);
+    }
+}
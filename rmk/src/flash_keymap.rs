@@ -0,0 +1,118 @@
+//! Flash-resident keymap with a RAM overlay for the edited keys.
+//!
+//! The layer tables are read from an image in memory-mapped flash, usually a `static` initialized by the
+//! `const fn get_default_keymap()` which `rmk-macro` generates, so they don't take RAM. Keys edited by Vial, or read
+//! from the keymap snapshot in the storage, are kept in a bounded overlay which only holds the keys that differ from
+//! the image. The RAM used by the layers is `overlay.len() * size_of::<(u16, KeyAction)>()`, no matter how many
+//! layers there are.
+//!
+//! The edits are saved to the storage as usual, the storage journal is compacted into a new snapshot on commit.
+use rmk_types::action::KeyAction;
+
+use crate::keymap::KeyTable;
+
+/// A keymap whose layers are read from an image in flash
+pub struct FlashKeymap<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize> {
+    /// Layer tables in flash
+    image: &'a [[[KeyAction; COL]; ROW]; NUM_LAYER],
+    /// Edited keys sorted by key index, only the first `len` entries are used
+    overlay: &'a mut [(u16, KeyAction)],
+    len: usize,
+}
+
+impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize> FlashKeymap<'a, ROW, COL, NUM_LAYER> {
+    /// Create a keymap from the image, at most `overlay.len()` keys can be changed
+    pub fn new(image: &'a [[[KeyAction; COL]; ROW]; NUM_LAYER], overlay: &'a mut [(u16, KeyAction)]) -> Self {
+        assert!(
+            ROW * COL * NUM_LAYER <= u16::MAX as usize + 1,
+            "Flash-resident keymap supports at most 65536 keys"
+        );
+        Self { image, overlay, len: 0 }
+    }
+
+    /// Number of keys which differ from the image
+    pub fn overlay_len(&self) -> usize {
+        self.len
+    }
+
+    /// Maximum number of keys which can differ from the image
+    pub fn overlay_capacity(&self) -> usize {
+        self.overlay.len()
+    }
+
+    /// Position of the key in the overlay, or the position where it should be inserted
+    fn find(&self, idx: usize) -> Result<usize, usize> {
+        self.overlay[..self.len].binary_search_by_key(&(idx as u16), |(i, _)| *i)
+    }
+}
+
+impl<const ROW: usize, const COL: usize, const NUM_LAYER: usize> KeyTable for FlashKeymap<'_, ROW, COL, NUM_LAYER> {
+    fn key_count(&self) -> usize {
+        ROW * COL * NUM_LAYER
+    }
+
+    fn key(&self, idx: usize) -> KeyAction {
+        match self.find(idx) {
+            Ok(pos) => self.overlay[pos].1,
+            Err(_) => self.image.key(idx),
+        }
+    }
+
+    /// Set the key in the overlay, a key which is set back to the image's action leaves the overlay.
+    ///
+    /// Returns an error if the overlay is full.
+    fn set_key(&mut self, idx: usize, action: KeyAction) -> Result<(), ()> {
+        let in_image = self.image.key(idx) == action;
+        match self.find(idx) {
+            Ok(pos) if in_image => {
+                self.overlay.copy_within(pos + 1..self.len, pos);
+                self.len -= 1;
+            }
+            Ok(pos) => self.overlay[pos].1 = action,
+            Err(_) if in_image => {}
+            Err(_) if self.len == self.overlay.len() => return Err(()),
+            Err(pos) => {
+                self.overlay.copy_within(pos..self.len, pos + 1);
+                self.overlay[pos] = (idx as u16, action);
+                self.len += 1;
+            }
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{a, k};
+
+    static IMAGE: [[[KeyAction; 2]; 2]; 2] = [[[k!(A), k!(B)], [k!(C), k!(D)]], [[a!(Transparent); 2]; 2]];
+
+    #[test]
+    fn test_overlay() {
+        let mut overlay = [(0, KeyAction::No); 2];
+        let mut keymap = FlashKeymap::new(&IMAGE, &mut overlay);
+        assert_eq!(keymap.key_count(), 8);
+        assert_eq!(keymap.key(3), k!(D));
+
+        // Edits are kept sorted in the overlay
+        assert!(keymap.set_key(6, k!(X)).is_ok());
+        assert!(keymap.set_key(1, k!(Y)).is_ok());
+        assert_eq!(keymap.key(1), k!(Y));
+        assert_eq!(keymap.key(6), k!(X));
+        assert_eq!(keymap.key(5), a!(Transparent));
+        assert_eq!(keymap.overlay_len(), 2);
+
+        // A key which is the same as the image doesn't take space
+        assert!(keymap.set_key(0, k!(A)).is_ok());
+        assert!(keymap.set_key(2, k!(Z)).is_err());
+        assert_eq!(keymap.key(2), k!(C));
+
+        // Setting a key back to the image frees its entry
+        assert!(keymap.set_key(1, k!(B)).is_ok());
+        assert_eq!(keymap.overlay_len(), 1);
+        assert!(keymap.set_key(2, k!(Z)).is_ok());
+        assert_eq!(keymap.key(2), k!(Z));
+        assert_eq!(keymap.key(6), k!(X));
+    }
+}
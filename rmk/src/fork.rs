@@ -1,5 +1,6 @@
 use core::ops::{BitAnd, BitOr, Not};
 
+use heapless::Vec;
 use postcard::experimental::max_size::MaxSize;
 use rmk_types::action::KeyAction;
 use rmk_types::led_indicator::LedIndicator;
@@ -7,6 +8,12 @@ use rmk_types::modifier::ModifierCombination;
 use rmk_types::mouse_button::MouseButtons;
 use serde::{Deserialize, Serialize};
 
+use crate::FORK_MAX_NUM;
+use crate::combo::key_action_hash;
+
+/// Number of words of `ForkMask`
+const FORK_MASK_WORDS: usize = FORK_MAX_NUM.div_ceil(32);
+
 #[derive(Debug, Copy, Clone, Eq, PartialEq, Default, Serialize, Deserialize, MaxSize)]
 #[cfg_attr(feature = "defmt", derive(defmt::Format))]
 pub struct StateBits {
@@ -134,3 +141,117 @@ pub struct ActiveFork {
     pub(crate) replacement: KeyAction, // the final replacement decision of the full fork chain
     pub(crate) suppress: ModifierCombination, // aggregate the chain's match_any modifiers here
 }
+
+/// Bit set of fork indices
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub(crate) struct ForkMask([u32; FORK_MASK_WORDS]);
+
+impl ForkMask {
+    pub(crate) fn set(&mut self, idx: usize) {
+        self.0[idx / 32] |= 1 << (idx % 32);
+    }
+
+    pub(crate) fn contains(&self, idx: usize) -> bool {
+        self.0.get(idx / 32).is_some_and(|word| word & (1 << (idx % 32)) != 0)
+    }
+
+    pub(crate) fn is_empty(&self) -> bool {
+        self.0.iter().all(|word| *word == 0)
+    }
+
+    /// Remove the lowest index from the mask and return it
+    pub(crate) fn pop_first(&mut self) -> Option<usize> {
+        let (i, word) = self.0.iter_mut().enumerate().find(|(_, word)| **word != 0)?;
+        let bit = word.trailing_zeros() as usize;
+        *word &= *word - 1;
+        Some(i * 32 + bit)
+    }
+}
+
+/// Index from key action to the forks which are triggered by it.
+///
+/// Without the index, every key event has to compare the key action against the triggers of all forks, including the
+/// empty ones which fill up the fork list. The index must be rebuilt whenever the forks are changed.
+#[derive(Clone, Debug, Default)]
+pub(crate) struct ForkIndex {
+    /// Distinct triggers of all forks with their hashes, sorted by hash, and the forks which are triggered by each of them
+    entries: Vec<(u32, KeyAction, ForkMask), FORK_MAX_NUM>,
+}
+
+impl ForkIndex {
+    /// Build the index from forks
+    pub(crate) fn new(forks: &[Fork]) -> Self {
+        let mut index = Self::default();
+        // Empty forks are triggered by `KeyAction::No`, which outputs nothing anyway
+        for (i, fork) in forks.iter().enumerate().filter(|(_, f)| f.trigger != KeyAction::No) {
+            match index.entries.iter_mut().find(|(_, a, _)| *a == fork.trigger) {
+                Some((_, _, mask)) => mask.set(i),
+                None => {
+                    let mut mask = ForkMask::default();
+                    mask.set(i);
+                    // The capacity covers the triggers of all forks
+                    let _ = index.entries.push((key_action_hash(&fork.trigger), fork.trigger, mask));
+                }
+            }
+        }
+        index.entries.sort_unstable_by_key(|(hash, _, _)| *hash);
+        index
+    }
+
+    /// Get the forks which are triggered by the key action
+    pub(crate) fn candidates(&self, key_action: &KeyAction) -> ForkMask {
+        if self.entries.is_empty() {
+            return ForkMask::default();
+        }
+        let hash = key_action_hash(key_action);
+        let start = self.entries.partition_point(|(h, _, _)| *h < hash);
+        self.entries[start..]
+            .iter()
+            .take_while(|(h, _, _)| *h == hash)
+            .find(|(_, a, _)| a == key_action)
+            .map(|(_, _, mask)| *mask)
+            .unwrap_or_default()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::k;
+
+    #[test]
+    fn test_fork_index() {
+        let mut forks = [Fork::empty(); 3];
+        forks[0] = Fork::new(
+            k!(A),
+            k!(A),
+            k!(B),
+            StateBits::default(),
+            StateBits::default(),
+            ModifierCombination::default(),
+            false,
+        );
+        forks[2] = Fork::new(
+            k!(A),
+            k!(C),
+            k!(D),
+            StateBits::default(),
+            StateBits::default(),
+            ModifierCombination::default(),
+            false,
+        );
+        let index = ForkIndex::new(&forks);
+
+        let a = index.candidates(&k!(A));
+        assert!(a.contains(0) && !a.contains(1) && a.contains(2));
+        assert!(index.candidates(&k!(B)).is_empty());
+        // Empty forks aren't indexed
+        assert!(index.candidates(&KeyAction::No).is_empty());
+
+        let mut forks = a;
+        assert_eq!(forks.pop_first(), Some(0));
+        assert_eq!(forks.pop_first(), Some(2));
+        assert_eq!(forks.pop_first(), None);
+    }
+}
@@ -1,5 +1,8 @@
 /// Traits and types for HID message reporting and listening.
-use core::{future::Future, sync::atomic::Ordering};
+use core::future::Future;
+#[cfg(feature = "nkro")]
+use core::sync::atomic::AtomicBool;
+use core::sync::atomic::Ordering;
 
 use embassy_usb::class::hid::ReadError;
 use embassy_usb::driver::EndpointError;
@@ -8,15 +11,19 @@ use usbd_hid::descriptor::{AsInputReport, MediaKeyboardReport, MouseReport, Syst
 
 use crate::CONNECTION_STATE;
 use crate::channel::KEYBOARD_REPORT_CHANNEL;
-use crate::descriptor::KeyboardReport;
+use crate::descriptor::{KeyboardReport, NkroKeyboardReport};
 use crate::state::ConnectionState;
 #[cfg(not(feature = "_no_usb"))]
 use crate::usb::USB_REMOTE_WAKEUP;
 
+pub mod coalescer;
+
 #[derive(Serialize, Debug, Clone)]
 pub enum Report {
     /// Normal keyboard hid report
     KeyboardReport(KeyboardReport),
+    /// NKRO keyboard hid report, writers fall back to `KeyboardReport` if the host doesn't use NKRO
+    NkroReport(NkroKeyboardReport),
     /// Mouse hid report
     MouseReport(MouseReport),
     /// Media keyboard report
@@ -27,6 +34,13 @@ pub enum Report {
 
 impl AsInputReport for Report {}
 
+/// Whether the current host accepts the NKRO keyboard report.
+///
+/// Set by the transport when the host talks to the NKRO interface, cleared when the connection is
+/// reset, so that the writers downgrade `Report::NkroReport` to the boot keyboard report.
+#[cfg(feature = "nkro")]
+pub(crate) static NKRO_ACTIVE: AtomicBool = AtomicBool::new(false);
+
 #[derive(PartialEq, Debug)]
 #[cfg_attr(feature = "defmt", derive(defmt::Format))]
 pub enum HidError {
@@ -0,0 +1,244 @@
+//! Report coalescing stage between `KEYBOARD_REPORT_CHANNEL` and the hid writers.
+//!
+//! Only the reports which are already queued in the channel are coalesced, so no latency is added:
+//! - consecutive mouse reports with the same buttons are merged into one, by summing the deltas
+//! - keyboard reports which are identical to the last written keyboard report are dropped
+//!
+//! The writer records each written report by [`ReportCoalescer::report_written`]. A keyboard report which is dropped
+//! while disconnected or fails to be written isn't the host's state, so the next identical report is still sent.
+//!
+//! Button changes and keyboard reports are never merged or reordered, so the press/release order is kept.
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use usbd_hid::descriptor::MouseReport;
+
+use crate::channel::KEYBOARD_REPORT_CHANNEL;
+use crate::descriptor::{KeyboardReport, NkroKeyboardReport};
+use crate::hid::{HidError, Report};
+
+/// Number of keyboard reports dropped because they were identical to the last written one
+static DROPPED_REPORTS: AtomicU32 = AtomicU32::new(0);
+/// Number of mouse reports merged into a previous mouse report
+static MERGED_REPORTS: AtomicU32 = AtomicU32::new(0);
+
+/// Number of keyboard reports dropped by the coalescer.
+pub fn dropped_reports() -> u32 {
+    DROPPED_REPORTS.load(Ordering::Relaxed)
+}
+
+/// Number of mouse reports merged by the coalescer.
+pub fn merged_reports() -> u32 {
+    MERGED_REPORTS.load(Ordering::Relaxed)
+}
+
+// Only the HID writer which owns the coalescer updates the counters
+fn increase(counter: &AtomicU32) {
+    counter.store(counter.load(Ordering::Relaxed).wrapping_add(1), Ordering::Relaxed);
+}
+
+/// The last written keyboard state
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum KeyboardState {
+    Boot { modifier: u8, keycodes: [u8; 6] },
+    Nkro(NkroKeyboardReport),
+}
+
+impl KeyboardState {
+    fn from_report(report: &Report) -> Option<Self> {
+        match report {
+            Report::KeyboardReport(KeyboardReport { modifier, keycodes, .. }) => Some(Self::Boot {
+                modifier: *modifier,
+                keycodes: *keycodes,
+            }),
+            Report::NkroReport(nkro_report) => Some(Self::Nkro(*nkro_report)),
+            _ => None,
+        }
+    }
+}
+
+#[derive(Default)]
+pub(crate) struct ReportCoalescer {
+    /// The report that is received from the channel but can't be merged into the previous one
+    pending: Option<Report>,
+    /// The last keyboard state that is written to the host
+    last_keyboard: Option<KeyboardState>,
+}
+
+impl ReportCoalescer {
+    pub(crate) fn new() -> Self {
+        Self::default()
+    }
+
+    /// Get the next report to be sent.
+    pub(crate) async fn next_report(&mut self) -> Report {
+        loop {
+            let report = match self.pending.take() {
+                Some(report) => report,
+                None => KEYBOARD_REPORT_CHANNEL.receive().await,
+            };
+            if let Some(report) = self.process(report) {
+                return report;
+            }
+        }
+    }
+
+    /// Get the next report if there is one queued, without waiting
+    pub(crate) fn try_next_report(&mut self) -> Option<Report> {
+        loop {
+            let report = match self.pending.take() {
+                Some(report) => report,
+                None => KEYBOARD_REPORT_CHANNEL.try_receive().ok()?,
+            };
+            if let Some(report) = self.process(report) {
+                return Some(report);
+            }
+        }
+    }
+
+    /// Record the result of writing a report.
+    ///
+    /// If the write failed, the state of the host is unknown, so the next keyboard report is always sent.
+    pub(crate) fn report_written(&mut self, report: &Report, result: &Result<usize, HidError>) {
+        match result {
+            Ok(_) => {
+                if let Some(state) = KeyboardState::from_report(report) {
+                    self.last_keyboard = Some(state);
+                }
+            }
+            Err(_) => self.last_keyboard = None,
+        }
+    }
+
+    /// Coalesce the received report with the queued ones, return `None` if the report should be dropped.
+    fn process(&mut self, report: Report) -> Option<Report> {
+        match report {
+            Report::MouseReport(mut mouse_report) => {
+                while let Ok(next) = KEYBOARD_REPORT_CHANNEL.try_receive() {
+                    match next {
+                        Report::MouseReport(next_mouse) if merge_mouse_report(&mut mouse_report, &next_mouse) => {
+                            increase(&MERGED_REPORTS);
+                        }
+                        other => {
+                            self.pending = Some(other);
+                            break;
+                        }
+                    }
+                }
+                Some(Report::MouseReport(mouse_report))
+            }
+            Report::KeyboardReport(_) | Report::NkroReport(_) => {
+                if KeyboardState::from_report(&report) == self.last_keyboard {
+                    increase(&DROPPED_REPORTS);
+                    #[cfg(feature = "latency_trace")]
+                    crate::latency_trace::report_dropped(&report);
+                    None
+                } else {
+                    Some(report)
+                }
+            }
+            other => Some(other),
+        }
+    }
+}
+
+/// Merge `next` into `current` if they have the same buttons and the summed deltas don't overflow.
+fn merge_mouse_report(current: &mut MouseReport, next: &MouseReport) -> bool {
+    if current.buttons != next.buttons {
+        return false;
+    }
+    match (
+        current.x.checked_add(next.x),
+        current.y.checked_add(next.y),
+        current.wheel.checked_add(next.wheel),
+        current.pan.checked_add(next.pan),
+    ) {
+        (Some(x), Some(y), Some(wheel), Some(pan)) => {
+            current.x = x;
+            current.y = y;
+            current.wheel = wheel;
+            current.pan = pan;
+            true
+        }
+        _ => false,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use usbd_hid::descriptor::SystemControlReport;
+
+    use super::*;
+
+    fn keyboard(keycode: u8) -> Report {
+        Report::KeyboardReport(KeyboardReport {
+            keycodes: [keycode, 0, 0, 0, 0, 0],
+            ..Default::default()
+        })
+    }
+
+    #[test]
+    fn test_merge_mouse_report() {
+        let mut current = MouseReport {
+            buttons: 0,
+            x: 100,
+            y: -3,
+            wheel: 0,
+            pan: 0,
+        };
+        let next = MouseReport {
+            buttons: 0,
+            x: 20,
+            y: -4,
+            wheel: 1,
+            pan: 0,
+        };
+        assert!(merge_mouse_report(&mut current, &next));
+        assert_eq!((current.x, current.y, current.wheel), (120, -7, 1));
+
+        // Overflow
+        assert!(!merge_mouse_report(&mut current, &next));
+        assert_eq!(current.x, 120);
+
+        // Button changed
+        let pressed = MouseReport { buttons: 1, ..next };
+        current.x = 0;
+        assert!(!merge_mouse_report(&mut current, &pressed));
+    }
+
+    #[test]
+    fn test_drop_duplicated_keyboard_report() {
+        let mut coalescer = ReportCoalescer::new();
+        let dropped = dropped_reports();
+        assert!(coalescer.process(keyboard(4)).is_some());
+        coalescer.report_written(&keyboard(4), &Ok(8));
+        assert!(coalescer.process(keyboard(4)).is_none());
+        // Other reports don't reset the last keyboard state
+        let system_report = Report::SystemControlReport(SystemControlReport { usage_id: 0 });
+        assert!(coalescer.process(system_report.clone()).is_some());
+        coalescer.report_written(&system_report, &Ok(1));
+        assert!(coalescer.process(keyboard(4)).is_none());
+        assert!(coalescer.process(keyboard(0)).is_some());
+        assert!(
+            coalescer
+                .process(Report::NkroReport(NkroKeyboardReport::default()))
+                .is_some()
+        );
+        assert!(dropped_reports() - dropped >= 2);
+    }
+
+    #[test]
+    fn test_keyboard_report_not_written() {
+        let mut coalescer = ReportCoalescer::new();
+        coalescer.report_written(&keyboard(4), &Ok(8));
+        // The report is dropped while disconnected, it's not recorded as written
+        assert!(coalescer.process(keyboard(0)).is_some());
+        assert!(coalescer.process(keyboard(0)).is_some());
+        coalescer.report_written(&keyboard(0), &Ok(8));
+        assert!(coalescer.process(keyboard(0)).is_none());
+
+        // The host state is unknown after a failed write
+        assert!(coalescer.process(keyboard(5)).is_some());
+        coalescer.report_written(&keyboard(5), &Err(HidError::BleError));
+        assert!(coalescer.process(keyboard(0)).is_some());
+    }
+}
@@ -1,15 +1,18 @@
 use embedded_storage_async::nor_flash::NorFlash as AsyncNorFlash;
+use heapless::Vec;
 use postcard::experimental::max_size::MaxSize;
 use rmk_types::action::{EncoderAction, KeyAction};
+use sequential_storage::Error as SSError;
 use sequential_storage::map::{SerializationError, Value};
 use serde::{Deserialize, Serialize};
 
 use crate::combo::{Combo, ComboConfig};
 use crate::fork::Fork;
+use crate::keymap::KeyTable;
 use crate::morse::Morse;
 use crate::storage::{
-    Storage, StorageData, StorageKeys, get_combo_key, get_fork_key, get_morse_key,
-    postcard_error_to_serialization_error, print_storage_error,
+    KEYMAP_SNAPSHOT_KEY, Storage, StorageData, StorageKeys, get_combo_key, get_fork_key, get_morse_key,
+    get_snapshot_chunk_key, postcard_error_to_serialization_error, print_storage_error,
 };
 use crate::{COMBO_MAX_NUM, FORK_MAX_NUM, MACRO_SPACE_SIZE, MORSE_MAX_NUM, ser_storage_variant};
 
@@ -33,6 +36,145 @@ pub(crate) struct EncoderKeymap {
     pub(crate) action: EncoderAction,
 }
 
+/// Version of the keymap snapshot format
+const KEYMAP_SNAPSHOT_VERSION: u8 = 1;
+
+/// Maximum size of the serialized keys in a snapshot chunk, a chunk should fit in the storage buffer
+pub(crate) const SNAPSHOT_CHUNK_SIZE: usize = 224;
+
+/// The keymap is compacted into a new snapshot at boot when more keys than this are changed after the snapshot
+const SNAPSHOT_JOURNAL_LIMIT: usize = 64;
+
+/// Header of the keymap snapshot.
+///
+/// The whole keymap is stored as a few contiguous chunks instead of one record per key. The header is written
+/// after all chunks of the snapshot, so a new snapshot is only used when it's completely written.
+#[derive(Clone, Copy, Debug, Serialize, Deserialize, MaxSize)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub(crate) struct KeymapSnapshotHeader {
+    pub(crate) version: u8,
+    /// Generation of the snapshot, increased by every snapshot
+    pub(crate) generation: u32,
+    /// Number of keys, aka `ROW * COL * NUM_LAYER`
+    pub(crate) keys: u32,
+    /// Number of chunks
+    pub(crate) chunks: u16,
+    /// Sum of the checksums of all chunks
+    pub(crate) checksum: u32,
+}
+
+/// A chunk of the keymap snapshot, which contains consecutive keys ordered by layer, row and col
+#[derive(Clone, Debug)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub(crate) struct KeymapSnapshotChunk {
+    /// Generation of the snapshot which the chunk belongs to
+    pub(crate) generation: u32,
+    /// Index of the first key of the chunk
+    pub(crate) start: u32,
+    /// Number of keys of the chunk
+    pub(crate) count: u16,
+    /// Postcard serialized `KeyAction`s
+    pub(crate) data: Vec<u8, SNAPSHOT_CHUNK_SIZE>,
+}
+
+impl KeymapSnapshotChunk {
+    fn new(generation: u32, start: u32) -> Self {
+        Self {
+            generation,
+            start,
+            count: 0,
+            data: Vec::new(),
+        }
+    }
+
+    /// FNV-1a hash of the chunk, seeded by the first key so that a misplaced chunk is detected
+    pub(crate) fn checksum(&self) -> u32 {
+        let mut hash = 0x811c_9dc5 ^ self.start;
+        for byte in self.data.iter() {
+            hash ^= *byte as u32;
+            hash = hash.wrapping_mul(0x0100_0193);
+        }
+        hash
+    }
+
+    /// Write the keys of the chunk to the keymap
+    pub(crate) fn apply(&self, keymap: &mut impl KeyTable) -> Result<(), SerializationError> {
+        let mut data = &self.data[..];
+        for idx in self.start as usize..self.start as usize + self.count as usize {
+            let (action, rest) = postcard::take_from_bytes(data).map_err(postcard_error_to_serialization_error)?;
+            data = rest;
+            if idx >= keymap.key_count() {
+                return Err(SerializationError::InvalidFormat);
+            }
+            if keymap.set_key(idx, action).is_err() {
+                error!("Keymap overlay is full, stored key {} is not applied", idx);
+            }
+        }
+        Ok(())
+    }
+
+    pub(crate) fn serialize_into(&self, buffer: &mut [u8]) -> Result<usize, SerializationError> {
+        buffer[0] = StorageKeys::KeymapSnapshotChunk as u8;
+        let len = postcard::to_slice(
+            &(self.generation, self.start, self.count, self.data.len() as u16),
+            &mut buffer[1..],
+        )
+        .map_err(postcard_error_to_serialization_error)?
+        .len();
+        let data_start = 1 + len;
+        if buffer.len() < data_start + self.data.len() {
+            return Err(SerializationError::BufferTooSmall);
+        }
+        buffer[data_start..data_start + self.data.len()].copy_from_slice(&self.data);
+        Ok(data_start + self.data.len())
+    }
+
+    pub(crate) fn deserialize_from(buffer: &[u8]) -> Result<(Self, usize), SerializationError> {
+        let ((generation, start, count, len), rest): ((u32, u32, u16, u16), _) =
+            postcard::take_from_bytes(&buffer[1..]).map_err(postcard_error_to_serialization_error)?;
+        let data = rest
+            .get(..len as usize)
+            .and_then(|d| Vec::from_slice(d).ok())
+            .ok_or(SerializationError::InvalidFormat)?;
+        let size = buffer.len() - rest.len() + len as usize;
+        Ok((
+            Self {
+                generation,
+                start,
+                count,
+                data,
+            },
+            size,
+        ))
+    }
+}
+
+/// Pack the keys from the key index `start` into a snapshot chunk, until the chunk is full or all keys are packed
+pub(crate) fn build_snapshot_chunk(
+    keymap: &impl KeyTable,
+    generation: u32,
+    start: usize,
+) -> Result<KeymapSnapshotChunk, postcard::Error> {
+    let mut chunk = KeymapSnapshotChunk::new(generation, start as u32);
+    let mut action_buffer = [0u8; KeyAction::POSTCARD_MAX_SIZE];
+    for idx in start..keymap.key_count() {
+        let bytes = postcard::to_slice(&keymap.key(idx), &mut action_buffer)?;
+        if chunk.data.extend_from_slice(bytes).is_err() {
+            break;
+        }
+        chunk.count += 1;
+    }
+    Ok(chunk)
+}
+
+/// A key changed after the keymap snapshot of `generation` is written
+#[derive(Clone, Copy, Debug, Serialize, Deserialize, MaxSize)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub(crate) struct KeymapJournal {
+    pub(crate) generation: u32,
+    pub(crate) key: KeymapKey,
+}
+
 /// Keymap data that can be updated by the host tools like Vial.
 #[derive(Clone, Debug)]
 #[cfg_attr(feature = "defmt", derive(defmt::Format))]
@@ -151,31 +293,65 @@ impl Value<'_> for KeymapData {
 impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_ENCODER: usize>
     Storage<F, ROW, COL, NUM_LAYER, NUM_ENCODER>
 {
+    /// Read the keymap snapshot and the keys changed after it, aka the journal.
+    ///
+    /// Storage of an older firmware has one record per key, it's read and migrated to a snapshot. A new snapshot is
+    /// also written when the journal grows too long.
     pub(crate) async fn read_keymap(
         &mut self,
-        keymap: &mut [[[KeyAction; COL]; ROW]; NUM_LAYER],
+        keymap: &mut impl KeyTable,
         encoder_map: &mut Option<&mut [[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
     ) -> Result<(), ()> {
-        // Use fetch_all_items to speed up the keymap reading
+        let header = match self
+            .flash
+            .fetch_item(&mut self.buffer, &KEYMAP_SNAPSHOT_KEY)
+            .await
+            .map_err(|e| print_storage_error::<F>(e))?
+        {
+            Some(StorageData::KeymapSnapshot(header))
+                if header.version == KEYMAP_SNAPSHOT_VERSION && header.keys == (ROW * COL * NUM_LAYER) as u32 =>
+            {
+                Some(header)
+            }
+            _ => None,
+        };
+        // Generation 0 means there's no snapshot
+        let generation = header.map_or(0, |h| h.generation);
+        let mut chunks = 0u16;
+        let mut checksum = 0u32;
+
+        // Use fetch_all_items to speed up the keymap reading.
+        // The first pass reads the snapshot, or the per-key records of older storage, and the encoders
         let mut key_iterator = self
             .flash
             .fetch_all_items(&mut self.buffer)
             .await
             .map_err(|e| print_storage_error::<F>(e))?;
-
-        // Read all keymap keys and encoder configs
-        while let Some((_key, item)) = key_iterator
+        // Chunks after the last one of the header are left by an interrupted snapshot of the same generation
+        let chunk_keys = header.map_or(0..0, |h| {
+            get_snapshot_chunk_key(generation, 0)..get_snapshot_chunk_key(generation, h.chunks)
+        });
+        while let Some((key, item)) = key_iterator
             .next::<StorageData>(&mut self.buffer)
             .await
             .map_err(|e| print_storage_error::<F>(e))?
         {
             match item {
-                StorageData::VialData(KeymapData::KeymapKey(key)) => {
+                StorageData::KeymapSnapshotChunk(chunk)
+                    if chunk_keys.contains(&key) && chunk.generation == generation =>
+                {
+                    chunks += 1;
+                    checksum = checksum.wrapping_add(chunk.checksum());
+                    if chunk.apply(keymap).is_err() {
+                        error!("Invalid keymap snapshot chunk at key {}", chunk.start);
+                    }
+                }
+                StorageData::VialData(KeymapData::KeymapKey(key)) if header.is_none() => {
                     let layer = key.layer as usize;
                     let row = key.row as usize;
                     let col = key.col as usize;
                     if layer < NUM_LAYER && row < ROW && col < COL {
-                        keymap[layer][row][col] = key.action;
+                        Self::apply_key(keymap, (layer * ROW + row) * COL + col, key.action);
                     }
                 }
                 StorageData::VialData(KeymapData::Encoder(encoder)) => {
@@ -190,10 +366,133 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
                 _ => continue,
             }
         }
+        drop(key_iterator);
+        let snapshot_valid = header.is_some_and(|h| h.chunks == chunks && h.checksum == checksum);
+        if header.is_some() && !snapshot_valid {
+            error!(
+                "Keymap snapshot {} is corrupted, {} chunks are read",
+                generation, chunks
+            );
+        }
+
+        // The second pass applies the keys changed after the snapshot
+        let mut journal = 0;
+        let mut key_iterator = self
+            .flash
+            .fetch_all_items(&mut self.buffer)
+            .await
+            .map_err(|e| print_storage_error::<F>(e))?;
+        while let Some((_key, item)) = key_iterator
+            .next::<StorageData>(&mut self.buffer)
+            .await
+            .map_err(|e| print_storage_error::<F>(e))?
+        {
+            if let StorageData::KeymapJournal(KeymapJournal { generation: g, key }) = item
+                && g == generation
+            {
+                journal += 1;
+                let layer = key.layer as usize;
+                let row = key.row as usize;
+                let col = key.col as usize;
+                if layer < NUM_LAYER && row < ROW && col < COL {
+                    Self::apply_key(keymap, (layer * ROW + row) * COL + col, key.action);
+                }
+            }
+        }
+        drop(key_iterator);
+        self.snapshot_generation = generation;
+
+        if !snapshot_valid || journal > SNAPSHOT_JOURNAL_LIMIT {
+            info!(
+                "Writing keymap snapshot, {} keys are changed after the last one",
+                journal
+            );
+            // The keymap is already read, failing to write a new snapshot shouldn't clear the storage
+            if let Err(e) = self.compact_keymap(&*keymap).await {
+                print_storage_error::<F>(e);
+            }
+        }
 
         Ok(())
     }
 
+    /// Apply a stored key to the keymap
+    fn apply_key(keymap: &mut impl KeyTable, idx: usize, action: KeyAction) {
+        if keymap.set_key(idx, action).is_err() {
+            error!("Keymap overlay is full, stored key {} is not applied", idx);
+        }
+    }
+
+    /// Write the keymap as a new snapshot, the journal of the previous snapshot is discarded.
+    pub(crate) async fn compact_keymap(&mut self, keymap: &impl KeyTable) -> Result<(), SSError<F::Error>> {
+        let generation = self.next_snapshot_generation().await?;
+        self.write_keymap_snapshot(keymap, generation).await
+    }
+
+    /// Generation of the next keymap snapshot.
+    ///
+    /// It's derived from the current header only, so the new chunks are always written to the other bank. Chunks of
+    /// an interrupted snapshot are in that bank too, and they're overwritten by the next snapshot.
+    pub(crate) async fn next_snapshot_generation(&mut self) -> Result<u32, SSError<F::Error>> {
+        let generation = match self.flash.fetch_item(&mut self.buffer, &KEYMAP_SNAPSHOT_KEY).await? {
+            Some(StorageData::KeymapSnapshot(header)) => header.generation,
+            _ => 0,
+        };
+        Ok(generation + 1)
+    }
+
+    /// Write the keymap snapshot of the given generation
+    pub(crate) async fn write_keymap_snapshot(
+        &mut self,
+        keymap: &impl KeyTable,
+        generation: u32,
+    ) -> Result<(), SSError<F::Error>> {
+        let mut start = 0;
+        let mut chunks = 0u16;
+        let mut checksum = 0u32;
+        while start < ROW * COL * NUM_LAYER {
+            let chunk = build_snapshot_chunk(keymap, generation, start)
+                .map_err(|e| SSError::SerializationError(postcard_error_to_serialization_error(e)))?;
+            start += chunk.count as usize;
+            checksum = checksum.wrapping_add(chunk.checksum());
+            self.flash
+                .store_item(
+                    &mut self.buffer,
+                    &get_snapshot_chunk_key(generation, chunks),
+                    &StorageData::KeymapSnapshotChunk(chunk),
+                )
+                .await?;
+            chunks += 1;
+        }
+        self.write_snapshot_header(generation, chunks, checksum).await
+    }
+
+    /// Write the header of a snapshot after all its chunks are written, which makes it the current snapshot
+    pub(crate) async fn write_snapshot_header(
+        &mut self,
+        generation: u32,
+        chunks: u16,
+        checksum: u32,
+    ) -> Result<(), SSError<F::Error>> {
+        let header = KeymapSnapshotHeader {
+            version: KEYMAP_SNAPSHOT_VERSION,
+            generation,
+            keys: (ROW * COL * NUM_LAYER) as u32,
+            chunks,
+            checksum,
+        };
+        self.flash
+            .store_item(
+                &mut self.buffer,
+                &KEYMAP_SNAPSHOT_KEY,
+                &StorageData::KeymapSnapshot(header),
+            )
+            .await?;
+        debug!("Keymap snapshot {} is written in {} chunks", generation, chunks);
+        self.snapshot_generation = generation;
+        Ok(())
+    }
+
     pub(crate) async fn read_macro_cache(&mut self, macro_cache: &mut [u8]) -> Result<(), ()> {
         let read_data = self
             .flash
@@ -387,4 +686,86 @@ mod tests {
             _ => panic!("Expected MorseData"),
         }
     }
+
+    #[test]
+    fn test_snapshot_chunk() {
+        let a = KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::A)));
+        let b = KeyAction::TapHold(
+            Action::Key(KeyCode::Hid(HidKeyCode::B)),
+            Action::LayerOn(1),
+            MorseProfile::const_default(),
+        );
+        let mut chunk = KeymapSnapshotChunk::new(3, 2);
+        let mut action_buffer = [0u8; KeyAction::POSTCARD_MAX_SIZE];
+        for action in [a, b, KeyAction::Transparent] {
+            let bytes = postcard::to_slice(&action, &mut action_buffer).unwrap();
+            chunk.data.extend_from_slice(bytes).unwrap();
+            chunk.count += 1;
+        }
+
+        // Serialization round trip
+        let mut buffer = [0u8; 256];
+        let storage_data = StorageData::KeymapSnapshotChunk(chunk.clone());
+        let serialized_size = Value::serialize_into(&storage_data, &mut buffer).unwrap();
+        let (deserialized, size) = StorageData::deserialize_from(&buffer[..serialized_size]).unwrap();
+        assert_eq!(size, serialized_size);
+        let StorageData::KeymapSnapshotChunk(deserialized) = deserialized else {
+            panic!("Expected KeymapSnapshotChunk");
+        };
+        assert_eq!(
+            (deserialized.generation, deserialized.start, deserialized.count),
+            (3, 2, 3)
+        );
+        assert_eq!(deserialized.checksum(), chunk.checksum());
+
+        // The keys are ordered by layer, row and col
+        let mut keymap = [[[KeyAction::No; 2]; 2]; 2];
+        deserialized.apply(&mut keymap).unwrap();
+        assert_eq!(keymap[0][0], [KeyAction::No, KeyAction::No]);
+        assert_eq!(keymap[0][1], [a, b]);
+        assert_eq!(keymap[1][0][0], KeyAction::Transparent);
+        assert_eq!(keymap[1][0][1], KeyAction::No);
+
+        // A chunk doesn't fit in a smaller keymap
+        let mut small = [[[KeyAction::No; 2]; 2]; 1];
+        assert!(deserialized.apply(&mut small).is_err());
+
+        // Misplaced chunk is detected by the checksum
+        let moved = KeymapSnapshotChunk {
+            start: 0,
+            ..chunk.clone()
+        };
+        assert_ne!(moved.checksum(), chunk.checksum());
+    }
+
+    #[test]
+    fn test_build_snapshot_chunk() {
+        let mut keymap = [[[KeyAction::No; 4]; 4]; 8];
+        for (i, action) in keymap.iter_mut().flatten().flatten().enumerate() {
+            *action = KeyAction::TapHold(
+                Action::Key(KeyCode::Hid(HidKeyCode::A)),
+                Action::LayerOn(i as u8),
+                MorseProfile::const_default(),
+            );
+        }
+
+        // The keymap doesn't fit in a chunk, the chunks cover all keys without overlapping
+        let mut restored = [[[KeyAction::No; 4]; 4]; 8];
+        let mut start = 0;
+        let mut chunks = 0;
+        while start < 128 {
+            let chunk = build_snapshot_chunk(&keymap, 1, start).unwrap();
+            assert_eq!(chunk.start as usize, start);
+            assert!(chunk.count > 0);
+            chunk.apply(&mut restored).unwrap();
+            start += chunk.count as usize;
+            chunks += 1;
+        }
+        assert_eq!(start, 128);
+        assert!(chunks > 1);
+        assert_eq!(restored, keymap);
+
+        // No key is left after the last one
+        assert_eq!(build_snapshot_chunk(&keymap, 1, 128).unwrap().count, 0);
+    }
 }
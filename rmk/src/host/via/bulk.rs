@@ -0,0 +1,142 @@
+//! RMK specific bulk keymap transfer.
+//!
+//! A host tool opens a transaction with `Begin`, writes consecutive keys with `Append` and saves them with `Commit`.
+//! The keys are applied to the keymap in RAM immediately, and the whole keymap is saved to storage as one snapshot
+//! when the transaction is committed, instead of a flash write for every key.
+//!
+//! The packets use little endian, like other vial commands:
+//! - request: `[0xFE, 0x40, subcommand, key index (u16), count (u8), keycodes (u16)...]`
+//! - response: `[status, ...]`, 0 for success. The keycodes of `Read` are at the same offset as the request.
+use core::cell::RefCell;
+
+use byteorder::{ByteOrder, LittleEndian};
+use rmk_types::protocol::vial::VialBulkKeymap;
+
+use super::VialService;
+use crate::descriptor::ViaReport;
+use crate::hid::{HidReaderTrait, HidWriterTrait};
+#[cfg(feature = "storage")]
+use crate::host::storage::build_snapshot_chunk;
+use crate::host::via::keycode_convert::{from_via_keycode, to_via_keycode};
+use crate::keymap::{KeyMap, KeyTable};
+#[cfg(feature = "storage")]
+use crate::{channel::FLASH_CHANNEL, storage::FlashOperationMessage};
+
+/// Offset of the keycodes in a bulk packet
+const BULK_DATA_OFFSET: usize = 6;
+const BULK_OK: u8 = 0x00;
+const BULK_ERROR: u8 = 0x01;
+
+impl<
+    'a,
+    RW: HidWriterTrait<ReportType = ViaReport> + HidReaderTrait<ReportType = ViaReport>,
+    const ROW: usize,
+    const COL: usize,
+    const NUM_LAYER: usize,
+    const NUM_ENCODER: usize,
+> VialService<'a, RW, ROW, COL, NUM_LAYER, NUM_ENCODER>
+{
+    pub(super) async fn process_bulk_keymap(
+        &mut self,
+        report: &mut ViaReport,
+        keymap: &RefCell<KeyMap<'a, ROW, COL, NUM_LAYER, NUM_ENCODER>>,
+    ) {
+        // The number of keys in a packet grows with the report size
+        let keys_per_packet = (report.output_data.len() - BULK_DATA_OFFSET) / 2;
+        let total = ROW * COL * NUM_LAYER;
+        let start = LittleEndian::read_u16(&report.output_data[3..5]) as usize;
+        let count = report.output_data[5] as usize;
+        let in_range = count <= keys_per_packet && start + count <= total;
+        match VialBulkKeymap::from(report.output_data[2]) {
+            VialBulkKeymap::Begin => {
+                #[cfg(feature = "storage")]
+                {
+                    self.bulk_transaction = true;
+                }
+                report.input_data[0] = BULK_OK;
+                report.input_data[1] = keys_per_packet as u8;
+                LittleEndian::write_u32(&mut report.input_data[2..6], total as u32);
+            }
+            VialBulkKeymap::Append if in_range => {
+                debug!("Bulk keymap append, start: {}, count: {}", start, count);
+                let mut keymap = keymap.borrow_mut();
+                let keycodes = report.output_data[BULK_DATA_OFFSET..].chunks_exact(2).take(count);
+                let mut status = BULK_OK;
+                for (idx, keycode) in (start..).zip(keycodes) {
+                    if keymap
+                        .layers
+                        .set_key(idx, from_via_keycode(LittleEndian::read_u16(keycode)))
+                        .is_err()
+                    {
+                        error!("Keymap overlay is full, key {} is not changed", idx);
+                        status = BULK_ERROR;
+                    }
+                }
+                drop(keymap);
+                // The keymap is rebuilt once the transaction is committed, or the last key is written
+                self.keymap_stale = true;
+                if start + count == total {
+                    self.rebuild_keymap();
+                }
+                #[cfg(feature = "storage")]
+                {
+                    self.keymap_dirty = true;
+                }
+                report.input_data[0] = status;
+            }
+            VialBulkKeymap::Read if in_range => {
+                let keymap = keymap.borrow();
+                let keycodes = report.input_data[BULK_DATA_OFFSET..].chunks_exact_mut(2).take(count);
+                for (idx, keycode) in (start..).zip(keycodes) {
+                    LittleEndian::write_u16(keycode, to_via_keycode(keymap.layers.key(idx)));
+                }
+                report.input_data[0] = BULK_OK;
+            }
+            VialBulkKeymap::Commit => {
+                self.rebuild_keymap();
+                #[cfg(feature = "storage")]
+                self.commit_keymap().await;
+                report.input_data[0] = BULK_OK;
+            }
+            _ => {
+                warn!("Invalid bulk keymap command: {}", report.output_data[2]);
+                report.input_data[0] = BULK_ERROR;
+            }
+        }
+    }
+
+    /// Rebuild the effective layers and the behavior flags after the keys are changed by bulk writes
+    fn rebuild_keymap(&mut self) {
+        if self.keymap_stale {
+            self.keymap_stale = false;
+            let mut keymap = self.keymap.borrow_mut();
+            keymap.update_effective_layers();
+            keymap.update_behavior_flags();
+        }
+    }
+
+    /// Save the whole keymap to storage as one snapshot, the snapshot is sent to the storage task chunk by chunk
+    #[cfg(feature = "storage")]
+    pub(super) async fn commit_keymap(&mut self) {
+        self.rebuild_keymap();
+        self.keymap_dirty = false;
+        self.bulk_transaction = false;
+        let mut start = 0;
+        while start < ROW * COL * NUM_LAYER {
+            // The generation of the snapshot is assigned by the storage task
+            let chunk = match build_snapshot_chunk(&self.keymap.borrow().layers, 0, start) {
+                Ok(chunk) => chunk,
+                Err(_e) => {
+                    error!("Failed to pack the keymap snapshot");
+                    return;
+                }
+            };
+            start += chunk.count as usize;
+            FLASH_CHANNEL
+                .send(FlashOperationMessage::KeymapSnapshotChunk(chunk))
+                .await;
+        }
+        FLASH_CHANNEL.send(FlashOperationMessage::KeymapSnapshotEnd).await;
+        info!("Keymap is committed to storage");
+    }
+}
@@ -1,12 +1,17 @@
 use core::cell::RefCell;
 
-use byteorder::{BigEndian, ByteOrder, LittleEndian};
+use byteorder::{BigEndian, ByteOrder};
 use embassy_time::{Instant, Timer};
 use embassy_usb::class::hid::HidReaderWriter;
 use embassy_usb::driver::Driver;
-use rmk_types::protocol::vial::{VIA_FIRMWARE_VERSION, VIA_PROTOCOL_VERSION, ViaCommand, ViaKeyboardInfo};
+use rmk_types::protocol::vial::{VIA_FIRMWARE_VERSION, VIA_PROTOCOL_VERSION, ViaCommand, ViaKeyboardInfo, VialCommand};
 use ssmarshal::serialize;
 use vial::process_vial;
+#[cfg(feature = "storage")]
+use {
+    crate::{channel::FLASH_CHANNEL, storage::FlashOperationMessage},
+    embassy_time::{Duration, with_timeout},
+};
 
 use crate::config::VialConfig;
 use crate::descriptor::ViaReport;
@@ -15,17 +20,28 @@ use crate::hid::{HidError, HidReaderTrait, HidWriterTrait};
 #[cfg(feature = "storage")]
 use crate::host::storage::{KeymapData, KeymapKey};
 use crate::host::via::keycode_convert::{from_via_keycode, to_via_keycode};
-use crate::keymap::KeyMap;
+use crate::keymap::{KeyMap, KeyTable};
+#[cfg(feature = "latency_trace")]
+use crate::latency_trace::{LatencyStage, latency_stats};
 use crate::state::ConnectionState;
+#[cfg(feature = "task_stats")]
+use crate::task_stats::{TaskId, task_stats};
 use crate::{CONNECTION_STATE, MACRO_SPACE_SIZE, boot};
-#[cfg(feature = "storage")]
-use crate::{channel::FLASH_CHANNEL, storage::FlashOperationMessage};
 
+mod bulk;
 pub(crate) mod keycode_convert;
 mod vial;
 #[cfg(feature = "vial_lock")]
 mod vial_lock;
 
+/// The keymap changed by bulk writes is saved when no packet is received within this period
+#[cfg(feature = "storage")]
+const BULK_COMMIT_QUIET_PERIOD: Duration = Duration::from_millis(500);
+
+/// An open bulk transaction is committed when no packet is received within this period
+#[cfg(feature = "storage")]
+const BULK_TRANSACTION_TIMEOUT: Duration = Duration::from_secs(5);
+
 pub(crate) struct VialService<
     'a,
     RW: HidWriterTrait<ReportType = ViaReport> + HidReaderTrait<ReportType = ViaReport>,
@@ -46,6 +62,17 @@ pub(crate) struct VialService<
 
     // Usb vial hid reader writer
     pub(crate) reader_writer: RW,
+
+    // The keymap in RAM is changed by bulk writes, and it's not saved yet
+    #[cfg(feature = "storage")]
+    keymap_dirty: bool,
+
+    // A bulk keymap transaction is open
+    #[cfg(feature = "storage")]
+    bulk_transaction: bool,
+
+    // Keys are changed by bulk writes, and the effective layers and the behavior flags aren't rebuilt yet
+    keymap_stale: bool,
 }
 
 impl<
@@ -70,10 +97,16 @@ impl<
             #[cfg(feature = "vial_lock")]
             locker: vial_lock::VialLock::<'_, ROW, COL, NUM_LAYER, NUM_ENCODER>::new(vial_config.unlock_keys, keymap),
             reader_writer,
+            #[cfg(feature = "storage")]
+            keymap_dirty: false,
+            #[cfg(feature = "storage")]
+            bulk_transaction: false,
+            keymap_stale: false,
         }
     }
 
     pub(crate) async fn run(&mut self) {
+        crate::startup::wait_keymap_ready().await;
         loop {
             match self.process().await {
                 Ok(_) => continue,
@@ -90,6 +123,24 @@ impl<
     }
 
     pub(crate) async fn process(&mut self) -> Result<(), HidError> {
+        #[cfg(feature = "storage")]
+        let mut via_report = if self.keymap_dirty {
+            let timeout = if self.bulk_transaction {
+                BULK_TRANSACTION_TIMEOUT
+            } else {
+                BULK_COMMIT_QUIET_PERIOD
+            };
+            match with_timeout(timeout, self.reader_writer.read_report()).await {
+                Ok(report) => report?,
+                Err(_) => {
+                    self.commit_keymap().await;
+                    return Ok(());
+                }
+            }
+        } else {
+            self.reader_writer.read_report().await?
+        };
+        #[cfg(not(feature = "storage"))]
         let mut via_report = self.reader_writer.read_report().await?;
 
         self.process_via_packet(&mut via_report, self.keymap).await;
@@ -130,21 +181,52 @@ impl<
                         ViaKeyboardInfo::SwitchMatrixState => {
                             #[cfg(feature = "vial_lock")]
                             {
+                                // The third byte is the first row of the page, large matrices are read page by page
+                                let offset = report.output_data[2] as usize;
                                 #[cfg(not(feature = "vial_lock"))]
                                 {
-                                    self.keymap.borrow().matrix_state.read_all(&mut report.input_data[2..]);
+                                    self.keymap
+                                        .borrow()
+                                        .matrix_state
+                                        .read_page(offset, &mut report.input_data[2..]);
                                     error!("It is not secure to use matrix tester without vial lock");
                                 }
 
                                 #[cfg(feature = "vial_lock")]
                                 if self.locker.is_unlocked() {
-                                    self.keymap.borrow().matrix_state.read_all(&mut report.input_data[2..]);
+                                    self.keymap
+                                        .borrow()
+                                        .matrix_state
+                                        .read_page(offset, &mut report.input_data[2..]);
                                 }
                             }
                         }
                         ViaKeyboardInfo::FirmwareVersion => {
                             BigEndian::write_u32(&mut report.input_data[2..6], VIA_FIRMWARE_VERSION);
                         }
+                        #[cfg(feature = "latency_trace")]
+                        ViaKeyboardInfo::LatencyStats => {
+                            // The stage is in the third byte, followed by count, min, avg, p99 and max as u32
+                            if let Some(stage) = LatencyStage::from_u8(report.output_data[2]) {
+                                let stats = latency_stats(stage);
+                                let values = [stats.count, stats.min_us, stats.avg_us, stats.p99_us, stats.max_us];
+                                for (i, value) in values.iter().enumerate() {
+                                    BigEndian::write_u32(&mut report.input_data[3 + i * 4..7 + i * 4], *value);
+                                }
+                            }
+                        }
+                        #[cfg(feature = "task_stats")]
+                        ViaKeyboardInfo::TaskStats => {
+                            // The task id is in the third byte, followed by polls, wakeups as u32, busy time in
+                            // microseconds as u64 and the longest poll as u32
+                            if let Some(task) = TaskId::from_u8(report.output_data[2]) {
+                                let stats = task_stats(task);
+                                BigEndian::write_u32(&mut report.input_data[3..7], stats.polls);
+                                BigEndian::write_u32(&mut report.input_data[7..11], stats.wakeups);
+                                BigEndian::write_u64(&mut report.input_data[11..19], stats.busy_us);
+                                BigEndian::write_u32(&mut report.input_data[19..23], stats.max_poll_us);
+                            }
+                        }
                         _ => (),
                     },
                     Err(e) => error!("Invalid subcommand: {} of GetKeyboardValue", e),
@@ -191,9 +273,15 @@ impl<
                     "Setting keycode: 0x{:02X} at ({},{}), layer {} as {:?}",
                     keycode, row, col, layer, action
                 );
-                keymap
+                if keymap
                     .borrow_mut()
-                    .set_action_at(KeyboardEventPos::key_pos(col, row), layer as usize, action);
+                    .set_action_at(KeyboardEventPos::key_pos(col, row), layer as usize, action)
+                    .is_err()
+                {
+                    // The key isn't changed, so it's not saved either
+                    report.input_data[0] = ViaCommand::Unhandled as u8;
+                    return;
+                }
                 #[cfg(feature = "storage")]
                 FLASH_CHANNEL
                     .send(FlashOperationMessage::VialMessage(KeymapData::KeymapKey(KeymapKey {
@@ -216,17 +304,28 @@ impl<
                 warn!("Custom get value -- not supported")
             }
             ViaCommand::CustomSave => {
-                // backlight/rgblight/rgb matrix/led matrix/audio settings here
-                warn!("Custom get value -- not supported")
+                // Commit the buffered keymap writes
+                #[cfg(feature = "storage")]
+                FLASH_CHANNEL.send(FlashOperationMessage::Commit(0)).await
             }
             ViaCommand::EepromReset => {
                 warn!("Resetting storage..");
                 #[cfg(feature = "storage")]
-                FLASH_CHANNEL.send(FlashOperationMessage::Reset).await
+                {
+                    self.keymap_dirty = false;
+                    FLASH_CHANNEL.send(FlashOperationMessage::Reset).await
+                }
                 // TODO: Reboot after a eeprom reset?
             }
             ViaCommand::BootloaderJump => {
                 warn!("Bootloader jumping");
+                #[cfg(feature = "storage")]
+                {
+                    if self.keymap_dirty {
+                        self.commit_keymap().await;
+                    }
+                    crate::storage::commit_storage().await;
+                }
                 boot::jump_to_bootloader();
             }
             ViaCommand::DynamicKeymapMacroGetCount => {
@@ -291,60 +390,36 @@ impl<
                 // size <= 28
                 let size = report.output_data[3];
                 debug!("Getting keymap buffer, offset: {}, size: {}", offset, size);
-                let mut idx = 4;
-                keymap
-                    .borrow()
-                    .layers
-                    .iter()
-                    .flatten()
-                    .flatten()
-                    .skip((offset / 2) as usize)
-                    .take((size / 2) as usize)
-                    .for_each(|a| {
-                        let kc = to_via_keycode(*a);
-                        BigEndian::write_u16(&mut report.input_data[idx..idx + 2], kc);
-                        idx += 2;
-                    });
+                let keymap = keymap.borrow();
+                let start = (offset / 2) as usize;
+                let end = (start + (size / 2) as usize).min(keymap.layers.key_count());
+                for (idx, key) in (start..end).enumerate() {
+                    let kc = to_via_keycode(keymap.layers.key(key));
+                    BigEndian::write_u16(&mut report.input_data[4 + idx * 2..6 + idx * 2], kc);
+                }
             }
             ViaCommand::DynamicKeymapSetBuffer => {
-                debug!("Dynamic keymap set buffer");
                 let offset = BigEndian::read_u16(&report.output_data[1..3]);
                 // size <= 28
-                let size = report.output_data[3];
-                let mut idx = 4;
-                let (row_num, col_num, _layer_num) = keymap.borrow().get_keymap_config();
-                keymap
-                    .borrow_mut()
-                    .layers
-                    .iter_mut()
-                    .flatten()
-                    .flatten()
-                    .skip(offset as usize)
-                    .take(size as usize)
-                    .enumerate()
-                    .for_each(|(i, a)| {
-                        let via_keycode = LittleEndian::read_u16(&report.output_data[idx..idx + 2]);
-                        let action: rmk_types::action::KeyAction = from_via_keycode(via_keycode);
-                        *a = action;
-                        idx += 2;
-                        let current_offset = offset as usize + i;
-                        let (row, col, layer) = get_position_from_offset(current_offset, row_num, col_num);
-                        info!(
-                            "Setting keymap buffer of offset: {}, row,col,layer: {},{},{}",
-                            offset, row, col, layer
-                        );
-                        #[cfg(feature = "storage")]
-                        if let Err(_e) = FLASH_CHANNEL.try_send(FlashOperationMessage::VialMessage(
-                            KeymapData::KeymapKey(KeymapKey {
-                                layer: layer as u8,
-                                col: col as u8,
-                                row: row as u8,
-                                action,
-                            }),
-                        )) {
-                            error!("Send keymap setting command error")
-                        }
-                    });
+                let size = report.output_data[3].min(28);
+                debug!("Setting keymap buffer, offset: {}, size: {}", offset, size);
+                let mut keymap = keymap.borrow_mut();
+                let start = (offset / 2) as usize;
+                let end = (start + (size / 2) as usize).min(keymap.layers.key_count());
+                for (idx, key) in (start..end).enumerate() {
+                    let via_keycode = BigEndian::read_u16(&report.output_data[4 + idx * 2..6 + idx * 2]);
+                    if keymap.layers.set_key(key, from_via_keycode(via_keycode)).is_err() {
+                        error!("Keymap overlay is full, key {} is not changed", key);
+                        report.input_data[0] = ViaCommand::Unhandled as u8;
+                    }
+                }
+                keymap.update_effective_layers();
+                keymap.update_behavior_flags();
+                // The whole keymap is saved once the host stops writing, instead of a flash write per key
+                #[cfg(feature = "storage")]
+                {
+                    self.keymap_dirty = true;
+                }
             }
             ViaCommand::DynamicKeymapGetEncoder => {
                 warn!("Keymap get encoder -- not supported");
@@ -352,6 +427,9 @@ impl<
             ViaCommand::DynamicKeymapSetEncoder => {
                 warn!("Keymap set encoder -- not supported");
             }
+            ViaCommand::Vial if VialCommand::from(report.output_data[1]) == VialCommand::BulkKeymap => {
+                self.process_bulk_keymap(report, keymap).await
+            }
             ViaCommand::Vial => {
                 process_vial(
                     report,
@@ -370,14 +448,6 @@ impl<
     }
 }
 
-fn get_position_from_offset(offset: usize, max_row: usize, max_col: usize) -> (usize, usize, usize) {
-    let layer = offset / (max_col * max_row);
-    let current_layer_offset = offset % (max_col * max_row);
-    let row = current_layer_offset / max_col;
-    let col = current_layer_offset % max_col;
-    (row, col, layer)
-}
-
 fn count_zeros(data: &[u8]) -> usize {
     data.iter().filter(|&&x| x == 0).count()
 }
@@ -456,6 +456,7 @@ pub(crate) async fn process_vial<
                                         layer: None,
                                     }))
                                 };
+                            km.update_combo_index();
                             (actions, output)
                         };
 
@@ -1,17 +1,238 @@
+use core::ops::Range;
+
 #[cfg(feature = "_nrf_ble")]
 pub mod nrf;
+#[cfg(feature = "_nrf_ble")]
+pub mod nrf_dma;
 
 #[cfg(feature = "_nrf_ble")]
 pub use nrf::*;
+#[cfg(feature = "_nrf_ble")]
+pub use nrf_dma::*;
 
 pub enum AnalogEventType {
     Joystick(u8),
     Battery,
 }
 
+impl AnalogEventType {
+    /// Number of ADC channels read by the event
+    pub fn channels(&self) -> usize {
+        match self {
+            AnalogEventType::Joystick(sz) => *sz as usize,
+            AnalogEventType::Battery => 1,
+        }
+    }
+}
+
+/// ADC channels of the event at `index`, the channels are assigned in the order of the events
+pub fn event_channels(event_type: &[AnalogEventType], index: usize) -> Range<usize> {
+    let start = event_type[..index].iter().map(|e| e.channels()).sum();
+    start..start + event_type[index].channels()
+}
+
 #[derive(PartialEq)]
 pub enum AdcState {
     Active,
     LightSleep,
     // DeepSleep,
 }
+
+/// Default deadzone of the joysticks around their rest position, in raw ADC units
+pub const DEFAULT_JOYSTICK_DEADZONE: u16 = 40;
+
+/// Minimum change of the averaged battery reading which is published, in raw ADC units
+pub const BATTERY_ADC_THRESHOLD: u16 = 8;
+
+/// Raw ADC reading of a scaled joystick value, the inverse of the scaling of the joystick events.
+///
+/// The bias of a [`JoystickProcessor`](crate::input_device::joystick::JoystickProcessor) is added to the scaled value,
+/// so the rest position of a joystick axis is `raw_joystick_value(-bias)`.
+pub const fn raw_joystick_value(value: i16) -> i16 {
+    value / 2 - i16::MIN / 2
+}
+
+/// Bulk filter of the analog samples.
+///
+/// A whole buffer of samples is averaged per channel, then an event is published only when its value crosses a
+/// threshold: a joystick while it's out of the deadzone around its rest position and once when it's back, a battery
+/// when the reading changes by `BATTERY_ADC_THRESHOLD`.
+///
+/// The rest position of a joystick is set by [`AnalogFilter::with_rest`], or captured from the first buffer in which
+/// the joystick doesn't move more than the deadzone. A joystick isn't published before its rest position is known,
+/// and [`AnalogFilter::recapture_rest`] captures it again.
+///
+/// At most 32 events are supported.
+pub struct AnalogFilter<const PIN_NUM: usize, const EVENT_NUM: usize> {
+    deadzone: u16,
+    /// Averaged reading of each channel
+    values: [i16; PIN_NUM],
+    /// Rest position of each joystick channel
+    rest: [i16; PIN_NUM],
+    /// Whether the rest position of the joystick of each event is known
+    rest_known: [bool; EVENT_NUM],
+    /// Last published reading of each channel
+    published: [i16; PIN_NUM],
+    /// Whether any reading is published, the first battery reading is always published
+    started: bool,
+    /// Whether the joystick of each event is out of the deadzone
+    deflected: [bool; EVENT_NUM],
+}
+
+impl<const PIN_NUM: usize, const EVENT_NUM: usize> AnalogFilter<PIN_NUM, EVENT_NUM> {
+    pub fn new(deadzone: u16) -> Self {
+        Self {
+            deadzone,
+            values: [0; PIN_NUM],
+            rest: [0; PIN_NUM],
+            rest_known: [false; EVENT_NUM],
+            published: [0; PIN_NUM],
+            started: false,
+            deflected: [false; EVENT_NUM],
+        }
+    }
+
+    /// Set the deadzone of the joysticks, in raw ADC units
+    pub fn with_deadzone(mut self, deadzone: u16) -> Self {
+        self.deadzone = deadzone;
+        self
+    }
+
+    /// Use a fixed rest position of each channel in raw ADC units, instead of capturing it from the readings.
+    ///
+    /// The values of the battery channels are not used.
+    pub fn with_rest(mut self, rest: [i16; PIN_NUM]) -> Self {
+        self.rest = rest;
+        self.rest_known = [true; EVENT_NUM];
+        self
+    }
+
+    /// Capture the rest position of the joysticks again from the next steady readings
+    pub fn recapture_rest(&mut self) {
+        self.rest_known = [false; EVENT_NUM];
+    }
+
+    /// Averaged reading of each channel
+    pub fn values(&self) -> &[i16; PIN_NUM] {
+        &self.values
+    }
+
+    /// Whether a joystick is out of its deadzone
+    pub fn is_active(&self) -> bool {
+        self.deflected.iter().any(|d| *d)
+    }
+
+    /// Average the samples, return the bit mask of the events which should be published
+    pub fn update(&mut self, event_type: &[AnalogEventType; EVENT_NUM], samples: &[[i16; PIN_NUM]]) -> u32 {
+        if samples.is_empty() {
+            return 0;
+        }
+        for (ch, value) in self.values.iter_mut().enumerate() {
+            let sum: i32 = samples.iter().map(|s| s[ch] as i32).sum();
+            *value = (sum / samples.len() as i32) as i16;
+        }
+        let first = !self.started;
+        self.started = true;
+
+        let mut mask = 0;
+        for (i, typ) in event_type.iter().enumerate().take(32) {
+            let channels = event_channels(event_type, i);
+            let channels = channels.start.min(PIN_NUM)..channels.end.min(PIN_NUM);
+            let publish = match typ {
+                AnalogEventType::Joystick(_) => {
+                    if !self.rest_known[i] {
+                        // A moving joystick isn't at rest, wait for a steady buffer
+                        let steady = channels
+                            .clone()
+                            .all(|ch| samples.iter().all(|s| s[ch].abs_diff(self.values[ch]) <= self.deadzone));
+                        if !steady {
+                            continue;
+                        }
+                        for ch in channels.clone() {
+                            self.rest[ch] = self.values[ch];
+                        }
+                        self.rest_known[i] = true;
+                    }
+                    let deflected = channels
+                        .clone()
+                        .any(|ch| self.values[ch].abs_diff(self.rest[ch]) > self.deadzone);
+                    let publish = deflected || self.deflected[i];
+                    self.deflected[i] = deflected;
+                    publish
+                }
+                AnalogEventType::Battery => channels
+                    .clone()
+                    .any(|ch| first || self.values[ch].abs_diff(self.published[ch]) >= BATTERY_ADC_THRESHOLD),
+            };
+            if publish {
+                for ch in channels {
+                    self.published[ch] = self.values[ch];
+                }
+                mask |= 1 << i;
+            }
+        }
+        mask
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const EVENTS: [AnalogEventType; 2] = [AnalogEventType::Joystick(2), AnalogEventType::Battery];
+
+    #[test]
+    fn test_event_channels() {
+        assert_eq!(event_channels(&EVENTS, 0), 0..2);
+        assert_eq!(event_channels(&EVENTS, 1), 2..3);
+    }
+
+    #[test]
+    fn test_joystick_deadzone() {
+        let mut filter = AnalogFilter::<3, 2>::new(40);
+        // The first steady buffer is the rest position, and the first battery reading is always published
+        assert_eq!(filter.update(&EVENTS, &[[2000, 2000, 4200]; 4]), 0b10);
+        assert_eq!(filter.values(), &[2000, 2000, 4200]);
+        // Noise inside the deadzone and small battery changes are filtered
+        assert_eq!(filter.update(&EVENTS, &[[2030, 1970, 4204], [2010, 1990, 4198]]), 0);
+        // A deflected joystick is published on every buffer, and once more when it's back at rest
+        assert_eq!(filter.update(&EVENTS, &[[2500, 2000, 4200]; 4]), 0b01);
+        assert!(filter.is_active());
+        assert_eq!(filter.update(&EVENTS, &[[2500, 2000, 4200]; 4]), 0b01);
+        assert_eq!(filter.update(&EVENTS, &[[2000, 2000, 4200]; 4]), 0b01);
+        assert!(!filter.is_active());
+        assert_eq!(filter.update(&EVENTS, &[[2000, 2000, 4200]; 4]), 0);
+    }
+
+    #[test]
+    fn test_battery_threshold() {
+        let mut filter = AnalogFilter::<3, 2>::new(40);
+        filter.update(&EVENTS, &[[2000, 2000, 4200]]);
+        // The battery reading is averaged over the buffer: (4190 + 4194) / 2 = 4192
+        assert_eq!(filter.update(&EVENTS, &[[2000, 2000, 4190], [2000, 2000, 4194]]), 0b10);
+        assert_eq!(filter.values()[2], 4192);
+        // Compared with the last published reading, not with the previous buffer
+        assert_eq!(filter.update(&EVENTS, &[[2000, 2000, 4188]]), 0);
+        assert_eq!(filter.update(&EVENTS, &[[2000, 2000, 4184]]), 0b10);
+    }
+
+    #[test]
+    fn test_joystick_rest() {
+        let mut filter = AnalogFilter::<3, 2>::new(40);
+        // The joystick is moving at boot, its rest position isn't captured from this buffer
+        assert_eq!(filter.update(&EVENTS, &[[2500, 2000, 4200], [2300, 2000, 4200]]), 0b10);
+        assert_eq!(filter.update(&EVENTS, &[[2000, 2000, 4200]; 4]), 0);
+        assert_eq!(filter.update(&EVENTS, &[[2500, 2000, 4200]; 4]), 0b01);
+
+        // Capture the rest position again, while the joystick is kept at the new position
+        filter.recapture_rest();
+        assert_eq!(filter.update(&EVENTS, &[[2500, 2000, 4200]; 4]), 0b01);
+        assert_eq!(filter.update(&EVENTS, &[[2500, 2000, 4200]; 4]), 0);
+
+        // A fixed rest position is used from the first buffer
+        let mut filter = AnalogFilter::<3, 2>::new(40).with_rest([raw_joystick_value(-12768), 2000, 0]);
+        assert_eq!(filter.update(&EVENTS, &[[10050, 2000, 4200]; 4]), 0b11);
+        assert_eq!(filter.update(&EVENTS, &[[10000, 2000, 4200]; 4]), 0b01);
+        assert!(!filter.is_active());
+    }
+}
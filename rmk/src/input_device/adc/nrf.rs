@@ -4,6 +4,7 @@ use rmk_macro::{InputEvent, input_device};
 
 use super::{AdcState, AnalogEventType};
 use crate::event::{Axis, AxisEvent, AxisValType, BatteryAdcEvent, PointingEvent};
+use crate::input_device::scan_governor::ScanGovernor;
 
 /// Events produced by NrfAdc.
 #[derive(InputEvent, Clone, Debug)]
@@ -24,6 +25,8 @@ pub struct NrfAdc<'a, const PIN_NUM: usize, const EVENT_NUM: usize> {
     buf_state: bool,
     adc_state: AdcState,
     active_instant: Instant,
+    /// Scan rate governor, the light sleep interval grows when all input devices are idle
+    governor: ScanGovernor,
 }
 
 impl<'a, const PIN_NUM: usize, const EVENT_NUM: usize> NrfAdc<'a, PIN_NUM, EVENT_NUM> {
@@ -44,6 +47,7 @@ impl<'a, const PIN_NUM: usize, const EVENT_NUM: usize> NrfAdc<'a, PIN_NUM, EVENT
             buf_state: false,
             adc_state: AdcState::LightSleep,
             active_instant: Instant::MIN,
+            governor: ScanGovernor::register(),
         }
     }
 }
@@ -57,7 +61,9 @@ impl<'a, const PIN_NUM: usize, const EVENT_NUM: usize> NrfAdc<'a, PIN_NUM, EVENT
             } else if let Some(light_sleep) = self.light_sleep
                 && self.adc_state == AdcState::LightSleep
             {
-                embassy_time::Timer::after(light_sleep).await;
+                let rate = self.governor.idle(light_sleep, false);
+                rate.sleep(core::future::pending::<()>()).await;
+                self.governor.wake();
             } else {
                 embassy_time::Timer::after(self.polling_interval).await;
             }
@@ -82,6 +88,7 @@ impl<'a, const PIN_NUM: usize, const EVENT_NUM: usize> NrfAdc<'a, PIN_NUM, EVENT
                         debug!("ADC Active");
                         self.adc_state = AdcState::Active;
                         self.active_instant = Instant::now();
+                        self.governor.activity();
                         break;
                     }
                 }
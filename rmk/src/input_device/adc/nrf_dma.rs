@@ -0,0 +1,227 @@
+//! Continuous SAADC scan, triggered by a timer through PPI and sampled into a double-buffered DMA ring.
+//!
+//! The SAADC scans all channels every `scan_interval` without the CPU, and the CPU wakes up only when a half of the
+//! ring, `DMA_SCANS_PER_BUFFER` scans, is full. The half is averaged and filtered in one pass by [`AnalogFilter`], and
+//! events are published only when a joystick is out of its deadzone or a battery reading changes.
+//!
+//! After `ACTIVE_TIMEOUT` without joystick movement, the scan stops and the channels are sampled once per light sleep
+//! interval, like [`NrfAdc`](super::NrfAdc).
+use embassy_nrf::Peri;
+use embassy_nrf::ppi::ConfigurableChannel;
+use embassy_nrf::saadc::{CallbackResult, Saadc};
+use embassy_nrf::timer::{Frequency, Instance as TimerInstance};
+use embassy_time::{Duration, Instant};
+use rmk_macro::input_device;
+
+use super::{AnalogEventType, AnalogFilter, DEFAULT_JOYSTICK_DEADZONE, NrfAdcEvent, event_channels};
+use crate::event::{Axis, AxisEvent, AxisValType, BatteryAdcEvent, PointingEvent};
+use crate::input_device::scan_governor::ScanGovernor;
+
+/// Number of scans in each half of the DMA ring, the CPU wakes up once per half
+pub const DMA_SCANS_PER_BUFFER: usize = 16;
+
+/// Time without joystick movement before the continuous scan stops
+const ACTIVE_TIMEOUT: Duration = Duration::from_millis(1200);
+
+#[input_device(publish = NrfAdcEvent)]
+pub struct NrfDmaAdc<
+    'a,
+    T: TimerInstance,
+    C1: ConfigurableChannel,
+    C2: ConfigurableChannel,
+    const PIN_NUM: usize,
+    const EVENT_NUM: usize,
+> {
+    saadc: Saadc<'a, PIN_NUM>,
+    /// Timer which triggers the scans
+    timer: Peri<'a, T>,
+    ppi_ch1: Peri<'a, C1>,
+    ppi_ch2: Peri<'a, C2>,
+    /// Interval between two scans of all channels
+    scan_interval: Duration,
+    light_sleep: Option<Duration>,
+    bufs: [[[i16; PIN_NUM]; DMA_SCANS_PER_BUFFER]; 2],
+    event_type: [AnalogEventType; EVENT_NUM],
+    filter: AnalogFilter<PIN_NUM, EVENT_NUM>,
+    /// Bit mask of the events which are waiting to be published
+    pending: u32,
+    active_instant: Instant,
+    /// Scan rate governor, the light sleep interval grows when all input devices are idle
+    governor: ScanGovernor,
+}
+
+impl<
+    'a,
+    T: TimerInstance,
+    C1: ConfigurableChannel,
+    C2: ConfigurableChannel,
+    const PIN_NUM: usize,
+    const EVENT_NUM: usize,
+> NrfDmaAdc<'a, T, C1, C2, PIN_NUM, EVENT_NUM>
+{
+    /// Create the scanner, `timer`, `ppi_ch1` and `ppi_ch2` are used only while scanning.
+    ///
+    /// `light_sleep` is the sampling interval after the joysticks are idle, `None` keeps scanning.
+    pub fn new(
+        saadc: Saadc<'a, PIN_NUM>,
+        timer: Peri<'a, T>,
+        ppi_ch1: Peri<'a, C1>,
+        ppi_ch2: Peri<'a, C2>,
+        event_type: [AnalogEventType; EVENT_NUM],
+        scan_interval: Duration,
+        light_sleep: Option<Duration>,
+    ) -> Self {
+        let channels: usize = event_type.iter().map(|e| e.channels()).sum();
+        if channels != PIN_NUM {
+            error!("NrfDmaAdc's pin size and event's required is mismatch");
+        }
+        Self {
+            saadc,
+            timer,
+            ppi_ch1,
+            ppi_ch2,
+            scan_interval,
+            light_sleep,
+            bufs: [[[0; PIN_NUM]; DMA_SCANS_PER_BUFFER]; 2],
+            event_type,
+            filter: AnalogFilter::new(DEFAULT_JOYSTICK_DEADZONE),
+            pending: 0,
+            // Scan first, the rest position of the joysticks is captured from the first steady buffer
+            active_instant: Instant::now(),
+            governor: ScanGovernor::register(),
+        }
+    }
+
+    /// Set the deadzone of the joysticks around their rest position, in raw ADC units
+    pub fn with_deadzone(mut self, deadzone: u16) -> Self {
+        self.filter = self.filter.with_deadzone(deadzone);
+        self
+    }
+
+    /// Use a fixed rest position of each channel in raw ADC units, see [`AnalogFilter::with_rest`].
+    ///
+    /// Without it, the rest position is captured from the first steady readings after boot.
+    pub fn with_rest(mut self, rest: [i16; PIN_NUM]) -> Self {
+        self.filter = self.filter.with_rest(rest);
+        self
+    }
+
+    /// Capture the rest position of the joysticks again from the next steady readings
+    pub fn recapture_rest(&mut self) {
+        self.filter.recapture_rest();
+    }
+
+    async fn read_nrf_adc_event(&mut self) -> NrfAdcEvent {
+        loop {
+            if let Some(event) = self.next_pending_event() {
+                return event;
+            }
+            match self.light_sleep {
+                Some(light_sleep) if self.active_instant.elapsed() >= ACTIVE_TIMEOUT => {
+                    self.sample_after(light_sleep).await
+                }
+                _ => self.scan().await,
+            }
+        }
+    }
+
+    /// Scan continuously until there is an event to publish or the joysticks are idle
+    async fn scan(&mut self) {
+        let Self {
+            saadc,
+            timer,
+            ppi_ch1,
+            ppi_ch2,
+            scan_interval,
+            light_sleep,
+            bufs,
+            event_type,
+            filter,
+            pending,
+            active_instant,
+            governor,
+        } = self;
+        let has_light_sleep = light_sleep.is_some();
+        // The timer counts microseconds, a scan of all channels takes tens of microseconds
+        let sample_counter = scan_interval.as_micros().clamp(100, u32::MAX as u64) as u32;
+        saadc
+            .run_task_sampler(
+                timer.reborrow(),
+                ppi_ch1.reborrow(),
+                ppi_ch2.reborrow(),
+                Frequency::F1MHz,
+                sample_counter,
+                bufs,
+                |buf| {
+                    *pending = filter.update(event_type, buf);
+                    if filter.is_active() {
+                        *active_instant = Instant::now();
+                        governor.activity();
+                    }
+                    if *pending != 0 || (has_light_sleep && active_instant.elapsed() >= ACTIVE_TIMEOUT) {
+                        CallbackResult::Stop
+                    } else {
+                        CallbackResult::Continue
+                    }
+                },
+            )
+            .await;
+    }
+
+    /// Sleep for the light sleep interval, then sample all channels once
+    async fn sample_after(&mut self, light_sleep: Duration) {
+        let rate = self.governor.idle(light_sleep, false);
+        rate.sleep(core::future::pending::<()>()).await;
+        self.governor.wake();
+
+        let mut sample = [0; PIN_NUM];
+        self.saadc.sample(&mut sample).await;
+        self.pending = self.filter.update(&self.event_type, &[sample]);
+        if self.filter.is_active() {
+            debug!("ADC Active");
+            self.active_instant = Instant::now();
+            self.governor.activity();
+        }
+    }
+
+    /// Take the first pending event
+    fn next_pending_event(&mut self) -> Option<NrfAdcEvent> {
+        if self.pending == 0 {
+            return None;
+        }
+        let index = self.pending.trailing_zeros() as usize;
+        self.pending &= !(1 << index);
+        let values = self.filter.values();
+        let channels = event_channels(&self.event_type, index);
+        let channels = channels.start.min(PIN_NUM)..channels.end.min(PIN_NUM);
+        match self.event_type[index] {
+            AnalogEventType::Joystick(_) => {
+                let mut e = [
+                    AxisEvent {
+                        typ: AxisValType::Rel,
+                        axis: Axis::X,
+                        value: 0,
+                    },
+                    AxisEvent {
+                        typ: AxisValType::Rel,
+                        axis: Axis::Y,
+                        value: 0,
+                    },
+                    AxisEvent {
+                        typ: AxisValType::Rel,
+                        axis: Axis::Z,
+                        value: 0,
+                    },
+                ];
+                // Same scaling as `NrfAdc`, so the bias and transform of the joystick processors are unchanged
+                for (axis, ch) in e.iter_mut().zip(channels) {
+                    axis.value = (values[ch] + i16::MIN / 2).saturating_mul(2);
+                }
+                Some(NrfAdcEvent::Pointing(PointingEvent(e)))
+            }
+            AnalogEventType::Battery => Some(NrfAdcEvent::Battery(BatteryAdcEvent(
+                values[channels.start].max(0) as u16
+            ))),
+        }
+    }
+}
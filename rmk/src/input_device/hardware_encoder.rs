@@ -0,0 +1,220 @@
+//! Rotary encoder decoded by a hardware quadrature decoder
+//!
+//! The quadrature edges are counted by the hardware, like the nRF QDEC, a RP PIO state machine or a STM32 timer in
+//! encoder mode, so fast spins don't lose steps and a step doesn't wake the CPU on every edge. The encoder reads the
+//! accumulated count on demand, and publishes a burst of steps as press/release pairs in one [`KeyboardBatchEvent`].
+//!
+//! The counted edges are replayed on a virtual pin state through the [`Phase`] of the encoder, so `DefaultPhase`,
+//! `E8H7Phase` and `ResolutionPhase` report the same steps as the software decoding of [`RotaryEncoder`].
+//!
+//! [`RotaryEncoder`]: crate::input_device::rotary_encoder::RotaryEncoder
+use embassy_time::Instant;
+use rmk_macro::input_device;
+
+use crate::event::{KEYBOARD_BATCH_EVENT_SIZE, KeyboardBatchEvent, KeyboardEvent};
+use crate::input_device::rotary_encoder::{DefaultPhase, Direction, Phase, ResolutionPhase};
+use crate::input_device::scan_governor::notify_input_activity;
+
+/// Virtual pin states of one quadrature cycle, `(b_is_low << 1) | a_is_low`, in the order of positive edges
+const QUADRATURE_CYCLE: [u8; 4] = [0b00, 0b01, 0b11, 0b10];
+
+/// Maximum number of edges replayed from one read, larger counts are treated as noise or an overflow
+const MAX_EDGES_PER_READ: u32 = 1024;
+
+/// Hardware quadrature decoder backend
+pub trait QuadratureDecoder {
+    /// Wait for movement, return the number of edges counted since the previous call.
+    ///
+    /// Every transition of pin A or pin B is an edge, aka x4 decoding. The count is positive when pin A changes
+    /// before pin B.
+    async fn read_edges(&mut self) -> i32;
+}
+
+/// Rotary encoder whose quadrature edges are counted by a [`QuadratureDecoder`]
+#[input_device(publish = KeyboardBatchEvent)]
+pub struct HardwareRotaryEncoder<Q: QuadratureDecoder, P: Phase = DefaultPhase> {
+    decoder: Q,
+    phase: P,
+    /// The index of the rotary encoder
+    id: u8,
+    /// Index of the virtual pin state in `QUADRATURE_CYCLE`
+    cycle_pos: usize,
+    /// Steps which are not published yet, positive for clockwise
+    pending_steps: i32,
+}
+
+impl<Q: QuadratureDecoder> HardwareRotaryEncoder<Q, DefaultPhase> {
+    /// Create an encoder with the default phase
+    pub fn new(decoder: Q, id: u8) -> Self {
+        Self::with_phase(decoder, DefaultPhase, id)
+    }
+}
+
+impl<Q: QuadratureDecoder> HardwareRotaryEncoder<Q, ResolutionPhase> {
+    /// Create an encoder with the specified resolution, like `RotaryEncoder::with_resolution`
+    pub fn with_resolution(decoder: Q, resolution: u8, reverse: bool, id: u8) -> Self {
+        Self::with_phase(decoder, ResolutionPhase::new(resolution, reverse), id)
+    }
+}
+
+impl<Q: QuadratureDecoder, P: Phase> HardwareRotaryEncoder<Q, P> {
+    /// Create an encoder with a custom phase
+    pub fn with_phase(decoder: Q, phase: P, id: u8) -> Self {
+        Self {
+            decoder,
+            phase,
+            id,
+            cycle_pos: 0,
+            pending_steps: 0,
+        }
+    }
+
+    /// Replay the counted edges through the phase, and add the decoded steps to the pending steps
+    fn replay_edges(&mut self, edges: i32) {
+        let forward = edges > 0;
+        for _ in 0..edges.unsigned_abs().min(MAX_EDGES_PER_READ) {
+            let old = QUADRATURE_CYCLE[self.cycle_pos];
+            self.cycle_pos = if forward {
+                (self.cycle_pos + 1) % 4
+            } else {
+                (self.cycle_pos + 3) % 4
+            };
+            let new = QUADRATURE_CYCLE[self.cycle_pos];
+            match self.phase.direction((new << 2) | old) {
+                Direction::Clockwise => self.pending_steps += 1,
+                Direction::CounterClockwise => self.pending_steps -= 1,
+                Direction::None => {}
+            }
+        }
+    }
+
+    /// Wait for steps, publish the pending steps as press/release pairs.
+    ///
+    /// If there are more steps than fit in one batch, the rest are published by the next call.
+    async fn read_keyboard_batch_event(&mut self) -> KeyboardBatchEvent {
+        while self.pending_steps == 0 {
+            let edges = self.decoder.read_edges().await;
+            self.replay_edges(edges);
+        }
+        notify_input_activity();
+
+        let direction = if self.pending_steps > 0 {
+            Direction::Clockwise
+        } else {
+            Direction::CounterClockwise
+        };
+        let steps = self
+            .pending_steps
+            .unsigned_abs()
+            .min(KEYBOARD_BATCH_EVENT_SIZE as u32 / 2);
+        self.pending_steps -= steps as i32 * self.pending_steps.signum();
+
+        let mut batch = KeyboardBatchEvent {
+            timestamp: Instant::now(),
+            events: heapless::Vec::new(),
+        };
+        for _ in 0..steps {
+            let _ = batch
+                .events
+                .push(KeyboardEvent::rotary_encoder(self.id, direction, true));
+            let _ = batch
+                .events
+                .push(KeyboardEvent::rotary_encoder(self.id, direction, false));
+        }
+        batch
+    }
+}
+
+/// nRF QDEC, the accumulator is read and cleared on every report of the QDEC
+#[cfg(feature = "_nrf_ble")]
+impl QuadratureDecoder for embassy_nrf::qdec::Qdec<'_> {
+    async fn read_edges(&mut self) -> i32 {
+        self.read().await as i32
+    }
+}
+
+/// RP PIO encoder program of embassy-rp, which reports one direction per quadrature cycle
+#[cfg(feature = "rp2040")]
+impl<T: embassy_rp::pio::Instance, const SM: usize> QuadratureDecoder
+    for embassy_rp::pio_programs::rotary_encoder::PioEncoder<'_, T, SM>
+{
+    async fn read_edges(&mut self) -> i32 {
+        use embassy_rp::pio_programs::rotary_encoder::Direction as PioDirection;
+        use embassy_time::{Duration, with_timeout};
+
+        let mut edges = 0;
+        let mut direction = Some(self.read().await);
+        while let Some(d) = direction {
+            edges += match d {
+                PioDirection::Clockwise => -4,
+                PioDirection::CounterClockwise => 4,
+            };
+            // Drain the cycles which are already in the FIFO, so that a fast spin is published in one batch
+            direction = with_timeout(Duration::from_ticks(0), self.read()).await.ok();
+        }
+        edges
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::input_device::rotary_encoder::E8H7Phase;
+
+    struct TestDecoder(heapless::Deque<i32, 4>);
+
+    impl QuadratureDecoder for TestDecoder {
+        async fn read_edges(&mut self) -> i32 {
+            self.0.pop_front().unwrap_or_default()
+        }
+    }
+
+    fn decoder(reads: &[i32]) -> TestDecoder {
+        let mut queue = heapless::Deque::new();
+        for read in reads {
+            queue.push_back(*read).unwrap();
+        }
+        TestDecoder(queue)
+    }
+
+    #[test]
+    fn test_burst_in_one_batch() {
+        // 3 detents of a 4-edge encoder, counted clockwise
+        let mut encoder = HardwareRotaryEncoder::with_resolution(decoder(&[-12]), 4, false, 1);
+        let batch = embassy_futures::block_on(encoder.read_keyboard_batch_event());
+        assert_eq!(batch.events.len(), 6);
+        for pair in batch.events.chunks(2) {
+            assert_eq!(pair[0], KeyboardEvent::rotary_encoder(1, Direction::Clockwise, true));
+            assert_eq!(pair[1], KeyboardEvent::rotary_encoder(1, Direction::Clockwise, false));
+        }
+    }
+
+    #[test]
+    fn test_steps_over_batch_size() {
+        let mut encoder = HardwareRotaryEncoder::with_resolution(decoder(&[24]), 4, false, 0);
+        let first = embassy_futures::block_on(encoder.read_keyboard_batch_event());
+        assert_eq!(first.events.len(), KEYBOARD_BATCH_EVENT_SIZE);
+        assert_eq!(
+            first.events[0],
+            KeyboardEvent::rotary_encoder(0, Direction::CounterClockwise, true)
+        );
+        // The remaining 2 steps are published by the next read
+        let second = embassy_futures::block_on(encoder.read_keyboard_batch_event());
+        assert_eq!(second.events.len(), 4);
+    }
+
+    #[test]
+    fn test_phase_semantics() {
+        // The default phase reports every edge, E8H7 every other edge, like the software decoding
+        let mut encoder = HardwareRotaryEncoder::new(decoder(&[]), 0);
+        encoder.replay_edges(-3);
+        assert_eq!(encoder.pending_steps, 3);
+        let mut encoder = HardwareRotaryEncoder::with_phase(decoder(&[]), E8H7Phase, 0);
+        encoder.replay_edges(4);
+        assert_eq!(encoder.pending_steps, 2);
+        // Reversing the resolution phase flips the direction
+        let mut encoder = HardwareRotaryEncoder::with_resolution(decoder(&[]), 4, true, 0);
+        encoder.replay_edges(8);
+        assert_eq!(encoder.pending_steps, 2);
+    }
+}
@@ -6,6 +6,7 @@ use usbd_hid::descriptor::MouseReport;
 use crate::event::PointingEvent;
 use crate::hid::Report;
 use crate::input_device::InputProcessor;
+use crate::input_device::motion::{MotionConfig, MotionStage};
 use crate::keymap::KeyMap;
 
 #[input_processor(subscribe = [PointingEvent])]
@@ -22,6 +23,7 @@ pub struct JoystickProcessor<
     keymap: &'a RefCell<KeyMap<'a, ROW, COL, NUM_LAYER, NUM_ENCODER>>,
     record: [i16; N],
     resolution: u16,
+    motion: MotionStage,
 }
 
 impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_ENCODER: usize, const N: usize>
@@ -39,9 +41,16 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             resolution,
             keymap,
             record: [0; N],
+            motion: MotionStage::default(),
         }
     }
 
+    /// Process the joystick motion by the motion stage, aka acceleration, smoothing and scroll mode
+    pub fn with_motion(mut self, config: MotionConfig) -> Self {
+        self.motion = MotionStage::new(config);
+        self
+    }
+
     async fn on_pointing_event(&mut self, event: PointingEvent) {
         for (rec, e) in self.record.iter_mut().zip(event.0.iter()) {
             *rec = e.value;
@@ -71,13 +80,23 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
 
         debug!("JoystickProcessor::generate_report: report = {:?}", report);
         // map to mouse
-        let buttons = self.keymap.borrow().mouse_buttons;
+        crate::startup::wait_keymap_ready().await;
+        let (buttons, scroll) = {
+            let keymap = self.keymap.borrow();
+            let scroll = self
+                .motion
+                .config()
+                .scroll_layer
+                .is_some_and(|l| keymap.is_layer_active(l));
+            (keymap.mouse_buttons, scroll)
+        };
+        let motion = self.motion.process(report[0], report[1], scroll);
         let mouse_report = MouseReport {
             buttons,
-            x: (report[0].clamp(i8::MIN as i16, i8::MAX as i16)) as i8,
-            y: (report[1].clamp(i8::MIN as i16, i8::MAX as i16)) as i8,
-            wheel: 0,
-            pan: 0,
+            x: (motion.x.clamp(i8::MIN as i16, i8::MAX as i16)) as i8,
+            y: (motion.y.clamp(i8::MIN as i16, i8::MAX as i16)) as i8,
+            wheel: (motion.wheel.clamp(i8::MIN as i16, i8::MAX as i16)) as i8,
+            pan: (motion.pan.clamp(i8::MIN as i16, i8::MAX as i16)) as i8,
         };
 
         // Send mouse report directly
@@ -9,11 +9,14 @@ use crate::hid::Report;
 pub mod adc;
 #[cfg(feature = "_ble")]
 pub mod battery;
+pub mod hardware_encoder;
 pub mod joystick;
+pub mod motion;
 pub mod pmw33xx;
 pub mod pmw3610;
 pub mod pointing;
 pub mod rotary_encoder;
+pub mod scan_governor;
 
 /// The trait for runnable input devices and processors.
 ///
@@ -0,0 +1,374 @@
+//! Fixed-point motion processing stage, shared by pointing devices, joysticks and mouse keys.
+//!
+//! The stage converts the raw deltas of a report to pointer movement or scrolling:
+//! - the deltas are scaled by the gain of an acceleration curve, which is a lookup table of the speed
+//! - the scaled deltas are smoothed by an exponential moving average
+//! - the fractional part of the output is carried to the next report, so slow movements aren't lost
+//! - optionally, the minor axis is snapped to zero, and the motion is converted to scrolling while a layer is active
+//!
+//! All values are integers with `FRAC_BITS` fractional bits, no float math is used, so it's cheap enough for MCUs
+//! without FPU at high sensor rates.
+
+/// Number of fractional bits of the fixed-point values
+pub const FRAC_BITS: u32 = 8;
+/// 1.0 in fixed point
+pub const ONE: i32 = 1 << FRAC_BITS;
+
+/// A point of an acceleration curve
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct AccelPoint {
+    /// Speed of the motion, in counts per report
+    pub speed: u16,
+    /// Gain at the speed, in 1/256
+    pub gain: u16,
+}
+
+/// Acceleration curve, the gain between the points is linearly interpolated.
+///
+/// The points should be sorted by speed. The gain of the first point is used below it and the gain of the last
+/// point is used above it. An empty curve has a constant gain of 1.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct AccelCurve {
+    pub points: &'static [AccelPoint],
+}
+
+impl AccelCurve {
+    /// No acceleration
+    pub const LINEAR: Self = Self { points: &[] };
+
+    /// Gain of the curve at `speed`, in fixed point
+    pub fn gain(&self, speed: u16) -> i32 {
+        let Some(first) = self.points.first() else {
+            return ONE;
+        };
+        if speed <= first.speed {
+            return first.gain as i32;
+        }
+        for w in self.points.windows(2) {
+            let (low, high) = (w[0], w[1]);
+            if speed <= high.speed {
+                let span = (high.speed - low.speed).max(1) as i64;
+                let offset = (speed - low.speed) as i64;
+                let delta = (high.gain as i64 - low.gain as i64) * offset / span;
+                return low.gain as i32 + delta as i32;
+            }
+        }
+        self.points[self.points.len() - 1].gain as i32
+    }
+}
+
+impl Default for AccelCurve {
+    fn default() -> Self {
+        Self::LINEAR
+    }
+}
+
+/// When the minor axis of the motion is snapped to zero
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub enum AxisSnap {
+    #[default]
+    Off,
+    /// Only in scroll mode
+    Scroll,
+    /// In both pointer and scroll mode
+    Always,
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct MotionConfig {
+    /// Acceleration curve of the pointer motion, it's not applied to scrolling
+    pub accel: AccelCurve,
+    /// Strength of the exponential smoothing, each report moves `1 / 2^smoothing` of the way to the new value.
+    /// 0 disables smoothing.
+    pub smoothing: u8,
+    pub axis_snap: AxisSnap,
+    /// The motion is converted to scrolling while this layer is active
+    pub scroll_layer: Option<u8>,
+    /// Motion counts per scroll step
+    pub scroll_divisor: u8,
+    /// Scroll down when moving up
+    pub invert_scroll: bool,
+}
+
+impl Default for MotionConfig {
+    fn default() -> Self {
+        Self {
+            accel: AccelCurve::LINEAR,
+            smoothing: 0,
+            axis_snap: AxisSnap::Off,
+            scroll_layer: None,
+            scroll_divisor: 8,
+            invert_scroll: false,
+        }
+    }
+}
+
+/// Output of the motion stage, in report units
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct MotionOutput {
+    pub x: i16,
+    pub y: i16,
+    pub wheel: i16,
+    pub pan: i16,
+}
+
+/// Motion processing stage, it keeps the smoothing and sub-pixel state of one input
+#[derive(Clone, Debug, Default)]
+pub struct MotionStage {
+    config: MotionConfig,
+    /// Smoothed motion of x and y, in fixed point
+    smoothed: [i32; 2],
+    /// Fractional part of the output of x and y, in fixed point
+    remainder: [i32; 2],
+    /// Whether the last motion was converted to scrolling
+    scrolling: bool,
+}
+
+impl MotionStage {
+    pub fn new(config: MotionConfig) -> Self {
+        Self {
+            config,
+            ..Default::default()
+        }
+    }
+
+    pub fn config(&self) -> &MotionConfig {
+        &self.config
+    }
+
+    /// Clear the smoothing and sub-pixel state
+    pub fn reset(&mut self) {
+        self.smoothed = [0; 2];
+        self.remainder = [0; 2];
+    }
+
+    /// Process the deltas of a report, `scroll` is whether the motion should be converted to scrolling.
+    pub fn process(&mut self, dx: i16, dy: i16, scroll: bool) -> MotionOutput {
+        if scroll != self.scrolling {
+            // The state of pointer motion isn't valid for scrolling and vice versa
+            self.reset();
+            self.scrolling = scroll;
+        }
+
+        let (mut dx, mut dy) = (dx as i32, dy as i32);
+        let snap = match self.config.axis_snap {
+            AxisSnap::Off => false,
+            AxisSnap::Scroll => scroll,
+            AxisSnap::Always => true,
+        };
+        if snap {
+            (dx, dy) = snap_axis(dx, dy);
+        }
+
+        // Scrolling isn't accelerated, the step size is set by the divisor
+        let gain = if scroll {
+            ONE
+        } else {
+            self.config.accel.gain(speed(dx, dy))
+        };
+        let mut motion = [dx * gain, dy * gain];
+        if self.config.smoothing > 0 {
+            let shift = self.config.smoothing.min(8) as u32;
+            for (smoothed, m) in self.smoothed.iter_mut().zip(motion.iter_mut()) {
+                // Round toward zero, so both directions are smoothed the same way, and snap to the target when the
+                // step is rounded to 0, so no remainder is left in the later reports
+                let diff = *m - *smoothed;
+                let step = diff / (1 << shift);
+                *smoothed += if step == 0 { diff } else { step };
+                *m = *smoothed;
+            }
+        }
+
+        let unit = if scroll {
+            self.config.scroll_divisor.max(1) as i32 * ONE
+        } else {
+            ONE
+        };
+        let mut output = [0i16; 2];
+        for ((out, remainder), m) in output.iter_mut().zip(self.remainder.iter_mut()).zip(motion) {
+            let total = remainder.saturating_add(m);
+            // Truncate toward zero, so the slow motion in both directions is handled the same way
+            let steps = (total / unit).clamp(i16::MIN as i32, i16::MAX as i32);
+            *remainder = total - steps * unit;
+            *out = steps as i16;
+        }
+
+        if scroll {
+            // Moving up, aka negative y, scrolls up, aka positive wheel
+            let wheel = if self.config.invert_scroll {
+                output[1]
+            } else {
+                -output[1]
+            };
+            MotionOutput {
+                wheel,
+                pan: output[0],
+                ..Default::default()
+            }
+        } else {
+            MotionOutput {
+                x: output[0],
+                y: output[1],
+                ..Default::default()
+            }
+        }
+    }
+}
+
+/// Approximated length of the motion vector: max + 3/8 * min, within 7% of the euclidean length
+pub fn speed(dx: i32, dy: i32) -> u16 {
+    let (a, b) = (dx.unsigned_abs(), dy.unsigned_abs());
+    let (max, min) = if a > b { (a, b) } else { (b, a) };
+    (max + ((min * 3) >> 3)).min(u16::MAX as u32) as u16
+}
+
+/// Snap the minor axis to zero if the major axis is at least twice as large
+pub fn snap_axis(dx: i32, dy: i32) -> (i32, i32) {
+    let (a, b) = (dx.abs(), dy.abs());
+    if a >= b * 2 {
+        (dx, 0)
+    } else if b >= a * 2 {
+        (0, dy)
+    } else {
+        (dx, dy)
+    }
+}
+
+/// Ease-out progression from `min` to `max` in `steps`: f(x) = 2x - x², where x = step / steps.
+pub fn ease_out(min: u16, max: u16, step: u16, steps: u16) -> u16 {
+    if step >= steps {
+        return max;
+    }
+    let range = max.saturating_sub(min);
+    // Use saturating operations to handle overflow cases
+    let linear_term = 2u16.saturating_mul(step).saturating_mul(steps);
+    let quadratic_term = step.saturating_mul(step);
+    let progress_numerator = linear_term.saturating_sub(quadratic_term);
+    let progress_denominator = steps.saturating_mul(steps);
+    min + (range.saturating_mul(progress_numerator) / progress_denominator.max(1))
+}
+
+/// Scale a diagonal motion by 1/sqrt(2), so it has the same speed as a straight one.
+///
+/// Non-zero values are kept non-zero.
+pub fn diagonal_compensation(x: i8, y: i8) -> (i8, i8) {
+    if x == 0 || y == 0 {
+        return (x, y);
+    }
+    // 1/sqrt(2) approximation using 181/256 (0.70703125)
+    let compensate = |v: i8| {
+        let compensated = (v as i16 * 181 + 128) / 256;
+        if compensated == 0 {
+            v.signum()
+        } else {
+            compensated as i8
+        }
+    };
+    (compensate(x), compensate(y))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const CURVE: AccelCurve = AccelCurve {
+        points: &[AccelPoint { speed: 2, gain: 128 }, AccelPoint { speed: 10, gain: 512 }],
+    };
+
+    fn pointer(stage: &mut MotionStage, dx: i16, dy: i16) -> (i16, i16) {
+        let output = stage.process(dx, dy, false);
+        (output.x, output.y)
+    }
+
+    #[test]
+    fn test_accel_curve() {
+        assert_eq!(AccelCurve::LINEAR.gain(100), ONE);
+        assert_eq!(CURVE.gain(0), 128);
+        assert_eq!(CURVE.gain(6), 320);
+        assert_eq!(CURVE.gain(10), 512);
+        assert_eq!(CURVE.gain(1000), 512);
+        assert_eq!(speed(-4, 0), 4);
+        assert_eq!(speed(8, -8), 11);
+    }
+
+    #[test]
+    fn test_linear_is_identity() {
+        let mut stage = MotionStage::new(MotionConfig::default());
+        for (dx, dy) in [(1, -1), (127, 0), (-300, 45), (0, 0)] {
+            assert_eq!(pointer(&mut stage, dx, dy), (dx, dy));
+        }
+    }
+
+    #[test]
+    fn test_remainder_carry() {
+        // Gain 0.5 at low speed, the half counts are carried to the next reports
+        let mut stage = MotionStage::new(MotionConfig {
+            accel: CURVE,
+            ..Default::default()
+        });
+        let moved: i16 = (0..6).map(|_| pointer(&mut stage, 1, 0).0).sum();
+        assert_eq!(moved, 3);
+        let moved: i16 = (0..6).map(|_| pointer(&mut stage, -1, 0).0).sum();
+        assert_eq!(moved, -3);
+        // Fast motion is accelerated
+        assert_eq!(pointer(&mut stage, 20, 0), (40, 0));
+    }
+
+    #[test]
+    fn test_smoothing() {
+        let mut stage = MotionStage::new(MotionConfig {
+            smoothing: 1,
+            ..Default::default()
+        });
+        assert_eq!(pointer(&mut stage, 16, 0), (8, 0));
+        assert_eq!(pointer(&mut stage, 16, 0), (12, 0));
+        assert_eq!(pointer(&mut stage, 16, 0), (14, 0));
+    }
+
+    #[test]
+    fn test_smoothing_converges() {
+        for sign in [1, -1] {
+            let mut stage = MotionStage::new(MotionConfig {
+                smoothing: 3,
+                ..Default::default()
+            });
+            let moved: i16 = (0..8).map(|_| pointer(&mut stage, 5 * sign, -3 * sign).0).sum();
+            // The smoothed motion returns exactly to 0 once the motion stops
+            let stopped: i16 = (0..64).map(|_| pointer(&mut stage, 0, 0).0).sum();
+            assert_eq!(stage.smoothed, [0, 0]);
+            assert_eq!(pointer(&mut stage, 0, 0), (0, 0));
+            assert_eq!(moved + stopped, 8 * 5 * sign);
+        }
+    }
+
+    #[test]
+    fn test_scroll_mode() {
+        let mut stage = MotionStage::new(MotionConfig {
+            axis_snap: AxisSnap::Scroll,
+            scroll_divisor: 4,
+            ..Default::default()
+        });
+        // Not snapped in pointer mode
+        assert_eq!(pointer(&mut stage, 6, 1), (6, 1));
+        // Snapped and divided in scroll mode, moving up scrolls up
+        let output = stage.process(1, -6, true);
+        assert_eq!((output.x, output.wheel, output.pan), (0, 1, 0));
+        let output = stage.process(1, -6, true);
+        assert_eq!(output.wheel, 2);
+        let output = stage.process(9, 0, true);
+        assert_eq!((output.wheel, output.pan), (0, 2));
+    }
+
+    #[test]
+    fn test_mouse_key_helpers() {
+        assert_eq!(ease_out(1, 10, 0, 4), 1);
+        assert_eq!(ease_out(1, 10, 2, 4), 7);
+        assert_eq!(ease_out(1, 10, 4, 4), 10);
+        assert_eq!(diagonal_compensation(10, 10), (7, 7));
+        assert_eq!(diagonal_compensation(1, -1), (1, -1));
+        assert_eq!(diagonal_compensation(10, 0), (10, 0));
+    }
+}
@@ -10,7 +10,9 @@ use embedded_hal::digital::{InputPin, OutputPin};
 use embedded_hal_async::digital::Wait;
 use embedded_hal_async::spi::SpiBus;
 
-use crate::input_device::pointing::{InitState, MotionData, PointingDevice, PointingDriver, PointingDriverError};
+use crate::input_device::pointing::{
+    InitState, MotionData, MotionPipeline, PointingDevice, PointingDriver, PointingDriverError,
+};
 
 // ============================================================================
 // Burst register offsets
@@ -742,6 +744,7 @@ where
             last_report: Instant::MIN,
             accumulated_x: 0,
             accumulated_y: 0,
+            pipeline: MotionPipeline::default(),
         }
     }
 
@@ -773,6 +776,7 @@ where
             last_report: Instant::MIN,
             accumulated_x: 0,
             accumulated_y: 0,
+            pipeline: MotionPipeline::default(),
         }
     }
 }
@@ -9,7 +9,9 @@ use embedded_hal_async::digital::Wait;
 use embedded_hal_async::spi::SpiBus;
 
 pub use crate::driver::bitbang_spi::{BitBangError, BitBangSpiBus};
-use crate::input_device::pointing::{InitState, MotionData, PointingDevice, PointingDriver, PointingDriverError};
+use crate::input_device::pointing::{
+    InitState, MotionData, MotionPipeline, PointingDevice, PointingDriver, PointingDriverError,
+};
 
 // ============================================================================
 // Page 0 registers
@@ -532,6 +534,7 @@ where
             last_report: Instant::MIN,
             accumulated_x: 0,
             accumulated_y: 0,
+            pipeline: MotionPipeline::default(),
         }
     }
 }
@@ -2,20 +2,41 @@
 
 use core::cell::RefCell;
 
-use embassy_time::{Duration, Instant, Timer};
+use embassy_sync::watch::{Receiver, Watch};
+use embassy_time::{Duration, Instant, Timer, with_deadline};
 use embedded_hal::digital::InputPin;
 use embedded_hal_async::digital::Wait;
 use futures::future::pending;
 use rmk_macro::input_processor;
 use usbd_hid::descriptor::MouseReport;
 
+#[cfg(feature = "_ble")]
+use crate::ble::conn_param::notify_activity;
 use crate::event::{Axis, AxisEvent, AxisValType, PointingEvent};
 use crate::hid::Report;
+use crate::input_device::motion::{MotionConfig, MotionStage};
 use crate::input_device::{InputDevice, InputProcessor};
 use crate::keymap::KeyMap;
 
 pub const ALL_POINTING_DEVICES: u8 = 255;
 
+/// Maximum number of pointing devices whose reports are synchronized with the HID writer
+const MAX_WRITER_SYNCED_DEVICES: usize = 2;
+/// A report that isn't written in this time is considered lost, e.g. when no host is connected
+const WRITER_SYNC_TIMEOUT: Duration = Duration::from_millis(100);
+/// Number of consecutive polls without motion before the sensor is polled at `IDLE_POLL_INTERVAL`
+const IDLE_POLLS: u16 = 64;
+/// Poll interval of a still sensor without motion GPIO, which leaves the SPI bus idle most of the time
+const IDLE_POLL_INTERVAL: Duration = Duration::from_millis(4);
+
+/// Written mouse reports, every writer synchronized pointing device holds a receiver
+static MOUSE_REPORT_WRITTEN: Watch<crate::RawMutex, (), MAX_WRITER_SYNCED_DEVICES> = Watch::new();
+
+/// Notify the pointing devices that a mouse report is written by the HID writer
+pub(crate) fn mouse_report_written() {
+    MOUSE_REPORT_WRITTEN.sender().send(());
+}
+
 /// Motion data from the sensor
 #[derive(Debug, Clone, Copy, Default)]
 pub struct MotionData {
@@ -59,6 +80,17 @@ pub enum InitState {
     Failed,
 }
 
+/// State of the motion pipeline between the sensor and the HID writer
+#[derive(Default)]
+pub struct MotionPipeline {
+    /// Receiver of written mouse reports, reports are paced by the HID writer instead of `report_interval` if set
+    written: Option<Receiver<'static, crate::RawMutex, (), MAX_WRITER_SYNCED_DEVICES>>,
+    /// Whether the last report isn't written by the HID writer yet
+    in_flight: bool,
+    /// Number of consecutive polls without motion
+    idle_polls: u16,
+}
+
 /// PointingDevice an InputDevice for RMK
 ///
 /// This device returns `Event::Joystick` events with relative X/Y movement.
@@ -72,6 +104,7 @@ pub struct PointingDevice<S: PointingDriver> {
     pub last_report: Instant,
     pub accumulated_x: i32,
     pub accumulated_y: i32,
+    pub pipeline: MotionPipeline,
 }
 
 impl<S> PointingDevice<S>
@@ -80,6 +113,25 @@ where
 {
     const MAX_INIT_RETRIES: u8 = 3;
 
+    /// Pace the reports by the HID writer instead of `report_interval`.
+    ///
+    /// The motion is accumulated while the previous report isn't written, and the next report is emitted as soon
+    /// as the writer has written it, aka at the next USB poll or BLE connection event. So the reports never queue
+    /// up with stale deltas, and one report carries all motion since the last write. The deltas which don't fit in
+    /// a mouse report are carried over to the next one instead of being clamped.
+    ///
+    /// Only use it on the side which sends the HID reports, aka not on split peripherals.
+    pub fn writer_synced(mut self) -> Self {
+        self.pipeline.written = MOUSE_REPORT_WRITTEN.receiver();
+        if self.pipeline.written.is_none() {
+            warn!(
+                "PointingDevice {}: At most {} devices can be synced with the HID writer",
+                self.id, MAX_WRITER_SYNCED_DEVICES
+            );
+        }
+        self
+    }
+
     async fn try_init(&mut self) -> bool {
         match self.init_state {
             InitState::Ready => return true,
@@ -133,6 +185,11 @@ where
             Ok(motion) => {
                 self.accumulated_x = self.accumulated_x.saturating_add(motion.dx as i32);
                 self.accumulated_y = self.accumulated_y.saturating_add(motion.dy as i32);
+                self.pipeline.idle_polls = if motion.dx == 0 && motion.dy == 0 {
+                    self.pipeline.idle_polls.saturating_add(1)
+                } else {
+                    0
+                };
             }
             Err(_e) => {
                 warn!("PointingDevice {}: Read motion error", self.id);
@@ -145,11 +202,24 @@ where
             return None;
         }
 
-        let dx = self.accumulated_x.clamp(i16::MIN as i32, i16::MAX as i32) as i16;
-        let dy = self.accumulated_y.clamp(i16::MIN as i32, i16::MAX as i32) as i16;
-
-        self.accumulated_x = 0;
-        self.accumulated_y = 0;
+        let (dx, dy) = if let Some(written) = self.pipeline.written.as_mut() {
+            // Mark the previous writes as seen, the report is in flight until the writer writes it
+            let _ = written.try_changed();
+            self.pipeline.in_flight = true;
+
+            // Carry the deltas which don't fit in a mouse report over to the next report
+            let dx = self.accumulated_x.clamp(-(i8::MAX as i32), i8::MAX as i32);
+            let dy = self.accumulated_y.clamp(-(i8::MAX as i32), i8::MAX as i32);
+            self.accumulated_x -= dx;
+            self.accumulated_y -= dy;
+            (dx as i16, dy as i16)
+        } else {
+            let dx = self.accumulated_x.clamp(i16::MIN as i32, i16::MAX as i32) as i16;
+            let dy = self.accumulated_y.clamp(i16::MIN as i32, i16::MAX as i32) as i16;
+            self.accumulated_x = 0;
+            self.accumulated_y = 0;
+            (dx, dy)
+        };
 
         Some(PointingEvent([
             AxisEvent {
@@ -214,12 +284,18 @@ where
             }
 
             loop {
+                // Slow down polling when the sensor is still
+                let poll_interval = if self.pipeline.idle_polls >= IDLE_POLLS {
+                    self.poll_interval.max(IDLE_POLL_INTERVAL)
+                } else {
+                    self.poll_interval
+                };
                 let poll_wait = async {
                     if let Some(gpio) = self.sensor.motion_gpio() {
                         let _ = gpio.wait_for_low().await;
                     } else {
                         Timer::after(
-                            self.poll_interval
+                            poll_interval
                                 .checked_sub(self.last_poll.elapsed())
                                 .unwrap_or(Duration::MIN),
                         )
@@ -228,16 +304,22 @@ where
                 };
 
                 let report_wait = async {
-                    if self.accumulated_x != 0 || self.accumulated_y != 0 {
+                    if self.accumulated_x == 0 && self.accumulated_y == 0 {
+                        // Don't schedule report if there's no accumulated motion
+                        pending::<()>().await;
+                    } else if let Some(written) = self.pipeline.written.as_mut() {
+                        // Report as soon as the writer has written the previous report
+                        if self.pipeline.in_flight {
+                            let _ = with_deadline(self.last_report + WRITER_SYNC_TIMEOUT, written.changed()).await;
+                            self.pipeline.in_flight = false;
+                        }
+                    } else {
                         Timer::after(
                             self.report_interval
                                 .checked_sub(self.last_report.elapsed())
                                 .unwrap_or(Duration::MIN),
                         )
                         .await;
-                    } else {
-                        // Don't schedule report if there's no accumulated motion
-                        pending::<()>().await;
                     }
                 };
 
@@ -266,6 +348,8 @@ pub struct PointingProcessorConfig {
     pub invert_y: bool,
     /// Swap X and Y axes
     pub swap_xy: bool,
+    /// Acceleration, smoothing and scroll mode of the motion
+    pub motion: MotionConfig,
 }
 
 /// PointingProcessor that converts motion events to mouse reports
@@ -274,6 +358,7 @@ pub struct PointingProcessor<'a, const ROW: usize, const COL: usize, const NUM_L
     /// Reference to the keymap
     keymap: &'a RefCell<KeyMap<'a, ROW, COL, NUM_LAYER, NUM_ENCODER>>,
     config: PointingProcessorConfig,
+    motion: MotionStage,
 }
 
 impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_ENCODER: usize>
@@ -284,10 +369,14 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         keymap: &'a RefCell<KeyMap<'a, ROW, COL, NUM_LAYER, NUM_ENCODER>>,
         config: PointingProcessorConfig,
     ) -> Self {
-        Self { keymap, config }
+        let motion = MotionStage::new(config.motion);
+        Self { keymap, config, motion }
     }
 
     async fn on_pointing_event(&mut self, event: PointingEvent) {
+        #[cfg(feature = "_ble")]
+        notify_activity();
+
         let mut x = 0i16;
         let mut y = 0i16;
 
@@ -309,13 +398,23 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             (x, y) = (y, x);
         }
 
-        let buttons = self.keymap.borrow().mouse_buttons;
+        crate::startup::wait_keymap_ready().await;
+        let (buttons, scroll) = {
+            let keymap = self.keymap.borrow();
+            let scroll = self
+                .config
+                .motion
+                .scroll_layer
+                .is_some_and(|l| keymap.is_layer_active(l));
+            (keymap.mouse_buttons, scroll)
+        };
+        let motion = self.motion.process(x, y, scroll);
         let mouse_report = MouseReport {
             buttons,
-            x: x.clamp(i8::MIN as i16, i8::MAX as i16) as i8,
-            y: y.clamp(i8::MIN as i16, i8::MAX as i16) as i8,
-            wheel: 0,
-            pan: 0,
+            x: motion.x.clamp(i8::MIN as i16, i8::MAX as i16) as i8,
+            y: motion.y.clamp(i8::MIN as i16, i8::MAX as i16) as i8,
+            wheel: motion.wheel.clamp(i8::MIN as i16, i8::MAX as i16) as i8,
+            pan: motion.pan.clamp(i8::MIN as i16, i8::MAX as i16) as i8,
         };
         self.send_report(Report::MouseReport(mouse_report)).await;
     }
@@ -456,6 +555,7 @@ mod tests {
             last_report: Instant::MIN,
             accumulated_x: 0,
             accumulated_y: 0,
+            pipeline: MotionPipeline::default(),
         };
 
         let mut result = false;
@@ -498,6 +598,7 @@ mod tests {
             last_report: Instant::MIN,
             accumulated_x: 0,
             accumulated_y: 0,
+            pipeline: MotionPipeline::default(),
         };
 
         // Run the async try_init
@@ -531,6 +632,7 @@ mod tests {
             last_report: Instant::MIN,
             accumulated_x: 0,
             accumulated_y: 0,
+            pipeline: MotionPipeline::default(),
         };
 
         let inited = block_on(device.try_init());
@@ -564,6 +666,7 @@ mod tests {
             last_report: Instant::MIN,
             accumulated_x: 0,
             accumulated_y: 0,
+            pipeline: MotionPipeline::default(),
             id: 1,
         };
 
@@ -600,6 +703,7 @@ mod tests {
             last_report: Instant::MIN,
             accumulated_x: 0,
             accumulated_y: 0,
+            pipeline: MotionPipeline::default(),
         };
 
         let start = Instant::now();
@@ -618,4 +722,43 @@ mod tests {
 
         assert!(device.sensor.read_called);
     }
+
+    #[test]
+    fn test_writer_synced_report_carries_deltas() {
+        let driver = DummyDriver {
+            motion_pending: true,
+            motion: MotionData::default(),
+            init_called: true,
+            fails_init: false,
+            motion_gpio: None,
+            read_called: false,
+        };
+
+        let mut device = PointingDevice {
+            sensor: driver,
+            init_state: InitState::Ready,
+            poll_interval: Duration::from_millis(1),
+            report_interval: Duration::from_millis(1),
+            last_poll: Instant::MIN,
+            last_report: Instant::MIN,
+            accumulated_x: 300,
+            accumulated_y: -20,
+            pipeline: MotionPipeline::default(),
+            id: 1,
+        }
+        .writer_synced();
+        assert!(device.pipeline.written.is_some());
+
+        // The deltas which don't fit in a mouse report are kept for the next report
+        let event = device.take_report_event().unwrap();
+        assert_eq!((event.0[0].value, event.0[1].value), (127, -20));
+        assert_eq!((device.accumulated_x, device.accumulated_y), (173, 0));
+        assert!(device.pipeline.in_flight);
+
+        // Still sensor
+        for _ in 0..IDLE_POLLS {
+            block_on(device.poll_once());
+        }
+        assert_eq!(device.pipeline.idle_polls, IDLE_POLLS);
+    }
 }
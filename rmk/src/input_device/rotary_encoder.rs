@@ -1,6 +1,7 @@
 //! General rotary encoder
 //!
 //! The rotary encoder implementation is adapted from: <https://github.com/leshow/rotary-encoder-hal/blob/master/src/lib.rs>
+use embassy_time::Duration;
 use embedded_hal::digital::InputPin;
 #[cfg(feature = "async_matrix")]
 use embedded_hal_async::digital::Wait;
@@ -9,6 +10,10 @@ use rmk_macro::input_device;
 use serde::{Deserialize, Serialize};
 
 use crate::event::KeyboardEvent;
+use crate::input_device::scan_governor::ScanGovernor;
+
+/// Poll interval of the encoders without pin interrupts
+const POLL_INTERVAL: Duration = Duration::from_millis(20);
 
 /// Holds current/old state and both [`InputPin`](https://docs.rs/embedded-hal/latest/embedded_hal/digital/trait.InputPin.html)
 #[derive(Clone, Debug)]
@@ -30,6 +35,8 @@ pub struct RotaryEncoder<
     /// The last action of the rotary encoder.
     /// When it's not `None`, the rotary encoder needs to emit a release event.
     last_action: Option<Direction>,
+    /// Scan rate governor
+    governor: ScanGovernor,
 }
 
 /// The encoder direction is either `Clockwise`, `CounterClockwise`, or `None`
@@ -150,6 +157,7 @@ impl<
             phase: DefaultPhase,
             id,
             last_action: None,
+            governor: ScanGovernor::register(),
         }
     }
 }
@@ -171,6 +179,7 @@ impl<
             phase: ResolutionPhase::new(resolution, reverse),
             id,
             last_action: None,
+            governor: ScanGovernor::register(),
         }
     }
 }
@@ -192,6 +201,7 @@ impl<
             phase,
             id,
             last_action: None,
+            governor: ScanGovernor::register(),
         }
     }
 
@@ -263,21 +273,28 @@ impl<
         loop {
             #[cfg(feature = "async_matrix")]
             {
-                let (pin_a, pin_b) = self.pins();
-                embassy_futures::select::select(pin_a.wait_for_any_edge(), pin_b.wait_for_any_edge()).await;
+                // Wait for an edge, or poll if the current scan tier isn't interrupt-only
+                let rate = self.governor.idle(POLL_INTERVAL, true);
+                let (pin_a, pin_b) = (&mut self.pin_a, &mut self.pin_b);
+                let edge = embassy_futures::select::select(pin_a.wait_for_any_edge(), pin_b.wait_for_any_edge());
+                rate.sleep(edge).await;
+                self.governor.wake();
             }
 
             let direction = self.update();
 
             if direction != Direction::None {
+                self.governor.activity();
                 self.last_action = Some(direction);
                 return KeyboardEvent::rotary_encoder(self.id, direction, true);
             }
 
             #[cfg(not(feature = "async_matrix"))]
             {
-                // Wait for 20ms to avoid busy loop
-                embassy_time::Timer::after_millis(20).await;
+                // Poll at least every 20ms to avoid busy loop, slower when idle
+                let rate = self.governor.idle(POLL_INTERVAL, false);
+                rate.sleep(core::future::pending::<()>()).await;
+                self.governor.wake();
             }
         }
     }
@@ -0,0 +1,292 @@
+//! Adaptive scan rate governor of the input devices.
+//!
+//! The input devices which scan or poll their hardware, like matrices, rotary encoders and ADCs, register at the
+//! governor with a [`ScanGovernor`] and ask it how to sleep after a scan pass without activity. The governor follows
+//! a [`ScanPolicy`]: a list of tiers, tier 0 is used while typing and the following tiers are entered one by one when
+//! there is no activity on any input device for the tier's `idle_after` time.
+//!
+//! Devices which can wake on a pin edge (`async_matrix`) stop scanning in the interrupt-only tiers and wait for the
+//! edge, the other devices fall back to the interval of the tier. Keys which are pressed or still being debounced
+//! count as activity, so the first keystroke after a long idle time is scanned at full rate until it's debounced.
+//!
+//! The time each registered device spends awake and asleep is measured, it's logged when the device enters another
+//! tier and can be read by [`scan_stats`].
+use core::cell::RefCell;
+use core::future::Future;
+
+use embassy_futures::yield_now;
+use embassy_sync::blocking_mutex::Mutex;
+use embassy_time::{Duration, Instant, Timer};
+
+use crate::RawMutex;
+
+/// Maximum number of input devices whose duty cycle is measured, the devices registered after them still follow
+/// the policy
+pub const MAX_SCAN_DEVICES: usize = 8;
+
+/// One tier of a scan policy
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ScanTier {
+    /// Time without activity before entering this tier, ignored for the first tier
+    pub idle_after: Duration,
+    /// Minimum time between two scan passes, devices which have a longer interval of their own keep it
+    pub interval: Duration,
+    /// Devices which can wake on a pin edge stop scanning and wait for the edge
+    pub interrupt_only: bool,
+}
+
+/// Scan policy of the input devices, the tiers should be sorted by `idle_after`
+#[derive(Clone, Copy, Debug)]
+pub struct ScanPolicy {
+    pub tiers: &'static [ScanTier],
+}
+
+impl ScanPolicy {
+    /// The default policy: devices with pin interrupts sleep as soon as all keys are released, as they did before
+    /// the governor. Polled devices scan at full rate while typing and slow down after 5 seconds and 1 minute idle.
+    pub const DEFAULT: Self = Self {
+        tiers: &[
+            ScanTier {
+                idle_after: Duration::from_secs(0),
+                interval: Duration::from_secs(0),
+                interrupt_only: true,
+            },
+            ScanTier {
+                idle_after: Duration::from_secs(5),
+                interval: Duration::from_millis(5),
+                interrupt_only: true,
+            },
+            ScanTier {
+                idle_after: Duration::from_secs(60),
+                interval: Duration::from_millis(20),
+                interrupt_only: true,
+            },
+        ],
+    };
+
+    /// Index of the tier after being idle for `idle`
+    fn tier_index(&self, idle: Duration) -> usize {
+        self.tiers
+            .iter()
+            .rposition(|tier| tier.idle_after <= idle)
+            .unwrap_or_default()
+    }
+}
+
+/// Time a device spent scanning and sleeping
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct ScanStats {
+    pub awake: Duration,
+    pub asleep: Duration,
+}
+
+impl ScanStats {
+    /// Share of the time the device is awake, in permille
+    pub fn duty_cycle_permille(&self) -> u16 {
+        let total = (self.awake + self.asleep).as_ticks();
+        if total == 0 {
+            return 1000;
+        }
+        (self.awake.as_ticks() * 1000 / total) as u16
+    }
+}
+
+/// How a device sleeps before the next scan pass
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub enum ScanRate {
+    /// Scan again after yielding to the executor
+    Full,
+    /// Scan again after the interval
+    Interval(Duration),
+    /// Wait for a pin edge
+    Interrupt,
+}
+
+impl ScanRate {
+    /// Sleep according to the rate, `wake` is the pin edge wait of the device and it's used only by `Interrupt`.
+    ///
+    /// The future doesn't borrow the governor, so `wake` can borrow the device.
+    pub async fn sleep(self, wake: impl Future) {
+        match self {
+            ScanRate::Full => yield_now().await,
+            ScanRate::Interval(interval) => Timer::after(interval).await,
+            ScanRate::Interrupt => {
+                wake.await;
+            }
+        }
+    }
+}
+
+struct GovernorState {
+    policy: ScanPolicy,
+    last_activity: Instant,
+    /// Registered devices
+    devices: usize,
+    stats: [ScanStats; MAX_SCAN_DEVICES],
+}
+
+static GOVERNOR: Mutex<RawMutex, RefCell<GovernorState>> = Mutex::new(RefCell::new(GovernorState {
+    policy: ScanPolicy::DEFAULT,
+    last_activity: Instant::from_ticks(0),
+    devices: 0,
+    stats: [ScanStats {
+        awake: Duration::from_ticks(0),
+        asleep: Duration::from_ticks(0),
+    }; MAX_SCAN_DEVICES],
+}));
+
+/// Set the scan policy of all input devices, it's used from the next scan pass
+pub fn set_scan_policy(policy: ScanPolicy) {
+    GOVERNOR.lock(|state| state.borrow_mut().policy = policy);
+}
+
+/// Notify the governor about activity on an input device, all devices go back to the first tier
+pub fn notify_input_activity() {
+    GOVERNOR.lock(|state| state.borrow_mut().last_activity = Instant::now());
+}
+
+/// Get the scan statistics of the registered device with the given id, in the order of registration
+pub fn scan_stats(id: usize) -> Option<ScanStats> {
+    GOVERNOR.lock(|state| {
+        let state = state.borrow();
+        (id < state.devices.min(MAX_SCAN_DEVICES)).then(|| state.stats[id])
+    })
+}
+
+/// Registration of an input device at the scan governor
+#[derive(Clone, Debug)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct ScanGovernor {
+    /// Id of the device, `None` if there are more than `MAX_SCAN_DEVICES` devices
+    id: Option<usize>,
+    /// The tier used by the last sleep
+    tier: usize,
+    /// Start of the current awake or asleep period
+    since: Instant,
+}
+
+impl Default for ScanGovernor {
+    fn default() -> Self {
+        Self::register()
+    }
+}
+
+impl ScanGovernor {
+    /// Register an input device
+    pub fn register() -> Self {
+        let id = GOVERNOR.lock(|state| {
+            let mut state = state.borrow_mut();
+            let id = state.devices;
+            state.devices += 1;
+            (id < MAX_SCAN_DEVICES).then_some(id)
+        });
+        Self {
+            id,
+            tier: 0,
+            since: Instant::now(),
+        }
+    }
+
+    /// Called after a scan pass with pressed keys, keys being debounced or other activity
+    pub fn activity(&self) {
+        notify_input_activity();
+    }
+
+    /// Called after a scan pass without activity, returns how the device should sleep.
+    ///
+    /// `active_interval` is the scan interval of the device while typing, `has_interrupt` is whether the device can
+    /// wake on a pin edge. [`ScanGovernor::wake`] must be called after the sleep.
+    pub fn idle(&mut self, active_interval: Duration, has_interrupt: bool) -> ScanRate {
+        let now = Instant::now();
+        let (tier_index, tier) = GOVERNOR.lock(|state| {
+            let mut state = state.borrow_mut();
+            let policy = state.policy;
+            let tier_index = policy.tier_index(now.saturating_duration_since(state.last_activity));
+            if let Some(id) = self.id {
+                state.stats[id].awake += now.saturating_duration_since(self.since);
+            }
+            (tier_index, policy.tiers.get(tier_index).copied())
+        });
+        self.since = now;
+        if tier_index != self.tier {
+            self.tier = tier_index;
+            if let Some((id, stats)) = self.id.and_then(|id| Some((id, scan_stats(id)?))) {
+                info!(
+                    "Input device {} enters scan tier {}, duty cycle: {}‰",
+                    id,
+                    tier_index,
+                    stats.duty_cycle_permille()
+                );
+            }
+        }
+
+        let Some(tier) = tier else {
+            // No tier in the policy, always scan at full rate
+            return ScanRate::Full;
+        };
+        let interval = active_interval.max(tier.interval);
+        if tier.interrupt_only && has_interrupt {
+            ScanRate::Interrupt
+        } else if interval == Duration::from_ticks(0) {
+            ScanRate::Full
+        } else {
+            ScanRate::Interval(interval)
+        }
+    }
+
+    /// Called when the device wakes up from the sleep returned by [`ScanGovernor::idle`]
+    pub fn wake(&mut self) {
+        let now = Instant::now();
+        let asleep = now.saturating_duration_since(self.since);
+        if let Some(id) = self.id {
+            GOVERNOR.lock(|state| state.borrow_mut().stats[id].asleep += asleep);
+        }
+        self.since = now;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const POLICY: ScanPolicy = ScanPolicy {
+        tiers: &[
+            ScanTier {
+                idle_after: Duration::from_secs(0),
+                interval: Duration::from_secs(0),
+                interrupt_only: false,
+            },
+            ScanTier {
+                idle_after: Duration::from_secs(1),
+                interval: Duration::from_millis(10),
+                interrupt_only: false,
+            },
+            ScanTier {
+                idle_after: Duration::from_secs(10),
+                interval: Duration::from_millis(50),
+                interrupt_only: true,
+            },
+        ],
+    };
+
+    #[test]
+    fn test_tier_index() {
+        assert_eq!(POLICY.tier_index(Duration::from_millis(0)), 0);
+        assert_eq!(POLICY.tier_index(Duration::from_millis(999)), 0);
+        assert_eq!(POLICY.tier_index(Duration::from_secs(1)), 1);
+        assert_eq!(POLICY.tier_index(Duration::from_secs(3600)), 2);
+        assert_eq!(ScanPolicy { tiers: &[] }.tier_index(Duration::from_secs(1)), 0);
+    }
+
+    #[test]
+    fn test_duty_cycle() {
+        let stats = ScanStats {
+            awake: Duration::from_millis(1),
+            asleep: Duration::from_millis(3),
+        };
+        assert_eq!(stats.duty_cycle_permille(), 250);
+        assert_eq!(ScanStats::default().duty_cycle_permille(), 1000);
+    }
+}
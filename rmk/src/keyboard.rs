@@ -6,7 +6,7 @@ use embassy_futures::yield_now;
 #[cfg(feature = "_ble")]
 use embassy_sync::signal::Signal;
 use embassy_time::{Duration, Instant, Timer, with_deadline};
-use heapless::Vec;
+use heapless::{Deque, Vec};
 use rmk_types::action::{Action, KeyAction, KeyboardAction, MorseMode};
 use rmk_types::keycode::{ConsumerKey, HidKeyCode, KeyCode, SpecialKey, SystemControlKey};
 use rmk_types::led_indicator::LedIndicator;
@@ -14,26 +14,36 @@ use rmk_types::modifier::ModifierCombination;
 use rmk_types::mouse_button::MouseButtons;
 use usbd_hid::descriptor::{MediaKeyboardReport, MouseReport, SystemControlReport};
 
+#[cfg(feature = "_ble")]
+use crate::ble::conn_param::notify_activity;
 use crate::channel::KEYBOARD_REPORT_CHANNEL;
 use crate::combo::Combo;
 use crate::config::Hand;
+#[cfg(not(feature = "nkro"))]
 use crate::descriptor::KeyboardReport;
+#[cfg(feature = "nkro")]
+use crate::descriptor::{NKRO_KEYCODE_BYTES, NkroKeyboardReport};
 #[cfg(all(feature = "split", feature = "_ble", feature = "controller"))]
 use crate::event::ClearPeerEvent;
+use crate::event::{
+    KEYBOARD_BATCH_EVENT_SIZE, KeyPos, KeyboardBatchEvent, KeyboardEvent, KeyboardEventPos, SubscribableInputEvent,
+    publish_input_event_async,
+};
 #[cfg(feature = "controller")]
 use crate::event::{KeyEvent, ModifierEvent, publish_controller_event};
-use crate::event::{KeyPos, KeyboardEvent, KeyboardEventPos, SubscribableInputEvent, publish_input_event_async};
 use crate::fork::{ActiveFork, StateBits};
 use crate::hid::Report;
-use crate::input_device::Runnable;
 use crate::input_device::rotary_encoder::Direction;
+use crate::input_device::{Runnable, motion};
 use crate::keyboard::held_buffer::{HeldBuffer, HeldKey, KeyState};
-use crate::keyboard_macros::MacroOperation;
+use crate::keyboard_macros::{MACRO_QUEUE_SIZE, MacroKey, MacroOperation, MacroPlayer};
 use crate::keymap::KeyMap;
+#[cfg(feature = "latency_trace")]
+use crate::latency_trace;
 use crate::morse::{MorsePattern, TAP};
 #[cfg(all(feature = "split", feature = "_ble"))]
 use crate::split::ble::central::update_activity_time;
-use crate::{FORK_MAX_NUM, boot};
+use crate::{FORK_MAX_NUM, HELD_BUFFER_SIZE, boot};
 
 pub(crate) mod combo;
 pub(crate) mod held_buffer;
@@ -41,8 +51,6 @@ pub(crate) mod morse;
 pub(crate) mod mouse;
 pub(crate) mod oneshot;
 
-const HOLD_BUFFER_SIZE: usize = 16;
-
 // Timestamp of the last key action, the value is the number of seconds since the boot
 #[cfg(feature = "_ble")]
 pub(crate) static LAST_KEY_TIMESTAMP: Signal<crate::RawMutex, u32> = Signal::new();
@@ -154,6 +162,8 @@ impl<const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_ENCOD
     /// Main keyboard processing task, it receives input devices result, processes keys.
     /// The report is sent using `send_report`.
     async fn run(&mut self) -> ! {
+        // The keymap may be loading from the storage at boot, the key events are queued until it's ready
+        crate::startup::wait_keymap_ready().await;
         loop {
             // TODO: Now the unprocessed_events is only used in one-shot keys and clear peer key.
             // Maybe it can be removed in the future?
@@ -165,11 +175,17 @@ impl<const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_ENCOD
             } else if let Some(key) = self.next_buffered_key() {
                 // Process buffered held key
                 self.process_buffered_key(key).await
+            } else if let Some(player) = &self.macro_player {
+                // Play the running macro step by step, new key events are processed between the steps
+                let next_step = player.wait_next_step();
+                match select(self.next_keyboard_event(), next_step).await {
+                    Either::First(event) => self.process_new_event(event).await,
+                    Either::Second(_) => self.step_macro().await,
+                }
             } else {
                 // No buffered tap-hold event, wait for new key
-                let event = self.keyboard_event_subscriber.receive().await;
-                // Process the key event
-                self.process_inner(event).await
+                let event = self.next_keyboard_event().await;
+                self.process_new_event(event).await;
             };
         }
     }
@@ -182,6 +198,12 @@ pub struct Keyboard<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usi
     /// Keyboard event subscriber - single instance to receive all keyboard events
     keyboard_event_subscriber: embassy_sync::channel::Receiver<'static, crate::RawMutex, KeyboardEvent, 16>,
 
+    /// Subscriber of key changes batched by matrices in frame mode
+    keyboard_batch_subscriber: <KeyboardBatchEvent as SubscribableInputEvent>::Subscriber,
+
+    /// Key changes of the last received batch which are not processed yet
+    batched_events: Deque<KeyboardEvent, KEYBOARD_BATCH_EVENT_SIZE>,
+
     /// Unprocessed events
     pub unprocessed_events: Vec<KeyboardEvent, 4>,
 
@@ -214,10 +236,16 @@ pub struct Keyboard<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usi
     /// The modifiers coming from (last) Action::KeyWithModifier
     with_modifiers: ModifierCombination,
 
-    /// Macro text typing state (affects the effective modifiers)
+    /// Macro text typing state (affects the modifiers of the macro's own reports)
     macro_texting: bool,
     macro_caps: bool,
 
+    /// The running macro
+    macro_player: Option<MacroPlayer>,
+
+    /// Triggered macros which wait for the running macro, the start index and the trigger event
+    macro_queue: Deque<(usize, KeyboardEvent), MACRO_QUEUE_SIZE>,
+
     /// The real state before fork activations is stored here
     fork_states: [Option<ActiveFork>; FORK_MAX_NUM], // chosen replacement key of the currently triggered forks and the related modifier suppression
     fork_keep_mask: ModifierCombination, // aggregate here the explicit modifiers pressed since the last fork activations
@@ -226,12 +254,30 @@ pub struct Keyboard<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usi
     held_modifiers: ModifierCombination,
 
     /// The held keys for the keyboard hid report, except the modifiers
+    #[cfg(not(feature = "nkro"))]
     held_keycodes: [HidKeyCode; 6],
 
     /// Registered key position.
     /// This is still needed besides `held_keycodes` because multiple keys with same keycode can be registered.
+    #[cfg(not(feature = "nkro"))]
     registered_keys: [Option<KeyboardEvent>; 6],
 
+    /// The held keys as NKRO bitmap, except the modifiers
+    #[cfg(feature = "nkro")]
+    nkro_report: NkroKeyboardReport,
+
+    /// Registered keycode of each key position and rotary encoder direction for the NKRO report.
+    /// A key position is registered only once, re-registering it replaces its keycode.
+    #[cfg(feature = "nkro")]
+    nkro_registered_keys: [[HidKeyCode; ROW]; COL],
+    #[cfg(feature = "nkro")]
+    nkro_registered_encoders: [[HidKeyCode; 2]; NUM_ENCODER],
+
+    /// Number of registered positions of each keycode in the NKRO bitmap.
+    /// Multiple positions can register the same keycode, the bit is cleared when the last one is released.
+    #[cfg(feature = "nkro")]
+    nkro_holders: [u8; NKRO_KEYCODE_BYTES * 8],
+
     /// Internal mouse report buf
     mouse_report: MouseReport,
 
@@ -257,6 +303,8 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         Keyboard {
             keymap,
             keyboard_event_subscriber: KeyboardEvent::input_subscriber(),
+            keyboard_batch_subscriber: KeyboardBatchEvent::input_subscriber(),
+            batched_events: Deque::new(),
             timer: [[None; ROW]; COL],
             rotary_encoder_timer: [[None; 2]; NUM_ENCODER],
             last_press_time: Instant::now(),
@@ -266,13 +314,25 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             with_modifiers: ModifierCombination::default(),
             macro_texting: false,
             macro_caps: false,
+            macro_player: None,
+            macro_queue: Deque::new(),
             fork_states: [None; FORK_MAX_NUM],
             fork_keep_mask: ModifierCombination::default(),
             unprocessed_events: Vec::new(),
             held_buffer: HeldBuffer::new(),
+            #[cfg(not(feature = "nkro"))]
             registered_keys: [None; 6],
             held_modifiers: ModifierCombination::default(),
+            #[cfg(not(feature = "nkro"))]
             held_keycodes: [HidKeyCode::No; 6],
+            #[cfg(feature = "nkro")]
+            nkro_report: NkroKeyboardReport::default(),
+            #[cfg(feature = "nkro")]
+            nkro_registered_keys: [[HidKeyCode::No; ROW]; COL],
+            #[cfg(feature = "nkro")]
+            nkro_registered_encoders: [[HidKeyCode::No; 2]; NUM_ENCODER],
+            #[cfg(feature = "nkro")]
+            nkro_holders: [0; NKRO_KEYCODE_BYTES * 8],
             mouse_report: MouseReport {
                 buttons: 0,
                 x: 0,
@@ -295,6 +355,31 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         KEYBOARD_REPORT_CHANNEL.sender().send(report).await
     }
 
+    /// Receive the next keyboard event.
+    ///
+    /// Single events and batched events are both received, the events of a batch are returned one by one in order.
+    async fn next_keyboard_event(&mut self) -> KeyboardEvent {
+        loop {
+            if let Some(event) = self.batched_events.pop_front() {
+                return event;
+            }
+            match select(
+                self.keyboard_event_subscriber.receive(),
+                self.keyboard_batch_subscriber.receive(),
+            )
+            .await
+            {
+                Either::First(event) => return event,
+                Either::Second(batch) => {
+                    for event in batch.events {
+                        // The deque has the same capacity as the batch
+                        let _ = self.batched_events.push_back(event);
+                    }
+                }
+            }
+        }
+    }
+
     /// Get a copy of the next timeout key in the buffer,
     /// which is either a combo component that is waiting for other combo keys,
     /// or a morse key that is in the pressed or released state.
@@ -307,7 +392,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
 
     // Clean up for leak keys, remove non morse keys in ProcessedButReleaseNotReportedYet state from the buffer
     pub(crate) fn clean_buffered_processed_keys(&mut self) {
-        self.held_buffer.keys.retain(|k| {
+        self.held_buffer.retain(|k| {
             if k.action.is_morse() {
                 true
             } else {
@@ -336,7 +421,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                     "[Combo] Waiting combo, timeout in: {:?}ms",
                     (key.timeout_time.saturating_duration_since(Instant::now())).as_millis()
                 );
-                match with_deadline(key.timeout_time, self.keyboard_event_subscriber.receive()).await {
+                match with_deadline(key.timeout_time, self.next_keyboard_event()).await {
                     Ok(event) => {
                         // Process new key event
                         debug!("[Combo] Interrupted by a new key event: {:?}", event);
@@ -353,7 +438,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                 if key.action.is_morse() {
                     // Wait for timeout or new key event
                     info!("Waiting morse key: {:?}", key.action);
-                    match with_deadline(key.timeout_time, self.keyboard_event_subscriber.receive()).await {
+                    match with_deadline(key.timeout_time, self.next_keyboard_event()).await {
                         Ok(event) => {
                             debug!("Buffered morse key interrupted by a new key event: {:?}", event);
                             self.process_inner(event).await;
@@ -369,6 +454,17 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         }
     }
 
+    /// Process a key event received from the input devices
+    async fn process_new_event(&mut self, event: KeyboardEvent) {
+        crate::startup::record_boot_phase(crate::startup::BootPhase::FirstKeyEvent);
+        #[cfg(feature = "latency_trace")]
+        latency_trace::begin_event(event.timestamp);
+        // Process the key event
+        self.process_inner(event).await;
+        #[cfg(feature = "latency_trace")]
+        latency_trace::end_event();
+    }
+
     /// Process key changes at (row, col)
     pub async fn process_inner(&mut self, event: KeyboardEvent) {
         #[cfg(feature = "vial_lock")]
@@ -381,10 +477,22 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         // Update activity time for BLE split central sleep management
         #[cfg(all(feature = "split", feature = "_ble"))]
         update_activity_time();
+        // Use the connection parameters for typing
+        #[cfg(feature = "_ble")]
+        notify_activity();
 
         // Process key
         let key_action = &self.keymap.borrow_mut().get_action_with_layer_cache(event);
 
+        // A key which can't trigger any combo, fork or morse key is processed directly when no other key is pending
+        if self.held_buffer.is_empty()
+            && self.keymap.borrow().is_plain_key(event.pos)
+            && !(self.combo_on && self.keymap.borrow_mut().has_started_combos())
+        {
+            self.process_resolved_key_action(*key_action, event).await;
+            return;
+        }
+
         if self.combo_on {
             if let (Some(key_action), is_combo) = self.process_combo(key_action, event).await {
                 self.process_key_action(&key_action, event, is_combo).await
@@ -466,7 +574,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     async fn fire_held_keys(
         &mut self,
         mut decision_for_current_key: KeyBehaviorDecision,
-        decisions: Vec<(KeyboardEventPos, HeldKeyDecision), 16>,
+        decisions: Vec<(KeyboardEventPos, HeldKeyDecision), HELD_BUFFER_SIZE>,
     ) -> (bool, KeyBehaviorDecision) {
         let mut keyboard_state_updated = false;
         // Fire buffered keys
@@ -496,7 +604,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                                 self.process_key_action_normal(action, held_key.event).await;
                                 held_key.state = KeyState::ProcessedButReleaseNotReportedYet(action);
                                 // Push back after triggered tap
-                                self.held_buffer.push_without_sort(held_key);
+                                self.held_buffer.push(held_key);
                             }
                             KeyState::Released(pattern) => {
                                 // In this state pattern is not surely finished,
@@ -537,7 +645,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                                     self.process_key_action_normal(action, held_key.event).await;
                                     held_key.state = KeyState::ProcessedButReleaseNotReportedYet(action);
                                     // Push back after triggered hold
-                                    self.held_buffer.push_without_sort(held_key);
+                                    self.held_buffer.push(held_key);
                                 }
                                 KeyState::Released(pattern) => {
                                     debug!("pattern after released, permissive hold: {:?}", pattern);
@@ -599,7 +707,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                                 _ => {} // For morse, the releasing will not be processed immediately, so just ignore it
                             }
                             // Push back after triggered hold
-                            self.held_buffer.push_without_sort(held_key);
+                            self.held_buffer.push(held_key);
                         }
                     }
 
@@ -650,11 +758,11 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         event: KeyboardEvent,
     ) -> (
         KeyBehaviorDecision,
-        Vec<(KeyboardEventPos, HeldKeyDecision), HOLD_BUFFER_SIZE>,
+        Vec<(KeyboardEventPos, HeldKeyDecision), HELD_BUFFER_SIZE>,
     ) {
         // Decision of current key and held keys
         let mut decision_for_current_key = KeyBehaviorDecision::Ignore;
-        let mut decisions: Vec<(_, HeldKeyDecision), HOLD_BUFFER_SIZE> = Vec::new();
+        let mut decisions: Vec<(_, HeldKeyDecision), HELD_BUFFER_SIZE> = Vec::new();
 
         // When pressing a morse key, check flow tap first.
         if event.pressed
@@ -676,13 +784,9 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                 .is_some_and(|k| matches!(k.state, KeyState::Pressed(_) | KeyState::Released(_)));
 
         if check_held_buffer {
-            // First, sort by press time
-            self.held_buffer.keys.sort_unstable_by_key(|k| k.press_time);
-
-            // Check all unresolved held keys, calculate their decision one-by-one
+            // Check all unresolved held keys in press order, calculate their decision one-by-one
             for held_key in self
                 .held_buffer
-                .keys
                 .iter()
                 .filter(|k| matches!(k.state, KeyState::Pressed(_) | KeyState::Released(_)))
             {
@@ -776,7 +880,12 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     async fn process_key_action_inner(&mut self, original_key_action: &KeyAction, event: KeyboardEvent) {
         // Start forks
         let key_action = self.try_start_forks(original_key_action, event);
+        self.process_resolved_key_action(key_action, event).await;
+        self.try_finish_forks(original_key_action, event);
+    }
 
+    /// Process the key action after the forks are resolved
+    async fn process_resolved_key_action(&mut self, key_action: KeyAction, event: KeyboardEvent) {
         // Clear with_modifier if a new key is pressed
         if self.with_modifiers.into_bits() != 0 && event.pressed {
             self.with_modifiers = ModifierCombination::new();
@@ -804,22 +913,22 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         } else {
             self.process_key_action_morse(&key_action, event).await;
         }
-        self.try_finish_forks(original_key_action, event);
     }
 
     /// Replaces the incoming key_action if a fork is configured for that key.
     /// The replacement decision is made at key_press time, and the decision
     /// is kept until the key is released.
     fn try_start_forks(&mut self, key_action: &KeyAction, event: KeyboardEvent) -> KeyAction {
-        if self.keymap.borrow().behavior.fork.forks.is_empty() {
+        // Most keys don't trigger any fork
+        let candidates = self.keymap.borrow().fork_candidates(key_action);
+        if candidates.is_empty() {
             return *key_action;
         }
 
         if !event.pressed {
-            for (i, fork) in (&self.keymap.borrow().behavior.fork.forks).into_iter().enumerate() {
-                if fork.trigger == *key_action
-                    && let Some(active) = self.fork_states[i]
-                {
+            let mut candidates = candidates;
+            while let Some(i) = candidates.pop_first() {
+                if let Some(active) = self.fork_states[i] {
                     // If the originating key of a fork is released, simply release the replacement key
                     // (The fork deactivation is delayed, will happen after the release hid report is sent)
                     debug!("replace input with fork action {:?}", active);
@@ -842,8 +951,11 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         let mut replacement = *key_action;
 
         'bind: loop {
-            for (i, fork) in (&self.keymap.borrow().behavior.fork.forks).into_iter().enumerate() {
-                if !triggered_forks[i] && self.fork_states[i].is_none() && fork.trigger == replacement {
+            // Only the forks which are triggered by the replacement are checked, not all fork slots
+            let mut candidates = self.keymap.borrow().fork_candidates(&replacement);
+            while let Some(i) = candidates.pop_first() {
+                if !triggered_forks[i] && self.fork_states[i].is_none() {
+                    let fork = self.keymap.borrow().behavior.fork.forks[i];
                     let decision = (fork.match_any & decision_state) != StateBits::default()
                         && (fork.match_none & decision_state) == StateBits::default();
 
@@ -913,11 +1025,10 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     // (explicit modifier suppressing effect will be stopped only AFTER the release hid report is sent)
     fn try_finish_forks(&mut self, original_key_action: &KeyAction, event: KeyboardEvent) {
         if !event.pressed {
-            for (i, fork) in (&self.keymap.borrow().behavior.fork.forks).into_iter().enumerate() {
-                if self.fork_states[i].is_some() && fork.trigger == *original_key_action {
-                    // if the originating key of a fork is released the replacement decision is not valid anymore
-                    self.fork_states[i] = None;
-                }
+            let mut candidates = self.keymap.borrow().fork_candidates(original_key_action);
+            while let Some(i) = candidates.pop_first() {
+                // if the originating key of a fork is released the replacement decision is not valid anymore
+                self.fork_states[i] = None;
             }
         }
     }
@@ -941,22 +1052,16 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     ///   When releasing, only trigger combos that contain the key_action.
     async fn trigger_delayed_combo(&mut self, key_action: &KeyAction, event: KeyboardEvent) {
         // First, find the delayed combo and trigger it
+        // When a key is pressed (interrupting a combo wait), trigger any delayed combo.
+        // When releasing a key, only trigger combos that contain the key_action.
         let triggered_combo = self
             .keymap
             .borrow_mut()
-            .behavior
-            .combo
-            .combos
-            .iter_mut()
-            .filter_map(|c| c.as_mut())
+            .combos_mut(key_action, event.pressed)
             .filter_map(|c| {
                 if c.is_all_pressed() && !c.is_triggered() {
-                    // When a key is pressed (interrupting a combo wait), trigger any delayed combo.
-                    // When releasing a key, only trigger combos that contain the key_action.
-                    if event.pressed || c.config.actions.contains(key_action) {
-                        // All keys are pressed but the combo is not triggered, trigger it
-                        return Some((c.size(), c));
-                    }
+                    // All keys are pressed but the combo is not triggered, trigger it
+                    return Some((c.size(), c));
                 }
                 None
             }) // Find all delayed combos
@@ -966,7 +1071,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         // Clean the held buffer, process the combo output action and clear other combos
         if let Some((action, combo_actions)) = triggered_combo {
             // Only remove keys that are part of the triggered combo from the held buffer
-            self.held_buffer.keys.retain(|item| {
+            self.held_buffer.retain(|item| {
                 if item.state != KeyState::WaitingCombo {
                     return true;
                 }
@@ -987,19 +1092,12 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     // Reset combos that contain a key_action but not triggered yet
     fn reset_combo(&mut self, key_action: &KeyAction) {
         // Reset other sub-combo states
-        self.keymap
-            .borrow_mut()
-            .behavior
-            .combo
-            .combos
-            .iter_mut()
-            .filter_map(|c| c.as_mut())
-            .for_each(|c| {
-                if c.is_all_pressed() && !c.is_triggered() && c.config.actions.contains(key_action) {
-                    info!("Resetting combo: {:?}", c,);
-                    c.reset();
-                }
-            });
+        self.keymap.borrow_mut().combos_mut(key_action, false).for_each(|c| {
+            if c.is_all_pressed() && !c.is_triggered() {
+                info!("Resetting combo: {:?}", c,);
+                c.reset();
+            }
+        });
     }
 
     /// Check combo before process keys.
@@ -1013,14 +1111,11 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             self.trigger_delayed_combo(key_action, event).await;
         }
 
+        // Other combos can't be affected by the key
         let max_size_of_updated_combo = self
             .keymap
             .borrow_mut()
-            .behavior
-            .combo
-            .combos
-            .iter_mut()
-            .filter_map(|c| c.as_mut())
+            .combos_mut(key_action, true)
             .map(|c| {
                 if c.update(key_action, event, current_layer) {
                     info!("Updated combo: {:?}", c);
@@ -1046,27 +1141,17 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             ));
 
             // Only one combo is updated, and triggered
-            let next_action = self
-                .keymap
-                .borrow_mut()
-                .behavior
-                .combo
-                .combos
-                .iter_mut()
-                .filter_map(|c| c.as_mut())
-                .find_map(|c| {
-                    if c.is_all_pressed() && !c.is_triggered() && c.size() == max_size {
-                        Some(c.trigger())
-                    } else {
-                        None
-                    }
-                });
+            let next_action = self.keymap.borrow_mut().combos_mut(key_action, true).find_map(|c| {
+                if c.is_all_pressed() && !c.is_triggered() && c.size() == max_size {
+                    Some(c.trigger())
+                } else {
+                    None
+                }
+            });
 
             if let Some(next_action) = next_action {
                 debug!("[Combo] {:?} triggered", next_action);
-                self.held_buffer
-                    .keys
-                    .retain(|item| item.state != KeyState::WaitingCombo);
+                self.held_buffer.retain(|item| item.state != KeyState::WaitingCombo);
                 self.reset_combo(key_action);
                 return (Some(next_action), true);
             }
@@ -1079,26 +1164,16 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                 let mut combo_output = None;
                 let mut releasing_triggered_combo = false;
 
-                for combo in self
-                    .keymap
-                    .borrow_mut()
-                    .behavior
-                    .combo
-                    .combos
-                    .iter_mut()
-                    .filter_map(|c| c.as_mut())
-                {
-                    if combo.config.actions.contains(key_action) {
-                        // Releasing a combo key in triggered combo
-                        releasing_triggered_combo |= combo.is_triggered();
-                        info!("[Combo] releasing: {:?}", combo);
-
-                        // Release the combo key, check whether the combo is fully released
-                        if combo.update_released(key_action) {
-                            // If the combo is fully released, update the combo output
-                            debug!("[Combo] {:?} is released", combo.config.output);
-                            combo_output = combo_output.or(Some(combo.config.output));
-                        }
+                for combo in self.keymap.borrow_mut().combos_mut(key_action, false) {
+                    // Releasing a combo key in triggered combo
+                    releasing_triggered_combo |= combo.is_triggered();
+                    info!("[Combo] releasing: {:?}", combo);
+
+                    // Release the combo key, check whether the combo is fully released
+                    if combo.update_released(key_action) {
+                        // If the combo is fully released, update the combo output
+                        debug!("[Combo] {:?} is released", combo.config.output);
+                        combo_output = combo_output.or(Some(combo.config.output));
                     }
                 }
 
@@ -1121,25 +1196,15 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         self.trigger_delayed_combo(key_action, event).await;
 
         // Dispatch all keys with state `WaitingCombo` in the held buffer
-        let mut i = 0;
-        while i < self.held_buffer.keys.len() {
-            if self.held_buffer.keys[i].state == KeyState::WaitingCombo {
-                let key = self.held_buffer.keys.swap_remove(i);
-                debug!("[Combo] Dispatching combo: {:?}", key);
-                self.process_key_action(&key.action, key.event, false).await;
-            } else {
-                i += 1;
-            }
+        while let Some(key) = self.held_buffer.remove_if(|k| k.state == KeyState::WaitingCombo) {
+            debug!("[Combo] Dispatching combo: {:?}", key);
+            self.process_key_action(&key.action, key.event, false).await;
         }
 
-        // Reset triggered combo states
+        // Reset the states of the started combos which aren't triggered
         self.keymap
             .borrow_mut()
-            .behavior
-            .combo
-            .combos
-            .iter_mut()
-            .filter_map(|combo| combo.as_mut())
+            .started_combos_mut()
             .filter(|combo| !combo.is_triggered())
             .for_each(Combo::reset);
     }
@@ -1190,7 +1255,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                 self.send_keyboard_report_with_resolved_modifiers(event.pressed).await;
                 self.update_osl(event);
             }
-            Action::TriggerMacro(macro_idx) => self.execute_macro(macro_idx, event).await,
+            Action::TriggerMacro(macro_idx) => self.execute_macro(macro_idx, event),
             Action::KeyWithModifier(key_code, modifiers) => {
                 if event.pressed {
                     // These modifiers will be combined into the hid report, so
@@ -1261,7 +1326,6 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
 
     pub fn print_buffer(&self) {
         self.held_buffer
-            .keys
             .iter()
             .enumerate()
             .for_each(|(i, k)| info!("\n✅Held buffer {}: {:?}, state: {:?}", i, k.event, k.state));
@@ -1284,7 +1348,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                 OneShotState::Initial(m) | OneShotState::Single(m) => {
                     self.osm_state = OneShotState::Single(m);
                     let timeout = Timer::after(self.keymap.borrow().behavior.one_shot.timeout);
-                    match select(timeout, self.keyboard_event_subscriber.receive()).await {
+                    match select(timeout, self.next_keyboard_event()).await {
                         Either::First(_) => {
                             // Timeout, release modifiers
                             self.update_osl(event);
@@ -1337,7 +1401,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                     self.osl_state = OneShotState::Single(l);
 
                     let timeout = embassy_time::Timer::after(self.keymap.borrow().behavior.one_shot.timeout);
-                    match select(timeout, self.keyboard_event_subscriber.receive()).await {
+                    match select(timeout, self.next_keyboard_event()).await {
                         Either::First(_) => {
                             // Timeout, deactivate layer
                             self.keymap.borrow_mut().deactivate_layer(layer_num);
@@ -1384,22 +1448,13 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     }
 
     /// Calculates the combined effect of all modifiers:
-    /// - text macro related modifier suppressions + capitalization
     /// - registered (held) modifiers keys
     /// - one-shot modifiers
     /// - effect of Action::KeyWithModifiers (while they are pressed)
     /// - possible fork related modifier suppressions
+    ///
+    /// The modifiers of a text typing macro are resolved by `resolve_macro_modifiers`, only for the macro's own reports.
     pub fn resolve_modifiers(&mut self, pressed: bool) -> ModifierCombination {
-        // Text typing macro should not be affected by any modifiers,
-        // only its own capitalization
-        if self.macro_texting {
-            if self.macro_caps {
-                return ModifierCombination::new().with_left_shift(true);
-            } else {
-                return ModifierCombination::new();
-            }
-        }
-
         // "explicit" modifiers: one-shot modifier, registered held modifiers:
         let mut result = self.resolve_explicit_modifiers(pressed);
 
@@ -1473,12 +1528,16 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             KeyboardAction::Bootloader => {
                 // When releasing the key, process the boot action
                 if !event.pressed {
+                    #[cfg(feature = "storage")]
+                    crate::storage::commit_storage().await;
                     boot::jump_to_bootloader();
                 }
             }
             KeyboardAction::Reboot => {
                 // When releasing the key, process the boot action
                 if !event.pressed {
+                    #[cfg(feature = "storage")]
+                    crate::storage::commit_storage().await;
                     boot::reboot_keyboard();
                 }
             }
@@ -1722,14 +1781,14 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
 
         // Apply diagonal compensation for movement
         if self.mouse_report.x != 0 && self.mouse_report.y != 0 {
-            let (x, y) = self.apply_diagonal_compensation(self.mouse_report.x, self.mouse_report.y);
+            let (x, y) = motion::diagonal_compensation(self.mouse_report.x, self.mouse_report.y);
             self.mouse_report.x = x;
             self.mouse_report.y = y;
         }
 
         // Apply diagonal compensation for wheel
         if self.mouse_report.wheel != 0 && self.mouse_report.pan != 0 {
-            let (wheel, pan) = self.apply_diagonal_compensation(self.mouse_report.wheel, self.mouse_report.pan);
+            let (wheel, pan) = motion::diagonal_compensation(self.mouse_report.wheel, self.mouse_report.pan);
             self.mouse_report.wheel = wheel;
             self.mouse_report.pan = pan;
         }
@@ -1815,12 +1874,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                     if event.pressed {
                         // Wait for 5s, if the key is still pressed, clear split peer info
                         // If there's any other key event received during this period, skip
-                        match select(
-                            embassy_time::Timer::after_millis(5000),
-                            self.keyboard_event_subscriber.receive(),
-                        )
-                        .await
-                        {
+                        match select(embassy_time::Timer::after_millis(5000), self.next_keyboard_event()).await {
                             Either::First(_) => {
                                 // Timeout reached, send clear peer message
                                 #[cfg(feature = "controller")]
@@ -1859,92 +1913,175 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         }
     }
 
-    async fn execute_macro(&mut self, macro_idx: u8, event: KeyboardEvent) {
+    /// Start the macro, or queue it if another macro is running.
+    ///
+    /// The macro is played by `step_macro`, so the keyboard isn't blocked until the macro is finished.
+    fn execute_macro(&mut self, macro_idx: u8, event: KeyboardEvent) {
         // Execute the macro only when releasing the key
         if event.pressed {
             return;
         }
 
-        // Read macro operations until the end of the macro
-        let macro_idx = self.keymap.borrow().get_macro_sequence_start(macro_idx);
-        if let Some(macro_start_idx) = macro_idx {
-            let mut offset = 0;
-            loop {
-                // First, get the next macro operation
-                let (operation, new_offset) = self.keymap.borrow().get_next_macro_operation(macro_start_idx, offset);
-                // Execute the operation
-                match operation {
-                    MacroOperation::Press(k) => {
-                        self.macro_texting = false;
-                        self.register_key(k, event);
-                        self.send_keyboard_report_with_resolved_modifiers(true).await;
-                    }
-                    MacroOperation::Release(k) => {
-                        self.macro_texting = false;
-                        self.unregister_key(k, event);
-                        self.send_keyboard_report_with_resolved_modifiers(false).await;
-                    }
-                    MacroOperation::Tap(k) => {
-                        self.macro_texting = false;
-                        self.register_key(k, event);
-                        self.send_keyboard_report_with_resolved_modifiers(true).await;
-                        embassy_time::Timer::after_millis(2).await;
-                        self.unregister_key(k, event);
-                        self.send_keyboard_report_with_resolved_modifiers(false).await;
-                    }
-                    MacroOperation::Text(k, is_cap) => {
-                        self.macro_texting = true;
-                        self.macro_caps = is_cap;
-                        if is_cap {
-                            self.send_keyboard_report_with_resolved_modifiers(true).await;
-                            embassy_time::Timer::after_millis(12).await;
-                        }
-                        self.register_keycode(k, event);
-                        self.send_keyboard_report_with_resolved_modifiers(true).await;
-                        embassy_time::Timer::after_millis(12).await;
-                        self.unregister_keycode(k, event);
-                        self.send_keyboard_report_with_resolved_modifiers(false).await;
-                        if is_cap {
-                            self.macro_caps = false;
-                            embassy_time::Timer::after_millis(12).await;
-                            self.send_keyboard_report_with_resolved_modifiers(false).await;
-                        }
-                    }
-                    MacroOperation::Delay(t) => {
-                        embassy_time::Timer::after_millis(t as u64).await;
-                    }
-                    MacroOperation::End => {
-                        if self.macro_texting {
-                            //restore the state of the keyboard (held modifiers, etc.) after text typing
-                            self.send_keyboard_report_with_resolved_modifiers(false).await;
-                            self.macro_texting = false;
-                        }
-                        break;
-                    }
-                };
+        let Some(macro_start_idx) = self.keymap.borrow().get_macro_sequence_start(macro_idx) else {
+            error!("Macro not found");
+            return;
+        };
+        if self.macro_player.is_none() {
+            self.macro_player = Some(MacroPlayer::new(macro_start_idx, event));
+        } else if self.macro_queue.push_back((macro_start_idx, event)).is_err() {
+            warn!("Too many macros are triggered, macro {} is dropped", macro_idx);
+        }
+    }
+
+    /// Play the running macro and the queued ones until all of them are finished, new key events aren't processed
+    pub async fn play_macros(&mut self) {
+        while let Some(player) = &self.macro_player {
+            player.wait_next_step().await;
+            self.step_macro().await;
+        }
+    }
+
+    /// Play the next step of the running macro, every step sends at most one keyboard report.
+    ///
+    /// The key pressed by the last step is released before the next operation. A text key is released in the same
+    /// report as the next text key is pressed, if they have different keycodes and the same shift state.
+    async fn step_macro(&mut self) {
+        let Some(mut player) = self.macro_player.take() else {
+            return;
+        };
+        player.start_step();
+        let (operation, new_offset) = self
+            .keymap
+            .borrow()
+            .get_next_macro_operation(player.start, player.offset);
 
-                offset = new_offset;
-                if offset > self.keymap.borrow().behavior.keyboard_macros.macro_sequences.len() {
-                    break;
+        if let Some(pressed) = player.pressed.take() {
+            match (pressed, &operation) {
+                (MacroKey::Text(last, last_cap), MacroOperation::Text(k, is_cap))
+                    if last != *k && last_cap == *is_cap =>
+                {
+                    self.unregister_keycode(last, player.event);
+                    self.register_keycode(*k, player.event);
+                    player.pressed = Some(MacroKey::Text(*k, *is_cap));
+                    player.offset = new_offset;
                 }
-                embassy_time::Timer::after_millis(1).await;
+                (MacroKey::Text(last, _), _) => self.unregister_keycode(last, player.event),
+                (MacroKey::Tap(last), _) => self.unregister_key(last, player.event),
             }
+            let pressed = player.pressed.is_some();
+            self.send_macro_report(&mut player, pressed).await;
+            self.macro_player = Some(player);
+            return;
+        }
+
+        match operation {
+            MacroOperation::Press(k) => {
+                self.macro_texting = false;
+                self.register_key(k, player.event);
+                self.send_macro_report(&mut player, true).await;
+            }
+            MacroOperation::Release(k) => {
+                self.macro_texting = false;
+                self.unregister_key(k, player.event);
+                self.send_macro_report(&mut player, false).await;
+            }
+            MacroOperation::Tap(k) => {
+                self.macro_texting = false;
+                self.register_key(k, player.event);
+                player.pressed = Some(MacroKey::Tap(k));
+                self.send_macro_report(&mut player, true).await;
+            }
+            MacroOperation::Text(k, is_cap) => {
+                if is_cap != (self.macro_texting && self.macro_caps) {
+                    // Shift is pressed or released in a separate report before the key
+                    self.macro_texting = true;
+                    self.macro_caps = is_cap;
+                    self.send_macro_report(&mut player, is_cap).await;
+                    self.macro_player = Some(player);
+                    return;
+                }
+                self.macro_texting = true;
+                self.register_keycode(k, player.event);
+                player.pressed = Some(MacroKey::Text(k, is_cap));
+                self.send_macro_report(&mut player, true).await;
+            }
+            MacroOperation::Delay(t) => player.delay(t),
+            MacroOperation::End => {
+                self.finish_macro().await;
+                return;
+            }
+        };
+
+        player.offset = new_offset;
+        if player.offset > self.keymap.borrow().behavior.keyboard_macros.macro_sequences.len() {
+            self.finish_macro().await;
         } else {
-            error!("Macro not found");
+            self.macro_player = Some(player);
         }
     }
 
+    /// Finish the running macro and start the next queued one
+    async fn finish_macro(&mut self) {
+        if self.macro_texting {
+            // Restore the state of the keyboard (held modifiers, etc.) after text typing
+            self.macro_texting = false;
+            self.macro_caps = false;
+            self.send_keyboard_report_with_resolved_modifiers(false).await;
+        }
+        self.macro_player = self
+            .macro_queue
+            .pop_front()
+            .map(|(start, event)| MacroPlayer::new(start, event));
+    }
+
+    /// Modifiers of the report of a macro step.
+    ///
+    /// Text typing macro should not be affected by any modifiers, only its own capitalization. The keys which are
+    /// pressed between the steps are reported with their own modifiers.
+    fn resolve_macro_modifiers(&mut self, pressed: bool) -> ModifierCombination {
+        if !self.macro_texting {
+            return self.resolve_modifiers(pressed);
+        }
+        if self.macro_caps {
+            ModifierCombination::new().with_left_shift(true)
+        } else {
+            ModifierCombination::new()
+        }
+    }
+
+    /// Send the keyboard report of a macro step, the next step waits until it's written
+    async fn send_macro_report(&mut self, player: &mut MacroPlayer, pressed: bool) {
+        player.report_queued();
+        let modifiers = self.resolve_macro_modifiers(pressed);
+        self.send_keyboard_report(modifiers, pressed).await;
+    }
+
     pub(crate) async fn send_keyboard_report_with_resolved_modifiers(&mut self, pressed: bool) {
         // all modifier related effects are combined here to be sent with the hid report:
         let modifiers = self.resolve_modifiers(pressed);
+        self.send_keyboard_report(modifiers, pressed).await;
+    }
+
+    async fn send_keyboard_report(&mut self, modifiers: ModifierCombination, pressed: bool) {
         info!("Sending keyboard report, pressed: {}", pressed);
-        self.send_report(Report::KeyboardReport(KeyboardReport {
+        #[cfg(not(feature = "nkro"))]
+        let report = Report::KeyboardReport(KeyboardReport {
             modifier: modifiers.into_bits(),
             reserved: 0,
             leds: LOCK_LED_STATES.load(core::sync::atomic::Ordering::Relaxed),
             keycodes: self.held_keycodes.map(|k| k as u8),
-        }))
-        .await;
+        });
+        // The writer downgrades it to the boot keyboard report if the host doesn't use NKRO
+        #[cfg(feature = "nkro")]
+        let report = Report::NkroReport(NkroKeyboardReport {
+            modifier: modifiers.into_bits(),
+            keycodes: self.nkro_report.keycodes,
+        });
+        #[cfg(feature = "latency_trace")]
+        latency_trace::report_queuing(&report);
+        self.send_report(report).await;
+        #[cfg(feature = "latency_trace")]
+        latency_trace::report_queued();
 
         // Yield once after sending the report to channel
         yield_now().await;
@@ -2048,7 +2185,67 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         }
     }
 
+    /// Get the registered NKRO keycode of the key position or the rotary encoder direction
+    #[cfg(feature = "nkro")]
+    fn nkro_registered_key_mut(&mut self, event: KeyboardEvent) -> Option<&mut HidKeyCode> {
+        match event.pos {
+            KeyboardEventPos::Key(pos) => self
+                .nkro_registered_keys
+                .get_mut(pos.col as usize)?
+                .get_mut(pos.row as usize),
+            KeyboardEventPos::RotaryEncoder(encoder_pos) => {
+                if encoder_pos.direction == Direction::None {
+                    return None;
+                }
+                self.nkro_registered_encoders
+                    .get_mut(encoder_pos.id as usize)?
+                    .get_mut(encoder_pos.direction as usize)
+            }
+        }
+    }
+
+    /// Register a key to be sent in hid report.
+    #[cfg(feature = "nkro")]
+    fn register_keycode(&mut self, key: HidKeyCode, event: KeyboardEvent) {
+        // If the position is already registered, its previous keycode is replaced
+        if let Some(registered) = self.nkro_registered_key_mut(event) {
+            let previous = core::mem::replace(registered, key);
+            if previous != HidKeyCode::No {
+                self.release_nkro_holder(previous);
+            }
+        }
+        if let Some(holders) = self.nkro_holders.get_mut(key as usize) {
+            *holders = holders.saturating_add(1);
+        }
+        self.nkro_report.set_key(key as u8);
+    }
+
+    /// Unregister a key from hid report.
+    #[cfg(feature = "nkro")]
+    fn unregister_keycode(&mut self, key: HidKeyCode, event: KeyboardEvent) {
+        // Release the keycode registered by the position, or the given key if the event has no position slot.
+        // A position which is already released holds nothing, so a duplicated release doesn't release other holders.
+        let key = match self.nkro_registered_key_mut(event) {
+            Some(registered) if *registered == HidKeyCode::No => return,
+            Some(registered) => core::mem::replace(registered, HidKeyCode::No),
+            None => key,
+        };
+        self.release_nkro_holder(key);
+    }
+
+    /// Release one holder of the keycode, the key is cleared from the NKRO bitmap when there's no holder left
+    #[cfg(feature = "nkro")]
+    fn release_nkro_holder(&mut self, key: HidKeyCode) {
+        if let Some(holders) = self.nkro_holders.get_mut(key as usize) {
+            *holders = holders.saturating_sub(1);
+            if *holders == 0 {
+                self.nkro_report.clear_key(key as u8);
+            }
+        }
+    }
+
     /// Register a key to be sent in hid report.
+    #[cfg(not(feature = "nkro"))]
     fn register_keycode(&mut self, key: HidKeyCode, event: KeyboardEvent) {
         // First, find the key event slot according to the position
         let slot = self.registered_keys.iter().enumerate().find_map(|(i, k)| {
@@ -2074,6 +2271,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     }
 
     /// Unregister a key from hid report.
+    #[cfg(not(feature = "nkro"))]
     fn unregister_keycode(&mut self, key: HidKeyCode, event: KeyboardEvent) {
         // First, find the key event slot according to the position
         let slot = self.registered_keys.iter().enumerate().find_map(|(i, k)| {
@@ -2159,21 +2357,13 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         } else if self.mouse_repeat >= config.time_to_max {
             (config.move_delta as u16).saturating_mul(config.max_speed as u16)
         } else {
-            // Natural acceleration with smooth unit progression.
-            // Calculate smooth progress using asymptotic curve: f(x) = 2x - x².
-            // Where x = repeat_count / time_to_max, giving smooth progression from 0 to 1
-            let repeat_count = self.mouse_repeat as u16;
-            let time_to_max = config.time_to_max as u16;
-            let min_unit = config.move_delta as u16;
-            let max_unit = (config.move_delta as u16).saturating_mul(config.max_speed as u16);
-            let unit_range = max_unit - min_unit;
-
-            // Use saturating operations to handle overflow cases
-            let linear_term = 2u16.saturating_mul(repeat_count).saturating_mul(time_to_max);
-            let quadratic_term = repeat_count.saturating_mul(repeat_count);
-            let progress_numerator = linear_term.saturating_sub(quadratic_term);
-            let progress_denominator = time_to_max.saturating_mul(time_to_max);
-            min_unit + (unit_range.saturating_mul(progress_numerator) / progress_denominator.max(1))
+            // Natural acceleration with smooth unit progression
+            motion::ease_out(
+                config.move_delta as u16,
+                (config.move_delta as u16).saturating_mul(config.max_speed as u16),
+                self.mouse_repeat as u16,
+                config.time_to_max as u16,
+            )
         };
 
         let final_unit = if unit > config.move_max as u16 {
@@ -2202,21 +2392,13 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         } else if self.mouse_wheel_repeat >= config.wheel_time_to_max {
             (config.wheel_delta as u16).saturating_mul(config.wheel_max_speed_multiplier as u16)
         } else {
-            // Natural acceleration with smooth unit progression.
-            let repeat_count = self.mouse_wheel_repeat as u16;
-            let time_to_max = config.wheel_time_to_max as u16;
-            let min_unit = config.wheel_delta as u16;
-            let max_unit = (config.wheel_delta as u16).saturating_mul(config.wheel_max_speed_multiplier as u16);
-            let unit_range = max_unit - min_unit;
-
-            // Calculate smooth progress using asymptotic curve: f(x) = 2x - x².
-            // Use saturating operations to handle overflow cases.
-            let linear_term = 2u16.saturating_mul(repeat_count).saturating_mul(time_to_max);
-            let quadratic_term = repeat_count.saturating_mul(repeat_count);
-            let progress_numerator = linear_term.saturating_sub(quadratic_term);
-            let progress_denominator = time_to_max.saturating_mul(time_to_max);
-
-            min_unit + (unit_range.saturating_mul(progress_numerator) / progress_denominator.max(1))
+            // Natural acceleration with smooth unit progression
+            motion::ease_out(
+                config.wheel_delta as u16,
+                (config.wheel_delta as u16).saturating_mul(config.wheel_max_speed_multiplier as u16),
+                self.mouse_wheel_repeat as u16,
+                config.wheel_time_to_max as u16,
+            )
         };
 
         let final_unit = if unit > config.wheel_max as u16 {
@@ -2229,28 +2411,6 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
 
         final_unit.min(i8::MAX as u16) as i8
     }
-
-    /// Apply diagonal movement compensation (approximation of 1/sqrt(2))
-    fn apply_diagonal_compensation(&self, mut x: i8, mut y: i8) -> (i8, i8) {
-        if x != 0 && y != 0 {
-            // Apply 1/sqrt(2) approximation using 181/256 (0.70703125)
-            let x_compensated = (x as i16 * 181 + 128) / 256;
-            let y_compensated = (y as i16 * 181 + 128) / 256;
-
-            x = if x_compensated == 0 && x != 0 {
-                if x > 0 { 1 } else { -1 }
-            } else {
-                x_compensated as i8
-            };
-
-            y = if y_compensated == 0 && y != 0 {
-                if y > 0 { 1 } else { -1 }
-            } else {
-                y_compensated as i8
-            };
-        }
-        (x, y)
-    }
 }
 
 #[derive(Debug, PartialEq, Eq)]
@@ -2290,7 +2450,8 @@ pub enum HeldKeyDecision {
     Normal,
 }
 
-#[cfg(test)]
+// These tests check the 6KRO slots, which don't exist when `nkro` is enabled
+#[cfg(all(test, not(feature = "nkro")))]
 mod test {
 
     use embassy_futures::block_on;
@@ -2477,7 +2638,7 @@ mod test {
                     KeyboardEventPos::Key(KeyPos { row: 0, col: 0 }),
                     0,
                     KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::Again))),
-                );
+                ).unwrap();
 
                 // first press ever of the Again issues KeyCode:No
                 keyboard.process_inner(KeyboardEvent::key(0, 0, true)).await;
@@ -2519,17 +2680,17 @@ mod test {
                     KeyboardEventPos::Key(KeyPos { row: 0, col: 0 }),
                     0,
                     KeyAction::TapHold(Action::Key(KeyCode::Hid(HidKeyCode::F)), Action::Key(KeyCode::Hid(HidKeyCode::Again)), Default::default()),
-                );
+                ).unwrap();
                 keyboard.keymap.borrow_mut().set_action_at(
                     KeyboardEventPos::Key(KeyPos { row: 2, col: 1 }),
                     0,
                     KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::A))),
-                );
+                ).unwrap();
                 keyboard.keymap.borrow_mut().set_action_at(
                     KeyboardEventPos::Key(KeyPos { row: 2, col: 2 }),
                     0,
                     KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::S))),
-                );
+                ).unwrap();
 
                 // Press down F
                 // first press ever of the Again issues KeyCode:No
@@ -2758,7 +2919,7 @@ mod test {
                     KeyboardEventPos::Key(KeyPos { row: 2, col: 1 }),
                     0,
                     KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::A))),
-                );
+                ).unwrap();
 
 
                 // Press Z key, by itself it should emit 'MouseBtn5'
@@ -2842,3 +3003,123 @@ mod test {
         }
     }
 }
+
+#[cfg(all(test, feature = "nkro"))]
+mod nkro_test {
+    use embassy_futures::block_on;
+    use rmk_types::action::KeyAction;
+    use rusty_fork::rusty_fork_test;
+
+    use super::*;
+    use crate::config::{BehaviorConfig, PositionalConfig};
+    use crate::{a, k, layer, mo};
+
+    #[rustfmt::skip]
+    const fn get_keymap() -> [[[KeyAction; 3]; 1]; 2] {
+        [
+            layer!([
+                [k!(A), k!(B), mo!(1)]
+            ]),
+            layer!([
+                [a!(No), k!(A), a!(Transparent)]
+            ]),
+        ]
+    }
+
+    fn create_test_keyboard() -> Keyboard<'static, 1, 3, 2> {
+        let behavior_config = Box::leak(Box::new(BehaviorConfig::default()));
+        let per_key_config = Box::leak(Box::new(PositionalConfig::default()));
+        let keymap = Box::leak(Box::new(get_keymap()));
+        let keymap = block_on(KeyMap::new(keymap, None, behavior_config, per_key_config));
+        Keyboard::new(Box::leak(Box::new(RefCell::new(keymap))))
+    }
+
+    fn is_pressed(keyboard: &Keyboard<'static, 1, 3, 2>, key: HidKeyCode) -> bool {
+        keyboard.nkro_report.is_pressed(key as u8)
+    }
+
+    rusty_fork_test! {
+        #[test]
+        fn test_nkro_same_keycode_from_two_positions() {
+            let main = async {
+                let mut keyboard = create_test_keyboard();
+
+                // Base layer A, then A from the layer 1 on another position
+                keyboard.process_inner(KeyboardEvent::key(0, 0, true)).await;
+                keyboard.process_inner(KeyboardEvent::key(0, 2, true)).await;
+                keyboard.process_inner(KeyboardEvent::key(0, 1, true)).await;
+                assert!(is_pressed(&keyboard, HidKeyCode::A));
+                assert!(!is_pressed(&keyboard, HidKeyCode::B));
+
+                // A is still held by the other position
+                keyboard.process_inner(KeyboardEvent::key(0, 0, false)).await;
+                assert!(is_pressed(&keyboard, HidKeyCode::A));
+
+                keyboard.process_inner(KeyboardEvent::key(0, 1, false)).await;
+                assert!(!is_pressed(&keyboard, HidKeyCode::A));
+                keyboard.process_inner(KeyboardEvent::key(0, 2, false)).await;
+                assert!(keyboard.nkro_report.keycodes.iter().all(|&b| b == 0));
+            };
+            block_on(main);
+        }
+
+        #[test]
+        fn test_nkro_release_in_press_order() {
+            let main = async {
+                let mut keyboard = create_test_keyboard();
+
+                keyboard.register_key(HidKeyCode::A, KeyboardEvent::key(0, 0, true));
+                keyboard.register_key(HidKeyCode::A, KeyboardEvent::key(0, 1, true));
+                keyboard.register_key(HidKeyCode::B, KeyboardEvent::key(0, 2, true));
+
+                keyboard.unregister_key(HidKeyCode::A, KeyboardEvent::key(0, 1, false));
+                assert!(is_pressed(&keyboard, HidKeyCode::A));
+                keyboard.unregister_key(HidKeyCode::A, KeyboardEvent::key(0, 0, false));
+                assert!(!is_pressed(&keyboard, HidKeyCode::A));
+                assert!(is_pressed(&keyboard, HidKeyCode::B));
+
+                // Releasing a key which isn't registered doesn't underflow
+                keyboard.unregister_key(HidKeyCode::A, KeyboardEvent::key(0, 0, false));
+                keyboard.register_key(HidKeyCode::A, KeyboardEvent::key(0, 0, true));
+                assert!(is_pressed(&keyboard, HidKeyCode::A));
+            };
+            block_on(main);
+        }
+
+        #[test]
+        fn test_nkro_reregister_position() {
+            let main = async {
+                let mut keyboard = create_test_keyboard();
+
+                // The same position registered again replaces its keycode
+                keyboard.register_key(HidKeyCode::A, KeyboardEvent::key(0, 0, true));
+                keyboard.register_key(HidKeyCode::B, KeyboardEvent::key(0, 0, true));
+                assert!(!is_pressed(&keyboard, HidKeyCode::A));
+                assert!(is_pressed(&keyboard, HidKeyCode::B));
+
+                keyboard.register_key(HidKeyCode::B, KeyboardEvent::key(0, 0, true));
+                keyboard.unregister_key(HidKeyCode::B, KeyboardEvent::key(0, 0, false));
+                assert!(!is_pressed(&keyboard, HidKeyCode::B));
+            };
+            block_on(main);
+        }
+
+        #[test]
+        fn test_nkro_duplicated_release() {
+            let main = async {
+                let mut keyboard = create_test_keyboard();
+
+                keyboard.register_key(HidKeyCode::A, KeyboardEvent::key(0, 0, true));
+                keyboard.register_key(HidKeyCode::A, KeyboardEvent::key(0, 1, true));
+                keyboard.unregister_key(HidKeyCode::A, KeyboardEvent::key(0, 0, false));
+                // A late release of the released position doesn't release A held by the other position
+                keyboard.unregister_key(HidKeyCode::A, KeyboardEvent::key(0, 0, false));
+                assert!(is_pressed(&keyboard, HidKeyCode::A));
+
+                keyboard.unregister_key(HidKeyCode::A, KeyboardEvent::key(0, 1, false));
+                assert!(!is_pressed(&keyboard, HidKeyCode::A));
+            };
+            block_on(main);
+        }
+    }
+}
@@ -1,88 +1,342 @@
 use embassy_time::Instant;
+use heapless::Vec;
 use rmk_types::action::{Action, KeyAction};
 
+use crate::HELD_BUFFER_SIZE;
 use crate::event::{KeyboardEvent, KeyboardEventPos};
 use crate::morse::MorsePattern;
 
+/// Marks an empty entry of the position index
+const EMPTY: u8 = u8::MAX;
+
+/// Size of the position index, at most half of the entries are used so that probe sequences stay short
+const INDEX_SIZE: usize = (2 * HELD_BUFFER_SIZE).next_power_of_two();
+
 /// The buffer of held keys.
-#[derive(Debug, Default, Clone)]
+///
+/// Each key stays in its slot until it's removed. On top of the slots, the buffer maintains:
+/// - a doubly linked list of the slots ordered by press time, which is the order of iteration.
+///   Keys are pushed with the current time, so a key is appended to the tail in O(1), and removed in O(1)
+/// - a binary min-heap of the slots by timeout time, so that the next timeout is found in O(1)
+///   and a key is inserted or removed in O(log n)
+/// - an open addressing hash index from `KeyboardEventPos` to slot
+///
+/// `press_time` and `timeout_time` of a buffered key must only be changed by [`HeldBuffer::update_times`],
+/// which keeps both orders valid.
+#[derive(Debug, Clone)]
 #[cfg_attr(feature = "defmt", derive(defmt::Format))]
 pub struct HeldBuffer {
-    // TODO: Make the buffer size configurable
-    pub(crate) keys: heapless::Vec<HeldKey, 16>,
+    /// Storage of held keys
+    slots: [Option<HeldKey>; HELD_BUFFER_SIZE],
+    /// First and last slot in press order, keys with the same press time keep the insertion order
+    press_head: u8,
+    press_tail: u8,
+    /// Next and previous slot of each occupied slot in press order
+    press_next: [u8; HELD_BUFFER_SIZE],
+    press_prev: [u8; HELD_BUFFER_SIZE],
+    /// Binary min-heap of occupied slots, by timeout time
+    timeouts: Vec<u8, HELD_BUFFER_SIZE>,
+    /// Index of each occupied slot in `timeouts`
+    heap_index: [u8; HELD_BUFFER_SIZE],
+    /// Hash index from key position to slot, with linear probing
+    pos_index: [u8; INDEX_SIZE],
+}
+
+impl Default for HeldBuffer {
+    fn default() -> Self {
+        Self::new()
+    }
 }
 
 impl HeldBuffer {
     /// Create a new held buffer
     pub fn new() -> Self {
         Self {
-            keys: heapless::Vec::new(),
+            slots: [None; HELD_BUFFER_SIZE],
+            press_head: EMPTY,
+            press_tail: EMPTY,
+            press_next: [EMPTY; HELD_BUFFER_SIZE],
+            press_prev: [EMPTY; HELD_BUFFER_SIZE],
+            timeouts: Vec::new(),
+            heap_index: [EMPTY; HELD_BUFFER_SIZE],
+            pos_index: [EMPTY; INDEX_SIZE],
         }
     }
 
-    /// Push a new held key into the buffer and then sort by the timeout
+    /// Push a new held key into the buffer
     pub fn push(&mut self, key: HeldKey) {
-        if let Err(e) = self.keys.push(key) {
-            error!("Held buffer overflowed, cannot save: {:?}", e);
-        }
-
-        // Sort the buffer after push
-        self.keys.sort_unstable_by_key(|k| k.timeout_time);
-    }
+        let Some(slot) = self.slots.iter().position(|s| s.is_none()) else {
+            error!("Held buffer overflowed, cannot save: {:?}", key);
+            return;
+        };
+        self.slots[slot] = Some(key);
+        let slot = slot as u8;
 
-    /// Push a new held key into the buffer
-    pub fn push_without_sort(&mut self, key: HeldKey) {
-        if let Err(e) = self.keys.push(key) {
-            error!("Held buffer overflowed, cannot save: {:?}", e);
-        }
+        self.insert_press_order(slot);
+        // The heap can't be full when there's a free slot
+        let _ = self.timeouts.push(slot);
+        self.heap_index[slot as usize] = (self.timeouts.len() - 1) as u8;
+        self.sift_up(self.timeouts.len() - 1);
+        self.index_insert(key.event.pos, slot);
     }
 
     /// Find a held key by the key action
     pub fn find_action(&self, action: &KeyAction) -> Option<&HeldKey> {
-        self.keys.iter().find(|x| x.action == *action)
+        self.iter().find(|x| x.action == *action)
     }
 
     /// Find a held key by the KeyboardEventPos
     pub fn find_pos(&self, pos: KeyboardEventPos) -> Option<&HeldKey> {
-        self.keys.iter().find(|x| x.event.pos == pos)
+        self.index_find(pos).map(|(_, slot)| self.key(slot))
     }
 
-    /// Find a mutable held key by the KeyboardEventPos
+    /// Find a mutable held key by the KeyboardEventPos.
+    ///
+    /// Use [`HeldBuffer::update_times`] to change the press time or timeout time.
     pub fn find_pos_mut(&mut self, pos: KeyboardEventPos) -> Option<&mut HeldKey> {
-        self.keys.iter_mut().find(|x| x.event.pos == pos)
+        let (_, slot) = self.index_find(pos)?;
+        self.slots[slot as usize].as_mut()
     }
 
-    /// Remove a held key from the buffer, keep the order
-    pub fn remove_if<P>(&mut self, predicate: P) -> Option<HeldKey>
+    /// Update the press time and timeout time of a held key
+    pub fn update_times(&mut self, pos: KeyboardEventPos, press_time: Instant, timeout_time: Instant) {
+        let Some((_, slot)) = self.index_find(pos) else {
+            return;
+        };
+        let key = self.slots[slot as usize].as_mut().unwrap();
+        key.press_time = press_time;
+        key.timeout_time = timeout_time;
+
+        self.remove_press_order(slot);
+        self.insert_press_order(slot);
+        let i = self.heap_index[slot as usize] as usize;
+        self.sift_up(i);
+        let i = self.heap_index[slot as usize] as usize;
+        self.sift_down(i);
+    }
+
+    /// Remove the first held key in press order that matches the predicate
+    pub fn remove_if<P>(&mut self, mut predicate: P) -> Option<HeldKey>
     where
         P: FnMut(&HeldKey) -> bool,
     {
-        if let Some(i) = self.keys.iter().position(predicate) {
-            Some(self.keys.remove(i))
-        } else {
-            None
-        }
+        let slot = self.press_slots().find(|&slot| predicate(self.key(slot)))?;
+        Some(self.remove_slot(slot))
     }
 
-    /// Remove a held key from the buffer and then resort the buffer
+    /// Remove a held key from the buffer
     pub fn remove(&mut self, pos: KeyboardEventPos) -> Option<HeldKey> {
-        let k = self.remove_if(|k| k.event.pos == pos);
-        // Re-sort the buffer after remove
-        self.keys.sort_unstable_by_key(|k| k.timeout_time);
-        k
+        let (_, slot) = self.index_find(pos)?;
+        Some(self.remove_slot(slot))
     }
 
-    /// Get the next timeout key in the buffer
+    /// Keep only the held keys that match the predicate
+    pub fn retain<P>(&mut self, mut predicate: P)
+    where
+        P: FnMut(&HeldKey) -> bool,
+    {
+        while self.remove_if(|k| !predicate(k)).is_some() {}
+    }
+
+    /// Get the next timeout key in the buffer that matches the predicate
     pub fn next_timeout<P>(&self, mut predicate: P) -> Option<HeldKey>
     where
         P: FnMut(&HeldKey) -> bool,
     {
-        // Support that the held buffer is already sorted by the timeout time
-        self.keys.iter().find(|&x| predicate(x)).copied()
+        // Fast path: the earliest timeout matches
+        let top = *self.timeouts.first()?;
+        if predicate(self.key(top)) {
+            return Some(*self.key(top));
+        }
+        self.iter()
+            .filter(|&k| predicate(k))
+            .min_by_key(|k| k.timeout_time)
+            .copied()
+    }
+
+    /// Iterate all held keys in press order
+    pub fn iter(&self) -> impl Iterator<Item = &HeldKey> {
+        self.press_slots().map(|slot| self.key(slot))
+    }
+
+    pub fn len(&self) -> usize {
+        // Every occupied slot is in the heap
+        self.timeouts.len()
     }
 
     pub fn is_empty(&self) -> bool {
-        self.keys.is_empty()
+        self.timeouts.is_empty()
+    }
+
+    /// Iterate the occupied slots in press order
+    fn press_slots(&self) -> impl Iterator<Item = u8> + '_ {
+        let first = Some(self.press_head).filter(|&slot| slot != EMPTY);
+        core::iter::successors(first, |&slot| {
+            Some(self.press_next[slot as usize]).filter(|&next| next != EMPTY)
+        })
+    }
+
+    fn key(&self, slot: u8) -> &HeldKey {
+        self.slots[slot as usize].as_ref().unwrap()
+    }
+
+    fn timeout_of(&self, heap_idx: usize) -> Instant {
+        self.key(self.timeouts[heap_idx]).timeout_time
+    }
+
+    fn remove_slot(&mut self, slot: u8) -> HeldKey {
+        let key = self.slots[slot as usize].take().unwrap();
+        self.remove_press_order(slot);
+        self.index_remove(key.event.pos, slot);
+
+        // Move the last entry of the heap to the hole and restore the heap
+        let i = self.heap_index[slot as usize] as usize;
+        self.heap_index[slot as usize] = EMPTY;
+        let last = self.timeouts.pop().unwrap();
+        if i < self.timeouts.len() {
+            self.timeouts[i] = last;
+            self.heap_index[last as usize] = i as u8;
+            self.sift_up(i);
+            let i = self.heap_index[last as usize] as usize;
+            self.sift_down(i);
+        }
+        key
+    }
+
+    /// Insert the slot after all keys pressed at the same time or earlier.
+    ///
+    /// The search starts from the tail, a key pressed at the current time is appended without walking the list.
+    fn insert_press_order(&mut self, slot: u8) {
+        let press_time = self.key(slot).press_time;
+        let mut prev = self.press_tail;
+        while prev != EMPTY && self.key(prev).press_time > press_time {
+            prev = self.press_prev[prev as usize];
+        }
+        let next = if prev == EMPTY {
+            self.press_head
+        } else {
+            self.press_next[prev as usize]
+        };
+
+        self.press_prev[slot as usize] = prev;
+        self.press_next[slot as usize] = next;
+        if prev == EMPTY {
+            self.press_head = slot;
+        } else {
+            self.press_next[prev as usize] = slot;
+        }
+        if next == EMPTY {
+            self.press_tail = slot;
+        } else {
+            self.press_prev[next as usize] = slot;
+        }
+    }
+
+    fn remove_press_order(&mut self, slot: u8) {
+        let prev = self.press_prev[slot as usize];
+        let next = self.press_next[slot as usize];
+        if prev == EMPTY {
+            self.press_head = next;
+        } else {
+            self.press_next[prev as usize] = next;
+        }
+        if next == EMPTY {
+            self.press_tail = prev;
+        } else {
+            self.press_prev[next as usize] = prev;
+        }
+        self.press_prev[slot as usize] = EMPTY;
+        self.press_next[slot as usize] = EMPTY;
+    }
+
+    fn swap_heap(&mut self, a: usize, b: usize) {
+        self.timeouts.swap(a, b);
+        self.heap_index[self.timeouts[a] as usize] = a as u8;
+        self.heap_index[self.timeouts[b] as usize] = b as u8;
+    }
+
+    fn sift_up(&mut self, mut i: usize) {
+        while i > 0 {
+            let parent = (i - 1) / 2;
+            if self.timeout_of(i) >= self.timeout_of(parent) {
+                break;
+            }
+            self.swap_heap(i, parent);
+            i = parent;
+        }
+    }
+
+    fn sift_down(&mut self, mut i: usize) {
+        let len = self.timeouts.len();
+        loop {
+            let mut smallest = i;
+            for child in [2 * i + 1, 2 * i + 2] {
+                if child < len && self.timeout_of(child) < self.timeout_of(smallest) {
+                    smallest = child;
+                }
+            }
+            if smallest == i {
+                break;
+            }
+            self.swap_heap(i, smallest);
+            i = smallest;
+        }
+    }
+
+    fn hash(pos: KeyboardEventPos) -> usize {
+        let key = match pos {
+            KeyboardEventPos::Key(k) => (k.row as u32) << 8 | k.col as u32,
+            KeyboardEventPos::RotaryEncoder(e) => 0x1_0000 | (e.id as u32) << 2 | e.direction as u32,
+        };
+        // Fibonacci hashing
+        (key.wrapping_mul(0x9E37_79B9) >> 16) as usize & (INDEX_SIZE - 1)
+    }
+
+    /// Find the first slot with the given position, return (index entry, slot)
+    fn index_find(&self, pos: KeyboardEventPos) -> Option<(usize, u8)> {
+        let mut i = Self::hash(pos);
+        loop {
+            let slot = self.pos_index[i];
+            if slot == EMPTY {
+                return None;
+            }
+            if self.key(slot).event.pos == pos {
+                return Some((i, slot));
+            }
+            i = (i + 1) & (INDEX_SIZE - 1);
+        }
+    }
+
+    fn index_insert(&mut self, pos: KeyboardEventPos, slot: u8) {
+        let mut i = Self::hash(pos);
+        while self.pos_index[i] != EMPTY {
+            i = (i + 1) & (INDEX_SIZE - 1);
+        }
+        self.pos_index[i] = slot;
+    }
+
+    /// Remove the slot from the index, with backward shift deletion. The slot must still be occupied.
+    fn index_remove(&mut self, pos: KeyboardEventPos, slot: u8) {
+        let mut i = Self::hash(pos);
+        while self.pos_index[i] != slot {
+            if self.pos_index[i] == EMPTY {
+                return;
+            }
+            i = (i + 1) & (INDEX_SIZE - 1);
+        }
+        // Shift back the following entries of the probe sequence
+        let mut hole = i;
+        let mut j = (i + 1) & (INDEX_SIZE - 1);
+        while self.pos_index[j] != EMPTY {
+            let home = Self::hash(self.key(self.pos_index[j]).event.pos);
+            // Move the entry if its home is not in (hole, j]
+            if (j.wrapping_sub(home) & (INDEX_SIZE - 1)) >= (j.wrapping_sub(hole) & (INDEX_SIZE - 1)) {
+                self.pos_index[hole] = self.pos_index[j];
+                hole = j;
+            }
+            j = (j + 1) & (INDEX_SIZE - 1);
+        }
+        self.pos_index[hole] = EMPTY;
     }
 }
 
@@ -143,3 +397,93 @@ impl HeldKey {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::k;
+
+    fn held_key(row: u8, col: u8, press_ms: u64, timeout_ms: u64) -> HeldKey {
+        HeldKey::new(
+            KeyboardEvent::key(row, col, true),
+            k!(A),
+            KeyState::Pressed(MorsePattern::default()),
+            Instant::from_millis(press_ms),
+            Instant::from_millis(timeout_ms),
+        )
+    }
+
+    fn press_order(buffer: &HeldBuffer) -> std::vec::Vec<u64> {
+        buffer.iter().map(|k| k.press_time.as_millis()).collect()
+    }
+
+    #[test]
+    fn test_press_order_and_timeout() {
+        let mut buffer = HeldBuffer::new();
+        buffer.push(held_key(0, 0, 30, 230));
+        buffer.push(held_key(0, 1, 10, 300));
+        buffer.push(held_key(0, 2, 20, 100));
+        assert_eq!(press_order(&buffer), [10, 20, 30]);
+        assert_eq!(buffer.next_timeout(|_| true).unwrap().timeout_time.as_millis(), 100);
+        // The earliest timeout doesn't match
+        let next = buffer.next_timeout(|k| k.event.pos != KeyboardEvent::key(0, 2, true).pos);
+        assert_eq!(next.unwrap().timeout_time.as_millis(), 230);
+
+        buffer.remove(KeyboardEvent::key(0, 2, true).pos);
+        assert_eq!(press_order(&buffer), [10, 30]);
+        assert_eq!(buffer.next_timeout(|_| true).unwrap().timeout_time.as_millis(), 230);
+    }
+
+    #[test]
+    fn test_update_times() {
+        let mut buffer = HeldBuffer::new();
+        buffer.push(held_key(0, 0, 10, 100));
+        buffer.push(held_key(0, 1, 20, 200));
+        let pos = KeyboardEvent::key(0, 0, true).pos;
+        buffer.update_times(pos, Instant::from_millis(30), Instant::from_millis(300));
+        assert_eq!(press_order(&buffer), [20, 30]);
+        assert_eq!(buffer.next_timeout(|_| true).unwrap().timeout_time.as_millis(), 200);
+        assert_eq!(buffer.find_pos(pos).unwrap().timeout_time.as_millis(), 300);
+    }
+
+    #[test]
+    fn test_press_order_list() {
+        let mut buffer = HeldBuffer::new();
+        // Keys pressed at the same time keep the insertion order
+        buffer.push(held_key(0, 0, 10, 100));
+        buffer.push(held_key(0, 1, 10, 101));
+        buffer.push(held_key(0, 2, 20, 102));
+        buffer.push(held_key(0, 3, 5, 103));
+        let timeouts: std::vec::Vec<u64> = buffer.iter().map(|k| k.timeout_time.as_millis()).collect();
+        assert_eq!(timeouts, [103, 100, 101, 102]);
+
+        // Remove the head, a middle key and the tail, then append to the emptied list
+        buffer.remove(KeyboardEvent::key(0, 3, true).pos);
+        buffer.remove(KeyboardEvent::key(0, 1, true).pos);
+        buffer.remove(KeyboardEvent::key(0, 2, true).pos);
+        assert_eq!(press_order(&buffer), [10]);
+        buffer.remove(KeyboardEvent::key(0, 0, true).pos);
+        assert!(buffer.is_empty() && buffer.iter().next().is_none());
+        buffer.push(held_key(1, 0, 40, 100));
+        buffer.push(held_key(1, 1, 30, 100));
+        assert_eq!(press_order(&buffer), [30, 40]);
+    }
+
+    #[test]
+    fn test_position_index() {
+        let mut buffer = HeldBuffer::new();
+        let count = HELD_BUFFER_SIZE as u8;
+        for i in 0..count {
+            buffer.push(held_key(i % 4, i / 4, i as u64, 100 + i as u64));
+        }
+        assert_eq!(buffer.len(), HELD_BUFFER_SIZE);
+        // Remove every other key, the remaining ones must still be found through the probe sequences
+        buffer.retain(|k| k.press_time.as_millis() % 2 == 1);
+        for i in 0..count {
+            let found = buffer.find_pos(KeyboardEvent::key(i % 4, i / 4, true).pos);
+            assert_eq!(found.is_some(), i % 2 == 1);
+        }
+        assert!(buffer.remove_if(|k| k.press_time.as_millis() == 1).is_some());
+        assert_eq!(buffer.len(), HELD_BUFFER_SIZE / 2 - 1);
+    }
+}
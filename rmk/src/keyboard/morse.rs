@@ -50,7 +50,6 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         // FIXME? is |Holding needed here?
         if self
             .held_buffer
-            .keys
             .iter()
             .any(|k| k.action.is_morse() && matches!(k.state, KeyState::Pressed(_)))
         {
@@ -74,8 +73,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                     // The current key is already in the buffer, update its state
                     if let KeyState::Released(pattern) = k.state {
                         k.state = KeyState::Pressed(pattern);
-                        k.press_time = pressed_time;
-                        k.timeout_time = timeout_time;
+                        self.held_buffer.update_times(event.pos, pressed_time, timeout_time);
                     }
                 }
                 None => {
@@ -129,10 +127,10 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                         } else {
                             // Expect a possible longer morse pattern (or idle timeout), update the state
                             k.state = KeyState::Released(pattern);
-                            // Use current release time for `IdleAfterTap` state
-                            k.press_time = released_time; // Use release time as the "press_time"
+                            // Use current release time for `IdleAfterTap` state, as the "press_time"
                             let timeout = Self::morse_timeout(&self.keymap.borrow(), &k.action, false);
-                            k.timeout_time = k.press_time + timeout;
+                            self.held_buffer
+                                .update_times(event.pos, released_time, released_time + timeout);
                         }
                     }
                     KeyState::Holding(pattern) => {
@@ -140,9 +138,10 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                         // So, just expect a possible longer morse pattern (or idle timeout), update the state
                         let released_time = Instant::now(); // TODO? It would be better if the event would carry the real timestamp of the release event!                        
                         k.state = KeyState::Released(pattern);
-                        // Use current release time for `IdleAfterTap` state
-                        k.press_time = released_time; // Use release time as the "press_time"
-                        k.timeout_time = k.press_time + Self::morse_timeout(&self.keymap.borrow(), &k.action, false);
+                        // Use current release time for `IdleAfterTap` state, as the "press_time"
+                        let timeout = Self::morse_timeout(&self.keymap.borrow(), &k.action, false);
+                        self.held_buffer
+                            .update_times(event.pos, released_time, released_time + timeout);
                     }
                     KeyState::ProcessedButReleaseNotReportedYet(action) => {
                         // Releasing a tap-hold action whose pressed HID report is already sent
@@ -161,9 +160,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     }
 
     pub(crate) async fn fire_held_non_morse_keys(&mut self) {
-        self.held_buffer.keys.sort_unstable_by_key(|k| k.press_time);
-
-        // Trigger all non morse keys in the buffer
+        // Trigger all non morse keys in the buffer, in press order
         while let Some(key) = self.held_buffer.remove_if(|k| !k.action.is_morse()) {
             debug!("Trigger non-morse key: {:?}", key);
             let action = self.keymap.borrow_mut().get_action_with_layer_cache(key.event);
@@ -173,8 +170,6 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                 _ => (),
             }
         }
-
-        self.held_buffer.keys.sort_unstable_by_key(|k| k.timeout_time);
     }
 
     pub fn action_from_pattern(
@@ -1,8 +1,112 @@
+use embassy_sync::signal::Signal;
+use embassy_time::{Duration, Instant, Timer, with_timeout};
 use rmk_types::keycode::{HidKeyCode, from_ascii, to_ascii};
 
 use crate::MACRO_SPACE_SIZE;
+use crate::channel::KEYBOARD_REPORT_CHANNEL;
+use crate::event::KeyboardEvent;
 use crate::keymap::fill_vec;
 
+/// Number of triggered macros which wait for the running macro
+pub(crate) const MACRO_QUEUE_SIZE: usize = 4;
+
+/// The next report of a macro is sent after this timeout if the written report isn't notified by the HID writer,
+/// for example when there's no connection or the report is dropped by the report coalescer
+const MACRO_REPORT_TIMEOUT: Duration = Duration::from_millis(10);
+
+/// Keyboard reports written by the HID writer, the running macro waits for it before sending the next report
+static KEYBOARD_REPORT_WRITTEN: Signal<crate::RawMutex, ()> = Signal::new();
+
+/// Notify the running macro that a keyboard report is written by the HID writer.
+///
+/// The built-in writers call it, a custom writer of the keyboard reports should call it after each written report.
+pub fn keyboard_report_written() {
+    KEYBOARD_REPORT_WRITTEN.signal(());
+}
+
+/// A key which is pressed by a macro step and released by the next step
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub(crate) enum MacroKey {
+    Tap(HidKeyCode),
+    /// Keycode and whether it's shifted
+    Text(HidKeyCode, bool),
+}
+
+/// State of the running macro.
+///
+/// The macro is played step by step by the keyboard, every step sends at most one keyboard report, so that key
+/// events are still processed between the steps.
+#[derive(Clone, Copy, Debug)]
+pub(crate) struct MacroPlayer {
+    /// Start index of the macro in the macro sequences
+    pub(crate) start: usize,
+    /// Offset of the next operation in the macro
+    pub(crate) offset: usize,
+    /// The key event which triggered the macro
+    pub(crate) event: KeyboardEvent,
+    /// The key pressed by the last step
+    pub(crate) pressed: Option<MacroKey>,
+    /// The last step sent a report, the next step waits until it's written
+    report_sent: bool,
+    /// The next step waits until the delay operation is over
+    resume_at: Option<Instant>,
+}
+
+impl MacroPlayer {
+    pub(crate) fn new(start: usize, event: KeyboardEvent) -> Self {
+        Self {
+            start,
+            offset: 0,
+            event,
+            pressed: None,
+            report_sent: false,
+            resume_at: None,
+        }
+    }
+
+    /// Called before the step sends its report
+    pub(crate) fn report_queued(&mut self) {
+        KEYBOARD_REPORT_WRITTEN.reset();
+        self.report_sent = true;
+    }
+
+    /// Called when the step waits for a delay operation
+    pub(crate) fn delay(&mut self, delay_ms: u16) {
+        self.resume_at = Some(Instant::now() + Duration::from_millis(delay_ms as u64));
+    }
+
+    /// Wait until the next step can be played.
+    ///
+    /// The returned future doesn't borrow the player, so it can be selected with the next key event.
+    pub(crate) fn wait_next_step(&self) -> impl Future<Output = ()> + use<> {
+        let report_sent = self.report_sent;
+        let resume_at = self.resume_at;
+        async move {
+            if report_sent {
+                // Wait until all queued reports are written, including the report of the last step
+                let _ = with_timeout(MACRO_REPORT_TIMEOUT, async {
+                    loop {
+                        KEYBOARD_REPORT_WRITTEN.wait().await;
+                        if KEYBOARD_REPORT_CHANNEL.is_empty() {
+                            break;
+                        }
+                    }
+                })
+                .await;
+            }
+            if let Some(resume_at) = resume_at {
+                Timer::at(resume_at).await;
+            }
+        }
+    }
+
+    /// Called when the next step is started, after `wait_next_step` is finished
+    pub(crate) fn start_step(&mut self) {
+        self.report_sent = false;
+        self.resume_at = None;
+    }
+}
+
 /// encoded with the two bytes, content at the third byte
 /// 0b 0000 0001 1000-1010 (VIAL_MACRO_EXT) are not supported
 ///
@@ -407,4 +511,15 @@ mod test {
         }
         assert_eq!(macro_sequences_binary, result_filled);
     }
+
+    #[test]
+    fn test_define_macro_sequences_text_round_trip() {
+        let macro_sequences_binary = define_macro_sequences(&[to_macro_sequence("\\|")]);
+        assert_eq!(macro_sequences_binary[..3], [b'\\', b'|', 0x00]);
+
+        let (operation, offset) = MacroOperation::get_next_macro_operation(&macro_sequences_binary, 0, 0);
+        assert!(matches!(operation, MacroOperation::Text(HidKeyCode::Backslash, false)));
+        let (operation, _) = MacroOperation::get_next_macro_operation(&macro_sequences_binary, 0, offset);
+        assert!(matches!(operation, MacroOperation::Text(HidKeyCode::Backslash, true)));
+    }
 }
@@ -5,22 +5,107 @@ use {
     embedded_storage_async::nor_flash::NorFlash,
 };
 
+use crate::combo::{Combo, ComboIndex, ComboIterMut, ComboMask};
 use crate::config::{BehaviorConfig, PositionalConfig};
 use crate::event::{KeyboardEvent, KeyboardEventPos};
 #[cfg(feature = "controller")]
 use crate::event::{LayerChangeEvent, publish_controller_event};
+use crate::flash_keymap::FlashKeymap;
+use crate::fork::{ForkIndex, ForkMask};
 use crate::input_device::rotary_encoder::Direction;
 use crate::keyboard_macros::MacroOperation;
 #[cfg(feature = "vial_lock")]
 use crate::matrix::MatrixState;
 
+/// Keys of a keymap addressed by key index, the keys are ordered by layer, row and col like the keymap snapshot in
+/// the storage
+pub trait KeyTable {
+    /// Number of keys
+    fn key_count(&self) -> usize;
+
+    /// Get the key at `idx`, `idx` must be less than `key_count()`
+    fn key(&self, idx: usize) -> KeyAction;
+
+    /// Set the key at `idx`, returns an error if the key can't be changed
+    fn set_key(&mut self, idx: usize, action: KeyAction) -> Result<(), ()>;
+}
+
+impl<const ROW: usize, const COL: usize, const NUM_LAYER: usize> KeyTable for [[[KeyAction; COL]; ROW]; NUM_LAYER] {
+    fn key_count(&self) -> usize {
+        ROW * COL * NUM_LAYER
+    }
+
+    fn key(&self, idx: usize) -> KeyAction {
+        self[idx / (ROW * COL)][idx / COL % ROW][idx % COL]
+    }
+
+    fn set_key(&mut self, idx: usize, action: KeyAction) -> Result<(), ()> {
+        self[idx / (ROW * COL)][idx / COL % ROW][idx % COL] = action;
+        Ok(())
+    }
+}
+
+/// Layer tables of a keymap
+pub enum KeymapLayers<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize> {
+    /// All layers are in RAM
+    Ram(&'a mut [[[KeyAction; COL]; ROW]; NUM_LAYER]),
+    /// The layers are read from flash, the edited keys are kept in a RAM overlay
+    Flash(FlashKeymap<'a, ROW, COL, NUM_LAYER>),
+}
+
+impl<const ROW: usize, const COL: usize, const NUM_LAYER: usize> KeymapLayers<'_, ROW, COL, NUM_LAYER> {
+    /// Get the key at the given layer and position
+    fn get(&self, layer: usize, row: usize, col: usize) -> KeyAction {
+        match self {
+            KeymapLayers::Ram(layers) => layers[layer][row][col],
+            KeymapLayers::Flash(keymap) => keymap.key((layer * ROW + row) * COL + col),
+        }
+    }
+}
+
+impl<const ROW: usize, const COL: usize, const NUM_LAYER: usize> KeyTable for KeymapLayers<'_, ROW, COL, NUM_LAYER> {
+    fn key_count(&self) -> usize {
+        ROW * COL * NUM_LAYER
+    }
+
+    fn key(&self, idx: usize) -> KeyAction {
+        match self {
+            KeymapLayers::Ram(layers) => layers.key(idx),
+            KeymapLayers::Flash(keymap) => keymap.key(idx),
+        }
+    }
+
+    fn set_key(&mut self, idx: usize, action: KeyAction) -> Result<(), ()> {
+        match self {
+            KeymapLayers::Ram(layers) => layers.set_key(idx, action),
+            KeymapLayers::Flash(keymap) => keymap.set_key(idx, action),
+        }
+    }
+}
+
+impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize> From<&'a mut [[[KeyAction; COL]; ROW]; NUM_LAYER]>
+    for KeymapLayers<'a, ROW, COL, NUM_LAYER>
+{
+    fn from(layers: &'a mut [[[KeyAction; COL]; ROW]; NUM_LAYER]) -> Self {
+        KeymapLayers::Ram(layers)
+    }
+}
+
+impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize> From<FlashKeymap<'a, ROW, COL, NUM_LAYER>>
+    for KeymapLayers<'a, ROW, COL, NUM_LAYER>
+{
+    fn from(keymap: FlashKeymap<'a, ROW, COL, NUM_LAYER>) -> Self {
+        KeymapLayers::Flash(keymap)
+    }
+}
+
 /// Keymap represents the stack of layers.
 ///
 /// Keymap should be binded to the actual pcb matrix definition.
 /// RMK detects hardware key strokes, uses tuple `(row, col, layer)` to retrieve the action from Keymap.
 pub struct KeyMap<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_ENCODER: usize = 0> {
-    /// Layers
-    pub(crate) layers: &'a mut [[[KeyAction; COL]; ROW]; NUM_LAYER],
+    /// Layers, in RAM or in flash
+    pub(crate) layers: KeymapLayers<'a, ROW, COL, NUM_LAYER>,
     /// Rotary encoders, each rotary encoder is represented as (Clockwise, CounterClockwise)
     pub(crate) encoders: Option<&'a mut [[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
     /// Current state of each layer
@@ -29,10 +114,23 @@ pub struct KeyMap<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize
     default_layer: u8,
     /// Layer cache
     layer_cache: [[u8; COL]; ROW],
+    /// The layer that a key press at each position resolves to under the current layer state,
+    /// `NO_EFFECTIVE_LAYER` if all active layers are transparent at this position
+    effective_layers: [[u8; COL]; ROW],
     /// Rotary encoder cache
     encoder_layer_cache: [[u8; 2]; NUM_ENCODER],
     /// Options for configurable action behavior
     pub(crate) behavior: &'a mut BehaviorConfig,
+    /// Index from key action to the combos of `behavior`
+    combo_index: ComboIndex,
+    /// Combos which may have keys pressed, a superset of the started combos.
+    /// A combo is only started or reset while it's iterated by `combos_mut`, so the iterated combos are added.
+    started_combos: ComboMask,
+    /// Index from key action to the forks of `behavior`
+    fork_index: ForkIndex,
+    /// Behaviors which any layer's action at each position may trigger, `BEHAVIOR_*` bits.
+    /// The keys without any of them are processed without the behavior checks.
+    behavior_flags: [[u8; COL]; ROW],
     pub positional_config: &'a mut PositionalConfig<ROW, COL>,
     /// Matrix state
     #[cfg(feature = "vial_lock")]
@@ -41,6 +139,14 @@ pub struct KeyMap<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize
     pub(crate) mouse_buttons: u8,
 }
 
+/// Marks a position of `effective_layers` where no active layer has a non-transparent action
+const NO_EFFECTIVE_LAYER: u8 = u8::MAX;
+
+/// Bits of `behavior_flags`: the position has an action which is in a combo, triggers a fork, or is a morse key
+const BEHAVIOR_COMBO: u8 = 1 << 0;
+const BEHAVIOR_FORK: u8 = 1 << 1;
+const BEHAVIOR_MORSE: u8 = 1 << 2;
+
 /// fills up the vector to its capacity
 pub(crate) fn fill_vec<T: Default + Clone, const N: usize>(vector: &mut heapless::Vec<T, N>) {
     vector
@@ -51,8 +157,9 @@ pub(crate) fn fill_vec<T: Default + Clone, const N: usize>(vector: &mut heapless
 impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_ENCODER: usize>
     KeyMap<'a, ROW, COL, NUM_LAYER, NUM_ENCODER>
 {
+    /// Create a keymap, `action_map` is the layers in RAM, or a [`FlashKeymap`]
     pub async fn new(
-        action_map: &'a mut [[[KeyAction; COL]; ROW]; NUM_LAYER],
+        action_map: impl Into<KeymapLayers<'a, ROW, COL, NUM_LAYER>>,
         encoder_map: Option<&'a mut [[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
         behavior: &'a mut BehaviorConfig,
         positional_config: &'a mut PositionalConfig<ROW, COL>,
@@ -62,54 +169,72 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         fill_vec(&mut behavior.fork.forks); // Is this needed? (has no Vial support)
         fill_vec(&mut behavior.morse.morses);
 
-        KeyMap {
-            layers: action_map,
+        let mut keymap = KeyMap {
+            layers: action_map.into(),
             encoders: encoder_map,
             layer_state: [false; NUM_LAYER],
             default_layer: 0,
             layer_cache: [[0; COL]; ROW],
+            effective_layers: [[0; COL]; ROW],
             encoder_layer_cache: [[0; 2]; NUM_ENCODER],
+            combo_index: ComboIndex::new(&behavior.combo.combos),
+            started_combos: ComboMask::default(),
+            fork_index: ForkIndex::new(&behavior.fork.forks),
+            behavior_flags: [[0; COL]; ROW],
             behavior,
             positional_config,
             #[cfg(feature = "vial_lock")]
             matrix_state: MatrixState::new(),
             mouse_buttons: 0,
-        }
+        };
+        keymap.update_effective_layers();
+        keymap.update_behavior_flags();
+        keymap
     }
 
     #[cfg(all(feature = "storage", feature = "host"))]
     pub async fn new_from_storage<F: NorFlash>(
-        action_map: &'a mut [[[KeyAction; COL]; ROW]; NUM_LAYER],
-        mut encoder_map: Option<&'a mut [[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
+        action_map: impl Into<KeymapLayers<'a, ROW, COL, NUM_LAYER>>,
+        encoder_map: Option<&'a mut [[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
         storage: Option<&mut Storage<F, ROW, COL, NUM_LAYER, NUM_ENCODER>>,
         behavior: &'a mut BehaviorConfig,
         positional_config: &'a mut PositionalConfig<ROW, COL>,
     ) -> Self {
-        // If the storage is initialized, read keymap from storage
-        fill_vec(&mut behavior.fork.forks); // Is this needed? (has no Vial support)
-        fill_vec(&mut behavior.morse.morses);
+        let mut keymap = Self::new(action_map, encoder_map, behavior, positional_config).await;
+        if let Some(storage) = storage {
+            keymap.load_from_storage(storage).await;
+        }
+        keymap
+    }
 
-        if let Some(storage) = storage
-            && {
-                Ok(())
-                    // Read keymap to `action_map`
-                    .and(storage.read_keymap(action_map, &mut encoder_map).await)
-                    // Read behavior config
-                    .and(storage.read_behavior_config(behavior).await)
-                    // Read macro cache
-                    .and(
-                        storage
-                            .read_macro_cache(&mut behavior.keyboard_macros.macro_sequences)
-                            .await,
-                    )
-                    // Read combo cache
-                    .and(storage.read_combos(&mut behavior.combo.combos).await)
-                    // Read fork cache
-                    .and(storage.read_forks(&mut behavior.fork.forks).await)
-                    // Read morse cache
-                    .and(storage.read_morses(&mut behavior.morse.morses).await)
-            }
-            .is_err()
+    /// Read the keymap and the behavior config from the storage.
+    ///
+    /// If the storage can't be read, it's cleared and the keyboard reboots.
+    #[cfg(all(feature = "storage", feature = "host"))]
+    pub(crate) async fn load_from_storage<F: NorFlash>(
+        &mut self,
+        storage: &mut Storage<F, ROW, COL, NUM_LAYER, NUM_ENCODER>,
+    ) {
+        if {
+            Ok(())
+                // Read keymap to the layers
+                .and(storage.read_keymap(&mut self.layers, &mut self.encoders).await)
+                // Read behavior config
+                .and(storage.read_behavior_config(self.behavior).await)
+                // Read macro cache
+                .and(
+                    storage
+                        .read_macro_cache(&mut self.behavior.keyboard_macros.macro_sequences)
+                        .await,
+                )
+                // Read combo cache
+                .and(storage.read_combos(&mut self.behavior.combo.combos).await)
+                // Read fork cache
+                .and(storage.read_forks(&mut self.behavior.fork.forks).await)
+                // Read morse cache
+                .and(storage.read_morses(&mut self.behavior.morse.morses).await)
+        }
+        .is_err()
         {
             error!("Failed to read from storage, clearing...");
             storage.flash.erase_all().await.ok();
@@ -117,23 +242,10 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             reboot_keyboard();
         }
 
-        KeyMap {
-            layers: action_map,
-            encoders: encoder_map,
-            layer_state: [false; NUM_LAYER],
-            default_layer: 0,
-            layer_cache: [[0; COL]; ROW],
-            encoder_layer_cache: [[0; 2]; NUM_ENCODER],
-            behavior,
-            positional_config,
-            #[cfg(feature = "vial_lock")]
-            matrix_state: MatrixState::new(),
-            mouse_buttons: 0,
-        }
-    }
-
-    pub(crate) fn get_keymap_config(&self) -> (usize, usize, usize) {
-        (ROW, COL, NUM_LAYER)
+        self.fork_index = ForkIndex::new(&self.behavior.fork.forks);
+        // Also rebuilds the behavior flags
+        self.update_combo_index();
+        self.update_effective_layers();
     }
 
     /// Get the default layer number
@@ -144,6 +256,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     /// Set the default layer number
     pub(crate) fn set_default_layer(&mut self, layer_num: u8) {
         self.default_layer = layer_num;
+        self.update_effective_layers();
     }
 
     pub(crate) fn get_next_macro_operation(&self, macro_start_idx: usize, offset: usize) -> (MacroOperation, usize) {
@@ -161,12 +274,30 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         )
     }
 
-    pub(crate) fn set_action_at(&mut self, pos: KeyboardEventPos, layer_num: usize, action: KeyAction) {
+    /// Set the action in keymap, returns an error if the key can't be changed, e.g. the keymap overlay is full
+    pub(crate) fn set_action_at(
+        &mut self,
+        pos: KeyboardEventPos,
+        layer_num: usize,
+        action: KeyAction,
+    ) -> Result<(), ()> {
         match pos {
             KeyboardEventPos::Key(key_pos) => {
                 let row = key_pos.row as usize;
                 let col = key_pos.col as usize;
-                self.layers[layer_num][row][col] = action;
+                if self
+                    .layers
+                    .set_key((layer_num * ROW + row) * COL + col, action)
+                    .is_err()
+                {
+                    error!(
+                        "Keymap overlay is full, key ({}, {}) of layer {} is not changed",
+                        row, col, layer_num
+                    );
+                    return Err(());
+                }
+                self.effective_layers[row][col] = self.resolve_layer(row, col);
+                self.behavior_flags[row][col] = self.resolve_behavior_flags(row, col);
             }
             KeyboardEventPos::RotaryEncoder(encoder_pos) => {
                 if let Some(encoders) = &mut self.encoders
@@ -180,6 +311,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
                 }
             }
         }
+        Ok(())
     }
 
     /// Fetch the action in keymap, with layer cache
@@ -188,7 +320,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             KeyboardEventPos::Key(key_pos) => {
                 let row = key_pos.row as usize;
                 let col = key_pos.col as usize;
-                self.layers[layer_num][row][col]
+                self.layers.get(layer_num, row, col)
             }
             KeyboardEventPos::RotaryEncoder(encoder_pos) => {
                 // Get the action from the keymap
@@ -216,32 +348,20 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             return action;
         }
 
-        // Iterate from higher layer to lower layer, the lowest checked layer is the default layer
         match event.pos {
             KeyboardEventPos::Key(key_pos) => {
+                // The layer is already resolved when the layer state changed
                 let row = key_pos.row as usize;
                 let col = key_pos.col as usize;
-                for (layer_idx, layer) in self.layers.iter().enumerate().rev() {
-                    if self.layer_state[layer_idx] || layer_idx as u8 == self.default_layer {
-                        // This layer is activated
-                        let action = layer[row][col];
-                        if action == KeyAction::Transparent {
-                            continue;
-                        }
-
-                        // Found a valid action in the layer, cache it
-                        self.save_layer_cache(event.pos, layer_idx as u8);
-
-                        return action;
-                    }
-
-                    if layer_idx as u8 == self.default_layer {
-                        // No action
-                        break;
-                    }
+                let layer = self.effective_layers[row][col];
+                if layer != NO_EFFECTIVE_LAYER {
+                    // Found a valid action in the layer, cache it
+                    self.save_layer_cache(event.pos, layer);
+                    return self.layers.get(layer as usize, row, col);
                 }
             }
             KeyboardEventPos::RotaryEncoder(encoder_pos) => {
+                // Iterate from higher layer to lower layer, the lowest checked layer is the default layer
                 if let Some(encoders) = &self.encoders {
                     for (layer_idx, layer) in encoders.iter().enumerate().rev() {
                         // Get the KeyAction for rotary_encoder_event from self.encoders
@@ -272,8 +392,130 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         KeyAction::No
     }
 
+    /// Resolve the layer of a key press at the given position under the current layer state.
+    ///
+    /// Iterate from higher layer to lower layer, the lowest checked layer is the default layer.
+    fn resolve_layer(&self, row: usize, col: usize) -> u8 {
+        for layer_idx in (0..NUM_LAYER).rev() {
+            if (self.layer_state[layer_idx] || layer_idx as u8 == self.default_layer)
+                && self.layers.get(layer_idx, row, col) != KeyAction::Transparent
+            {
+                return layer_idx as u8;
+            }
+
+            if layer_idx as u8 == self.default_layer {
+                break;
+            }
+        }
+        NO_EFFECTIVE_LAYER
+    }
+
+    /// Recompute the effective layer of all positions.
+    ///
+    /// Must be called after the layer state or the keymap is changed.
+    pub(crate) fn update_effective_layers(&mut self) {
+        for row in 0..ROW {
+            for col in 0..COL {
+                self.effective_layers[row][col] = self.resolve_layer(row, col);
+            }
+        }
+    }
+
+    /// Rebuild the combo index, must be called after the combos are changed.
+    pub(crate) fn update_combo_index(&mut self) {
+        self.combo_index = ComboIndex::new(&self.behavior.combo.combos);
+        // The changed combos are checked again by the next `combos_mut`
+        self.started_combos = ComboMask::all();
+        self.update_behavior_flags();
+    }
+
+    /// Behaviors which the actions at the given position may trigger, on any layer
+    fn resolve_behavior_flags(&self, row: usize, col: usize) -> u8 {
+        let mut flags = 0;
+        for layer_idx in 0..NUM_LAYER {
+            let action = self.layers.get(layer_idx, row, col);
+            if action.is_morse() {
+                flags |= BEHAVIOR_MORSE;
+            }
+            if !self.combo_index.candidates(&action).is_empty() {
+                flags |= BEHAVIOR_COMBO;
+            }
+            if !self.fork_index.candidates(&action).is_empty() {
+                flags |= BEHAVIOR_FORK;
+            }
+        }
+        flags
+    }
+
+    /// Recompute the behavior flags of all positions.
+    ///
+    /// Must be called after the keymap, the combos or the forks are changed.
+    pub(crate) fn update_behavior_flags(&mut self) {
+        for row in 0..ROW {
+            for col in 0..COL {
+                self.behavior_flags[row][col] = self.resolve_behavior_flags(row, col);
+            }
+        }
+    }
+
+    /// Whether the key at the position can't trigger a combo, a fork or a morse key on any layer
+    pub(crate) fn is_plain_key(&self, pos: KeyboardEventPos) -> bool {
+        match pos {
+            KeyboardEventPos::Key(key_pos) => self
+                .behavior_flags
+                .get(key_pos.row as usize)
+                .and_then(|row| row.get(key_pos.col as usize))
+                .is_some_and(|flags| *flags == 0),
+            KeyboardEventPos::RotaryEncoder(_) => false,
+        }
+    }
+
+    /// Whether any combo has keys pressed
+    pub(crate) fn has_started_combos(&mut self) -> bool {
+        !self.prune_started_combos().is_empty()
+    }
+
+    /// Get the forks which are triggered by the key action
+    pub(crate) fn fork_candidates(&self, key_action: &KeyAction) -> ForkMask {
+        self.fork_index.candidates(key_action)
+    }
+
+    /// Iterate the combos which contain the key action.
+    ///
+    /// If `with_started` is true, the combos which have keys pressed are included as well.
+    /// Only the candidate and started combos are visited, not all combo slots.
+    pub(crate) fn combos_mut(&mut self, key_action: &KeyAction, with_started: bool) -> ComboIterMut<'_> {
+        let started = self.prune_started_combos();
+        let mut mask = self.combo_index.candidates(key_action);
+        if with_started {
+            mask |= started;
+        }
+        // The iterated combos can be started by the caller
+        self.started_combos = started | mask;
+        ComboIterMut::new(&mut self.behavior.combo.combos, mask)
+    }
+
+    /// Drop the combos which are released since they were iterated from the started combos, and return them
+    fn prune_started_combos(&mut self) -> ComboMask {
+        let combos = &self.behavior.combo.combos;
+        let mut maybe_started = self.started_combos;
+        let mut started = ComboMask::default();
+        while let Some(i) = maybe_started.pop_first() {
+            if combos.get(i).is_some_and(|c| c.as_ref().is_some_and(Combo::started)) {
+                started.set(i);
+            }
+        }
+        self.started_combos = started;
+        started
+    }
+
+    /// Iterate the combos which have keys pressed
+    pub(crate) fn started_combos_mut(&mut self) -> ComboIterMut<'_> {
+        self.combos_mut(&KeyAction::No, true)
+    }
+
     pub(crate) fn get_activated_layer(&self) -> u8 {
-        for (layer_idx, _) in self.layers.iter().enumerate().rev() {
+        for layer_idx in (0..NUM_LAYER).rev() {
             if self.layer_state[layer_idx] || layer_idx as u8 == self.default_layer {
                 return layer_idx as u8;
             }
@@ -282,6 +524,11 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         self.default_layer
     }
 
+    /// Whether the given layer is activated, or it's the default layer
+    pub(crate) fn is_layer_active(&self, layer_num: u8) -> bool {
+        layer_num == self.default_layer || ((layer_num as usize) < NUM_LAYER && self.layer_state[layer_num as usize])
+    }
+
     fn pop_layer_from_cache(&mut self, pos: KeyboardEventPos) -> u8 {
         match pos {
             KeyboardEventPos::Key(key_pos) => {
@@ -329,6 +576,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
     pub(crate) fn update_fn_layer_state(&mut self) {
         if NUM_LAYER > 3 {
             self.layer_state[3] = self.layer_state[1] && self.layer_state[2];
+            self.update_effective_layers();
             #[cfg(feature = "controller")]
             {
                 let layer = self.get_activated_layer();
@@ -343,6 +591,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
             self.layer_state[tri_layer[2] as usize] =
                 self.layer_state[tri_layer[0] as usize] && self.layer_state[tri_layer[1] as usize];
         }
+        self.update_effective_layers();
 
         #[cfg(feature = "controller")]
         {
@@ -388,6 +637,7 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
         }
 
         self.layer_state[layer_num as usize] = !self.layer_state[layer_num as usize];
+        self.update_effective_layers();
 
         #[cfg(feature = "controller")]
         {
@@ -399,12 +649,113 @@ impl<'a, const ROW: usize, const COL: usize, const NUM_LAYER: usize, const NUM_E
 
 #[cfg(test)]
 mod test {
+    use embassy_futures::block_on;
+    use rmk_types::action::KeyAction;
     use rmk_types::modifier::ModifierCombination;
 
     use crate::combo::{Combo, ComboConfig};
+    use crate::config::{BehaviorConfig, PositionalConfig};
+    use crate::event::KeyboardEvent;
+    use crate::flash_keymap::FlashKeymap;
     use crate::fork::{Fork, StateBits};
-    use crate::keymap::fill_vec;
-    use crate::{COMBO_MAX_NUM, FORK_MAX_NUM, k};
+    use crate::keymap::{KeyMap, fill_vec};
+    use crate::{COMBO_MAX_NUM, FORK_MAX_NUM, a, k, th};
+
+    #[test]
+    fn test_effective_layer_lookup() {
+        let layers = Box::leak(Box::new([
+            [[k!(A), k!(B)]],
+            [[a!(Transparent), k!(C)]],
+            [[a!(Transparent), a!(Transparent)]],
+        ]));
+        let behavior = Box::leak(Box::new(BehaviorConfig::default()));
+        let positional = Box::leak(Box::new(PositionalConfig::<1, 2>::default()));
+        let mut keymap = block_on(KeyMap::new(layers, None, behavior, positional));
+
+        let press = |col| KeyboardEvent::key(0, col, true);
+        assert_eq!(keymap.get_action_with_layer_cache(press(1)), k!(B));
+
+        keymap.activate_layer(2);
+        keymap.activate_layer(1);
+        assert_eq!(keymap.get_action_with_layer_cache(press(0)), k!(A));
+        assert_eq!(keymap.get_action_with_layer_cache(press(1)), k!(C));
+
+        // Release uses the cached layer even if the layer state changed
+        keymap.deactivate_layer(1);
+        assert_eq!(
+            keymap.get_action_with_layer_cache(KeyboardEvent::key(0, 1, false)),
+            k!(C)
+        );
+        assert_eq!(keymap.get_action_with_layer_cache(press(1)), k!(B));
+
+        // Keymap changes update the lookup table
+        keymap.set_action_at(press(1).pos, 2, k!(D)).unwrap();
+        assert_eq!(keymap.get_action_with_layer_cache(press(1)), k!(D));
+
+        // All layers are transparent above the default layer
+        keymap.set_default_layer(1);
+        keymap.deactivate_layer(2);
+        assert_eq!(keymap.get_action_with_layer_cache(press(0)), KeyAction::No);
+    }
+
+    #[test]
+    fn test_behavior_flags() {
+        let layers = Box::leak(Box::new([
+            [[k!(A), k!(B), k!(C), k!(D)]],
+            [[a!(Transparent), a!(Transparent), a!(Transparent), th!(E, LShift)]],
+        ]));
+        let behavior = Box::leak(Box::new(BehaviorConfig::default()));
+        behavior.combo.combos[0] = Some(Combo::new(ComboConfig::new([k!(A), k!(X)], k!(Z), None)));
+        let _ = behavior.fork.forks.push(Fork::new(
+            k!(B),
+            k!(B),
+            k!(F),
+            StateBits::default(),
+            StateBits::default(),
+            ModifierCombination::new(),
+            false,
+        ));
+        let positional = Box::leak(Box::new(PositionalConfig::<1, 4>::default()));
+        let mut keymap = block_on(KeyMap::new(layers, None, behavior, positional));
+
+        let pos = |col| KeyboardEvent::key(0, col, true).pos;
+        // Combo key, fork trigger, plain key, and a morse key on a higher layer
+        assert!(!keymap.is_plain_key(pos(0)));
+        assert!(!keymap.is_plain_key(pos(1)));
+        assert!(keymap.is_plain_key(pos(2)));
+        assert!(!keymap.is_plain_key(pos(3)));
+
+        // Keymap and combo changes update the flags
+        keymap.set_action_at(pos(2), 1, k!(X)).unwrap();
+        assert!(!keymap.is_plain_key(pos(2)));
+        keymap.behavior.combo.combos[0] = None;
+        keymap.update_combo_index();
+        assert!(keymap.is_plain_key(pos(0)));
+        assert!(keymap.is_plain_key(pos(2)));
+    }
+
+    #[test]
+    fn test_flash_resident_keymap() {
+        static LAYERS: [[[KeyAction; 2]; 1]; 2] = [[[k!(A), k!(B)]], [[a!(Transparent), k!(C)]]];
+        let overlay = Box::leak(Box::new([(0, KeyAction::No); 1]));
+        let behavior = Box::leak(Box::new(BehaviorConfig::default()));
+        let positional = Box::leak(Box::new(PositionalConfig::<1, 2>::default()));
+        let layers = FlashKeymap::new(&LAYERS, overlay);
+        let mut keymap = block_on(KeyMap::new(layers, None, behavior, positional));
+
+        let press = |col| KeyboardEvent::key(0, col, true);
+        keymap.activate_layer(1);
+        assert_eq!(keymap.get_action_with_layer_cache(press(0)), k!(A));
+        assert_eq!(keymap.get_action_with_layer_cache(press(1)), k!(C));
+
+        // Changed keys are kept in the overlay
+        keymap.set_action_at(press(1).pos, 1, a!(Transparent)).unwrap();
+        assert_eq!(keymap.get_action_with_layer_cache(press(1)), k!(B));
+
+        // The overlay is full, the key is not changed
+        assert!(keymap.set_action_at(press(0).pos, 0, k!(D)).is_err());
+        assert_eq!(keymap.get_action_with_layer_cache(press(0)), k!(A));
+    }
 
     #[test]
     fn test_fill_vec() {
@@ -0,0 +1,321 @@
+//! End-to-end latency tracing of key events, enabled by the `latency_trace` feature.
+//!
+//! Every `KeyboardEvent` carries a compact scan timestamp. The latency from the scan to each `LatencyStage` is
+//! recorded in a lock-free ring of the recent samples of the stage, the min/max are kept since boot.
+//! The statistics are logged periodically, which goes to defmt or `usb_log`, and can be queried through Via.
+//!
+//! The scan timestamps of the queued keyboard reports are kept in a small FIFO in the channel order, together with a
+//! fingerprint of each report. A written or dropped report takes the first entry with its fingerprint, the entries
+//! before it belong to the reports which are consumed without being written, so several queued reports keep their
+//! own timestamps.
+use core::cell::RefCell;
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use embassy_sync::blocking_mutex::Mutex;
+use embassy_time::Instant;
+use heapless::Deque;
+use postcard::experimental::max_size::MaxSize;
+
+use crate::descriptor::KeyboardReport;
+use crate::hid::Report;
+
+/// Number of recent samples of each stage, the avg and p99 are computed from them
+pub const LATENCY_RING_SIZE: usize = 64;
+
+/// The statistics are logged every `LOG_INTERVAL` written keyboard reports
+const LOG_INTERVAL: u32 = 256;
+
+/// Stages of a key event, the latency of every stage is measured from the matrix scan
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+#[repr(u8)]
+pub enum LatencyStage {
+    /// The event is received by `Keyboard::process_inner`
+    Process = 0,
+    /// The keyboard report of the event is queued in `KEYBOARD_REPORT_CHANNEL`
+    Report = 1,
+    /// The keyboard report is written by the HID writer, aka USB endpoint or BLE notification
+    Write = 2,
+}
+
+impl LatencyStage {
+    pub const ALL: [Self; 3] = [Self::Process, Self::Report, Self::Write];
+
+    pub fn from_u8(value: u8) -> Option<Self> {
+        Self::ALL.get(value as usize).copied()
+    }
+}
+
+/// Scan timestamp of a key event, microseconds since boot in 32 bits.
+///
+/// It's not a part of the event identity: it's not serialized and it's ignored when comparing events. Events which
+/// are deserialized, aka received from split peripherals, are stamped at the time they are received.
+#[derive(Clone, Copy, Debug)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct TraceStamp(u32);
+
+impl TraceStamp {
+    pub fn now() -> Self {
+        // 0 is reserved for "no trace"
+        Self((Instant::now().as_micros() as u32).max(1))
+    }
+
+    fn elapsed_us(stamp: u32) -> u32 {
+        (Instant::now().as_micros() as u32).wrapping_sub(stamp)
+    }
+}
+
+impl Default for TraceStamp {
+    fn default() -> Self {
+        Self::now()
+    }
+}
+
+impl PartialEq for TraceStamp {
+    fn eq(&self, _other: &Self) -> bool {
+        true
+    }
+}
+
+impl Eq for TraceStamp {}
+
+impl MaxSize for TraceStamp {
+    const POSTCARD_MAX_SIZE: usize = 0;
+}
+
+/// Latency statistics of a stage, in microseconds
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct LatencyStats {
+    /// Number of samples since boot
+    pub count: u32,
+    pub min_us: u32,
+    /// Average of the recent samples
+    pub avg_us: u32,
+    /// 99th percentile of the recent samples
+    pub p99_us: u32,
+    pub max_us: u32,
+}
+
+struct StageRecorder {
+    ring: [AtomicU32; LATENCY_RING_SIZE],
+    count: AtomicU32,
+    min: AtomicU32,
+    max: AtomicU32,
+}
+
+impl StageRecorder {
+    const fn new() -> Self {
+        Self {
+            ring: [const { AtomicU32::new(0) }; LATENCY_RING_SIZE],
+            count: AtomicU32::new(0),
+            min: AtomicU32::new(u32::MAX),
+            max: AtomicU32::new(0),
+        }
+    }
+
+    // A stage is only recorded by its own task: the keyboard task, or the HID writer for `Write`
+    fn record(&self, latency_us: u32) {
+        let count = self.count.load(Ordering::Relaxed);
+        self.ring[count as usize % LATENCY_RING_SIZE].store(latency_us, Ordering::Relaxed);
+        if latency_us < self.min.load(Ordering::Relaxed) {
+            self.min.store(latency_us, Ordering::Relaxed);
+        }
+        if latency_us > self.max.load(Ordering::Relaxed) {
+            self.max.store(latency_us, Ordering::Relaxed);
+        }
+        self.count.store(count.wrapping_add(1), Ordering::Relaxed);
+    }
+
+    fn stats(&self) -> LatencyStats {
+        let count = self.count.load(Ordering::Relaxed);
+        let n = (count as usize).min(LATENCY_RING_SIZE);
+        if n == 0 {
+            return LatencyStats::default();
+        }
+        let mut samples = [0u32; LATENCY_RING_SIZE];
+        for (sample, slot) in samples.iter_mut().zip(self.ring.iter()).take(n) {
+            *sample = slot.load(Ordering::Relaxed);
+        }
+        let samples = &mut samples[..n];
+        samples.sort_unstable();
+        let sum: u64 = samples.iter().map(|&s| s as u64).sum();
+        LatencyStats {
+            count,
+            min_us: self.min.load(Ordering::Relaxed),
+            avg_us: (sum / n as u64) as u32,
+            p99_us: samples[(n * 99).div_ceil(100) - 1],
+            max_us: self.max.load(Ordering::Relaxed),
+        }
+    }
+}
+
+static RECORDERS: [StageRecorder; 3] = [const { StageRecorder::new() }; 3];
+
+/// Scan timestamp of the key event which is being processed by the keyboard, 0 if there's none
+static PROCESSING: AtomicU32 = AtomicU32::new(0);
+
+/// Number of queued keyboard reports which are traced, the oldest entry is dropped when it's full
+const QUEUED_SIZE: usize = 8;
+
+/// Scan timestamps and fingerprints of the queued keyboard reports, in the channel order.
+/// The timestamp is 0 if the report isn't caused by a key event.
+static QUEUED: Mutex<crate::RawMutex, RefCell<Deque<(u32, u32), QUEUED_SIZE>>> = Mutex::new(RefCell::new(Deque::new()));
+
+/// Fingerprint of a keyboard report, as it's written in the boot protocol
+fn fingerprint(report: &KeyboardReport) -> u32 {
+    // FNV-1a
+    core::iter::once(report.modifier)
+        .chain(report.keycodes)
+        .fold(0x811c_9dc5, |hash, byte| (hash ^ byte as u32).wrapping_mul(0x0100_0193))
+}
+
+fn report_fingerprint(report: &Report) -> Option<u32> {
+    match report {
+        Report::KeyboardReport(report) => Some(fingerprint(report)),
+        Report::NkroReport(report) => Some(fingerprint(&report.to_boot_report())),
+        _ => None,
+    }
+}
+
+/// Take the timestamp of the report with the fingerprint out of the FIFO, 0 if it's not traced
+fn take_queued(fingerprint: u32) -> u32 {
+    QUEUED.lock(|queued| {
+        let mut queued = queued.borrow_mut();
+        if !queued.iter().any(|(_, f)| *f == fingerprint) {
+            // The report isn't queued by the keyboard
+            return 0;
+        }
+        while let Some((stamp, f)) = queued.pop_front() {
+            if f == fingerprint {
+                return stamp;
+            }
+        }
+        0
+    })
+}
+
+fn record(stage: LatencyStage, stamp: u32) {
+    RECORDERS[stage as usize].record(TraceStamp::elapsed_us(stamp));
+}
+
+/// Get the latency statistics of a stage
+pub fn latency_stats(stage: LatencyStage) -> LatencyStats {
+    RECORDERS[stage as usize].stats()
+}
+
+/// Log the latency statistics of all stages
+pub fn log_latency_stats() {
+    for stage in LatencyStage::ALL {
+        let stats = latency_stats(stage);
+        info!(
+            "Latency {:?}: count {}, min {}us, avg {}us, p99 {}us, max {}us",
+            stage, stats.count, stats.min_us, stats.avg_us, stats.p99_us, stats.max_us
+        );
+    }
+}
+
+/// The keyboard starts processing an event
+pub(crate) fn begin_event(stamp: TraceStamp) {
+    record(LatencyStage::Process, stamp.0);
+    PROCESSING.store(stamp.0, Ordering::Relaxed);
+}
+
+/// The keyboard finishes processing an event, the reports sent later are not caused by the event
+pub(crate) fn end_event() {
+    PROCESSING.store(0, Ordering::Relaxed);
+}
+
+/// A keyboard report is going to be queued by the keyboard, it must be called before the report is sent to the channel
+pub(crate) fn report_queuing(report: &Report) {
+    let Some(fingerprint) = report_fingerprint(report) else {
+        return;
+    };
+    let stamp = PROCESSING.load(Ordering::Relaxed);
+    QUEUED.lock(|queued| {
+        let mut queued = queued.borrow_mut();
+        if queued.is_full() {
+            queued.pop_front();
+        }
+        let _ = queued.push_back((stamp, fingerprint));
+    });
+}
+
+/// A keyboard report is queued by the keyboard
+pub(crate) fn report_queued() {
+    let stamp = PROCESSING.load(Ordering::Relaxed);
+    if stamp != 0 {
+        record(LatencyStage::Report, stamp);
+    }
+}
+
+/// A queued keyboard report is dropped before it's written
+pub(crate) fn report_dropped(report: &Report) {
+    if let Some(fingerprint) = report_fingerprint(report) {
+        take_queued(fingerprint);
+    }
+}
+
+/// A keyboard report is written to the host, NKRO reports are passed as their boot reports
+pub(crate) fn report_written(report: &KeyboardReport) {
+    let stamp = take_queued(fingerprint(report));
+    if stamp != 0 {
+        record(LatencyStage::Write, stamp);
+        if RECORDERS[LatencyStage::Write as usize].count.load(Ordering::Relaxed) % LOG_INTERVAL == 0 {
+            log_latency_stats();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_stage_stats() {
+        let recorder = StageRecorder::new();
+        assert_eq!(recorder.stats(), LatencyStats::default());
+        for latency in 1..=100 {
+            recorder.record(latency);
+        }
+        let stats = recorder.stats();
+        assert_eq!(stats.count, 100);
+        assert_eq!((stats.min_us, stats.max_us), (1, 100));
+        // Only the recent samples, 37..=100, are in the ring
+        assert_eq!(stats.avg_us, (37 + 100) / 2);
+        assert_eq!(stats.p99_us, 100);
+    }
+
+    fn keyboard(keycode: u8) -> KeyboardReport {
+        KeyboardReport {
+            keycodes: [keycode, 0, 0, 0, 0, 0],
+            ..Default::default()
+        }
+    }
+
+    #[test]
+    fn test_queued_stamps() {
+        // Press A, release, press B and release are queued before the writer runs
+        for (stamp, keycode) in [(10, 4), (20, 0), (30, 5), (0, 0)] {
+            PROCESSING.store(stamp, Ordering::Relaxed);
+            report_queuing(&Report::KeyboardReport(keyboard(keycode)));
+        }
+        assert_eq!(take_queued(fingerprint(&keyboard(4))), 10);
+        // The first release is consumed without being written, its entry is skipped
+        assert_eq!(take_queued(fingerprint(&keyboard(5))), 30);
+        // A report which isn't queued by the keyboard keeps the entries
+        assert_eq!(take_queued(fingerprint(&keyboard(6))), 0);
+        assert_eq!(take_queued(fingerprint(&keyboard(0))), 0);
+        assert!(QUEUED.lock(|queued| queued.borrow().is_empty()));
+    }
+
+    #[test]
+    fn test_trace_stamp_is_ignored() {
+        assert_eq!(
+            crate::event::KeyboardEvent::key(1, 2, true),
+            crate::event::KeyboardEvent::key(1, 2, true)
+        );
+        assert_eq!(LatencyStage::from_u8(2), Some(LatencyStage::Write));
+        assert_eq!(LatencyStage::from_u8(3), None);
+    }
+}
@@ -82,6 +82,7 @@ pub mod descriptor;
 pub mod direct_pin;
 pub mod driver;
 pub mod event;
+pub mod flash_keymap;
 pub mod fork;
 pub mod helper_macro;
 pub mod hid;
@@ -91,15 +92,20 @@ pub mod input_device;
 pub mod keyboard;
 pub mod keyboard_macros;
 pub mod keymap;
+#[cfg(feature = "latency_trace")]
+pub mod latency_trace;
 pub mod layout_macro;
 pub mod light;
 pub mod matrix;
 pub mod morse;
 #[cfg(feature = "split")]
 pub mod split;
+pub mod startup;
 pub mod state;
 #[cfg(feature = "storage")]
 pub mod storage;
+#[cfg(feature = "task_stats")]
+pub mod task_stats;
 #[cfg(not(feature = "_no_usb"))]
 pub mod usb;
 
@@ -165,10 +171,11 @@ pub async fn initialize_encoder_keymap_and_storage<
         .await;
 
         let keymap = RefCell::new(
-            KeyMap::new_from_storage(
+            new_keymap_with_storage(
                 default_keymap,
                 Some(default_encoder_map),
-                Some(&mut storage),
+                &mut storage,
+                storage_config,
                 behavior_config,
                 positional_config,
             )
@@ -214,10 +221,11 @@ pub async fn initialize_keymap_and_storage<
     {
         let mut storage = Storage::new(flash, default_keymap, &None, storage_config, behavior_config).await;
         let keymap = RefCell::new(
-            KeyMap::new_from_storage(
+            new_keymap_with_storage(
                 default_keymap,
                 None,
-                Some(&mut storage),
+                &mut storage,
+                storage_config,
                 behavior_config,
                 positional_config,
             )
@@ -234,6 +242,87 @@ pub async fn initialize_keymap_and_storage<
     }
 }
 
+/// Initialize a flash-resident keymap and the storage.
+///
+/// The layers are read from `keymap_image`, which should be a `static` so that it stays in flash. The keys which are
+/// changed by the host or read from the storage are kept in `overlay`.
+#[cfg(feature = "storage")]
+pub async fn initialize_flash_keymap_and_storage<
+    'a,
+    F: AsyncNorFlash,
+    const ROW: usize,
+    const COL: usize,
+    const NUM_LAYER: usize,
+>(
+    keymap_image: &'a [[[KeyAction; COL]; ROW]; NUM_LAYER],
+    overlay: &'a mut [(u16, KeyAction)],
+    flash: F,
+    storage_config: &config::StorageConfig,
+    behavior_config: &'a mut config::BehaviorConfig,
+    positional_config: &'a mut PositionalConfig<ROW, COL>,
+) -> (
+    RefCell<KeyMap<'a, ROW, COL, NUM_LAYER, 0>>,
+    Storage<F, ROW, COL, NUM_LAYER, 0>,
+) {
+    let layers = flash_keymap::FlashKeymap::new(keymap_image, overlay);
+
+    #[cfg(feature = "host")]
+    {
+        let mut storage = Storage::new(flash, keymap_image, &None, storage_config, behavior_config).await;
+        let keymap = RefCell::new(
+            new_keymap_with_storage(
+                layers,
+                None,
+                &mut storage,
+                storage_config,
+                behavior_config,
+                positional_config,
+            )
+            .await,
+        );
+        (keymap, storage)
+    }
+
+    #[cfg(not(feature = "host"))]
+    {
+        let storage = Storage::new(flash, storage_config, &behavior_config).await;
+        let keymap = RefCell::new(KeyMap::new(layers, None, behavior_config, positional_config).await);
+        (keymap, storage)
+    }
+}
+
+/// Create the keymap with the storage.
+///
+/// The keymap is read from the storage now, or by the storage task after the transports are started if `staged_load`
+/// is set in the storage config.
+#[cfg(all(feature = "storage", feature = "host"))]
+async fn new_keymap_with_storage<
+    'a,
+    F: AsyncNorFlash,
+    const ROW: usize,
+    const COL: usize,
+    const NUM_LAYER: usize,
+    const NUM_ENCODER: usize,
+>(
+    layers: impl Into<keymap::KeymapLayers<'a, ROW, COL, NUM_LAYER>>,
+    encoder_map: Option<&'a mut [[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
+    storage: &mut Storage<F, ROW, COL, NUM_LAYER, NUM_ENCODER>,
+    storage_config: &config::StorageConfig,
+    behavior_config: &'a mut config::BehaviorConfig,
+    positional_config: &'a mut PositionalConfig<ROW, COL>,
+) -> KeyMap<'a, ROW, COL, NUM_LAYER, NUM_ENCODER> {
+    startup::record_boot_phase(startup::BootPhase::StorageInit);
+    if storage_config.staged_load {
+        startup::set_keymap_pending();
+        KeyMap::new(layers, encoder_map, behavior_config, positional_config).await
+    } else {
+        let keymap =
+            KeyMap::new_from_storage(layers, encoder_map, Some(storage), behavior_config, positional_config).await;
+        startup::record_boot_phase(startup::BootPhase::KeymapReady);
+        keymap
+    }
+}
+
 #[allow(unreachable_code)]
 pub async fn run_rmk<
     'a,
@@ -275,6 +364,8 @@ pub async fn run_rmk<
         let mut other_writer = add_usb_writer!(&mut usb_builder, CompositeReport, 9);
         #[cfg(feature = "host")]
         let mut host_reader_writer = add_usb_reader_writer!(&mut usb_builder, ViaReport, 32, 32);
+        #[cfg(feature = "nkro")]
+        let mut nkro_writer = crate::usb::add_usb_nkro_writer(&mut usb_builder);
 
         let (mut keyboard_reader, mut keyboard_writer) = keyboard_reader_writer.split();
 
@@ -308,6 +399,8 @@ pub async fn run_rmk<
                         }
                     }
                 };
+                #[cfg(feature = "task_stats")]
+                let usb_task = task_stats::instrument(task_stats::TaskId::Usb, usb_task);
 
                 run_keyboard(
                     #[cfg(feature = "storage")]
@@ -320,7 +413,12 @@ pub async fn run_rmk<
                     rmk_config.vial_config,
                     usb_task,
                     UsbLedReader::new(&mut keyboard_reader),
-                    UsbKeyboardWriter::new(&mut keyboard_writer, &mut other_writer),
+                    UsbKeyboardWriter::new(
+                        &mut keyboard_writer,
+                        &mut other_writer,
+                        #[cfg(feature = "nkro")]
+                        &mut nkro_writer,
+                    ),
                 )
                 .await;
             }
@@ -358,6 +456,7 @@ pub(crate) async fn run_keyboard<
 ) {
     // The state will be changed to true after the keyboard starts running
     CONNECTION_STATE.store(ConnectionState::Connected.into(), Ordering::Release);
+    startup::record_boot_phase(startup::BootPhase::TransportStarted);
     let writer_fut = keyboard_writer.run_writer();
     let led_fut = async {
         loop {
@@ -385,11 +484,31 @@ pub(crate) async fn run_keyboard<
         #[cfg(feature = "vial")]
         vial_config,
     );
-    #[cfg(feature = "storage")]
+    #[cfg(all(feature = "storage", feature = "host"))]
+    let storage_fut = async {
+        // Load the keymap of the staged startup while the transport is coming up
+        startup::load_pending_keymap(keymap, storage).await;
+        storage.run().await
+    };
+    #[cfg(all(feature = "storage", not(feature = "host")))]
     let storage_fut = storage.run();
 
     #[cfg(feature = "controller")]
     let mut wpm_controller = WpmController::new();
+    #[cfg(feature = "controller")]
+    let wpm_fut = wpm_controller.polling_loop();
+
+    #[cfg(feature = "task_stats")]
+    let (writer_fut, led_fut) = (
+        task_stats::instrument(task_stats::TaskId::Writer, writer_fut),
+        task_stats::instrument(task_stats::TaskId::Led, led_fut),
+    );
+    #[cfg(all(feature = "task_stats", feature = "host"))]
+    let host_fut = task_stats::instrument(task_stats::TaskId::Host, host_fut);
+    #[cfg(all(feature = "task_stats", feature = "storage"))]
+    let storage_fut = task_stats::instrument(task_stats::TaskId::Storage, storage_fut);
+    #[cfg(all(feature = "task_stats", feature = "controller"))]
+    let wpm_fut = task_stats::instrument(task_stats::TaskId::Wpm, wpm_fut);
 
     #[cfg(feature = "storage")]
     let storage_task = core::pin::pin!(storage_fut.fuse());
@@ -402,7 +521,7 @@ pub(crate) async fn run_keyboard<
     futures::select_biased! {
         _ = communication_task => error!("Communication task has ended"),
         _ = with_feature!("storage", storage_task) => error!("Storage task has ended"),
-        _ = with_feature!("controller", wpm_controller.polling_loop()) => error!("WPM Controller task ended"),
+        _ = with_feature!("controller", wpm_fut) => error!("WPM Controller task ended"),
         _ = led_task => error!("Led task has ended"),
         _ = with_feature!("host", host_task) => error!("Host task ended"),
         _ = writer_task => error!("Writer task has ended"),
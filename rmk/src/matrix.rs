@@ -2,7 +2,7 @@
 use core::pin::pin;
 use core::sync::atomic::Ordering;
 
-use embassy_time::Timer;
+use embassy_time::{Duration, Timer};
 use embedded_hal::digital::{InputPin, OutputPin};
 use rmk_macro::input_device;
 #[cfg(feature = "async_matrix")]
@@ -11,16 +11,23 @@ use {embassy_futures::select::select_slice, embedded_hal_async::digital::Wait, h
 use crate::CONNECTION_STATE;
 use crate::debounce::{DebounceState, DebouncerTrait};
 use crate::event::{KeyboardEvent, publish_input_event_async};
+use crate::input_device::scan_governor::ScanGovernor;
 use crate::input_device::{InputDevice, Runnable};
 use crate::state::ConnectionState;
 pub mod bidirectional_matrix;
+pub mod frame_matrix;
+
+/// Size of a page of the Vial matrix tester report, in bytes
+#[cfg(feature = "vial_lock")]
+pub const MATRIX_STATE_PAGE_SIZE: usize = 28;
 
 /// Recording the matrix pressed state
+///
+/// The state is bit-packed per row, bit `col` of `state[row]` is the key at (row, col), so any matrix size up to 64
+/// columns is supported. The host reads the state in pages of whole rows, see [`Self::read_page`].
 #[cfg(feature = "vial_lock")]
 pub struct MatrixState<const ROW: usize, const COL: usize> {
-    // 30 bytes is the limited by Vial and 240 keys is enough for
-    // most keyboard
-    state: [u8; 30],
+    state: [u64; ROW],
 }
 
 #[cfg(feature = "vial_lock")]
@@ -32,15 +39,18 @@ impl<const ROW: usize, const COL: usize> Default for MatrixState<ROW, COL> {
 
 #[cfg(feature = "vial_lock")]
 impl<const ROW: usize, const COL: usize> MatrixState<ROW, COL> {
-    const ROW_LEN: usize = (COL + 8) / 8;
-    const OUT_OF_BOUNDARY: () = if ROW * Self::ROW_LEN > 30 {
+    /// Bytes of a row in the Vial report
+    const ROW_LEN: usize = if COL == 0 { 1 } else { COL.div_ceil(8) };
+    const OUT_OF_BOUNDARY: () = if COL > 64 {
         panic!(
-            "Cannot use matrix tester because your keyboard has too many keys. \
-            Consider disable the `matrix_tester` feature"
+            "Cannot use matrix tester because your keyboard has more than 64 columns. \
+            Consider disable the `vial_lock` feature"
         )
     };
     pub fn new() -> Self {
-        Self { state: [0; 30] }
+        #[allow(clippy::let_unit_value)]
+        let _ = Self::OUT_OF_BOUNDARY;
+        Self { state: [0; ROW] }
     }
     pub fn update(&mut self, event: &KeyboardEvent) {
         use crate::event::{KeyPos, KeyboardEventPos};
@@ -49,24 +59,27 @@ impl<const ROW: usize, const COL: usize> MatrixState<ROW, COL> {
                 warn!("Matrix read out of bounds");
                 return;
             }
-            let pressed = event.pressed;
-            let index = row as usize * Self::ROW_LEN * 8 + col as usize;
-            let byte_index = index / 8;
-            let bit_index = index % 8;
-            self.state[byte_index] = self.state[byte_index] & !(1 << bit_index) | ((pressed as u8) << bit_index);
+            let bit = 1 << col;
+            if event.pressed {
+                self.state[row as usize] |= bit;
+            } else {
+                self.state[row as usize] &= !bit;
+            }
         }
     }
-    pub fn read_all(&self, target: &mut [u8]) {
-        let slice = &self.state[..(ROW * Self::ROW_LEN)];
-        let mut target_iter = target.iter_mut();
-        for row_bytes in slice.chunks(Self::ROW_LEN) {
-            for byte in row_bytes.iter().rev() {
-                if let Some(target_byte) = target_iter.next() {
-                    *target_byte = *byte;
-                } else {
-                    break;
-                }
-            }
+    /// Number of rows in a page
+    pub const fn rows_per_page() -> usize {
+        MATRIX_STATE_PAGE_SIZE / Self::ROW_LEN
+    }
+    /// Read the page of rows starting from row `offset`, as many whole rows as fit in `MATRIX_STATE_PAGE_SIZE` bytes.
+    ///
+    /// Each row takes `ceil(COL / 8)` bytes, the most significant byte first. Rows after the last row are left
+    /// untouched.
+    pub fn read_page(&self, offset: usize, target: &mut [u8]) {
+        let len = target.len().min(MATRIX_STATE_PAGE_SIZE);
+        let rows = self.state.iter().skip(offset).take(Self::rows_per_page());
+        for (row, target_bytes) in rows.zip(target[..len].chunks_exact_mut(Self::ROW_LEN)) {
+            target_bytes.copy_from_slice(&row.to_be_bytes()[8 - Self::ROW_LEN..]);
         }
     }
     pub fn read(&self, row: u8, col: u8) -> bool {
@@ -74,10 +87,7 @@ impl<const ROW: usize, const COL: usize> MatrixState<ROW, COL> {
             warn!("Matrix read out of bounds");
             return false;
         }
-        let index = row as usize * Self::ROW_LEN * 8 + col as usize;
-        let byte_index = index / 8;
-        let bit_index = index % 8;
-        self.state[byte_index] & (1 << bit_index) != 0
+        self.state[row as usize] & (1 << col) != 0
     }
 }
 
@@ -175,9 +185,10 @@ pub struct Matrix<
     key_states: [[KeyState; ROW]; COL],
     /// Current scan pos: (out_idx, in_idx)
     scan_pos: (usize, usize),
-    /// Re-scan needed flag
-    #[cfg(feature = "async_matrix")]
+    /// Re-scan needed flag, set when a key is pressed or being debounced
     rescan_needed: bool,
+    /// Scan rate governor
+    governor: ScanGovernor,
 }
 
 impl<
@@ -366,8 +377,8 @@ where
             debouncer,
             key_states: [[KeyState::new(); ROW]; COL],
             scan_pos: (0, 0),
-            #[cfg(feature = "async_matrix")]
             rescan_needed: false,
+            governor: ScanGovernor::register(),
         }
     }
 }
@@ -425,10 +436,7 @@ where
                     if let DebounceState::Debounced = debounce_state {
                         self.key_states[col_idx][row_idx].toggle_pressed();
                         self.scan_pos = (out_idx, in_idx);
-                        #[cfg(feature = "async_matrix")]
-                        {
-                            self.rescan_needed = true;
-                        }
+                        self.rescan_needed = true;
                         // Pull it back to low before returning
                         if let Some(out_pin) = self.get_output_pins_mut().get_mut(out_idx) {
                             out_pin.set_low().ok();
@@ -440,9 +448,10 @@ where
                         );
                     }
 
-                    // If there's key still pressed, always refresh the self.scan_start
-                    #[cfg(feature = "async_matrix")]
-                    if self.key_states[col_idx][row_idx].pressed {
+                    // Keep scanning at full rate while a key is pressed or being debounced, so that the first
+                    // keystroke after idle isn't lost in a slow scan tier
+                    if self.key_states[col_idx][row_idx].pressed || matches!(debounce_state, DebounceState::InProgress)
+                    {
                         self.rescan_needed = true;
                     }
                 }
@@ -453,13 +462,19 @@ where
                 }
             }
 
-            #[cfg(feature = "async_matrix")]
-            {
-                if !self.rescan_needed {
-                    self.wait_for_key().await;
-                }
-                self.rescan_needed = false;
+            if self.rescan_needed {
+                self.governor.activity();
+            } else {
+                let rate = self
+                    .governor
+                    .idle(Duration::from_ticks(0), cfg!(feature = "async_matrix"));
+                #[cfg(feature = "async_matrix")]
+                rate.sleep(self.wait_for_key()).await;
+                #[cfg(not(feature = "async_matrix"))]
+                rate.sleep(core::future::pending::<()>()).await;
+                self.governor.wake();
             }
+            self.rescan_needed = false;
             self.scan_pos = (0, 0);
         }
     }
@@ -554,3 +569,39 @@ impl<const ROW: usize, const COL: usize> MatrixTrait<ROW, COL> for TestMatrix<RO
     #[cfg(feature = "async_matrix")]
     async fn wait_for_key(&mut self) {}
 }
+
+#[cfg(all(test, feature = "vial_lock"))]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_matrix_state_pages() {
+        // 12 columns take 2 bytes per row, 14 rows per page
+        let mut state = MatrixState::<20, 12>::new();
+        assert_eq!(MatrixState::<20, 12>::rows_per_page(), 14);
+        state.update(&KeyboardEvent::key(0, 11, true));
+        state.update(&KeyboardEvent::key(15, 3, true));
+        state.update(&KeyboardEvent::key(19, 1, true));
+        state.update(&KeyboardEvent::key(19, 3, true));
+        assert!(state.read(0, 11));
+        assert!(state.read(19, 3));
+        assert!(!state.read(19, 2));
+
+        let mut page = [0xFF; 30];
+        state.read_page(0, &mut page);
+        assert_eq!(page[..2], [0x08, 0x00]);
+        assert_eq!(page[2..28], [0; 26]);
+        // Bytes after the page are untouched
+        assert_eq!(page[28..], [0xFF; 2]);
+
+        let mut page = [0xFF; 30];
+        state.read_page(14, &mut page);
+        assert_eq!(page[2..4], [0x00, 0x08]);
+        assert_eq!(page[10..12], [0x00, 0x0A]);
+        assert_eq!(page[12..], [0xFF; 18]);
+
+        // Releasing a key only clears its own bit
+        state.update(&KeyboardEvent::key(19, 1, false));
+        assert_eq!(state.state[19], 0b1000);
+    }
+}
@@ -0,0 +1,653 @@
+//! Frame-based matrix scan engine.
+//!
+//! [`Matrix`](crate::matrix::Matrix) awaits a timer after strobing every output pin, so one scan pass
+//! is interleaved with every other task in the executor and may take several milliseconds.
+//! [`FrameMatrix`] scans a whole frame synchronously instead: each output line is settled with a
+//! calibrated busy-wait, all input lines are read at once through [`ScanPins::read_inputs`], and control
+//! is handed back to the executor only after the full frame has been captured.
+//!
+//! The pin access is abstracted by [`ScanPins`]. [`GpioScanPins`] works with any `embedded-hal` pins,
+//! chip-specific implementations can read a whole GPIO port with one register access, or override
+//! [`ScanPins::scan_frame`] to capture the frame with a hardware timer, PIO or DMA driven strobe.
+use core::hint::black_box;
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use embassy_time::{Duration, Instant, Timer};
+use embedded_hal::digital::{InputPin, OutputPin};
+#[cfg(feature = "async_matrix")]
+use embedded_hal_async::digital::Wait;
+use rmk_macro::input_device;
+
+use crate::USB_POLL_INTERVAL_US;
+use crate::debounce::BatchDebouncerTrait;
+use crate::event::{KEYBOARD_BATCH_EVENT_SIZE, KeyboardBatchEvent, KeyboardEvent};
+use crate::input_device::scan_governor::{ScanGovernor, ScanRate};
+use crate::matrix::MatrixTrait;
+
+/// Matrix scan rate of the latest measurement window, in frames per second
+static MATRIX_SCAN_RATE: AtomicU32 = AtomicU32::new(0);
+
+/// Cached result of the busy-wait calibration, 0 means not calibrated yet
+static SPIN_LOOPS_PER_US: AtomicU32 = AtomicU32::new(0);
+
+/// Get the latest measured matrix scan rate, in frames per second.
+///
+/// Returns 0 if no [`FrameMatrix`] has completed a measurement window yet.
+pub fn matrix_scan_rate() -> u32 {
+    MATRIX_SCAN_RATE.load(Ordering::Relaxed)
+}
+
+/// Busy-wait delay used to let the matrix lines settle after an output is strobed.
+///
+/// The delay is calibrated against `embassy_time` once, so it doesn't depend on the core clock
+/// and it's much finer than the tick rate of the time driver.
+#[derive(Clone, Copy, Debug)]
+pub struct SpinDelay {
+    loops_per_us: u32,
+}
+
+impl SpinDelay {
+    /// Length of the calibration window
+    const CALIBRATION_WINDOW_US: u64 = 2000;
+    /// Number of spin loops between two `Instant::now()` calls while calibrating
+    const CALIBRATION_BATCH: u32 = 256;
+
+    /// Get the calibrated delay, the calibration runs only at the first call.
+    pub fn calibrated() -> Self {
+        let loops_per_us = match SPIN_LOOPS_PER_US.load(Ordering::Relaxed) {
+            0 => {
+                let loops_per_us = Self::calibrate();
+                SPIN_LOOPS_PER_US.store(loops_per_us, Ordering::Relaxed);
+                loops_per_us
+            }
+            l => l,
+        };
+        Self { loops_per_us }
+    }
+
+    fn calibrate() -> u32 {
+        // Align the start to a tick edge of the time driver
+        let edge = Instant::now();
+        while Instant::now() == edge {}
+
+        let start = Instant::now();
+        let mut loops: u64 = 0;
+        while start.elapsed().as_micros() < Self::CALIBRATION_WINDOW_US {
+            Self::spin(Self::CALIBRATION_BATCH);
+            loops += Self::CALIBRATION_BATCH as u64;
+        }
+        let loops_per_us = loops.div_ceil(start.elapsed().as_micros().max(1));
+        debug!("Matrix settle delay calibrated: {} loops/us", loops_per_us);
+        (loops_per_us as u32).max(1)
+    }
+
+    #[inline(always)]
+    fn spin(loops: u32) {
+        for i in 0..loops {
+            black_box(i);
+            core::hint::spin_loop();
+        }
+    }
+
+    /// Busy-wait for `us` microseconds
+    #[inline]
+    pub fn delay_us(&self, us: u32) {
+        Self::spin(self.loops_per_us.saturating_mul(us));
+    }
+}
+
+/// Measures the scan rate of a matrix, the result is available via [`matrix_scan_rate`].
+pub struct ScanRateMeter {
+    window_start: Instant,
+    frames: u32,
+}
+
+impl Default for ScanRateMeter {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl ScanRateMeter {
+    /// Length of the measurement window
+    const WINDOW: Duration = Duration::from_secs(1);
+
+    pub fn new() -> Self {
+        Self {
+            window_start: Instant::now(),
+            frames: 0,
+        }
+    }
+
+    /// Record a captured frame
+    pub fn tick(&mut self) {
+        self.frames += 1;
+        let elapsed = self.window_start.elapsed();
+        if elapsed >= Self::WINDOW {
+            let rate = (self.frames as u64 * 1_000_000 / elapsed.as_micros().max(1)) as u32;
+            MATRIX_SCAN_RATE.store(rate, Ordering::Relaxed);
+            debug!("Matrix scan rate: {} Hz", rate);
+            self.window_start = Instant::now();
+            self.frames = 0;
+        }
+    }
+}
+
+/// Pins of a scanned matrix.
+///
+/// The matrix is scanned by activating the output lines one by one and reading all input lines
+/// while an output is active.
+pub trait ScanPins {
+    /// Number of output(strobe) lines
+    const OUTPUT_NUM: usize;
+    /// Number of input lines, at most 32
+    const INPUT_NUM: usize;
+
+    /// Activate or deactivate a single output line
+    fn set_output(&mut self, out_idx: usize, active: bool);
+
+    /// Read all input lines, bit `i` of the result is set if input line `i` is active.
+    ///
+    /// Implementations for a specific chip can read the whole GPIO port in one register access here.
+    fn read_inputs(&mut self) -> u32;
+
+    /// Capture a full frame, `f(out_idx, input_mask)` is called for every output line.
+    ///
+    /// The default implementation strobes the output lines one by one in software and waits `settle`
+    /// before reading the inputs. Override it if the frame can be captured by hardware.
+    fn scan_frame(&mut self, settle: &SpinDelay, settle_us: u32, mut f: impl FnMut(usize, u32)) {
+        for out_idx in 0..Self::OUTPUT_NUM {
+            self.set_output(out_idx, true);
+            settle.delay_us(settle_us);
+            let inputs = self.read_inputs();
+            self.set_output(out_idx, false);
+            f(out_idx, inputs);
+        }
+    }
+
+    /// Activate all output lines and wait until any of the input lines becomes active
+    #[cfg(feature = "async_matrix")]
+    async fn wait_for_any_input(&mut self);
+}
+
+/// [`ScanPins`] implementation over `embedded-hal` GPIO pins.
+pub struct GpioScanPins<
+    #[cfg(feature = "async_matrix")] In: Wait + InputPin,
+    #[cfg(not(feature = "async_matrix"))] In: InputPin,
+    Out: OutputPin,
+    const INPUT_NUM: usize,
+    const OUTPUT_NUM: usize,
+> {
+    input_pins: [In; INPUT_NUM],
+    output_pins: [Out; OUTPUT_NUM],
+}
+
+impl<
+    #[cfg(feature = "async_matrix")] In: Wait + InputPin,
+    #[cfg(not(feature = "async_matrix"))] In: InputPin,
+    Out: OutputPin,
+    const INPUT_NUM: usize,
+    const OUTPUT_NUM: usize,
+> GpioScanPins<In, Out, INPUT_NUM, OUTPUT_NUM>
+{
+    pub fn new(input_pins: [In; INPUT_NUM], output_pins: [Out; OUTPUT_NUM]) -> Self {
+        Self {
+            input_pins,
+            output_pins,
+        }
+    }
+}
+
+impl<
+    #[cfg(feature = "async_matrix")] In: Wait + InputPin,
+    #[cfg(not(feature = "async_matrix"))] In: InputPin,
+    Out: OutputPin,
+    const INPUT_NUM: usize,
+    const OUTPUT_NUM: usize,
+> ScanPins for GpioScanPins<In, Out, INPUT_NUM, OUTPUT_NUM>
+{
+    const OUTPUT_NUM: usize = OUTPUT_NUM;
+    const INPUT_NUM: usize = INPUT_NUM;
+
+    fn set_output(&mut self, out_idx: usize, active: bool) {
+        if let Some(out_pin) = self.output_pins.get_mut(out_idx) {
+            if active {
+                out_pin.set_high().ok();
+            } else {
+                out_pin.set_low().ok();
+            }
+        }
+    }
+
+    fn read_inputs(&mut self) -> u32 {
+        let mut mask = 0;
+        for (in_idx, in_pin) in self.input_pins.iter_mut().enumerate() {
+            if in_pin.is_high().ok().unwrap_or_default() {
+                mask |= 1 << in_idx;
+            }
+        }
+        mask
+    }
+
+    #[cfg(feature = "async_matrix")]
+    async fn wait_for_any_input(&mut self) {
+        use core::pin::pin;
+
+        use embassy_futures::select::select_slice;
+        use heapless::Vec;
+
+        for out_pin in self.output_pins.iter_mut() {
+            out_pin.set_high().ok();
+        }
+        let mut futs: Vec<_, INPUT_NUM> = self
+            .input_pins
+            .iter_mut()
+            .map(|input_pin| input_pin.wait_for_high())
+            .collect();
+        let _ = select_slice(pin!(futs.as_mut_slice())).await;
+        drop(futs);
+        for out_pin in self.output_pins.iter_mut() {
+            out_pin.set_low().ok();
+        }
+    }
+}
+
+/// Matrix which captures a whole frame before handing control back to the executor.
+///
+/// The frame and the key states are stored row-major as bitmasks, bit `col` of `frame[row]` is the
+/// raw state of the key at (row, col). The whole frame is debounced at once by a [`BatchDebouncerTrait`],
+/// every [`DebouncerTrait`](crate::debounce::DebouncerTrait) can be used as well.
+/// The debounced changes of a frame are reported one by one, a new frame is captured only after all
+/// changes in the current frame are reported.
+#[input_device(publish = KeyboardEvent)]
+pub struct FrameMatrix<
+    P: ScanPins,
+    D: BatchDebouncerTrait<ROW, COL>,
+    const ROW: usize,
+    const COL: usize,
+    const COL2ROW: bool,
+    const ROW_OFFSET: usize = 0,
+    const COL_OFFSET: usize = 0,
+> {
+    /// Matrix pins
+    pins: P,
+    /// Debouncer
+    debouncer: D,
+    /// Raw key states of the latest captured frame
+    frame: [u32; ROW],
+    /// Debounced key states
+    key_states: [u32; ROW],
+    /// Debounced changes of the current frame which are not reported yet
+    changed: [u32; ROW],
+    /// Settle time after an output line is activated, in microseconds
+    settle_us: u32,
+    /// Wait time between two frames
+    scan_interval: Duration,
+    /// Timestamp of the latest captured frame
+    frame_time: Instant,
+    /// Whether frames are captured on a fixed `scan_interval` grid instead of waiting `scan_interval` after each frame
+    poll_aligned: bool,
+    /// Scheduled start of the next frame, used when `poll_aligned` is set
+    next_scan: Instant,
+    /// Scan rate measurement
+    scan_rate: ScanRateMeter,
+    /// Scan rate governor
+    governor: ScanGovernor,
+}
+
+impl<
+    P: ScanPins,
+    D: BatchDebouncerTrait<ROW, COL>,
+    const ROW: usize,
+    const COL: usize,
+    const COL2ROW: bool,
+    const ROW_OFFSET: usize,
+    const COL_OFFSET: usize,
+> FrameMatrix<P, D, ROW, COL, COL2ROW, ROW_OFFSET, COL_OFFSET>
+{
+    const DEFAULT_SETTLE_US: u32 = 1;
+    const DEFAULT_SCAN_INTERVAL_US: u64 = 0;
+    const SIZE_CHECK: () = {
+        if COL > 32 || P::INPUT_NUM > 32 {
+            panic!("FrameMatrix supports at most 32 columns and 32 input pins")
+        }
+        if P::OUTPUT_NUM != (if COL2ROW { COL } else { ROW }) || P::INPUT_NUM != (if COL2ROW { ROW } else { COL }) {
+            panic!("The number of matrix pins doesn't match ROW and COL")
+        }
+    };
+
+    /// Create a frame matrix with default settle time and scan interval.
+    pub fn new(pins: P, debouncer: D) -> Self {
+        Self::with_scan_interval(pins, debouncer, Self::DEFAULT_SETTLE_US, Self::DEFAULT_SCAN_INTERVAL_US)
+    }
+
+    /// Create a frame matrix with custom settle time and scan interval, in microseconds.
+    ///
+    /// A zero scan interval still yields to the executor between frames.
+    pub fn with_scan_interval(pins: P, debouncer: D, settle_us: u32, scan_interval_us: u64) -> Self {
+        #[allow(clippy::let_unit_value)]
+        let _ = Self::SIZE_CHECK;
+        Self {
+            pins,
+            debouncer,
+            frame: [0; ROW],
+            key_states: [0; ROW],
+            changed: [0; ROW],
+            settle_us,
+            scan_interval: Duration::from_micros(scan_interval_us),
+            frame_time: Instant::now(),
+            poll_aligned: false,
+            next_scan: Instant::now(),
+            scan_rate: ScanRateMeter::new(),
+            governor: ScanGovernor::register(),
+        }
+    }
+
+    /// Create a frame matrix which captures exactly one frame per USB polling interval.
+    ///
+    /// Frames are scheduled on a fixed grid of `usb_poll_interval_us` in `keyboard.toml`, so that every
+    /// host poll picks up a fresh frame, and the scan doesn't drift when processing a frame takes longer.
+    pub fn poll_aligned(pins: P, debouncer: D, settle_us: u32) -> Self {
+        let mut matrix = Self::with_scan_interval(pins, debouncer, settle_us, USB_POLL_INTERVAL_US as u64);
+        matrix.poll_aligned = true;
+        matrix
+    }
+
+    /// Wait until the next frame should be captured
+    async fn wait_next_frame(&mut self) {
+        if !self.poll_aligned {
+            Timer::after(self.scan_interval).await;
+            return;
+        }
+        self.next_scan += self.scan_interval;
+        let now = Instant::now();
+        if self.next_scan < now {
+            // Missed a slot, restart the grid from now instead of catching up with a burst of frames
+            self.next_scan = now;
+        }
+        Timer::at(self.next_scan).await;
+    }
+
+    /// Capture a full frame without yielding.
+    fn capture_frame(&mut self) {
+        let settle = SpinDelay::calibrated();
+        let frame = &mut self.frame;
+        if COL2ROW {
+            // Output lines are columns, scatter the active rows into the row-major frame
+            *frame = [0; ROW];
+            self.pins.scan_frame(&settle, self.settle_us, |col_idx, mut rows| {
+                while rows != 0 {
+                    let row_idx = rows.trailing_zeros() as usize;
+                    if let Some(r) = frame.get_mut(row_idx) {
+                        *r |= 1 << col_idx;
+                    }
+                    rows &= rows - 1;
+                }
+            });
+        } else {
+            self.pins.scan_frame(&settle, self.settle_us, |row_idx, cols| {
+                if let Some(r) = frame.get_mut(row_idx) {
+                    *r = cols;
+                }
+            });
+        }
+        self.frame_time = Instant::now();
+        self.debouncer
+            .debounce_frame(self.frame_time, &self.frame, &self.key_states, &mut self.changed);
+        self.scan_rate.tick();
+    }
+
+    /// Take the next unreported change of current frame, in row-major order.
+    fn next_debounced_event(&mut self) -> Option<KeyboardEvent> {
+        for row_idx in 0..ROW {
+            let changed = self.changed[row_idx];
+            if changed != 0 {
+                let col_idx = changed.trailing_zeros() as usize;
+                let bit = 1 << col_idx;
+                self.changed[row_idx] &= !bit;
+                self.key_states[row_idx] ^= bit;
+                return Some(KeyboardEvent::key(
+                    (row_idx + ROW_OFFSET) as u8,
+                    (col_idx + COL_OFFSET) as u8,
+                    self.key_states[row_idx] & bit != 0,
+                ));
+            }
+        }
+        None
+    }
+
+    /// Whether all keys are released and stable, so that the scanning can be paused
+    fn is_idle(&self) -> bool {
+        self.frame.iter().chain(self.key_states.iter()).all(|r| *r == 0)
+    }
+
+    /// Keep scanning until there are unreported changes in the current frame
+    async fn scan_until_changed(&mut self) {
+        while self.changed.iter().all(|r| *r == 0) {
+            if self.is_idle() {
+                let rate = self
+                    .governor
+                    .idle(Duration::from_ticks(0), cfg!(feature = "async_matrix"));
+                #[cfg(feature = "async_matrix")]
+                rate.sleep(self.wait_for_key()).await;
+                #[cfg(not(feature = "async_matrix"))]
+                rate.sleep(core::future::pending::<()>()).await;
+                self.governor.wake();
+                if rate != ScanRate::Full {
+                    // Restart the grid from the wakeup
+                    self.next_scan = Instant::now();
+                }
+            } else {
+                self.governor.activity();
+            }
+
+            self.wait_next_frame().await;
+            self.capture_frame();
+        }
+    }
+
+    async fn read_keyboard_event(&mut self) -> KeyboardEvent {
+        loop {
+            if let Some(event) = self.next_debounced_event() {
+                return event;
+            }
+            self.scan_until_changed().await;
+        }
+    }
+}
+
+/// Matrix which can report all debounced changes of a scan pass at once.
+pub trait FrameScan {
+    /// Wait for the next scan pass with changes, return all changes of that pass.
+    ///
+    /// If there are more changes than [`KEYBOARD_BATCH_EVENT_SIZE`], the rest are returned by the next call.
+    async fn read_frame(&mut self) -> KeyboardBatchEvent;
+}
+
+impl<
+    P: ScanPins,
+    D: BatchDebouncerTrait<ROW, COL>,
+    const ROW: usize,
+    const COL: usize,
+    const COL2ROW: bool,
+    const ROW_OFFSET: usize,
+    const COL_OFFSET: usize,
+> FrameScan for FrameMatrix<P, D, ROW, COL, COL2ROW, ROW_OFFSET, COL_OFFSET>
+{
+    async fn read_frame(&mut self) -> KeyboardBatchEvent {
+        self.scan_until_changed().await;
+        let mut batch = KeyboardBatchEvent {
+            timestamp: self.frame_time,
+            events: heapless::Vec::new(),
+        };
+        while batch.events.len() < KEYBOARD_BATCH_EVENT_SIZE
+            && let Some(event) = self.next_debounced_event()
+        {
+            let _ = batch.events.push(event);
+        }
+        batch
+    }
+}
+
+/// Frame mode of a matrix: all debounced changes of one scan pass are published as a single [`KeyboardBatchEvent`].
+///
+/// # Example
+/// ```rust,ignore
+/// let matrix = FrameMatrix::<_, _, ROW, COL, true>::new(pins, BitDebouncer::new());
+/// let mut matrix = FrameModeMatrix::new(matrix);
+/// run_all!(matrix);
+/// ```
+#[input_device(publish = KeyboardBatchEvent)]
+pub struct FrameModeMatrix<M: FrameScan> {
+    matrix: M,
+}
+
+impl<M: FrameScan> FrameModeMatrix<M> {
+    pub fn new(matrix: M) -> Self {
+        Self { matrix }
+    }
+
+    async fn read_keyboard_batch_event(&mut self) -> KeyboardBatchEvent {
+        self.matrix.read_frame().await
+    }
+}
+
+impl<const ROW: usize, const COL: usize, M: FrameScan + MatrixTrait<ROW, COL>> MatrixTrait<ROW, COL>
+    for FrameModeMatrix<M>
+{
+    #[cfg(feature = "async_matrix")]
+    async fn wait_for_key(&mut self) {
+        self.matrix.wait_for_key().await;
+    }
+}
+
+impl<
+    P: ScanPins,
+    D: BatchDebouncerTrait<ROW, COL>,
+    const ROW: usize,
+    const COL: usize,
+    const COL2ROW: bool,
+    const ROW_OFFSET: usize,
+    const COL_OFFSET: usize,
+> MatrixTrait<ROW, COL> for FrameMatrix<P, D, ROW, COL, COL2ROW, ROW_OFFSET, COL_OFFSET>
+{
+    #[cfg(feature = "async_matrix")]
+    async fn wait_for_key(&mut self) {
+        self.pins.wait_for_any_input().await;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use core::cell::Cell;
+    use core::convert::Infallible;
+
+    use embedded_hal::digital::ErrorType;
+
+    use super::*;
+    use crate::debounce::bit_debouncer::BitDebouncer;
+    use crate::debounce::fast_debouncer::FastDebouncer;
+
+    thread_local! {
+        /// Currently active output line
+        static ACTIVE_OUT: Cell<Option<usize>> = const { Cell::new(None) };
+        /// Pressed keys, as (out_idx, in_idx)
+        static PRESSED: Cell<[(usize, usize); 2]> = const { Cell::new([(1, 0), (2, 1)]) };
+    }
+
+    struct TestOut(usize);
+    struct TestIn(usize);
+
+    impl ErrorType for TestOut {
+        type Error = Infallible;
+    }
+    impl ErrorType for TestIn {
+        type Error = Infallible;
+    }
+
+    impl OutputPin for TestOut {
+        fn set_low(&mut self) -> Result<(), Self::Error> {
+            ACTIVE_OUT.with(|o| o.set(None));
+            Ok(())
+        }
+        fn set_high(&mut self) -> Result<(), Self::Error> {
+            ACTIVE_OUT.with(|o| o.set(Some(self.0)));
+            Ok(())
+        }
+    }
+
+    impl InputPin for TestIn {
+        fn is_high(&mut self) -> Result<bool, Self::Error> {
+            let out = ACTIVE_OUT.with(|o| o.get());
+            Ok(PRESSED.with(|p| p.get().iter().any(|&(o, i)| Some(o) == out && i == self.0)))
+        }
+        fn is_low(&mut self) -> Result<bool, Self::Error> {
+            self.is_high().map(|h| !h)
+        }
+    }
+
+    #[cfg(feature = "async_matrix")]
+    impl embedded_hal_async::digital::Wait for TestIn {
+        async fn wait_for_high(&mut self) -> Result<(), Self::Error> {
+            Ok(())
+        }
+        async fn wait_for_low(&mut self) -> Result<(), Self::Error> {
+            Ok(())
+        }
+        async fn wait_for_rising_edge(&mut self) -> Result<(), Self::Error> {
+            Ok(())
+        }
+        async fn wait_for_falling_edge(&mut self) -> Result<(), Self::Error> {
+            Ok(())
+        }
+        async fn wait_for_any_edge(&mut self) -> Result<(), Self::Error> {
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn test_col2row_frame_is_row_major() {
+        // COL2ROW: 3 output columns, 2 input rows
+        let pins = GpioScanPins::new([TestIn(0), TestIn(1)], [TestOut(0), TestOut(1), TestOut(2)]);
+        let mut matrix: FrameMatrix<_, _, 2, 3, true> = FrameMatrix::new(pins, FastDebouncer::new());
+        matrix.capture_frame();
+        assert_eq!(matrix.frame, [0b010, 0b100]);
+
+        // Fast debouncer reports both keys from the same frame, in row-major order
+        assert_eq!(matrix.next_debounced_event(), Some(KeyboardEvent::key(0, 1, true)));
+        assert_eq!(matrix.next_debounced_event(), Some(KeyboardEvent::key(1, 2, true)));
+        assert_eq!(matrix.next_debounced_event(), None);
+        assert_eq!(matrix.key_states, [0b010, 0b100]);
+    }
+
+    #[test]
+    fn test_row2col_frame() {
+        // ROW2COL: 3 output rows, 2 input columns
+        let pins = GpioScanPins::new([TestIn(0), TestIn(1)], [TestOut(0), TestOut(1), TestOut(2)]);
+        let mut matrix: FrameMatrix<_, _, 3, 2, false> = FrameMatrix::new(pins, FastDebouncer::new());
+        matrix.capture_frame();
+        assert_eq!(matrix.frame, [0b00, 0b01, 0b10]);
+        assert!(!matrix.is_idle());
+    }
+
+    #[test]
+    fn test_frame_with_bit_debouncer() {
+        let pins = GpioScanPins::new([TestIn(0), TestIn(1)], [TestOut(0), TestOut(1), TestOut(2)]);
+        let mut matrix: FrameMatrix<_, _, 2, 3, true> = FrameMatrix::new(pins, BitDebouncer::new());
+        // Nothing is reported before the keys are stable for `DEBOUNCE_THRESHOLD`
+        matrix.capture_frame();
+        assert_eq!(matrix.next_debounced_event(), None);
+        assert!(!matrix.is_idle());
+    }
+
+    #[test]
+    fn test_frame_mode_batches_all_changes() {
+        let pins = GpioScanPins::new([TestIn(0), TestIn(1)], [TestOut(0), TestOut(1), TestOut(2)]);
+        let mut matrix: FrameMatrix<_, _, 2, 3, true> = FrameMatrix::new(pins, FastDebouncer::new());
+        let batch = embassy_futures::block_on(matrix.read_frame());
+        assert_eq!(
+            batch.events.as_slice(),
+            &[KeyboardEvent::key(0, 1, true), KeyboardEvent::key(1, 2, true)]
+        );
+    }
+}
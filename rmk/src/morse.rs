@@ -233,27 +233,24 @@ impl Morse {
     /// Checks all stored patterns if more than one continuation found for the given pattern, None,
     /// otherwise the unique completion
     pub fn try_predict_final_action(&self, pattern_start: MorsePattern) -> Option<Action> {
-        // Check whether current pattern matches any of the legal patterns.
-        // If not, return early
-        if !self.actions.contains_key(&pattern_start) {
-            return None;
-        }
-
+        // The patterns are checked in one pass: the given pattern must be one of the legal patterns,
+        // and all patterns starting with it must have the same action
+        let mut legal = false;
         let mut first: Option<&Action> = None;
-        for pair in self.actions.iter() {
-            // If pair.pattern starts with the given pattern_start
-            if pair.0.starts_with(pattern_start) {
-                if let Some(action) = first {
-                    if *action != *pair.1 {
-                        return None; //the solution is not unique, so must wait for possible continuation
-                    }
-                } else {
-                    first = Some(pair.1);
-                }
+        for (pattern, action) in self.actions.iter() {
+            if !pattern.starts_with(pattern_start) {
+                continue;
+            }
+            legal |= *pattern == pattern_start;
+            match first {
+                // The solution is not unique, so must wait for possible continuation
+                Some(first) if first != action => return None,
+                Some(_) => (),
+                None => first = Some(action),
             }
         }
 
-        first.copied()
+        if legal { first.copied() } else { None }
     }
 
     pub fn get(&self, pattern: MorsePattern) -> Option<Action> {
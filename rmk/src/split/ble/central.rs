@@ -3,7 +3,7 @@ use core::sync::atomic::Ordering;
 
 use bt_hci::cmd::le::{LeReadLocalSupportedFeatures, LeSetPhy, LeSetScanParams};
 use bt_hci::controller::{ControllerCmdAsync, ControllerCmdSync};
-use embassy_futures::select::{Either, Either3, select, select3};
+use embassy_futures::select::{Either, Either4, select, select4};
 use embassy_sync::mutex::Mutex;
 use embassy_sync::signal::Signal;
 use embassy_time::{Duration, Timer, with_timeout};
@@ -11,7 +11,8 @@ use embedded_storage_async::nor_flash::NorFlash;
 use heapless::{Vec, VecView};
 use trouble_host::prelude::*;
 
-use crate::ble::{SLEEPING_STATE, update_ble_phy, update_conn_params};
+use crate::ble::conn_param::{ConnParamScheduler, notify_activity, split_policy};
+use crate::ble::{ConnLink, SLEEPING_STATE, update_ble_phy, update_conn_params};
 use crate::channel::FLASH_CHANNEL;
 #[cfg(feature = "controller")]
 use crate::event::{PeripheralConnectedEvent, SleepStateEvent, publish_controller_event};
@@ -287,13 +288,7 @@ pub(crate) async fn run_ble_peripheral_manager<
 }
 
 fn defaul_central_conn_param() -> ConnectParams {
-    ConnectParams {
-        min_connection_interval: Duration::from_micros(7500),
-        max_connection_interval: Duration::from_micros(7500),
-        max_latency: 30, // 225ms
-        supervision_timeout: Duration::from_secs(5),
-        ..Default::default()
-    }
+    split_policy().active()
 }
 
 async fn run_central_manager_task<
@@ -317,16 +312,19 @@ async fn run_central_manager_task<
     info!("Updating connection parameters for peripheral");
     update_conn_params(stack, conn, &defaul_central_conn_param()).await;
 
-    match select3(
+    let mut conn_param_scheduler = ConnParamScheduler::new(ConnLink::SplitPeripheral(id), split_policy());
+    match select4(
         ble_central_task(&client, conn),
         run_peripheral_manager::<_, _, ROW, COL, ROW_OFFSET, COL_OFFSET>(id, &client),
         sleep_manager_task(stack, conn),
+        conn_param_scheduler.run(stack, conn),
     )
     .await
     {
-        Either3::First(e) => e,
-        Either3::Second(e) => e,
-        Either3::Third(e) => e,
+        Either4::First(e) => e,
+        Either4::Second(e) => e,
+        Either4::Third(e) => e,
+        Either4::Fourth(_) => Ok(()),
     }
 }
 
@@ -443,7 +441,7 @@ impl<'a, 'b, 'c, C: Controller + ControllerCmdAsync<LeSetPhy>, P: PacketPool> Sp
         // Update last activity time when receiving key events from peripheral
         if matches!(
             message,
-            SplitMessage::Key(_) | SplitMessage::Touchpad(_) | SplitMessage::Pointing(_)
+            SplitMessage::Key(_) | SplitMessage::KeyBatch(_) | SplitMessage::Touchpad(_) | SplitMessage::Pointing(_)
         ) {
             debug!("Activity {:?} detected from peripheral", &message);
             update_activity_time();
@@ -583,8 +581,9 @@ async fn sleep_manager_task<
                 #[cfg(feature = "controller")]
                 publish_controller_event(SleepStateEvent { sleeping: false });
 
-                // Restore normal connection parameters
+                // Restore the connection parameters for typing, the conn param scheduler ramps them up again when idle
                 update_conn_params(stack, conn, &defaul_central_conn_param()).await;
+                notify_activity();
             }
         }
     }
@@ -209,7 +209,10 @@ pub async fn initialize_nrf_ble_split_peripheral_and_run<
         }
     };
 
-    join(ble_task(runner), peri_task).await;
+    let ble_stack_task = ble_task(runner);
+    #[cfg(feature = "task_stats")]
+    let ble_stack_task = crate::task_stats::instrument(crate::task_stats::TaskId::BleStack, ble_stack_task);
+    join(ble_stack_task, peri_task).await;
 }
 
 /// Create an advertiser to use to connect to a BLE Central, and wait for it to connect.
@@ -7,7 +7,7 @@ use embassy_time::Instant;
 #[cfg(all(feature = "storage", feature = "_ble"))]
 use {crate::channel::FLASH_CHANNEL, crate::split::ble::PeerAddress, crate::storage::FlashOperationMessage};
 
-use super::SplitMessage;
+use super::{SPLIT_PROTOCOL_VERSION, SplitMessage};
 use crate::CONNECTION_STATE;
 use crate::event::{
     KeyboardEvent, KeyboardEventPos, SubscribableControllerEvent, publish_input_event, publish_input_event_async,
@@ -54,13 +54,19 @@ pub(crate) struct PeripheralManager<
     transceiver: T,
     /// Peripheral id
     id: usize,
+    /// Sequence number of the last received key batch, reset by the version handshake and on every new connection
+    last_batch_seq: Option<u8>,
 }
 
 impl<const ROW: usize, const COL: usize, const ROW_OFFSET: usize, const COL_OFFSET: usize, T: SplitReader + SplitWriter>
     PeripheralManager<ROW, COL, ROW_OFFSET, COL_OFFSET, T>
 {
     pub(crate) fn new(transceiver: T, id: usize) -> Self {
-        Self { transceiver, id }
+        Self {
+            transceiver,
+            id,
+            last_batch_seq: None,
+        }
     }
 
     /// Run the manager.
@@ -71,11 +77,16 @@ impl<const ROW: usize, const COL: usize, const ROW_OFFSET: usize, const COL_OFFS
         use crate::event::EventSubscriber;
 
         let mut conn_state = CONNECTION_STATE.load(Ordering::Acquire);
-        // Send connection state once on start
-        if let Err(e) = self.transceiver.write(&SplitMessage::ConnectionState(conn_state)).await {
-            match e {
-                SplitDriverError::Disconnected => return,
-                _ => error!("SplitDriver write error: {:?}", e),
+        // Send protocol version and connection state once on start
+        for message in [
+            SplitMessage::Version(SPLIT_PROTOCOL_VERSION),
+            SplitMessage::ConnectionState(conn_state),
+        ] {
+            if let Err(e) = self.transceiver.write(&message).await {
+                match e {
+                    SplitDriverError::Disconnected => return,
+                    _ => error!("SplitDriver write error: {:?}", e),
+                }
             }
         }
 
@@ -105,6 +116,22 @@ impl<const ROW: usize, const COL: usize, const ROW_OFFSET: usize, const COL_OFFS
             .await
             {
                 Either3::First(read_result) => match read_result {
+                    Ok(SplitMessage::Version(version)) => {
+                        info!("Peripheral {} split protocol version: {}", self.id, version);
+                        // The peripheral is restarted or reconnected, its batch sequence starts over
+                        self.last_batch_seq = None;
+                        // Reply the version, in case the peripheral missed the one sent on start
+                        if let Err(e) = self
+                            .transceiver
+                            .write(&SplitMessage::Version(SPLIT_PROTOCOL_VERSION))
+                            .await
+                        {
+                            match e {
+                                SplitDriverError::Disconnected => return,
+                                _ => error!("SplitDriver write error: {:?}", e),
+                            }
+                        }
+                    }
                     Ok(split_message) => {
                         self.process_peripheral_message(split_message).await;
 
@@ -204,37 +231,28 @@ impl<const ROW: usize, const COL: usize, const ROW_OFFSET: usize, const COL_OFFS
     }
 
     /// Process a single message from the peripheral.
-    async fn process_peripheral_message(&self, split_message: SplitMessage) {
+    async fn process_peripheral_message(&mut self, split_message: SplitMessage) {
         trace!("Got message from peripheral: {:?}", split_message);
         match split_message {
-            SplitMessage::Key(e) => match e.pos {
-                KeyboardEventPos::Key(key_pos) => {
-                    // Verify the row/col
-                    if key_pos.row as usize > ROW || key_pos.col as usize > COL {
-                        error!("Invalid peripheral row/col: {} {}", key_pos.row, key_pos.col);
+            SplitMessage::Key(e) => self.process_key_event(e).await,
+            SplitMessage::KeyBatch(batch) => {
+                if let Some(last) = self.last_batch_seq {
+                    if batch.seq == last {
+                        warn!("Duplicated key batch {} from peripheral {}", batch.seq, self.id);
                         return;
                     }
-
-                    if CONNECTION_STATE.load(core::sync::atomic::Ordering::Acquire) {
-                        // Only when the connection is established, send the key event.
-                        let adjusted_key_event = KeyboardEvent::key(
-                            key_pos.row + ROW_OFFSET as u8,
-                            key_pos.col + COL_OFFSET as u8,
-                            e.pressed,
+                    if batch.seq != last.wrapping_add(1) {
+                        warn!(
+                            "Key batches from peripheral {} are lost: {} -> {}",
+                            self.id, last, batch.seq
                         );
-                        publish_input_event_async(adjusted_key_event).await;
-                    } else {
-                        warn!("Key event from peripheral is ignored because the connection is not established.");
                     }
                 }
-                _ => {
-                    // For rotary encoder
-                    if CONNECTION_STATE.load(core::sync::atomic::Ordering::Acquire) {
-                        // Only when the connection is established, send the key event.
-                        publish_input_event_async(e).await;
-                    }
+                self.last_batch_seq = Some(batch.seq);
+                for e in batch.events() {
+                    self.process_key_event(e).await;
                 }
-            },
+            }
             // Process other split messages which requires connection to host
             _ if CONNECTION_STATE.load(core::sync::atomic::Ordering::Acquire) => match split_message {
                 // Non-key events are drop-on-full to keep the split read loop responsive.
@@ -253,4 +271,36 @@ impl<const ROW: usize, const COL: usize, const ROW_OFFSET: usize, const COL_OFFS
             ),
         }
     }
+
+    /// Process a key change from the peripheral.
+    async fn process_key_event(&self, e: KeyboardEvent) {
+        match e.pos {
+            KeyboardEventPos::Key(key_pos) => {
+                // Verify the row/col
+                if key_pos.row as usize > ROW || key_pos.col as usize > COL {
+                    error!("Invalid peripheral row/col: {} {}", key_pos.row, key_pos.col);
+                    return;
+                }
+
+                if CONNECTION_STATE.load(core::sync::atomic::Ordering::Acquire) {
+                    // Only when the connection is established, send the key event.
+                    let adjusted_key_event = KeyboardEvent::key(
+                        key_pos.row + ROW_OFFSET as u8,
+                        key_pos.col + COL_OFFSET as u8,
+                        e.pressed,
+                    );
+                    publish_input_event_async(adjusted_key_event).await;
+                } else {
+                    warn!("Key event from peripheral is ignored because the connection is not established.");
+                }
+            }
+            _ => {
+                // For rotary encoder
+                if CONNECTION_STATE.load(core::sync::atomic::Ordering::Acquire) {
+                    // Only when the connection is established, send the key event.
+                    publish_input_event_async(e).await;
+                }
+            }
+        }
+    }
 }
@@ -1,9 +1,14 @@
+use core::mem::discriminant;
+
+use heapless::Vec;
 use postcard::experimental::max_size::MaxSize;
 use serde::{Deserialize, Serialize};
 
 #[cfg(feature = "_ble")]
 use crate::event::BatteryStateEvent;
-use crate::event::{KeyboardEvent, PointingEvent, TouchpadEvent};
+use crate::event::{
+    AxisValType, KEYBOARD_BATCH_EVENT_SIZE, KeyPos, KeyboardEvent, KeyboardEventPos, PointingEvent, TouchpadEvent,
+};
 
 #[cfg(feature = "_ble")]
 pub mod ble;
@@ -19,6 +24,24 @@ pub mod serial;
 /// Maximum size of a split message
 pub const SPLIT_MESSAGE_MAX_SIZE: usize = SplitMessage::POSTCARD_MAX_SIZE + 4;
 
+/// Version of the split protocol.
+///
+/// - 1: every key change is sent as a `SplitMessage::Key`
+/// - 2: key changes which are queued at the same time are sent in one `SplitMessage::KeyBatch`
+///
+/// Both sides send `SplitMessage::Version` when the link is up, the central also replies to the peripheral version.
+/// The peripheral sends `KeyBatch` only after it receives a version >= 2 from the central,
+/// so a peripheral keeps working with a central of version 1, which never sends its version.
+pub(crate) const SPLIT_PROTOCOL_VERSION: u8 = 2;
+
+/// Maximum number of key changes in a [`KeyBatch`].
+///
+/// A full batch is not larger than a `SplitMessage::Pointing`, so it doesn't increase `SPLIT_MESSAGE_MAX_SIZE`.
+pub(crate) const SPLIT_KEY_BATCH_SIZE: usize = 6;
+
+/// Split messages which are produced from the events received at the same time
+pub(crate) type SplitMessages = Vec<SplitMessage, KEYBOARD_BATCH_EVENT_SIZE>;
+
 /// Message used from central & peripheral communication
 #[repr(u8)]
 #[derive(Serialize, Deserialize, Debug, Clone, Copy, MaxSize)]
@@ -46,4 +69,183 @@ pub(crate) enum SplitMessage {
     /// Battery state, from peripheral to central
     #[cfg(feature = "_ble")]
     BatteryState(BatteryStateEvent),
+    /// Multiple key changes, from peripheral to central. Requires split protocol version 2
+    KeyBatch(KeyBatch),
+    /// Split protocol version, exchanged when the link is up
+    Version(u8),
+}
+
+/// Key changes of the peripheral which are sent in one split message.
+///
+/// Each key change is packed into 2 bytes: `[row | pressed << 7, col]`, so only keys with row < 128 can be batched.
+#[derive(Serialize, Deserialize, Debug, Clone, Copy, MaxSize)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub(crate) struct KeyBatch {
+    /// Sequence number, increased by one for every sent batch
+    pub(crate) seq: u8,
+    /// Number of used entries in `keys`
+    len: u8,
+    keys: [[u8; 2]; SPLIT_KEY_BATCH_SIZE],
+}
+
+impl KeyBatch {
+    pub(crate) fn new(seq: u8) -> Self {
+        Self {
+            seq,
+            len: 0,
+            keys: [[0; 2]; SPLIT_KEY_BATCH_SIZE],
+        }
+    }
+
+    /// Add a key change to the batch, returns false if the batch is full or the event can't be packed.
+    pub(crate) fn push(&mut self, event: KeyboardEvent) -> bool {
+        match event.pos {
+            KeyboardEventPos::Key(KeyPos { row, col }) if row < 0x80 && self.len() < SPLIT_KEY_BATCH_SIZE => {
+                self.keys[self.len()] = [row | (event.pressed as u8) << 7, col];
+                self.len += 1;
+                true
+            }
+            _ => false,
+        }
+    }
+
+    pub(crate) fn len(&self) -> usize {
+        self.len as usize
+    }
+
+    /// Iterate the key changes in the batch, in the order they're pushed
+    pub(crate) fn events(&self) -> impl Iterator<Item = KeyboardEvent> + '_ {
+        self.keys
+            .iter()
+            .take(self.len())
+            .map(|&[row, col]| KeyboardEvent::key(row & 0x7F, col, row & 0x80 != 0))
+    }
+}
+
+/// Pack key events into split messages.
+///
+/// Consecutive key changes are put into [`KeyBatch`]es, rotary encoder events are sent as `SplitMessage::Key`.
+/// `seq` is the sequence number of the next batch. At most `KEYBOARD_BATCH_EVENT_SIZE` events should be packed at once.
+pub(crate) fn pack_key_events(events: impl IntoIterator<Item = KeyboardEvent>, seq: &mut u8) -> SplitMessages {
+    fn finish_batch(messages: &mut SplitMessages, batch: &KeyBatch, seq: &mut u8) {
+        if batch.len() == 1 {
+            // A single key change is smaller as a plain key message
+            if let Some(event) = batch.events().next() {
+                messages.push(SplitMessage::Key(event)).ok();
+            }
+        } else if batch.len() > 1 {
+            messages.push(SplitMessage::KeyBatch(*batch)).ok();
+            *seq = seq.wrapping_add(1);
+        }
+    }
+
+    let mut messages = SplitMessages::new();
+    let mut batch = KeyBatch::new(*seq);
+    for event in events {
+        if batch.push(event) {
+            continue;
+        }
+        finish_batch(&mut messages, &batch, seq);
+        batch = KeyBatch::new(*seq);
+        if !batch.push(event) {
+            messages.push(SplitMessage::Key(event)).ok();
+        }
+    }
+    finish_batch(&mut messages, &batch, seq);
+    messages
+}
+
+/// Merge a queued pointing event into `current`.
+///
+/// Only events with the same relative axes can be merged, returns false if `next` isn't merged.
+pub(crate) fn merge_pointing_event(current: &mut PointingEvent, next: &PointingEvent) -> bool {
+    let mergeable = current.0.iter().zip(next.0.iter()).all(|(a, b)| {
+        matches!((a.typ, b.typ), (AxisValType::Rel, AxisValType::Rel))
+            && discriminant(&a.axis) == discriminant(&b.axis)
+            && a.value.checked_add(b.value).is_some()
+    });
+    if mergeable {
+        for (a, b) in current.0.iter_mut().zip(next.0.iter()) {
+            a.value += b.value;
+        }
+    }
+    mergeable
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::event::{Axis, AxisEvent};
+    use crate::input_device::rotary_encoder::Direction;
+
+    fn pointing(x: i16, y: i16) -> PointingEvent {
+        PointingEvent([
+            AxisEvent {
+                typ: AxisValType::Rel,
+                axis: Axis::X,
+                value: x,
+            },
+            AxisEvent {
+                typ: AxisValType::Rel,
+                axis: Axis::Y,
+                value: y,
+            },
+            AxisEvent {
+                typ: AxisValType::Rel,
+                axis: Axis::Z,
+                value: 0,
+            },
+        ])
+    }
+
+    #[test]
+    fn test_key_batch_size() {
+        assert!(KeyBatch::POSTCARD_MAX_SIZE <= PointingEvent::POSTCARD_MAX_SIZE);
+    }
+
+    #[test]
+    fn test_pack_key_events() {
+        let events = [
+            KeyboardEvent::key(0, 1, true),
+            KeyboardEvent::key(3, 5, true),
+            KeyboardEvent::rotary_encoder(0, Direction::Clockwise, true),
+            KeyboardEvent::key(1, 2, false),
+        ];
+        let mut seq = 7;
+        let messages = pack_key_events(events, &mut seq);
+        assert_eq!(messages.len(), 3);
+        match messages[0] {
+            SplitMessage::KeyBatch(batch) => {
+                assert_eq!(batch.seq, 7);
+                assert!(batch.events().eq(events[..2].iter().copied()));
+            }
+            _ => panic!("Expected a key batch"),
+        }
+        assert!(matches!(messages[1], SplitMessage::Key(e) if e == events[2]));
+        // A single key change is not batched
+        assert!(matches!(messages[2], SplitMessage::Key(e) if e == events[3]));
+        assert_eq!(seq, 8);
+
+        // The serialized batch is decoded to the same key changes
+        let mut buf = [0u8; SPLIT_MESSAGE_MAX_SIZE];
+        let bytes = postcard::to_slice(&messages[0], &mut buf).unwrap();
+        match postcard::from_bytes::<SplitMessage>(bytes).unwrap() {
+            SplitMessage::KeyBatch(batch) => assert!(batch.events().eq(events[..2].iter().copied())),
+            _ => panic!("Expected a key batch"),
+        }
+    }
+
+    #[test]
+    fn test_merge_pointing_event() {
+        let mut current = pointing(3, -2);
+        assert!(merge_pointing_event(&mut current, &pointing(4, -1)));
+        assert_eq!((current.0[0].value, current.0[1].value), (7, -3));
+        // Overflow
+        assert!(!merge_pointing_event(&mut current, &pointing(i16::MAX, 0)));
+        assert_eq!(current.0[0].value, 7);
+        // Absolute axes are not merged
+        let mut absolute = pointing(1, 1);
+        absolute.0[0].typ = AxisValType::Abs;
+        assert!(!merge_pointing_event(&mut current, &absolute));
+    }
 }
@@ -14,10 +14,12 @@ use {
     trouble_host::prelude::*,
 };
 
-use super::SplitMessage;
 use super::driver::{SplitReader, SplitWriter};
+use super::{SPLIT_PROTOCOL_VERSION, SplitMessage, SplitMessages, merge_pointing_event, pack_key_events};
 use crate::CONNECTION_STATE;
-use crate::event::{KeyboardEvent, PointingEvent, SubscribableInputEvent, TouchpadEvent};
+use crate::event::{
+    KEYBOARD_BATCH_EVENT_SIZE, KeyboardBatchEvent, KeyboardEvent, PointingEvent, SubscribableInputEvent, TouchpadEvent,
+};
 #[cfg(feature = "controller")]
 use crate::event::{LayerChangeEvent, LedIndicatorEvent, publish_controller_event};
 #[cfg(not(feature = "_ble"))]
@@ -62,11 +64,19 @@ pub async fn run_rmk_split_peripheral<
 /// The split peripheral instance.
 pub(crate) struct SplitPeripheral<S: SplitWriter + SplitReader> {
     split_driver: S,
+    /// Whether the central supports `SplitMessage::KeyBatch`
+    batch_keys: bool,
+    /// Sequence number of the next key batch
+    key_batch_seq: u8,
 }
 
 impl<S: SplitWriter + SplitReader> SplitPeripheral<S> {
     pub(crate) fn new(split_driver: S) -> Self {
-        Self { split_driver }
+        Self {
+            split_driver,
+            batch_keys: false,
+            key_batch_seq: 0,
+        }
     }
 
     /// Run the peripheral keyboard service.
@@ -76,7 +86,15 @@ impl<S: SplitWriter + SplitReader> SplitPeripheral<S> {
     pub(crate) async fn run(&mut self) {
         CONNECTION_STATE.store(ConnectionState::Connected.into(), core::sync::atomic::Ordering::Release);
 
+        // Key batches are only used after the central announces its version
+        self.batch_keys = false;
+        self.split_driver
+            .write(&SplitMessage::Version(SPLIT_PROTOCOL_VERSION))
+            .await
+            .ok();
+
         let key_sub = KeyboardEvent::input_subscriber();
+        let key_batch_sub = KeyboardBatchEvent::input_subscriber();
         #[cfg(feature = "_ble")]
         let charging_state_sub = ChargingStateEvent::input_subscriber();
         let touch_sub = TouchpadEvent::input_subscriber();
@@ -85,21 +103,53 @@ impl<S: SplitWriter + SplitReader> SplitPeripheral<S> {
         let mut battery_sub = BatteryStateEvent::controller_subscriber();
 
         loop {
+            let batch_keys = self.batch_keys;
+            let key_batch_seq = &mut self.key_batch_seq;
             let read_message_to_send = async {
-                let message = crate::select_biased_with_feature! {
-                    e = key_sub.receive().fuse() => SplitMessage::Key(e),
+                let messages = crate::select_biased_with_feature! {
+                    e = key_sub.receive().fuse() => {
+                        if batch_keys {
+                            // Put the key changes which are already queued into the same batch
+                            let queued = core::iter::from_fn(|| key_sub.try_receive().ok());
+                            let events = core::iter::once(e).chain(queued).take(KEYBOARD_BATCH_EVENT_SIZE);
+                            pack_key_events(events, key_batch_seq)
+                        } else {
+                            single(SplitMessage::Key(e))
+                        }
+                    },
+                    e = key_batch_sub.receive().fuse() => {
+                        if batch_keys {
+                            pack_key_events(e.events, key_batch_seq)
+                        } else {
+                            e.events.into_iter().map(SplitMessage::Key).collect()
+                        }
+                    },
                     with_feature("_ble"): e = charging_state_sub.receive().fuse() => {
                         if e.charging {
-                            SplitMessage::BatteryState(BatteryStateEvent::Charging)
+                            single(SplitMessage::BatteryState(BatteryStateEvent::Charging))
                         } else {
-                            SplitMessage::BatteryState(BatteryStateEvent::NotAvailable)
+                            single(SplitMessage::BatteryState(BatteryStateEvent::NotAvailable))
+                        }
+                    },
+                    e = touch_sub.receive().fuse() => single(SplitMessage::Touchpad(e)),
+                    e = pointing_sub.receive().fuse() => {
+                        // Coalesce the queued relative motion into as few messages as possible
+                        let mut messages = SplitMessages::new();
+                        let mut current = e;
+                        while messages.len() < messages.capacity() - 1
+                            && let Ok(next) = pointing_sub.try_receive()
+                        {
+                            if !merge_pointing_event(&mut current, &next) {
+                                messages.push(SplitMessage::Pointing(current)).ok();
+                                current = next;
+                            }
                         }
+                        messages.push(SplitMessage::Pointing(current)).ok();
+                        messages
                     },
-                    e = touch_sub.receive().fuse() => SplitMessage::Touchpad(e),
-                    e = pointing_sub.receive().fuse() => SplitMessage::Pointing(e),
-                    with_feature("_ble"): e = battery_sub.next_event().fuse() => SplitMessage::BatteryState(e),
+                    with_feature("_ble"): e = battery_sub.next_event().fuse() => single(SplitMessage::BatteryState(e)),
                 };
-                message
+                messages
             };
 
             match select(self.split_driver.read(), read_message_to_send).await {
@@ -111,6 +161,10 @@ impl<S: SplitWriter + SplitReader> SplitPeripheral<S> {
                             trace!("Received connection state update: {}", state);
                             CONNECTION_STATE.store(state, core::sync::atomic::Ordering::Release);
                         }
+                        SplitMessage::Version(version) => {
+                            info!("Central split protocol version: {}", version);
+                            self.batch_keys = version >= 2;
+                        }
                         #[cfg(all(feature = "_ble", feature = "storage"))]
                         SplitMessage::ClearPeer => {
                             // Clear the peer address
@@ -139,11 +193,13 @@ impl<S: SplitWriter + SplitReader> SplitPeripheral<S> {
                         }
                     }
                 },
-                Either::Second(e) => {
+                Either::Second(messages) => {
                     // Only send the key event if the connection is established
                     if CONNECTION_STATE.load(core::sync::atomic::Ordering::Acquire) {
-                        debug!("Writing split message {:?} to central", e);
-                        self.split_driver.write(&e).await.ok();
+                        for e in messages {
+                            debug!("Writing split message {:?} to central", e);
+                            self.split_driver.write(&e).await.ok();
+                        }
                     } else {
                         debug!("Connection not established, skipping key event");
                     }
@@ -152,3 +208,9 @@ impl<S: SplitWriter + SplitReader> SplitPeripheral<S> {
         }
     }
 }
+
+fn single(message: SplitMessage) -> SplitMessages {
+    let mut messages = SplitMessages::new();
+    messages.push(message).ok();
+    messages
+}
@@ -26,6 +26,11 @@ unsafe impl<PIO: Instance> Binding<PIO::Interrupt, InterruptHandler<PIO>> for Ir
 
 const BAUD_RATE: u32 = 115_200;
 
+/// Time of `bits` bits on the line
+fn bit_time(bits: u32) -> Duration {
+    Duration::from_micros((1_000_000u64 * bits as u64) / BAUD_RATE as u64)
+}
+
 mod StatusBit {
     pub const SM1_RX: u32 = 1 << 1;
     pub const SM0_TX: u32 = 1 << 4;
@@ -284,7 +289,7 @@ impl<'a, PIO: Instance + UartPioAccess> BufferedUart<'a, PIO> {
 
     async fn enable_sm_tx(&mut self) {
         while !PIO::uart_buffer().idle_line.lock(|b| *b.borrow()) {
-            Timer::after(Duration::from_micros(((1_000_000u32 * 1) / BAUD_RATE) as u64)).await;
+            Timer::after(bit_time(1)).await;
         }
         self.sm_rx.set_enable(false);
         self.set_pin_tx();
@@ -293,8 +298,9 @@ impl<'a, PIO: Instance + UartPioAccess> BufferedUart<'a, PIO> {
     }
 
     async fn enable_sm_rx(&mut self) {
-        while !self.sm_tx.tx().empty() {}
-        Timer::after(Duration::from_micros(((1_000_000u32 * 11) / BAUD_RATE) as u64)).await;
+        self.wait_tx_fifo_empty().await;
+        // The last byte is still being shifted out
+        Timer::after(bit_time(11)).await;
         self.sm_tx.set_enable(false);
 
         self.set_pin_rx();
@@ -361,9 +367,17 @@ impl<'a, PIO: Instance + UartPioAccess> BufferedUart<'a, PIO> {
             return Ok(0);
         }
         if self.full_duplex {
-            let result = self.write_ring(buf);
-            PIO::regs().irqs(0).inte().modify(|i| i.set_sm0_txnfull(true));
-            return result;
+            // Wait until there's space in the ring, instead of returning `Ok(0)`, which makes the caller spin
+            return poll_fn(|cx| {
+                PIO::uart_buffer().waker_tx.register(cx.waker());
+                let result = self.write_ring(buf);
+                PIO::regs().irqs(0).inte().modify(|i| i.set_sm0_txnfull(true));
+                match result {
+                    Ok(0) => Poll::Pending,
+                    result => Poll::Ready(result),
+                }
+            })
+            .await;
         } else {
             if !self.sm_tx.is_enabled() {
                 self.enable_sm_tx().await;
@@ -401,10 +415,22 @@ impl<'a, PIO: Instance + UartPioAccess> BufferedUart<'a, PIO> {
         })
     }
 
+    /// Wait until the TX FIFO is drained, without blocking the executor while the queued bytes are sent
+    async fn wait_tx_fifo_empty(&mut self) {
+        loop {
+            let level = self.sm_tx.tx().level() as u32;
+            if level == 0 {
+                break;
+            }
+            // Start bit, 8 data bits and stop bit for each queued byte
+            Timer::after(bit_time(10 * level)).await;
+        }
+    }
+
     async fn flush(&mut self) -> Result<(), Error> {
         if !self.sm_tx.tx().empty() {
-            while !self.sm_tx.tx().empty() {}
-            Timer::after(Duration::from_micros(((1_000_000u32 * 11) / BAUD_RATE) as u64)).await;
+            self.wait_tx_fifo_empty().await;
+            Timer::after(bit_time(11)).await;
         }
         Ok(())
     }
@@ -441,8 +467,12 @@ impl<PIO: Instance + UartPioAccess> Handler<PIO::Interrupt> for UartInterruptHan
             PIO::Interrupt::unpend();
             if PIO::uart_buffer().buf_tx.is_available() {
                 // Full-Duplex Mode
-                if !PIO::uart_buffer().buf_tx.is_full() {
-                    let mut reader = unsafe { PIO::uart_buffer().buf_tx.reader() };
+                // The ring is drained whenever the FIFO has room, a full ring included: that's when the writer is
+                // waiting for space, and the interrupt stays raised until the FIFO is full or the ring is empty.
+                // The queued bytes can wrap around the end of the ring, so the slices are popped until no byte fits.
+                let mut reader = unsafe { PIO::uart_buffer().buf_tx.reader() };
+                let mut popped = false;
+                loop {
                     let tx_buf = reader.pop_slice();
                     let mut n = 0;
                     while (pio.fstat().read().txfull() & 1 << 0 as u8) == 0 && n < tx_buf.len() {
@@ -450,7 +480,14 @@ impl<PIO: Instance + UartPioAccess> Handler<PIO::Interrupt> for UartInterruptHan
                         pio.txf(0).write(|f| *f = byte as u32);
                         n += 1;
                     }
+                    if n == 0 {
+                        break;
+                    }
                     reader.pop_done(n);
+                    popped = true;
+                }
+                if popped {
+                    PIO::uart_buffer().waker_tx.wake();
                 }
                 if PIO::uart_buffer().buf_tx.is_empty() {
                     PIO::regs().irqs(0).inte().modify(|i| i.set_sm0_txnfull(false));
@@ -0,0 +1,156 @@
+//! Streaming COBS frame decoder for the serial split link.
+//!
+//! Received bytes are decoded once, as they arrive, directly into the frame buffer. There is no
+//! sentinel scan over the whole buffer and no shifting of the bytes that belong to the next frame.
+
+/// Error of a received COBS frame
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub(crate) enum CobsError {
+    /// The decoded frame doesn't fit in the frame buffer
+    Overflow,
+    /// The sentinel is received in the middle of a COBS block
+    Truncated,
+}
+
+pub(crate) struct CobsDecoder<const N: usize> {
+    frame: [u8; N],
+    /// Number of decoded bytes of the current frame
+    len: usize,
+    /// Number of data bytes left in the current COBS block
+    remaining: u8,
+    /// Whether a zero should be inserted before the next block
+    pending_zero: bool,
+    /// Whether the decoded frame exceeds the frame buffer, the rest of the frame is dropped
+    overflow: bool,
+}
+
+impl<const N: usize> CobsDecoder<N> {
+    pub(crate) const fn new() -> Self {
+        Self {
+            frame: [0; N],
+            len: 0,
+            remaining: 0,
+            pending_zero: false,
+            overflow: false,
+        }
+    }
+
+    /// Drop the partially received frame
+    pub(crate) fn reset(&mut self) {
+        self.len = 0;
+        self.remaining = 0;
+        self.pending_zero = false;
+        self.overflow = false;
+    }
+
+    /// Decode `data` until a frame is completed.
+    ///
+    /// Returns the number of consumed bytes, and the decoded frame if the sentinel is reached. Empty frames, aka
+    /// consecutive sentinels, are skipped.
+    pub(crate) fn feed(&mut self, data: &[u8]) -> (usize, Option<Result<&[u8], CobsError>>) {
+        for (i, &byte) in data.iter().enumerate() {
+            if byte == 0x00 {
+                let result = if self.overflow {
+                    Err(CobsError::Overflow)
+                } else if self.remaining != 0 {
+                    Err(CobsError::Truncated)
+                } else if self.len == 0 && !self.pending_zero {
+                    continue;
+                } else {
+                    Ok(self.len)
+                };
+                self.reset();
+                return (i + 1, Some(result.map(|len| &self.frame[..len])));
+            }
+
+            if self.remaining == 0 {
+                // Code byte, starts a new block
+                if self.pending_zero {
+                    self.push(0);
+                }
+                self.remaining = byte - 1;
+                self.pending_zero = byte != 0xFF;
+            } else {
+                self.push(byte);
+                self.remaining -= 1;
+            }
+        }
+        (data.len(), None)
+    }
+
+    fn push(&mut self, byte: u8) {
+        if self.len < N {
+            self.frame[self.len] = byte;
+            self.len += 1;
+        } else {
+            self.overflow = true;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::event::KeyboardEvent;
+    use crate::split::{SPLIT_MESSAGE_MAX_SIZE, SplitMessage};
+
+    #[test]
+    fn test_decode_postcard_frames_in_chunks() {
+        let messages = [
+            SplitMessage::Key(KeyboardEvent::key(1, 2, true)),
+            SplitMessage::ConnectionState(true),
+            SplitMessage::Version(2),
+        ];
+        let mut stream = [0u8; 3 * SPLIT_MESSAGE_MAX_SIZE];
+        let mut stream_len = 0;
+        for message in messages.iter() {
+            stream_len += postcard::to_slice_cobs(message, &mut stream[stream_len..])
+                .unwrap()
+                .len();
+        }
+
+        // Feed the stream in small chunks, so that frames are split between reads
+        let mut decoder = CobsDecoder::<SPLIT_MESSAGE_MAX_SIZE>::new();
+        let mut decoded: heapless::Vec<SplitMessage, 3> = heapless::Vec::new();
+        for chunk in stream[..stream_len].chunks(3) {
+            let mut start = 0;
+            while start < chunk.len() {
+                let (consumed, frame) = decoder.feed(&chunk[start..]);
+                start += consumed;
+                if let Some(frame) = frame {
+                    decoded.push(postcard::from_bytes(frame.unwrap()).unwrap()).unwrap();
+                }
+            }
+        }
+        assert_eq!(decoded.len(), messages.len());
+        assert!(matches!(decoded[0], SplitMessage::Key(event) if event == KeyboardEvent::key(1, 2, true)));
+        assert!(matches!(decoded[1], SplitMessage::ConnectionState(true)));
+        assert!(matches!(decoded[2], SplitMessage::Version(2)));
+    }
+
+    #[test]
+    fn test_decode_errors() {
+        let mut decoder = CobsDecoder::<4>::new();
+        // Leading sentinels are skipped
+        assert_eq!(
+            decoder.feed(&[0x00, 0x00, 0x03, 0x11, 0x22, 0x00]),
+            (6, Some(Ok(&[0x11, 0x22][..])))
+        );
+        // Frame with zeros inside
+        assert_eq!(
+            decoder.feed(&[0x01, 0x02, 0x33, 0x00]),
+            (4, Some(Ok(&[0x00, 0x33][..])))
+        );
+        // Sentinel in the middle of a block
+        assert_eq!(decoder.feed(&[0x04, 0x11, 0x00]), (3, Some(Err(CobsError::Truncated))));
+        // Frame larger than the buffer
+        assert_eq!(
+            decoder.feed(&[0x06, 1, 2, 3, 4, 5, 0x00]),
+            (7, Some(Err(CobsError::Overflow)))
+        );
+        // The decoder recovers after errors
+        assert_eq!(decoder.feed(&[0x02, 0x44]), (2, None));
+        assert_eq!(decoder.feed(&[0x00]), (1, Some(Ok(&[0x44][..]))));
+    }
+}
@@ -1,3 +1,6 @@
+mod cobs;
+
+use cobs::CobsDecoder;
 use embedded_io_async::{Read, Write};
 
 use super::driver::SplitDriverError;
@@ -30,62 +33,62 @@ pub(crate) async fn run_serial_peripheral_manager<
 }
 
 /// Serial driver for BOTH split central and peripheral
+///
+/// Bytes read from the serial are decoded by a streaming COBS decoder, the unconsumed part of a read is kept in
+/// `rx_buffer` and decoded on the next call, so the received bytes are never rescanned or shifted.
 pub(crate) struct SerialSplitDriver<S: Read + Write> {
     serial: S,
-    buffer: [u8; SPLIT_MESSAGE_MAX_SIZE],
-    n_bytes_part: usize,
+    rx_buffer: [u8; SPLIT_MESSAGE_MAX_SIZE],
+    /// The not yet decoded bytes are `rx_buffer[rx_start..rx_end]`
+    rx_start: usize,
+    rx_end: usize,
+    decoder: CobsDecoder<SPLIT_MESSAGE_MAX_SIZE>,
 }
 
 impl<S: Read + Write> SerialSplitDriver<S> {
     pub(crate) fn new(serial: S) -> Self {
         Self {
             serial,
-            buffer: [0_u8; SPLIT_MESSAGE_MAX_SIZE],
-            n_bytes_part: 0,
+            rx_buffer: [0_u8; SPLIT_MESSAGE_MAX_SIZE],
+            rx_start: 0,
+            rx_end: 0,
+            decoder: CobsDecoder::new(),
         }
     }
 }
 
 impl<S: Read + Write> SplitReader for SerialSplitDriver<S> {
     async fn read(&mut self) -> Result<SplitMessage, SplitDriverError> {
-        const SENTINEL: u8 = 0x00;
-        while self.n_bytes_part < self.buffer.len() {
-            let n_bytes = self
-                .serial
-                .read(&mut self.buffer[self.n_bytes_part..])
-                .await
-                .map_err(|_e| {
-                    self.n_bytes_part = 0;
+        loop {
+            if self.rx_start == self.rx_end {
+                let n_bytes = self.serial.read(&mut self.rx_buffer).await.map_err(|_e| {
+                    self.decoder.reset();
                     SplitDriverError::SerialError
                 })?;
-            if n_bytes == 0 {
-                return Err(SplitDriverError::EmptyMessage);
+                if n_bytes == 0 {
+                    self.decoder.reset();
+                    return Err(SplitDriverError::EmptyMessage);
+                }
+                self.rx_start = 0;
+                self.rx_end = n_bytes;
             }
 
-            self.n_bytes_part = (self.n_bytes_part + n_bytes).min(self.buffer.len());
-            if self.buffer[..self.n_bytes_part].contains(&SENTINEL) {
-                break;
+            let (n_bytes_used, frame) = self.decoder.feed(&self.rx_buffer[self.rx_start..self.rx_end]);
+            self.rx_start += n_bytes_used;
+            match frame {
+                Some(Ok(frame)) => {
+                    return postcard::from_bytes::<SplitMessage>(frame).map_err(|e| {
+                        error!("Postcard deserialize split message error: {}", e);
+                        SplitDriverError::SerializeError
+                    });
+                }
+                Some(Err(e)) => {
+                    error!("Received invalid split message frame: {:?}", e);
+                    return Err(SplitDriverError::SerializeError);
+                }
+                None => {}
             }
         }
-
-        let (result, n_bytes_unused) =
-            match postcard::take_from_bytes_cobs::<SplitMessage>(&mut self.buffer[..self.n_bytes_part]) {
-                Ok((message, unused_bytes)) => (Ok(message), unused_bytes.len()),
-                Err(e) => {
-                    error!("Postcard deserialize split message error: {}", e);
-                    let n_bytes_unused = self.buffer[..self.n_bytes_part]
-                        .iter()
-                        .position(|&x| x == SENTINEL)
-                        .map_or(0, |index| self.n_bytes_part - index - 1);
-                    (Err(SplitDriverError::SerializeError), n_bytes_unused)
-                }
-            };
-
-        self.buffer
-            .copy_within(self.n_bytes_part - n_bytes_unused..self.n_bytes_part, 0);
-        self.n_bytes_part = n_bytes_unused;
-
-        result
     }
 }
 
@@ -0,0 +1,154 @@
+//! Staged startup and boot phase timings.
+//!
+//! By default the keymap and the behavior config are read from the storage before the keyboard is created, so the USB
+//! enumeration and the BLE advertising wait for the storage. With `staged_load` of [`StorageConfig`], the keymap is
+//! created from the compiled default keymap instead, and the storage is read by the storage task while the transports
+//! are coming up and the matrix is already scanning.
+//!
+//! The loaded keymap is swapped in at once: key processing and the host tools wait until the loading is done, the key
+//! events in the meantime are queued and processed on the loaded keymap, so no key is resolved on a half-loaded keymap.
+//!
+//! The time of each boot phase since power on is logged, and can be read by [`boot_timings`].
+//!
+//! [`StorageConfig`]: crate::config::StorageConfig
+use core::sync::atomic::{AtomicBool, AtomicU32, Ordering};
+
+use embassy_sync::watch::Watch;
+use embassy_time::{Duration, Instant, Timer};
+#[cfg(all(feature = "storage", feature = "host"))]
+use {
+    crate::keymap::KeyMap, crate::storage::Storage, core::cell::RefCell, embedded_storage_async::nor_flash::NorFlash,
+};
+
+/// Whether the keymap is ready, it's false only while the staged loading is pending
+static KEYMAP_READY: AtomicBool = AtomicBool::new(true);
+/// Maximum number of tasks which wait for the keymap together: the keyboard, the host task and the input processors
+const MAX_KEYMAP_WAITERS: usize = 8;
+/// Notified when the pending keymap is loaded, every waiting task holds a receiver
+static KEYMAP_LOADED: Watch<crate::RawMutex, (), MAX_KEYMAP_WAITERS> = Watch::new();
+
+/// Boot phases, in the order they're usually reached
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub enum BootPhase {
+    /// The storage is opened, and initialized if it's empty
+    StorageInit = 0,
+    /// The USB device or the BLE stack is running
+    TransportStarted = 1,
+    /// The keymap is loaded from the storage and used by the keyboard
+    KeymapReady = 2,
+    /// The keyboard processes the first key event
+    FirstKeyEvent = 3,
+}
+
+const BOOT_PHASES: usize = 4;
+
+/// Time of each phase since power on in microseconds, 0 if the phase isn't reached yet
+static BOOT_TIMINGS: [AtomicU32; BOOT_PHASES] = [const { AtomicU32::new(0) }; BOOT_PHASES];
+
+/// Time of each boot phase since power on, `None` if the phase isn't reached yet
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct BootTimings {
+    pub storage_init: Option<Duration>,
+    pub transport_started: Option<Duration>,
+    pub keymap_ready: Option<Duration>,
+    pub first_key_event: Option<Duration>,
+}
+
+/// Get the time of each boot phase since power on
+pub fn boot_timings() -> BootTimings {
+    let timing = |phase: BootPhase| match BOOT_TIMINGS[phase as usize].load(Ordering::Relaxed) {
+        0 => None,
+        us => Some(Duration::from_micros(us as u64)),
+    };
+    BootTimings {
+        storage_init: timing(BootPhase::StorageInit),
+        transport_started: timing(BootPhase::TransportStarted),
+        keymap_ready: timing(BootPhase::KeymapReady),
+        first_key_event: timing(BootPhase::FirstKeyEvent),
+    }
+}
+
+/// Record that a boot phase is reached, only the first time of each phase is recorded
+pub(crate) fn record_boot_phase(phase: BootPhase) {
+    let timing = &BOOT_TIMINGS[phase as usize];
+    if timing.load(Ordering::Relaxed) != 0 {
+        return;
+    }
+    // The time driver starts at power on
+    let us = Instant::now().as_micros().clamp(1, u32::MAX as u64) as u32;
+    timing.store(us, Ordering::Relaxed);
+    info!("Boot phase {:?} reached at {}us", phase, us);
+}
+
+/// Mark the keymap as pending, it's used only after it's loaded by the storage task
+pub(crate) fn set_keymap_pending() {
+    KEYMAP_READY.store(false, Ordering::Release);
+}
+
+/// Wait until the keymap is ready.
+///
+/// It must be called before borrowing the keymap in a task which can run while the storage is loading.
+pub(crate) async fn wait_keymap_ready() {
+    if KEYMAP_READY.load(Ordering::Acquire) {
+        return;
+    }
+    // The receiver sees the notification even if it's sent before the receiver is taken
+    match KEYMAP_LOADED.receiver() {
+        Some(mut loaded) => {
+            while !KEYMAP_READY.load(Ordering::Acquire) {
+                loaded.changed().await;
+            }
+        }
+        None => {
+            warn!("Too many tasks wait for the keymap, poll it instead");
+            while !KEYMAP_READY.load(Ordering::Acquire) {
+                Timer::after_millis(1).await;
+            }
+        }
+    }
+}
+
+/// Load the pending keymap from the storage, does nothing if the keymap is already ready.
+///
+/// The keymap is borrowed during the loading, the other tasks wait for it by [`wait_keymap_ready`]. If the loading is
+/// cancelled, e.g. when the connection changes, the keymap stays pending and it's loaded again by the next storage task.
+#[cfg(all(feature = "storage", feature = "host"))]
+#[allow(clippy::await_holding_refcell_ref)]
+pub(crate) async fn load_pending_keymap<
+    'a,
+    F: NorFlash,
+    const ROW: usize,
+    const COL: usize,
+    const NUM_LAYER: usize,
+    const NUM_ENCODER: usize,
+>(
+    keymap: &'a RefCell<KeyMap<'a, ROW, COL, NUM_LAYER, NUM_ENCODER>>,
+    storage: &mut Storage<F, ROW, COL, NUM_LAYER, NUM_ENCODER>,
+) {
+    if KEYMAP_READY.load(Ordering::Acquire) {
+        return;
+    }
+    let start = Instant::now();
+    // Other tasks don't borrow the keymap until it's ready
+    keymap.borrow_mut().load_from_storage(storage).await;
+    KEYMAP_READY.store(true, Ordering::Release);
+    KEYMAP_LOADED.sender().send(());
+    info!("Keymap loaded from storage in {}us", start.elapsed().as_micros());
+    record_boot_phase(BootPhase::KeymapReady);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_record_first_time_only() {
+        record_boot_phase(BootPhase::TransportStarted);
+        let first = boot_timings().transport_started;
+        assert!(first.is_some());
+        embassy_futures::block_on(Timer::after_millis(2));
+        record_boot_phase(BootPhase::TransportStarted);
+        assert_eq!(boot_timings().transport_started, first);
+    }
+}
@@ -1,17 +1,25 @@
+use core::cell::Cell;
 use core::fmt::Debug;
 
 use embassy_embedded_hal::adapter::BlockingAsync;
+use embassy_sync::blocking_mutex::Mutex;
 use embassy_sync::signal::Signal;
-use embassy_time::Duration;
+use embassy_sync::watch::Watch;
+use embassy_time::{Duration, with_timeout};
 use embedded_storage::nor_flash::NorFlash;
 use embedded_storage_async::nor_flash::NorFlash as AsyncNorFlash;
 use rmk_types::action::MorseProfile;
 use sequential_storage::Error as SSError;
-use sequential_storage::cache::NoCache;
+use sequential_storage::cache::KeyPointerCache;
 use sequential_storage::map::{MapConfig, MapStorage, SerializationError, Value};
 #[cfg(feature = "host")]
 use {
-    crate::host::storage::{KeymapData, KeymapKey},
+    crate::STORAGE_WRITE_BACK_SIZE,
+    crate::host::storage::{
+        EncoderKeymap, KeymapData, KeymapJournal, KeymapKey, KeymapSnapshotChunk, KeymapSnapshotHeader,
+    },
+    crate::keymap::KeyTable,
+    heapless::Vec,
     rmk_types::action::{EncoderAction, KeyAction},
 };
 
@@ -21,12 +29,34 @@ use crate::channel::FLASH_CHANNEL;
 use crate::config::StorageConfig;
 #[cfg(all(feature = "_ble", feature = "split"))]
 use crate::split::ble::PeerAddress;
-use crate::{BUILD_HASH, config};
+use crate::{BUILD_HASH, STORAGE_CACHE_KEYS, STORAGE_CACHE_PAGES, config};
 
 /// Signal to synchronize the flash operation status, usually used outside of the flash task.
 /// True if the flash operation is finished correctly, false if the flash operation is finished with error.
 pub(crate) static FLASH_OPERATION_FINISHED: Signal<crate::RawMutex, bool> = Signal::new();
 
+/// Maximum number of tasks which wait for a commit together: the keyboard task and the host task
+const MAX_COMMIT_WAITERS: usize = 2;
+/// The latest finished acknowledged commit, with the id of the commit and whether the buffered writes are written.
+///
+/// Unlike [`FLASH_OPERATION_FINISHED`], it's only sent by the commit which carries the id, so a waiter can't be
+/// woken up by an earlier operation.
+static COMMIT_FINISHED: Watch<crate::RawMutex, (u32, bool), MAX_COMMIT_WAITERS> = Watch::new();
+/// Id of the latest acknowledged commit, 0 is used by the commits which aren't acknowledged
+static COMMIT_ID: Mutex<crate::RawMutex, Cell<u32>> = Mutex::new(Cell::new(0));
+
+/// Cache of the storage, which keeps the state of all pages and the flash addresses of recently used keys,
+/// so that most of the operations don't need to scan the pages.
+pub(crate) type StorageCache = KeyPointerCache<STORAGE_CACHE_PAGES, u32, STORAGE_CACHE_KEYS>;
+
+/// The buffered writes are committed when no new write is received within this period
+#[cfg(feature = "host")]
+const WRITE_BACK_QUIET_PERIOD: Duration = Duration::from_millis(500);
+
+/// Number of times a failed commit of the buffered writes is retried before the writes are dropped
+#[cfg(feature = "host")]
+const MAX_COMMIT_RETRIES: u8 = 3;
+
 // Message send from other tasks, which will do saving or clearing operation
 #[allow(clippy::large_enum_variant)]
 #[derive(Clone, Debug)]
@@ -43,6 +73,8 @@ pub(crate) enum FlashOperationMessage {
     PeerAddress(PeerAddress),
     // Clear the storage
     Reset,
+    // Commit the buffered writes to flash, `COMMIT_FINISHED` is sent with the id if it isn't 0
+    Commit(u32),
     // Clear the layout info
     ResetLayout,
     // Clear info of given slot number
@@ -54,6 +86,12 @@ pub(crate) enum FlashOperationMessage {
     // Vial Flash Message
     #[cfg(feature = "host")]
     VialMessage(KeymapData),
+    // A chunk of a keymap snapshot which is written by the host, the chunks are sent in order
+    #[cfg(feature = "host")]
+    KeymapSnapshotChunk(KeymapSnapshotChunk),
+    // All chunks of the keymap snapshot are sent
+    #[cfg(feature = "host")]
+    KeymapSnapshotEnd,
     // Current saved connection type
     ConnectionType(u8),
     // Timeout time for combos
@@ -92,6 +130,12 @@ pub(crate) enum StorageKeys {
     ForkData = 8,
     #[cfg(feature = "host")]
     MorseData = 9,
+    #[cfg(feature = "host")]
+    KeymapSnapshot = 10,
+    #[cfg(feature = "host")]
+    KeymapSnapshotChunk = 11,
+    #[cfg(feature = "host")]
+    KeymapJournal = 12,
     #[cfg(all(feature = "_ble", feature = "split"))]
     PeerAddress = 0xED,
     #[cfg(feature = "_ble")]
@@ -119,6 +163,12 @@ impl StorageKeys {
             8 => Some(StorageKeys::ForkData),
             #[cfg(feature = "host")]
             9 => Some(StorageKeys::MorseData),
+            #[cfg(feature = "host")]
+            10 => Some(StorageKeys::KeymapSnapshot),
+            #[cfg(feature = "host")]
+            11 => Some(StorageKeys::KeymapSnapshotChunk),
+            #[cfg(feature = "host")]
+            12 => Some(StorageKeys::KeymapJournal),
             #[cfg(all(feature = "_ble", feature = "split"))]
             0xED => Some(StorageKeys::PeerAddress),
             #[cfg(feature = "_ble")]
@@ -140,6 +190,12 @@ pub(crate) enum StorageData {
     ConnectionType(u8),
     #[cfg(feature = "host")]
     VialData(KeymapData),
+    #[cfg(feature = "host")]
+    KeymapSnapshot(KeymapSnapshotHeader),
+    #[cfg(feature = "host")]
+    KeymapSnapshotChunk(KeymapSnapshotChunk),
+    #[cfg(feature = "host")]
+    KeymapJournal(KeymapJournal),
     #[cfg(all(feature = "_ble", feature = "split"))]
     PeerAddress(PeerAddress),
     #[cfg(feature = "_ble")]
@@ -156,6 +212,19 @@ pub(crate) fn get_keymap_key<const ROW: usize, const COL: usize, const NUM_LAYER
     0x1000 + (keymap_key.layer as usize * COL * ROW + keymap_key.row as usize * COL + keymap_key.col as usize) as u32
 }
 
+/// Key of the keymap snapshot header.
+#[cfg(feature = "host")]
+pub(crate) const KEYMAP_SNAPSHOT_KEY: u32 = 0x8000;
+
+/// Get the key to retrieve a chunk of the keymap snapshot from the storage.
+///
+/// The chunks of consecutive generations are in different banks, so writing a new snapshot doesn't overwrite the
+/// current one until its header is written.
+#[cfg(feature = "host")]
+pub(crate) fn get_snapshot_chunk_key(generation: u32, idx: u16) -> u32 {
+    0x1_0000 + (generation % 2) * 0x1_0000 + idx as u32
+}
+
 /// Get the key to retrieve the bond info from the storage.
 pub(crate) fn get_bond_info_key(slot_num: u8) -> u32 {
     0x2000 + slot_num as u32
@@ -241,6 +310,12 @@ impl StorageData {
             #[cfg(feature = "_ble")]
             Self::ActiveBleProfile(_) => StorageKeys::ActiveBleProfile as u32,
             #[cfg(feature = "host")]
+            Self::KeymapSnapshot(_) => StorageKeys::KeymapSnapshot as u32,
+            #[cfg(feature = "host")]
+            Self::KeymapSnapshotChunk(_) => StorageKeys::KeymapSnapshotChunk as u32,
+            #[cfg(feature = "host")]
+            Self::KeymapJournal(_) => StorageKeys::KeymapJournal as u32,
+            #[cfg(feature = "host")]
             Self::VialData(d) => match d {
                 KeymapData::Macro(_) => StorageKeys::MacroData as u32,
                 KeymapData::KeymapKey(_) => panic!("Error"),
@@ -272,6 +347,12 @@ impl Value<'_> for StorageData {
             Self::ActiveBleProfile(d) => ser_storage_variant!(buffer, StorageKeys::ActiveBleProfile, d),
             #[cfg(feature = "host")]
             Self::VialData(vial_data) => vial_data.serialize_into(buffer),
+            #[cfg(feature = "host")]
+            Self::KeymapSnapshot(d) => ser_storage_variant!(buffer, StorageKeys::KeymapSnapshot, d),
+            #[cfg(feature = "host")]
+            Self::KeymapSnapshotChunk(chunk) => chunk.serialize_into(buffer),
+            #[cfg(feature = "host")]
+            Self::KeymapJournal(d) => ser_storage_variant!(buffer, StorageKeys::KeymapJournal, d),
         }
     }
 
@@ -332,6 +413,23 @@ impl Value<'_> for StorageData {
                 Ok((Self::ActiveBleProfile(data), size))
             }
             #[cfg(feature = "host")]
+            StorageKeys::KeymapSnapshot => {
+                let (data, unused) =
+                    postcard::take_from_bytes(&buffer[1..]).map_err(postcard_error_to_serialization_error)?;
+                let size = buffer.len() - unused.len();
+                Ok((Self::KeymapSnapshot(data), size))
+            }
+            #[cfg(feature = "host")]
+            StorageKeys::KeymapSnapshotChunk => KeymapSnapshotChunk::deserialize_from(buffer)
+                .map(|(chunk, size)| (Self::KeymapSnapshotChunk(chunk), size)),
+            #[cfg(feature = "host")]
+            StorageKeys::KeymapJournal => {
+                let (data, unused) =
+                    postcard::take_from_bytes(&buffer[1..]).map_err(postcard_error_to_serialization_error)?;
+                let size = buffer.len() - unused.len();
+                Ok((Self::KeymapJournal(data), size))
+            }
+            #[cfg(feature = "host")]
             StorageKeys::KeymapConfig
             | StorageKeys::MacroData
             | StorageKeys::ComboData
@@ -390,7 +488,7 @@ pub async fn new_storage_for_split_peripheral<F: AsyncNorFlash>(
     Storage::<F, 0, 0, 0, 0>::new(
         flash,
         #[cfg(feature = "host")]
-        &[],
+        &[[[KeyAction::No; 0]; 0]; 0],
         #[cfg(feature = "host")]
         &None,
         &storage_config,
@@ -399,6 +497,68 @@ pub async fn new_storage_for_split_peripheral<F: AsyncNorFlash>(
     .await
 }
 
+/// A keymap write which is buffered before committing to flash
+#[cfg(feature = "host")]
+#[derive(Clone, Copy, Debug)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+enum PendingWrite {
+    KeymapKey(KeymapKey),
+    Encoder(EncoderKeymap),
+}
+
+#[cfg(feature = "host")]
+impl PendingWrite {
+    /// Convert to the stored item, a keymap key is saved in the journal of the snapshot of `generation`
+    fn into_storage_data(self, generation: u32) -> StorageData {
+        match self {
+            PendingWrite::KeymapKey(key) => StorageData::KeymapJournal(KeymapJournal { generation, key }),
+            PendingWrite::Encoder(encoder) => StorageData::VialData(KeymapData::Encoder(encoder)),
+        }
+    }
+}
+
+/// Commit the buffered writes of the storage task, and wait until they're written.
+///
+/// Should be called before rebooting, otherwise the buffered writes are lost.
+/// Returns false if the writes failed, or the commit isn't finished in time.
+pub(crate) async fn commit_storage() -> bool {
+    let Some(mut commit_finished) = COMMIT_FINISHED.receiver() else {
+        warn!("Too many tasks wait for a storage commit");
+        return false;
+    };
+    // Both the keyboard task and the host task commit before rebooting
+    let id = COMMIT_ID.lock(|last| {
+        let id = match last.get().wrapping_add(1) {
+            0 => 1,
+            id => id,
+        };
+        last.set(id);
+        id
+    });
+    FLASH_CHANNEL.send(FlashOperationMessage::Commit(id)).await;
+    let wait_commit = async {
+        loop {
+            // The commits are run in order, so a later commit has written the writes of this one too.
+            // Acknowledgements of the earlier commits are skipped.
+            let (finished, ok) = commit_finished.changed().await;
+            if finished.wrapping_sub(id) as i32 >= 0 {
+                return ok;
+            }
+        }
+    };
+    match with_timeout(Duration::from_secs(1), wait_commit).await {
+        Ok(true) => true,
+        Ok(false) => {
+            error!("Committing storage failed");
+            false
+        }
+        Err(_) => {
+            warn!("Committing storage timeout");
+            false
+        }
+    }
+}
+
 pub struct Storage<
     F: AsyncNorFlash,
     const ROW: usize,
@@ -406,8 +566,32 @@ pub struct Storage<
     const NUM_LAYER: usize,
     const NUM_ENCODER: usize = 0,
 > {
-    pub(crate) flash: MapStorage<u32, F, NoCache>,
+    pub(crate) flash: MapStorage<u32, F, StorageCache>,
     pub(crate) buffer: [u8; get_buffer_size()],
+    /// Writes which are not committed yet, a later write of the same key replaces the buffered one
+    #[cfg(feature = "host")]
+    pending_writes: Vec<(u32, PendingWrite), STORAGE_WRITE_BACK_SIZE>,
+    /// Generation of the current keymap snapshot, 0 if there's no snapshot
+    #[cfg(feature = "host")]
+    pub(crate) snapshot_generation: u32,
+    /// The keymap snapshot which is being received from the host
+    #[cfg(feature = "host")]
+    bulk_snapshot: Option<BulkSnapshot>,
+    /// Number of consecutive failed commits of the buffered writes
+    #[cfg(feature = "host")]
+    commit_failures: u8,
+}
+
+/// State of a keymap snapshot which is received chunk by chunk
+#[cfg(feature = "host")]
+struct BulkSnapshot {
+    generation: u32,
+    /// Number of written chunks
+    chunks: u16,
+    /// Sum of the checksums of the written chunks
+    checksum: u32,
+    /// Index of the first key of the next chunk
+    next_start: u32,
 }
 
 /// Read out storage config, update and then save back.
@@ -429,7 +613,7 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
 {
     pub async fn new(
         flash: F,
-        #[cfg(feature = "host")] keymap: &[[[KeyAction; COL]; ROW]; NUM_LAYER],
+        #[cfg(feature = "host")] keymap: &impl KeyTable,
         #[cfg(feature = "host")] encoder_map: &Option<&mut [[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
         storage_config: &StorageConfig,
         behavior_config: &config::BehaviorConfig,
@@ -439,6 +623,10 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
             storage_config.num_sectors >= 2,
             "Number of used sector for storage must larger than 1"
         );
+        assert!(
+            storage_config.num_sectors as usize <= STORAGE_CACHE_PAGES,
+            "Number of used sector for storage must not exceed `storage_cache_pages`"
+        );
 
         // If config.start_addr == 0:
         // - For nRF chips: use sectors starting at 0x0006_0000
@@ -474,8 +662,16 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
         };
 
         let mut storage = Self {
-            flash: MapStorage::new(flash, MapConfig::new(storage_range), NoCache::new()),
+            flash: MapStorage::new(flash, MapConfig::new(storage_range), StorageCache::new()),
             buffer: [0; get_buffer_size()],
+            #[cfg(feature = "host")]
+            pending_writes: Vec::new(),
+            #[cfg(feature = "host")]
+            snapshot_generation: 0,
+            #[cfg(feature = "host")]
+            bulk_snapshot: None,
+            #[cfg(feature = "host")]
+            commit_failures: 0,
         };
 
         // Check whether keymap and configs have been storaged in flash
@@ -524,14 +720,24 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
 
     pub(crate) async fn run(&mut self) {
         loop {
-            let info: FlashOperationMessage = FLASH_CHANNEL.receive().await;
+            let info: FlashOperationMessage = self.next_operation().await;
             debug!("Flash operation: {:?}", info);
-            match match info {
+            let commit_id = match info {
+                FlashOperationMessage::Commit(id) if id != 0 => Some(id),
+                _ => None,
+            };
+            let result = match info {
                 FlashOperationMessage::LayoutOptions(layout_option) => {
                     // Read out layout options, update layer option and save back
                     update_storage_field!(&mut self.flash, &mut self.buffer, LayoutConfig, layout_option)
                 }
-                FlashOperationMessage::Reset => self.flash.erase_all().await,
+                FlashOperationMessage::Reset => {
+                    // The buffered writes would be erased anyway
+                    #[cfg(feature = "host")]
+                    self.pending_writes.clear();
+                    self.flash.erase_all().await
+                }
+                FlashOperationMessage::Commit(_) => self.commit_pending_writes().await,
                 FlashOperationMessage::ResetLayout => {
                     info!("Ignoring ResetLayout at runtime (handled at startup via clear_layout).");
                     Ok(())
@@ -554,13 +760,11 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
                     }
                     KeymapData::KeymapKey(keymap_key) => {
                         let key = get_keymap_key::<ROW, COL, NUM_LAYER>(&keymap_key);
-                        let data = StorageData::VialData(KeymapData::KeymapKey(keymap_key));
-                        self.flash.store_item(&mut self.buffer, &key, &data).await
+                        self.write_back(key, PendingWrite::KeymapKey(keymap_key)).await
                     }
                     KeymapData::Encoder(encoder_config) => {
-                        let data = StorageData::VialData(KeymapData::Encoder(encoder_config));
                         let key = get_encoder_config_key::<NUM_ENCODER>(encoder_config.idx, encoder_config.layer);
-                        self.flash.store_item(&mut self.buffer, &key, &data).await
+                        self.write_back(key, PendingWrite::Encoder(encoder_config)).await
                     }
                     KeymapData::Combo(idx, config) => {
                         let key = get_combo_key(idx);
@@ -591,6 +795,10 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
                             .await
                     }
                 },
+                #[cfg(feature = "host")]
+                FlashOperationMessage::KeymapSnapshotChunk(chunk) => self.write_bulk_chunk(chunk).await,
+                #[cfg(feature = "host")]
+                FlashOperationMessage::KeymapSnapshotEnd => self.finish_bulk_snapshot().await,
                 FlashOperationMessage::ConnectionType(ty) => {
                     self.flash
                         .store_item(
@@ -670,7 +878,11 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
                 }
                 #[cfg(not(feature = "_ble"))]
                 _ => Ok(()),
-            } {
+            };
+            if let Some(id) = commit_id {
+                COMMIT_FINISHED.sender().send((id, result.is_ok()));
+            }
+            match result {
                 Err(e) => {
                     print_storage_error::<F>(e);
                     FLASH_OPERATION_FINISHED.signal(false);
@@ -682,6 +894,153 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
         }
     }
 
+    /// Receive the next flash operation.
+    ///
+    /// If there are buffered writes, a `Commit` is returned when no operation is received within the quiet period.
+    async fn next_operation(&self) -> FlashOperationMessage {
+        #[cfg(feature = "host")]
+        if !self.pending_writes.is_empty() {
+            return with_timeout(WRITE_BACK_QUIET_PERIOD, FLASH_CHANNEL.receive())
+                .await
+                .unwrap_or(FlashOperationMessage::Commit(0));
+        }
+        FLASH_CHANNEL.receive().await
+    }
+
+    /// Buffer a keymap write, the buffered writes are committed when the buffer is full.
+    #[cfg(feature = "host")]
+    async fn write_back(&mut self, key: u32, item: PendingWrite) -> Result<(), SSError<F::Error>> {
+        if let Some((_, pending)) = self.pending_writes.iter_mut().find(|(k, _)| *k == key) {
+            *pending = item;
+            return Ok(());
+        }
+        let committed = if self.pending_writes.is_full() {
+            self.commit_pending_writes().await
+        } else {
+            Ok(())
+        };
+        if let Err((key, item)) = self.pending_writes.push((key, item)) {
+            // The write-back buffer is disabled, or it's still full because the commit failed
+            let stored = self
+                .flash
+                .store_item(
+                    &mut self.buffer,
+                    &key,
+                    &item.into_storage_data(self.snapshot_generation),
+                )
+                .await;
+            return committed.and(stored);
+        }
+        committed
+    }
+
+    /// Write a chunk of the keymap snapshot received from the host.
+    ///
+    /// The first chunk starts a new snapshot. The buffered key writes are kept until the snapshot is complete, so
+    /// they're still saved if the snapshot is dropped.
+    #[cfg(feature = "host")]
+    async fn write_bulk_chunk(&mut self, mut chunk: KeymapSnapshotChunk) -> Result<(), SSError<F::Error>> {
+        if chunk.start == 0 {
+            self.bulk_snapshot = Some(BulkSnapshot {
+                generation: self.next_snapshot_generation().await?,
+                chunks: 0,
+                checksum: 0,
+                next_start: 0,
+            });
+        }
+        let Some(snapshot) = self.bulk_snapshot.as_mut() else {
+            warn!(
+                "Keymap snapshot chunk {} is received without the first chunk",
+                chunk.start
+            );
+            return Ok(());
+        };
+        if chunk.start != snapshot.next_start {
+            warn!(
+                "Keymap snapshot chunk {} is out of order, the snapshot is dropped",
+                chunk.start
+            );
+            self.bulk_snapshot = None;
+            return Ok(());
+        }
+        chunk.generation = snapshot.generation;
+        snapshot.next_start += chunk.count as u32;
+        snapshot.checksum = snapshot.checksum.wrapping_add(chunk.checksum());
+        let key = get_snapshot_chunk_key(snapshot.generation, snapshot.chunks);
+        snapshot.chunks += 1;
+        let result = self
+            .flash
+            .store_item(&mut self.buffer, &key, &StorageData::KeymapSnapshotChunk(chunk))
+            .await;
+        if result.is_err() {
+            self.bulk_snapshot = None;
+        }
+        result
+    }
+
+    /// Write the header of the keymap snapshot received from the host, if all keys are received.
+    ///
+    /// The buffered key writes are dropped once the header is written, because the snapshot is taken after them.
+    #[cfg(feature = "host")]
+    async fn finish_bulk_snapshot(&mut self) -> Result<(), SSError<F::Error>> {
+        match self.bulk_snapshot.take() {
+            Some(snapshot) if snapshot.next_start as usize == ROW * COL * NUM_LAYER => {
+                self.write_snapshot_header(snapshot.generation, snapshot.chunks, snapshot.checksum)
+                    .await?;
+                self.pending_writes
+                    .retain(|(_, item)| !matches!(item, PendingWrite::KeymapKey(_)));
+                Ok(())
+            }
+            _ => {
+                warn!("Keymap snapshot is incomplete, it's not saved");
+                Ok(())
+            }
+        }
+    }
+
+    /// Write all buffered writes to flash
+    async fn commit_pending_writes(&mut self) -> Result<(), SSError<F::Error>> {
+        #[cfg(feature = "host")]
+        if !self.pending_writes.is_empty() {
+            debug!("Committing {} buffered writes", self.pending_writes.len());
+            let mut result = Ok(());
+            let mut written = 0;
+            let generation = self.snapshot_generation;
+            for (key, item) in self.pending_writes.iter() {
+                if let Err(e) = self
+                    .flash
+                    .store_item(&mut self.buffer, key, &item.into_storage_data(generation))
+                    .await
+                {
+                    result = Err(e);
+                    break;
+                }
+                written += 1;
+            }
+            if result.is_ok() || self.commit_failures >= MAX_COMMIT_RETRIES {
+                if result.is_err() {
+                    error!(
+                        "Dropping {} buffered writes after {} failed commits",
+                        self.pending_writes.len() - written,
+                        self.commit_failures + 1
+                    );
+                }
+                self.pending_writes.clear();
+                self.commit_failures = 0;
+            } else {
+                // The writes which aren't written are kept, they're retried by the next commit
+                let mut idx = 0;
+                self.pending_writes.retain(|_| {
+                    idx += 1;
+                    idx > written
+                });
+                self.commit_failures += 1;
+            }
+            return result;
+        }
+        Ok(())
+    }
+
     pub(crate) async fn read_behavior_config(
         &mut self,
         behavior_config: &mut config::BehaviorConfig,
@@ -706,7 +1065,7 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
 
     async fn initialize_storage_with_config(
         &mut self,
-        #[cfg(feature = "host")] keymap: &[[[KeyAction; COL]; ROW]; NUM_LAYER],
+        #[cfg(feature = "host")] keymap: &impl KeyTable,
         #[cfg(feature = "host")] encoder_map: &Option<&mut [[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
         behavior: &config::BehaviorConfig,
     ) -> Result<(), ()> {
@@ -746,27 +1105,11 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
             .await
             .map_err(|e| print_storage_error::<F>(e))?;
 
+        // Save the keymap as the first snapshot
         #[cfg(feature = "host")]
-        for (layer, layer_data) in keymap.iter().enumerate() {
-            for (row, row_data) in layer_data.iter().enumerate() {
-                for (col, action) in row_data.iter().enumerate() {
-                    let keymap_key = KeymapKey {
-                        row: row as u8,
-                        col: col as u8,
-                        layer: layer as u8,
-                        action: *action,
-                    };
-                    self.flash
-                        .store_item(
-                            &mut self.buffer,
-                            &get_keymap_key::<ROW, COL, NUM_LAYER>(&keymap_key),
-                            &StorageData::VialData(KeymapData::KeymapKey(keymap_key)),
-                        )
-                        .await
-                        .map_err(|e| print_storage_error::<F>(e))?;
-                }
-            }
-        }
+        self.write_keymap_snapshot(keymap, 1)
+            .await
+            .map_err(|e| print_storage_error::<F>(e))?;
 
         // Save encoder configurations
         #[cfg(feature = "host")]
@@ -798,7 +1141,7 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
     #[cfg(feature = "host")]
     async fn reset_layout_only(
         &mut self,
-        keymap: &[[[KeyAction; COL]; ROW]; NUM_LAYER],
+        keymap: &impl KeyTable,
         encoder_map: &Option<&[[EncoderAction; NUM_ENCODER]; NUM_LAYER]>,
         behavior: &config::BehaviorConfig,
     ) -> Result<(), SSError<F::Error>> {
@@ -824,25 +1167,8 @@ impl<F: AsyncNorFlash, const ROW: usize, const COL: usize, const NUM_LAYER: usiz
             .await?;
 
         // TODO: Generic reset for vial and other hosts
-        for (layer, layer_data) in keymap.iter().enumerate() {
-            for (row, row_data) in layer_data.iter().enumerate() {
-                for (col, action) in row_data.iter().enumerate() {
-                    let keymap_key = KeymapKey {
-                        row: row as u8,
-                        col: col as u8,
-                        layer: layer as u8,
-                        action: *action,
-                    };
-                    self.flash
-                        .store_item(
-                            &mut self.buffer,
-                            &get_keymap_key::<ROW, COL, NUM_LAYER>(&keymap_key),
-                            &StorageData::VialData(KeymapData::KeymapKey(keymap_key)),
-                        )
-                        .await?;
-                }
-            }
-        }
+        // A new snapshot replaces the keymap, the keys changed after the old snapshot are discarded
+        self.compact_keymap(keymap).await?;
 
         // TODO: Generic reset for vial and other hosts
         if let Some(encoder_map) = encoder_map {
@@ -966,3 +1292,120 @@ macro_rules! read_storage {
         $storage.flash.fetch_item(&mut $buf, $key).await
     };
 }
+
+#[cfg(all(test, feature = "host"))]
+mod tests {
+    use embassy_futures::block_on;
+    use embedded_storage::nor_flash::{ErrorType, NorFlashErrorKind, ReadNorFlash};
+    use rmk_types::action::Action;
+    use rmk_types::keycode::{HidKeyCode, KeyCode};
+
+    use super::*;
+    use crate::host::storage::build_snapshot_chunk;
+
+    const SECTOR_SIZE: usize = 4096;
+
+    /// Flash of two sectors in RAM
+    struct RamFlash([u8; 2 * SECTOR_SIZE]);
+
+    impl ErrorType for RamFlash {
+        type Error = NorFlashErrorKind;
+    }
+
+    impl ReadNorFlash for RamFlash {
+        const READ_SIZE: usize = 1;
+
+        fn read(&mut self, offset: u32, bytes: &mut [u8]) -> Result<(), Self::Error> {
+            let offset = offset as usize;
+            bytes.copy_from_slice(&self.0[offset..offset + bytes.len()]);
+            Ok(())
+        }
+
+        fn capacity(&self) -> usize {
+            self.0.len()
+        }
+    }
+
+    impl NorFlash for RamFlash {
+        const WRITE_SIZE: usize = 4;
+        const ERASE_SIZE: usize = SECTOR_SIZE;
+
+        fn erase(&mut self, from: u32, to: u32) -> Result<(), Self::Error> {
+            self.0[from as usize..to as usize].fill(0xFF);
+            Ok(())
+        }
+
+        fn write(&mut self, offset: u32, bytes: &[u8]) -> Result<(), Self::Error> {
+            // NOR flash can only clear bits
+            for (cell, byte) in self.0[offset as usize..].iter_mut().zip(bytes) {
+                *cell &= *byte;
+            }
+            Ok(())
+        }
+    }
+
+    type TestStorage = Storage<BlockingAsync<RamFlash>, 1, 2, 1>;
+
+    fn keymap(code: HidKeyCode) -> [[[KeyAction; 2]; 1]; 1] {
+        [[[KeyAction::Single(Action::Key(KeyCode::Hid(code))); 2]; 1]]
+    }
+
+    fn create_storage(keymap: &[[[KeyAction; 2]; 1]; 1]) -> TestStorage {
+        block_on(Storage::new(
+            async_flash_wrapper(RamFlash([0xFF; 2 * SECTOR_SIZE])),
+            keymap,
+            &None,
+            &StorageConfig::default(),
+            &config::BehaviorConfig::default(),
+        ))
+    }
+
+    fn read_keymap(storage: &mut TestStorage) -> [[[KeyAction; 2]; 1]; 1] {
+        let mut read = [[[KeyAction::No; 2]; 1]];
+        block_on(storage.read_keymap(&mut read, &mut None)).unwrap();
+        read
+    }
+
+    #[test]
+    fn test_interrupted_snapshots() {
+        let saved = keymap(HidKeyCode::A);
+        let mut storage = create_storage(&saved);
+        let unsaved = keymap(HidKeyCode::B);
+        // Two snapshots are interrupted after their first chunk, e.g. by power loss
+        for _ in 0..2 {
+            let chunk = build_snapshot_chunk(&unsaved, 0, 0).unwrap();
+            block_on(storage.write_bulk_chunk(chunk)).unwrap();
+            storage.bulk_snapshot = None;
+        }
+        // The current snapshot isn't overwritten by the interrupted ones
+        assert_eq!(read_keymap(&mut storage), saved);
+
+        // A complete snapshot replaces it
+        let chunk = build_snapshot_chunk(&unsaved, 0, 0).unwrap();
+        block_on(storage.write_bulk_chunk(chunk)).unwrap();
+        block_on(storage.finish_bulk_snapshot()).unwrap();
+        assert_eq!(read_keymap(&mut storage), unsaved);
+    }
+
+    #[test]
+    fn test_incomplete_snapshot_keeps_buffered_keys() {
+        let mut storage = create_storage(&keymap(HidKeyCode::A));
+        let key = KeymapKey {
+            row: 0,
+            col: 1,
+            layer: 0,
+            action: KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::C))),
+        };
+        block_on(storage.write_back(get_keymap_key::<1, 2, 1>(&key), PendingWrite::KeymapKey(key))).unwrap();
+        // The snapshot is dropped, because the last key is never received
+        let mut chunk = build_snapshot_chunk(&keymap(HidKeyCode::B), 0, 0).unwrap();
+        chunk.count = 1;
+        block_on(storage.write_bulk_chunk(chunk)).unwrap();
+        block_on(storage.finish_bulk_snapshot()).unwrap();
+        block_on(storage.commit_pending_writes()).unwrap();
+
+        let read = read_keymap(&mut storage);
+        assert_eq!(read[0][0][0], keymap(HidKeyCode::A)[0][0][0]);
+        assert_eq!(read[0][0][1], key.action);
+    }
+}
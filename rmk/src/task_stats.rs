@@ -0,0 +1,256 @@
+//! Per-task CPU time and wakeup accounting, enabled by the `task_stats` feature.
+//!
+//! The futures of the long-running tasks, like the input devices, the keyboard, the storage and the BLE stack, are
+//! wrapped by [`instrument`]. The wrapper counts the polls and the wakeups of a task, and measures the busy time
+//! spent in its polls and the longest single poll. A task which runs other instrumented tasks, like `run_rmk`,
+//! includes their busy time.
+//!
+//! The statistics are logged periodically, which goes to defmt or `usb_log`, and can be queried through Via.
+use core::cell::Cell;
+use core::future::{Future, poll_fn};
+use core::pin::pin;
+use core::sync::atomic::{AtomicU32, Ordering};
+use core::task::{Context, RawWaker, RawWakerVTable, Waker};
+
+use embassy_sync::blocking_mutex::Mutex;
+use embassy_sync::blocking_mutex::raw::CriticalSectionRawMutex;
+use embassy_sync::waitqueue::AtomicWaker;
+use embassy_time::Instant;
+
+/// The statistics are logged every `LOG_INTERVAL_SECS` seconds, when an instrumented task is polled
+const LOG_INTERVAL_SECS: u32 = 60;
+
+/// Instrumented tasks
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+#[repr(u8)]
+pub enum TaskId {
+    /// Input devices and the matrix
+    Devices = 0,
+    /// Input processors
+    Processors = 1,
+    /// `Keyboard::run`
+    Keyboard = 2,
+    /// Controllers
+    Controllers = 3,
+    /// `run_rmk`, including the tasks below which it runs
+    Rmk = 4,
+    /// USB device
+    Usb = 5,
+    /// BLE stack runner
+    BleStack = 6,
+    /// GATT events, connection parameters and battery service of the BLE connection
+    Gatt = 7,
+    /// `Storage::run`
+    Storage = 8,
+    /// Via/Vial host communication
+    Host = 9,
+    /// HID report writer
+    Writer = 10,
+    /// LED indicator reader
+    Led = 11,
+    /// WPM controller
+    Wpm = 12,
+    /// Peripheral managers of the split central, or the split peripheral
+    Split = 13,
+    /// Scanning of the BLE split peripherals
+    SplitScan = 14,
+}
+
+impl TaskId {
+    pub const ALL: [Self; 15] = [
+        Self::Devices,
+        Self::Processors,
+        Self::Keyboard,
+        Self::Controllers,
+        Self::Rmk,
+        Self::Usb,
+        Self::BleStack,
+        Self::Gatt,
+        Self::Storage,
+        Self::Host,
+        Self::Writer,
+        Self::Led,
+        Self::Wpm,
+        Self::Split,
+        Self::SplitScan,
+    ];
+
+    pub fn from_u8(value: u8) -> Option<Self> {
+        Self::ALL.get(value as usize).copied()
+    }
+}
+
+/// Statistics of a task
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "defmt", derive(defmt::Format))]
+pub struct TaskStats {
+    /// Number of polls, including the polls of tasks which are joined with this task
+    pub polls: u32,
+    /// Number of wakeups of the task
+    pub wakeups: u32,
+    /// Time spent in the polls, in microseconds
+    pub busy_us: u64,
+    /// Longest single poll, in microseconds
+    pub max_poll_us: u32,
+}
+
+impl TaskStats {
+    const fn new() -> Self {
+        Self {
+            polls: 0,
+            wakeups: 0,
+            busy_us: 0,
+            max_poll_us: 0,
+        }
+    }
+
+    fn record_poll(&mut self, poll_us: u64) {
+        self.polls = self.polls.wrapping_add(1);
+        self.busy_us += poll_us;
+        self.max_poll_us = self.max_poll_us.max(poll_us.min(u32::MAX as u64) as u32);
+    }
+
+    /// Share of `uptime_us` spent in the polls, in permille
+    pub fn busy_permille(&self, uptime_us: u64) -> u32 {
+        (self.busy_us.saturating_mul(1000) / uptime_us.max(1)).min(1000) as u32
+    }
+}
+
+struct TaskSlot {
+    /// Waker of the executor task which polls the instrumented future
+    waker: AtomicWaker,
+    /// Wakers can be called from interrupts, so a critical section is used
+    stats: Mutex<CriticalSectionRawMutex, Cell<TaskStats>>,
+}
+
+impl TaskSlot {
+    const fn new() -> Self {
+        Self {
+            waker: AtomicWaker::new(),
+            stats: Mutex::new(Cell::new(TaskStats::new())),
+        }
+    }
+
+    fn update(&self, f: impl FnOnce(&mut TaskStats)) {
+        self.stats.lock(|stats| {
+            let mut s = stats.get();
+            f(&mut s);
+            stats.set(s);
+        });
+    }
+
+    fn wake(&self) {
+        self.update(|s| s.wakeups = s.wakeups.wrapping_add(1));
+        self.waker.wake();
+    }
+
+    /// Waker which counts the wakeups of the task and forwards them to the executor
+    fn waker(&'static self) -> Waker {
+        // SAFETY: the slot is static, and the vtable functions only call `TaskSlot::wake` on it
+        unsafe { Waker::from_raw(RawWaker::new(self as *const Self as *const (), &WAKER_VTABLE)) }
+    }
+}
+
+static WAKER_VTABLE: RawWakerVTable = RawWakerVTable::new(clone_waker, wake_waker, wake_waker, drop_waker);
+
+unsafe fn clone_waker(data: *const ()) -> RawWaker {
+    RawWaker::new(data, &WAKER_VTABLE)
+}
+
+unsafe fn wake_waker(data: *const ()) {
+    // SAFETY: `data` is a `&'static TaskSlot`, see `TaskSlot::waker`
+    unsafe { &*(data as *const TaskSlot) }.wake();
+}
+
+unsafe fn drop_waker(_data: *const ()) {}
+
+static SLOTS: [TaskSlot; TaskId::ALL.len()] = [const { TaskSlot::new() }; TaskId::ALL.len()];
+
+/// Uptime in seconds of the latest log
+static LAST_LOG: AtomicU32 = AtomicU32::new(0);
+
+/// Run a task future with accounting of its polls, wakeups and busy time.
+///
+/// A task id should be used by the futures of one executor task only, because the wakeups are forwarded to the
+/// waker of the latest poll.
+pub async fn instrument<F: Future>(task: TaskId, fut: F) -> F::Output {
+    let slot = &SLOTS[task as usize];
+    let waker = slot.waker();
+    let mut fut = pin!(fut);
+    poll_fn(|cx| {
+        slot.waker.register(cx.waker());
+        let start = Instant::now();
+        let poll = fut.as_mut().poll(&mut Context::from_waker(&waker));
+        let poll_us = start.elapsed().as_micros();
+        slot.update(|s| s.record_poll(poll_us));
+
+        let now = Instant::now().as_secs() as u32;
+        if now.wrapping_sub(LAST_LOG.load(Ordering::Relaxed)) >= LOG_INTERVAL_SECS {
+            LAST_LOG.store(now, Ordering::Relaxed);
+            log_task_stats();
+        }
+        poll
+    })
+    .await
+}
+
+/// Get the statistics of a task
+pub fn task_stats(task: TaskId) -> TaskStats {
+    SLOTS[task as usize].stats.lock(|stats| stats.get())
+}
+
+/// Log the statistics of all tasks which are polled
+pub fn log_task_stats() {
+    let uptime_us = Instant::now().as_micros();
+    for task in TaskId::ALL {
+        let stats = task_stats(task);
+        if stats.polls == 0 {
+            continue;
+        }
+        info!(
+            "Task {:?}: polls {}, wakeups {}, busy {}ms ({}‰), max poll {}us",
+            task,
+            stats.polls,
+            stats.wakeups,
+            stats.busy_us / 1000,
+            stats.busy_permille(uptime_us),
+            stats.max_poll_us
+        );
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use embassy_futures::{block_on, yield_now};
+
+    use super::*;
+
+    #[test]
+    fn test_instrument_counts_polls_and_wakeups() {
+        let before = task_stats(TaskId::SplitScan);
+        let output = block_on(instrument(TaskId::SplitScan, async {
+            // `yield_now` wakes the task and returns pending once
+            yield_now().await;
+            yield_now().await;
+            42
+        }));
+        assert_eq!(output, 42);
+        let stats = task_stats(TaskId::SplitScan);
+        assert_eq!(stats.polls - before.polls, 3);
+        assert_eq!(stats.wakeups - before.wakeups, 2);
+        assert!(stats.busy_us >= stats.max_poll_us as u64);
+    }
+
+    #[test]
+    fn test_task_id() {
+        assert_eq!(TaskId::from_u8(2), Some(TaskId::Keyboard));
+        assert_eq!(TaskId::from_u8(TaskId::ALL.len() as u8), None);
+        let stats = TaskStats {
+            busy_us: 250,
+            ..Default::default()
+        };
+        assert_eq!(stats.busy_permille(1000), 250);
+        assert_eq!(stats.busy_permille(0), 1000);
+    }
+}
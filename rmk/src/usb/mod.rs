@@ -10,10 +10,15 @@ use static_cell::StaticCell;
 
 use crate::channel::KEYBOARD_REPORT_CHANNEL;
 use crate::config::DeviceConfig;
-use crate::descriptor::CompositeReportType;
+#[cfg(feature = "nkro")]
+use crate::descriptor::NKRO_REPORT_SIZE;
+use crate::descriptor::{CompositeReportType, KeyboardReport};
+#[cfg(feature = "nkro")]
+use crate::hid::NKRO_ACTIVE;
+use crate::hid::coalescer::ReportCoalescer;
 use crate::hid::{HidError, HidWriterTrait, Report, RunnableHidWriter};
 use crate::state::ConnectionState;
-use crate::{CONNECTION_STATE, RawMutex};
+use crate::{CONNECTION_STATE, REPORT_COALESCING, RawMutex};
 
 pub(crate) static USB_REMOTE_WAKEUP: Signal<RawMutex, ()> = Signal::new();
 
@@ -43,37 +48,59 @@ impl From<u8> for UsbState {
 pub(crate) struct UsbKeyboardWriter<'a, 'd, D: Driver<'d>> {
     pub(crate) keyboard_writer: &'a mut HidWriter<'d, D, 8>,
     pub(crate) other_writer: &'a mut HidWriter<'d, D, 9>,
+    #[cfg(feature = "nkro")]
+    pub(crate) nkro_writer: &'a mut HidWriter<'d, D, NKRO_REPORT_SIZE>,
+    coalescer: ReportCoalescer,
 }
 impl<'a, 'd, D: Driver<'d>> UsbKeyboardWriter<'a, 'd, D> {
-    pub(crate) fn new(keyboard_writer: &'a mut HidWriter<'d, D, 8>, other_writer: &'a mut HidWriter<'d, D, 9>) -> Self {
+    pub(crate) fn new(
+        keyboard_writer: &'a mut HidWriter<'d, D, 8>,
+        other_writer: &'a mut HidWriter<'d, D, 9>,
+        #[cfg(feature = "nkro")] nkro_writer: &'a mut HidWriter<'d, D, NKRO_REPORT_SIZE>,
+    ) -> Self {
         Self {
             keyboard_writer,
             other_writer,
+            #[cfg(feature = "nkro")]
+            nkro_writer,
+            coalescer: ReportCoalescer::new(),
         }
     }
-}
 
-impl<'d, D: Driver<'d>> RunnableHidWriter for UsbKeyboardWriter<'_, 'd, D> {
-    async fn get_report(&mut self) -> Self::ReportType {
-        KEYBOARD_REPORT_CHANNEL.receive().await
+    async fn write_keyboard_report(&mut self, keyboard_report: KeyboardReport) -> Result<usize, HidError> {
+        let mut buf: [u8; 8] = [0; 8];
+        let n: usize = serialize(&mut buf, &keyboard_report).map_err(|_| HidError::ReportSerializeError)?;
+        self.keyboard_writer
+            .write(&buf[0..n])
+            .await
+            .map_err(HidError::UsbEndpointError)?;
+        #[cfg(feature = "latency_trace")]
+        crate::latency_trace::report_written(&keyboard_report);
+        crate::keyboard_macros::keyboard_report_written();
+        Ok(n)
     }
-}
 
-impl<'d, D: Driver<'d>> HidWriterTrait for UsbKeyboardWriter<'_, 'd, D> {
-    type ReportType = Report;
-
-    async fn write_report(&mut self, report: Self::ReportType) -> Result<usize, HidError> {
+    async fn write_usb_report(&mut self, report: Report) -> Result<usize, HidError> {
         // Write report to USB
         match report {
-            Report::KeyboardReport(keyboard_report) => {
-                let mut buf: [u8; 8] = [0; 8];
-                let n: usize = serialize(&mut buf, &keyboard_report).map_err(|_| HidError::ReportSerializeError)?;
-                self.keyboard_writer
+            Report::KeyboardReport(keyboard_report) => self.write_keyboard_report(keyboard_report).await,
+            #[cfg(feature = "nkro")]
+            Report::NkroReport(nkro_report) if NKRO_ACTIVE.load(Ordering::Relaxed) => {
+                let mut buf: [u8; NKRO_REPORT_SIZE] = [0; NKRO_REPORT_SIZE];
+                let n: usize = serialize(&mut buf, &nkro_report).map_err(|_| HidError::ReportSerializeError)?;
+                self.nkro_writer
                     .write(&buf[0..n])
                     .await
                     .map_err(HidError::UsbEndpointError)?;
+                #[cfg(feature = "latency_trace")]
+                crate::latency_trace::report_written(&nkro_report.to_boot_report());
+                crate::keyboard_macros::keyboard_report_written();
                 Ok(n)
             }
+            Report::NkroReport(nkro_report) => {
+                // The host doesn't use the NKRO interface, fall back to the boot keyboard report
+                self.write_keyboard_report(nkro_report.to_boot_report()).await
+            }
             Report::MouseReport(mouse_report) => {
                 let mut buf: [u8; 9] = [0; 9];
                 buf[0] = CompositeReportType::Mouse as u8;
@@ -82,6 +109,7 @@ impl<'d, D: Driver<'d>> HidWriterTrait for UsbKeyboardWriter<'_, 'd, D> {
                     .write(&buf[0..n + 1])
                     .await
                     .map_err(HidError::UsbEndpointError)?;
+                crate::input_device::pointing::mouse_report_written();
                 Ok(n)
             }
             Report::MediaKeyboardReport(media_keyboard_report) => {
@@ -108,6 +136,29 @@ impl<'d, D: Driver<'d>> HidWriterTrait for UsbKeyboardWriter<'_, 'd, D> {
     }
 }
 
+impl<'d, D: Driver<'d>> RunnableHidWriter for UsbKeyboardWriter<'_, 'd, D> {
+    async fn get_report(&mut self) -> Self::ReportType {
+        if REPORT_COALESCING {
+            self.coalescer.next_report().await
+        } else {
+            KEYBOARD_REPORT_CHANNEL.receive().await
+        }
+    }
+}
+
+impl<'d, D: Driver<'d>> HidWriterTrait for UsbKeyboardWriter<'_, 'd, D> {
+    type ReportType = Report;
+
+    async fn write_report(&mut self, report: Self::ReportType) -> Result<usize, HidError> {
+        if !REPORT_COALESCING {
+            return self.write_usb_report(report).await;
+        }
+        let result = self.write_usb_report(report.clone()).await;
+        self.coalescer.report_written(&report, &result);
+        result
+    }
+}
+
 pub(crate) fn new_usb_builder<'d, D: Driver<'d>>(driver: D, keyboard_config: DeviceConfig<'d>) -> Builder<'d, D> {
     // Create embassy-usb Config
     let mut usb_config = embassy_usb::Config::new(keyboard_config.vid, keyboard_config.pid);
@@ -124,9 +175,9 @@ pub(crate) fn new_usb_builder<'d, D: Driver<'d>>(driver: D, keyboard_config: Dev
     usb_config.device_protocol = 0x01;
     usb_config.composite_with_iads = true;
 
-    #[cfg(feature = "usb_log")]
+    #[cfg(any(feature = "usb_log", feature = "nkro"))]
     const USB_BUF_SIZE: usize = 256;
-    #[cfg(not(feature = "usb_log"))]
+    #[cfg(not(any(feature = "usb_log", feature = "nkro")))]
     const USB_BUF_SIZE: usize = 128;
 
     // Create embassy-usb DeviceBuilder using the driver and config.
@@ -180,7 +231,7 @@ macro_rules! add_usb_writer {
         let hid_config = ::embassy_usb::class::hid::Config {
             report_descriptor: <$descriptor>::desc(),
             request_handler: Some(request_handler),
-            poll_ms: 1,
+            poll_ms: $crate::USB_POLL_INTERVAL_MS,
             max_packet_size: 64,
         };
 
@@ -205,7 +256,7 @@ macro_rules! add_usb_reader_writer {
         let hid_config = ::embassy_usb::class::hid::Config {
             report_descriptor: <$descriptor>::desc(),
             request_handler: Some(request_handler),
-            poll_ms: 1,
+            poll_ms: $crate::USB_POLL_INTERVAL_MS,
             max_packet_size: 64,
         };
 
@@ -227,6 +278,44 @@ impl RequestHandler for UsbRequestHandler {
     }
 }
 
+/// Request handler of the NKRO keyboard interface.
+///
+/// Report protocol hosts bind every HID interface and send `SET_IDLE` to it, while boot protocol
+/// hosts(BIOS, bootloaders) only drive the boot keyboard interface. So `SET_IDLE` on the NKRO interface
+/// is used as the signal that NKRO reports can be sent.
+#[cfg(feature = "nkro")]
+pub(crate) struct NkroRequestHandler {}
+
+#[cfg(feature = "nkro")]
+impl RequestHandler for NkroRequestHandler {
+    fn set_idle_ms(&mut self, id: Option<ReportId>, duration_ms: u32) {
+        info!("Set idle for NKRO interface {:?}: {}ms, NKRO enabled", id, duration_ms);
+        NKRO_ACTIVE.store(true, Ordering::Relaxed);
+    }
+}
+
+/// Add the NKRO keyboard interface, which is used alongside the boot keyboard interface.
+#[cfg(feature = "nkro")]
+pub(crate) fn add_usb_nkro_writer<D: Driver<'static>>(
+    builder: &mut Builder<'static, D>,
+) -> HidWriter<'static, D, NKRO_REPORT_SIZE> {
+    use embassy_usb::class::hid::{Config, State};
+    use usbd_hid::descriptor::SerializedDescriptor;
+
+    use crate::descriptor::NkroKeyboardReport;
+
+    static NKRO_STATE: StaticCell<State> = StaticCell::new();
+    static NKRO_HANDLER: StaticCell<NkroRequestHandler> = StaticCell::new();
+
+    let hid_config = Config {
+        report_descriptor: NkroKeyboardReport::desc(),
+        request_handler: Some(NKRO_HANDLER.init(NkroRequestHandler {})),
+        poll_ms: crate::USB_POLL_INTERVAL_MS,
+        max_packet_size: 64,
+    };
+    HidWriter::new(builder, NKRO_STATE.init(State::new()), hid_config)
+}
+
 pub(crate) struct UsbDeviceHandler {}
 
 impl UsbDeviceHandler {
@@ -254,6 +343,9 @@ impl Handler for UsbDeviceHandler {
 
     fn reset(&mut self) {
         info!("Bus reset, the Vbus current limit is 100mA");
+        // The new host must enable NKRO again
+        #[cfg(feature = "nkro")]
+        NKRO_ACTIVE.store(false, Ordering::Relaxed);
     }
 
     fn addressed(&mut self, addr: u8) {
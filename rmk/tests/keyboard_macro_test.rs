@@ -6,7 +6,7 @@ mod macro_test {
     use rmk::keyboard::Keyboard;
     use rmk::keyboard_macros::{MacroOperation, define_macro_sequences, to_macro_sequence};
     use rmk::types::action::{Action, KeyAction};
-    use rmk_types::keycode::HidKeyCode;
+    use rmk_types::keycode::{HidKeyCode, KeyCode};
     use rusty_fork::rusty_fork_test;
 
     use crate::common::{KC_LSHIFT, wrap_keymap};
@@ -24,6 +24,18 @@ mod macro_test {
         Keyboard::new(wrap_keymap(keymap, per_key_config, behavior_config))
     }
 
+    fn create_macro_keyboard_with_key(behavior_config: BehaviorConfig) -> Keyboard<'static, 1, 2, 1> {
+        let keymap = [[[
+            KeyAction::Single(Action::TriggerMacro(0)),
+            KeyAction::Single(Action::Key(KeyCode::Hid(HidKeyCode::X))),
+        ]]];
+        static BEHAVIOR_CONFIG: static_cell::StaticCell<BehaviorConfig> = static_cell::StaticCell::new();
+        let behavior_config: &'static mut BehaviorConfig = BEHAVIOR_CONFIG.init(behavior_config);
+        static KEY_CONFIG: static_cell::StaticCell<PositionalConfig<1, 2>> = static_cell::StaticCell::new();
+        let per_key_config = KEY_CONFIG.init(PositionalConfig::default());
+        Keyboard::new(wrap_keymap(keymap, per_key_config, behavior_config))
+    }
+
     rusty_fork_test! {
 
         #[test]
@@ -81,23 +93,43 @@ mod macro_test {
                     [KC_LSHIFT, [0, 0, 0, 0, 0, 0]],            // release C
                     [0, [0, 0, 0, 0, 0, 0]],            // release shift
                     [0, [kc_to_u8!(D), 0, 0, 0, 0, 0]], // press D
-                    [0, [0, 0, 0, 0, 0, 0]],            // release D
-                    [0, [kc_to_u8!(Kc1), 0, 0, 0, 0, 0]], // press 1
-                    [0, [0, 0, 0, 0, 0, 0]],            // release 1
-                    [0, [kc_to_u8!(Kc2), 0, 0, 0, 0, 0]], // press 2
-                    [0, [0, 0, 0, 0, 0, 0]],            // release 2
-                    [0, [kc_to_u8!(Kc3), 0, 0, 0, 0, 0]], // press 3
-                    [0, [0, 0, 0, 0, 0, 0]],            // release 3
-                    [0, [kc_to_u8!(Kc4), 0, 0, 0, 0, 0]], // press 4
-                    [0, [0, 0, 0, 0, 0, 0]],            // release 4
-                    [0, [kc_to_u8!(Kc5), 0, 0, 0, 0, 0]], // press 5
-                    [0, [0, 0, 0, 0, 0, 0]],            // release 5
-                    [0, [kc_to_u8!(Kc6), 0, 0, 0, 0, 0]], // press 6
+                    [0, [kc_to_u8!(Kc1), 0, 0, 0, 0, 0]], // release D + press 1
+                    [0, [kc_to_u8!(Kc2), 0, 0, 0, 0, 0]], // release 1 + press 2
+                    [0, [kc_to_u8!(Kc3), 0, 0, 0, 0, 0]], // release 2 + press 3
+                    [0, [kc_to_u8!(Kc4), 0, 0, 0, 0, 0]], // release 3 + press 4
+                    [0, [kc_to_u8!(Kc5), 0, 0, 0, 0, 0]], // release 4 + press 5
+                    [0, [kc_to_u8!(Kc6), 0, 0, 0, 0, 0]], // release 5 + press 6
                     [0, [0, 0, 0, 0, 0, 0]],            // release 6
                 ]
             );
         }
 
+        #[test]
+        fn test_macro_text_repeated_key() {
+            let macro_sequences = &[to_macro_sequence("all")];
+
+            let macro_data = define_macro_sequences(macro_sequences);
+            let mut config = BehaviorConfig::default();
+            config.keyboard_macros.macro_sequences = macro_data;
+
+            let keyboard = create_simple_macro_keyboard(config);
+
+            key_sequence_test!(
+                keyboard: keyboard,
+                sequence: [
+                    [0, 0, true, 0],   // press Macro0
+                    [0, 0, false, 100], // release Macro0
+                ],
+                expected_reports: [
+                    [0, [kc_to_u8!(A), 0, 0, 0, 0, 0]], // press A
+                    [0, [kc_to_u8!(L), 0, 0, 0, 0, 0]], // release A + press L
+                    [0, [0, 0, 0, 0, 0, 0]],            // release L, the same key can't be pressed again in one report
+                    [0, [kc_to_u8!(L), 0, 0, 0, 0, 0]], // press L
+                    [0, [0, 0, 0, 0, 0, 0]],            // release L
+                ]
+            );
+        }
+
         #[test]
         fn test_macro_tap_key_a() {
             let macro_sequences = &[Vec::from_slice(&[MacroOperation::Tap(HidKeyCode::A)]).expect("too many elements")];
@@ -184,5 +216,42 @@ mod macro_test {
                 ]
             );
         }
+
+        #[test]
+        fn test_typing_during_text_macro() {
+            // The key typed while the text macro is running isn't shifted by the macro
+            let macro_sequences = &[Vec::from_slice(&[
+                MacroOperation::Text(HidKeyCode::A, true),
+                MacroOperation::Delay(101 << 8), // 100 ms
+                MacroOperation::Text(HidKeyCode::B, true),
+            ])
+            .expect("too many elements")];
+
+            let macro_data = define_macro_sequences(macro_sequences);
+            let mut config = BehaviorConfig::default();
+            config.keyboard_macros.macro_sequences = macro_data;
+
+            let keyboard = create_macro_keyboard_with_key(config);
+
+            key_sequence_test!(
+                keyboard: keyboard,
+                sequence: [
+                    [0, 0, true, 0],   // press Macro0
+                    [0, 0, false, 10], // release Macro0
+                    [0, 1, true, 40],  // press X during the delay
+                    [0, 1, false, 20], // release X
+                ],
+                expected_reports: [
+                    [KC_LSHIFT, [0, 0, 0, 0, 0, 0]],            // press shift
+                    [KC_LSHIFT, [kc_to_u8!(A), 0, 0, 0, 0, 0]], // press A + shift
+                    [KC_LSHIFT, [0, 0, 0, 0, 0, 0]],            // release A
+                    [0, [kc_to_u8!(X), 0, 0, 0, 0, 0]],         // press X, without the shift of the macro
+                    [0, [0, 0, 0, 0, 0, 0]],                    // release X
+                    [KC_LSHIFT, [kc_to_u8!(B), 0, 0, 0, 0, 0]], // press B + shift
+                    [KC_LSHIFT, [0, 0, 0, 0, 0, 0]],            // release B
+                    [0, [0, 0, 0, 0, 0, 0]],                    // release shift
+                ]
+            );
+        }
     }
 }